@@ -1,364 +1,7019 @@
 #pragma once
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
+#include <cerrno>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
 #include <functional>
+#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <queue>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
 #include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
-// 任务队列
-class TaskQueue {
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// 只可移动的任务类型，替代队列中的std::function<void()>
+// 不超过kInlineSize字节的闭包直接存放在内部缓冲区中（例如StageT::push中的[this, index]），
+// 更大的闭包才在堆上分配；任务在队列中只移动不复制
+class Task {
 public:
-    // 向队列添加任务
-    void pushTask(std::function<void()> task)
+    static const size_t kInlineSize = 48;
+
+    Task() noexcept
+        : ops(nullptr)
     {
-        std::unique_lock<std::mutex> lock(mtx);
-        tasks.push(task);
-        cv.notify_one(); // 通知一个等待的线程
     }
 
-    // 从队列中取出任务
-    std::function<void()> popTask()
+    Task(std::nullptr_t) noexcept
+        : ops(nullptr)
     {
-        std::unique_lock<std::mutex> lock(mtx);
-        cv.wait(lock, [this] { return !tasks.empty(); }); // 等待直到队列有任务
-        auto task = tasks.front();
-        tasks.pop();
-        return task;
     }
 
-    bool empty()
+    template <typename F,
+        typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F&& f)
+        : ops(nullptr)
     {
-        std::unique_lock<std::mutex> lock(mtx);
-        return tasks.empty();
+        using Fn = typename std::decay<F>::type;
+        if (isEmpty(f))
+            return;
+        init<Fn>(std::forward<F>(f), std::integral_constant<bool, fitsInline<Fn>()>());
     }
 
-private:
-    std::queue<std::function<void()>> tasks;
-    std::mutex mtx;
-    std::condition_variable cv;
-};
+    Task(Task&& other) noexcept
+        : ops(other.ops)
+        , count(other.count)
+    {
+        if (ops) {
+            ops->move(&storage, &other.storage);
+            other.ops = nullptr;
+        }
+    }
 
-// 有界任务队列，用于在I/O和处理任务之间传递数据
-class BoundedTaskQueue {
-public:
-    BoundedTaskQueue(size_t capacity = 20)
-        : capacity(capacity)
+    Task& operator=(Task&& other) noexcept
     {
+        if (this != &other) {
+            reset();
+            if (other.ops) {
+                other.ops->move(&storage, &other.storage);
+                ops = other.ops;
+                other.ops = nullptr;
+            }
+            count = other.count;
+        }
+        return *this;
     }
 
-    void setCapacity(size_t capacity)
+    Task& operator=(std::nullptr_t) noexcept
     {
-        this->capacity = capacity;
+        reset();
+        return *this;
     }
-    // 向队列中添加任务
-    void pushTask(std::function<void()> task)
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task()
     {
-        std::unique_lock<std::mutex> lock(mtx);
-        cv_producer.wait(lock, [this] { return tasks.size() < capacity; }); // 等待缓冲区有空位
-        tasks.push(task);
-        cv_consumer.notify_one(); // 通知消费者有新的任务
+        reset();
     }
 
-    // 从队列中取出任务
-    std::function<void()> popTask()
+    void operator()()
     {
-        std::unique_lock<std::mutex> lock(mtx);
-        cv_consumer.wait(lock, [this] { return !tasks.empty(); }); // 等待队列中有任务
-        auto task = tasks.front();
-        tasks.pop();
-        cv_producer.notify_one(); // 通知生产者可以继续生产
-        return task;
+        ops->invoke(&storage);
     }
 
-    bool empty()
+    explicit operator bool() const noexcept
     {
-        std::unique_lock<std::mutex> lock(mtx);
-        return tasks.empty();
+        return ops != nullptr;
     }
 
-protected:
-    std::queue<std::function<void()>> tasks;
-    std::mutex mtx;
-    std::condition_variable cv_producer, cv_consumer;
-    size_t capacity; // 队列的最大容量
+    // 任务代表的值的个数（默认1，pushRange的一块为块中的索引数）；FullPolicy丢弃任务时据此通知下游
+    // 为0表示不能被丢弃，例如协程的恢复任务和parallelFor的块：丢弃它们会让等待者永远等下去
+    uint32_t weight() const noexcept
+    {
+        return count;
+    }
+
+    void setWeight(uint32_t n) noexcept
+    {
+        count = n;
+    }
+
+private:
+    using Storage = typename std::aligned_storage<kInlineSize, alignof(std::max_align_t)>::type;
+
+    struct Ops {
+        void (*invoke)(void*);
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void*);
+    };
+
+    template <typename Fn>
+    static constexpr bool fitsInline()
+    {
+        return sizeof(Fn) <= kInlineSize
+            && alignof(Fn) <= alignof(Storage)
+            && std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    template <typename Fn>
+    struct InlineOps {
+        static void invoke(void* p) { (*static_cast<Fn*>(p))(); }
+        static void move(void* dst, void* src)
+        {
+            new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        }
+        static void destroy(void* p) { static_cast<Fn*>(p)->~Fn(); }
+        static constexpr Ops ops = { &invoke, &move, &destroy };
+    };
+
+    template <typename Fn>
+    struct HeapOps {
+        static void invoke(void* p) { (**static_cast<Fn**>(p))(); }
+        static void move(void* dst, void* src) { *static_cast<Fn**>(dst) = *static_cast<Fn**>(src); }
+        static void destroy(void* p) { delete *static_cast<Fn**>(p); }
+        static constexpr Ops ops = { &invoke, &move, &destroy };
+    };
+
+    template <typename Fn, typename F>
+    void init(F&& f, std::true_type)
+    {
+        new (&storage) Fn(std::forward<F>(f));
+        ops = &InlineOps<Fn>::ops;
+    }
+
+    template <typename Fn, typename F>
+    void init(F&& f, std::false_type)
+    {
+        *reinterpret_cast<Fn**>(&storage) = new Fn(std::forward<F>(f));
+        ops = &HeapOps<Fn>::ops;
+    }
+
+    // 空的std::function或函数指针构造出空任务
+    template <typename F>
+    static bool isEmpty(const F&) { return false; }
+    template <typename Sig>
+    static bool isEmpty(const std::function<Sig>& f) { return !f; }
+    template <typename R>
+    static bool isEmpty(R (*const& f)()) { return f == nullptr; }
+
+    void reset() noexcept
+    {
+        if (ops) {
+            ops->destroy(&storage);
+            ops = nullptr;
+        }
+    }
+
+    Storage storage;
+    const Ops* ops;
+    uint32_t count = 1;
 };
 
-// 线程池
+template <typename Fn>
+constexpr Task::Ops Task::InlineOps<Fn>::ops;
+template <typename Fn>
+constexpr Task::Ops Task::HeapOps<Fn>::ops;
 
-template <typename TaskQueueT>
-class ThreadPool {
+// CPU自旋提示，降低自旋等待时对同一物理核上另一个超线程的影响
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// CPU拓扑：每个NUMA节点包含的CPU，从/sys/devices/system/node读取
+// 读取失败（非Linux或没有NUMA信息）时视为一个包含所有CPU的节点；只保留本进程允许使用的CPU
+class CpuTopology {
 public:
-    ThreadPool(size_t numThreads,
-        TaskQueueT& _taskQueue,
-        std::atomic<int>& taskCounter,
-        std::condition_variable& doneCV,
-        std::mutex& doneMtx)
-        : taskQueue(_taskQueue)
-        , stop(false)
-        , taskCounter(taskCounter)
-        , doneCV(doneCV)
-        , doneMtx(doneMtx)
+    static CpuTopology& instance()
     {
-        for (size_t i = 0; i < numThreads; ++i) {
-            workers.emplace_back([this] {
-                while (true) {
-                    auto task = taskQueue.popTask();
-                    if (stop)
-                        break;
-                    task(); // 执行任务
-                    taskFinished();
-                }
-            });
+        static CpuTopology topology;
+        return topology;
+    }
+
+    const std::vector<std::vector<int>>& nodes() const
+    {
+        return nodeCpus;
+    }
+
+    // CPU所在的节点，未知时返回-1
+    int nodeOf(int cpu) const
+    {
+        for (size_t n = 0; n < nodeCpus.size(); ++n) {
+            for (int c : nodeCpus[n]) {
+                if (c == cpu)
+                    return (int)n;
+            }
         }
+        return -1;
     }
-    ~ThreadPool()
+
+    // 紧凑分配：按节点顺序依次分配CPU，先占满一个节点再使用下一个
+    int nextCompact()
     {
-        stopAll();
-        for (auto& worker : workers) {
-            if (worker.joinable()) {
-                worker.join();
+        std::lock_guard<std::mutex> lock(mtx);
+        size_t total = 0;
+        for (auto& cpus : nodeCpus) {
+            total += cpus.size();
+        }
+        size_t i = compactCursor++ % total;
+        for (auto& cpus : nodeCpus) {
+            if (i < cpus.size())
+                return cpus[i];
+            i -= cpus.size();
+        }
+        return -1;
+    }
+
+    // 分散分配：依次轮转到下一个节点，再在节点内依次分配CPU
+    int nextSpread()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        size_t node = spreadCursor++ % nodeCpus.size();
+        const std::vector<int>& cpus = nodeCpus[node];
+        return cpus[nodeCursor[node]++ % cpus.size()];
+    }
+
+private:
+    CpuTopology()
+    {
+        std::vector<bool> allowed = allowedCpus();
+        for (int n = 0;; ++n) {
+            std::ifstream in("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist");
+            if (!in)
+                break;
+            std::string list;
+            std::getline(in, list);
+            std::vector<int> cpus;
+            for (int c : parseCpuList(list)) {
+                if (c < (int)allowed.size() && allowed[c])
+                    cpus.push_back(c);
+            }
+            if (!cpus.empty())
+                nodeCpus.push_back(cpus);
+        }
+        if (nodeCpus.empty()) {
+            std::vector<int> cpus;
+            for (size_t c = 0; c < allowed.size(); ++c) {
+                if (allowed[c])
+                    cpus.push_back((int)c);
             }
+            nodeCpus.push_back(cpus);
         }
+        nodeCursor.assign(nodeCpus.size(), 0);
     }
 
-    void stopAll()
+    static std::vector<bool> allowedCpus()
     {
-        if (!stop) {
-            stop = true;
-            for (size_t i = 0; i < workers.size(); ++i) {
-                taskQueue.pushTask([] { }); // 发送空任务让线程退出
+        unsigned n = std::thread::hardware_concurrency();
+        std::vector<bool> allowed(n ? n : 1, true);
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            allowed.assign(CPU_SETSIZE, false);
+            bool any = false;
+            for (int c = 0; c < CPU_SETSIZE; ++c) {
+                if (CPU_ISSET(c, &set)) {
+                    allowed[c] = true;
+                    any = true;
+                }
             }
+            if (!any)
+                allowed.assign(n ? n : 1, true);
         }
+#endif
+        return allowed;
     }
 
-    void taskFinished()
+    // 解析"0-3,8-11"格式
+    static std::vector<int> parseCpuList(const std::string& list)
     {
-        std::unique_lock<std::mutex> lock(doneMtx);
-        --taskCounter; // 减少任务计数器
-        if (taskCounter == 0) {
-            stopAll();
-            doneCV.notify_all(); // 当所有任务完成时，通知主线程
+        std::vector<int> cpus;
+        size_t pos = 0;
+        while (pos < list.size()) {
+            size_t end = list.find(',', pos);
+            if (end == std::string::npos)
+                end = list.size();
+            std::string range = list.substr(pos, end - pos);
+            size_t dash = range.find('-');
+            if (!range.empty()) {
+                int first = std::atoi(range.c_str());
+                int last = dash == std::string::npos ? first : std::atoi(range.c_str() + dash + 1);
+                for (int c = first; c <= last; ++c) {
+                    cpus.push_back(c);
+                }
+            }
+            pos = end + 1;
         }
+        return cpus;
     }
 
-private:
-    std::vector<std::thread> workers;
-    TaskQueueT& taskQueue;
-    bool stop;
-    std::atomic<int>& taskCounter; // 任务计数器，追踪未完成任务
-    std::condition_variable& doneCV; // 用于通知任务完成
-    std::mutex& doneMtx; // 用于任务计数器的互斥锁
+    std::vector<std::vector<int>> nodeCpus;
+    std::mutex mtx;
+    size_t compactCursor = 0;
+    size_t spreadCursor = 0;
+    std::vector<size_t> nodeCursor;
 };
 
-template <typename TaskQueueT>
-class ThreadPoolEx {
+// 工作线程的放置方式
+class Placement {
 public:
-    using ThreadPoolPtr = std::shared_ptr<ThreadPool<TaskQueueT>>;
+    enum class Mode {
+        None, // 不限制，由操作系统调度
+        Cores, // 第i个工作线程绑定到cores[i % cores.size()]
+        Compact, // 所有紧凑放置的线程依次占用相邻的CPU，相邻的阶段因此落在同一个节点上
+        Spread, // 线程在节点之间轮转，适合内存带宽受限的阶段
+        Node, // 线程可以运行在指定节点的任意CPU上
+    };
 
-    TaskQueueT taskQueue;
-    ThreadPoolEx(size_t numThreads)
+    static Placement none()
     {
-        threadPool = std::make_shared<ThreadPool<TaskQueueT>>(numThreads, taskQueue, taskCounter, doneCV, doneMtx);
+        return Placement(Mode::None);
     }
 
-    void setTaskCount(int n)
+    static Placement cores(std::vector<int> cpus)
     {
-        taskCounter = n;
+        Placement p(Mode::Cores);
+        p.cpus = std::move(cpus);
+        return p;
     }
 
-    void pushTask(std::function<void()> task)
+    static Placement compact()
     {
-        taskQueue.pushTask(task);
+        return Placement(Mode::Compact);
     }
 
-    void wait()
+    static Placement spread()
     {
-        std::unique_lock<std::mutex> lock(doneMtx);
-        doneCV.wait(lock, [&] { return taskCounter == 0; });
+        return Placement(Mode::Spread);
     }
-    // void restart()
-    // {
-    //     threadPool->restart();
-    // }
 
-private:
-    ThreadPoolPtr threadPool;
-    std::atomic<int> taskCounter;
-    std::condition_variable doneCV;
-    std::mutex doneMtx;
-};
+    static Placement node(int n)
+    {
+        Placement p(n >= 0 ? Mode::Node : Mode::None);
+        p.nodeIndex = n;
+        return p;
+    }
 
-template <typename TaskQueueT>
-class CurrentThread {
-public:
-    CurrentThread(
-        TaskQueueT& _taskQueue,
-        std::atomic<int>& taskCounter,
-        std::condition_variable& doneCV,
-        std::mutex& doneMtx)
-        : taskQueue(_taskQueue)
-        , stop(false)
-        , taskCounter(taskCounter)
-        , doneCV(doneCV)
-        , doneMtx(doneMtx)
+    // 与上游阶段放在同一个节点上，阶段之间交接的数据不必跨越节点互联
+    // upstream可以是任何提供numaNode()的阶段或线程池，上游未放置时不限制
+    template <typename Upstream>
+    static Placement sameNodeAs(const Upstream& upstream)
     {
+        return node(upstream.numaNode());
     }
 
-    void run()
+    Mode mode() const
     {
-        while (true) {
-            auto task = taskQueue.popTask();
-            if (stop)
+        return placementMode;
+    }
+
+    // 为第i个工作线程分配CPU，空表示不限制；Compact/Spread每次调用都会占用新的CPU
+    std::vector<int> assign(size_t i) const
+    {
+        CpuTopology& topology = CpuTopology::instance();
+        switch (placementMode) {
+        case Mode::Cores:
+            if (cpus.empty())
                 break;
-            task(); // 执行任务
-            taskFinished();
+            return { cpus[i % cpus.size()] };
+        case Mode::Compact:
+            return { topology.nextCompact() };
+        case Mode::Spread:
+            return { topology.nextSpread() };
+        case Mode::Node:
+            if (nodeIndex < (int)topology.nodes().size())
+                return topology.nodes()[nodeIndex];
+            break;
+        case Mode::None:
+            break;
         }
+        return {};
     }
-    ~CurrentThread()
+
+private:
+    explicit Placement(Mode mode)
+        : placementMode(mode)
     {
-        stopAll();
     }
 
-    void stopAll()
+    Mode placementMode;
+    std::vector<int> cpus;
+    int nodeIndex = -1;
+};
+
+// 把线程绑定到cpus（为空时不做任何事），不支持的平台返回false
+inline bool pinThread(std::thread& thread, const std::vector<int>& cpus)
+{
+    if (cpus.empty())
+        return false;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cpus) {
+        if (c >= 0 && c < CPU_SETSIZE)
+            CPU_SET(c, &set);
+    }
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+    (void)thread;
+    return false;
+#endif
+}
+
+// 尽力把[addr, addr + len)中的完整页迁移到node节点（mbind系统调用，不依赖libnuma）
+// 不足一页的部分保持原样；失败或不支持时返回false
+inline bool bindMemoryToNode(void* addr, size_t len, int node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    const int kMpolPreferred = 1;
+    const unsigned kMpolMfMove = 1 << 1;
+    const int kMaxNodes = 1024;
+    if (node < 0 || node >= kMaxNodes)
+        return false;
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t begin = ((uintptr_t)addr + page - 1) & ~(page - 1);
+    uintptr_t end = ((uintptr_t)addr + len) & ~(page - 1);
+    if (end <= begin)
+        return false;
+    const int bits = 8 * sizeof(unsigned long);
+    unsigned long mask[kMaxNodes / (8 * sizeof(unsigned long))] = {};
+    mask[node / bits] |= 1ul << (node % bits);
+    return syscall(SYS_mbind, begin, end - begin, kMpolPreferred, mask, (unsigned long)kMaxNodes, kMpolMfMove) == 0;
+#else
+    (void)addr;
+    (void)len;
+    (void)node;
+    return false;
+#endif
+}
+
+// 等待统计：每条等待路径被走到的次数
+struct WaitStats {
+    uint64_t immediate = 0; // 条件已满足，无需等待
+    uint64_t spun = 0; // 在自旋/让出/轮询期间条件满足
+    uint64_t parked = 0; // 进入条件变量休眠
+    uint64_t waitNanos = 0; // 自旋和休眠的累计耗时，条件立即满足时不计时
+};
+
+inline uint64_t elapsedNanos(std::chrono::steady_clock::time_point since)
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - since)
+        .count();
+}
+
+// 任务时间线追踪：定义TASK_QUEUE_TRACE后，阶段记录每个索引的入队、执行和工作线程的空闲时间，
+// 写入每个线程自己的环形缓冲区，可以导出为Chrome trace-event JSON，用chrome://tracing或ui.perfetto.dev打开
+// 未定义时TraceSpan是空类型，编译后不留下任何代码
+enum class TraceKind : uint8_t {
+    Push, // 生产者把索引放入阶段的输入队列，队列满时的阻塞时间也在其中
+    Run, // 工作线程执行阶段函数（不含推送到下游）
+    Idle, // 工作线程等待任务
+};
+
+#ifdef TASK_QUEUE_TRACE
+
+#ifndef TASK_QUEUE_TRACE_CAPACITY
+#define TASK_QUEUE_TRACE_CAPACITY 32768 // 每个线程保留的最近事件数，必须是2的幂
+#endif
+
+struct TraceRecord {
+    uint64_t begin; // 相对Tracer创建时刻的纳秒
+    uint64_t end;
+    uint32_t stage; // Tracer::registerStage返回的编号，Idle为0
+    int32_t index; // 索引或块的起点，没有索引时为-1
+    int32_t count; // 块中的索引数
+    TraceKind kind;
+};
+
+// 单个线程的事件环形缓冲区：只有所属线程写入，满了覆盖最早的事件
+class TraceBuffer {
+public:
+    static const size_t kCapacity = TASK_QUEUE_TRACE_CAPACITY;
+
+    explicit TraceBuffer(uint32_t tid)
+        : tid(tid)
+        , records(kCapacity)
     {
-        if (!stop) {
-            stop = true;
-            taskQueue.pushTask([] { }); // 发送空任务让线程退出
-        }
     }
 
-    void taskFinished()
+    void add(const TraceRecord& r)
     {
-        std::unique_lock<std::mutex> lock(doneMtx);
-        --taskCounter; // 减少任务计数器
-        if (taskCounter == 0) {
-            stopAll();
-            doneCV.notify_all(); // 当所有任务完成时，通知主线程
-        }
+        uint64_t h = head.load(std::memory_order_relaxed);
+        records[h & (kCapacity - 1)] = r;
+        head.store(h + 1, std::memory_order_release);
     }
 
-private:
-    // std::vector<std::thread> workers;
-    TaskQueueT& taskQueue;
-    bool stop;
-    std::atomic<int>& taskCounter; // 任务计数器，追踪未完成任务
-    std::condition_variable& doneCV; // 用于通知任务完成
-    std::mutex& doneMtx; // 用于任务计数器的互斥锁
+    const uint32_t tid;
+    std::vector<TraceRecord> records;
+    std::atomic<uint64_t> head { 0 };
 };
 
-template <typename TaskQueueT>
-class CurrentThreadEx {
+// 全局追踪器：登记阶段名，为每个线程分配缓冲区，导出时按线程输出事件
+// 导出时读取的是各线程的缓冲区，应当在流水线结束（或暂停）后调用
+class Tracer {
 public:
-    using CurrentThreadPtr = std::shared_ptr<CurrentThread<TaskQueueT>>;
+    static Tracer& instance()
+    {
+        static Tracer tracer;
+        return tracer;
+    }
 
-    TaskQueueT taskQueue;
-    CurrentThreadEx(int) // 为了保证调用方式和ThreadPoolEx一致，这里并没有意义
+    uint32_t registerStage(const std::string& name)
     {
-        currentThread = std::make_shared<CurrentThread<TaskQueueT>>(taskQueue, taskCounter, doneCV, doneMtx);
+        std::lock_guard<std::mutex> lock(mtx);
+        stageNames.push_back(name);
+        return (uint32_t)stageNames.size() - 1;
     }
 
-    void setTaskCount(int n)
+    uint64_t now() const
     {
-        taskCounter = n;
+        return elapsedNanos(epoch);
     }
 
-    void pushTask(std::function<void()> task)
+    void record(TraceKind kind, uint32_t stage, int index, int count, uint64_t begin)
     {
-        taskQueue.pushTask(task);
+        local().add(TraceRecord { begin, now(), stage, index, count, kind });
     }
 
-    void run()
+    // Push到Run之间用flow箭头相连，同一个索引在两个线程上的位置一目了然
+    void writeChromeJson(std::ostream& os)
     {
-        currentThread->run();
+        std::lock_guard<std::mutex> lock(mtx);
+        os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+        bool first = true;
+        for (const auto& buf : buffers) {
+            uint64_t head = buf->head.load(std::memory_order_acquire);
+            uint64_t begin = head > TraceBuffer::kCapacity ? head - TraceBuffer::kCapacity : 0;
+            std::string threadName;
+            for (uint64_t i = begin; i < head; ++i) {
+                const TraceRecord& r = buf->records[i & (TraceBuffer::kCapacity - 1)];
+                if (r.kind == TraceKind::Run && threadName.empty())
+                    threadName = stageNames[r.stage];
+                writeEvent(os, first, *buf, r);
+            }
+            if (threadName.empty())
+                threadName = "producer";
+            separate(os, first);
+            os << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << buf->tid
+               << ",\"args\":{\"name\":\"" << escape(threadName) << " #" << buf->tid << "\"}}";
+        }
+        os << "\n]}\n";
     }
 
-private:
-    CurrentThreadPtr currentThread;
-    std::atomic<int> taskCounter;
-    std::condition_variable doneCV;
-    std::mutex doneMtx;
-};
+    bool writeChromeJson(const std::string& path)
+    {
+        std::ofstream os(path);
+        if (!os)
+            return false;
+        writeChromeJson(os);
+        return (bool)os;
+    }
 
-// 基类，用于StageT链接
-class StageBase {
-public:
-    virtual ~StageBase() = default;
-    virtual void push(int index) = 0;
-};
+    // 丢弃已记录的事件，已登记的阶段和缓冲区保留
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto& buf : buffers) {
+            buf->head.store(0, std::memory_order_relaxed);
+        }
+    }
 
-// 泛型Stage类，支持不同的执行器类型
-template <typename ExecutorT>
-class StageT : public StageBase {
-public:
-    using Func = std::function<void(int)>;
+private:
+    Tracer()
+        : epoch(std::chrono::steady_clock::now())
+    {
+        stageNames.push_back(""); // 编号0留给不属于阶段的事件
+    }
 
-    // 构造函数 - 对于ThreadPoolEx需要num_workers，对于CurrentThreadEx不需要
-    StageT(const std::string& name, int threads, int capacity, Func func)
-        : name_(name)
-        , executor_(threads)
-        , func_(std::move(func))
+    TraceBuffer& local()
     {
-        executor_.taskQueue.setCapacity(capacity);
+        thread_local TraceBuffer* buf = nullptr;
+        if (!buf) {
+            std::lock_guard<std::mutex> lock(mtx);
+            buffers.emplace_back(new TraceBuffer((uint32_t)buffers.size() + 1));
+            buf = buffers.back().get();
+        }
+        return *buf;
     }
 
-    void setTaskCount(int n)
+    static void separate(std::ostream& os, bool& first)
     {
-        executor_.setTaskCount(n);
+        if (!first)
+            os << ",\n";
+        first = false;
     }
 
-    void push(int index) override
+    void writeEvent(std::ostream& os, bool& first, const TraceBuffer& buf, const TraceRecord& r)
     {
-        executor_.pushTask([this, index]() {
-            run(index);
-        });
+        static const char* const kCategories[] = { "push", "run", "idle" };
+        const std::string& stage = stageNames[r.stage];
+        separate(os, first);
+        os << "{\"ph\":\"X\",\"cat\":\"" << kCategories[(int)r.kind] << "\",\"name\":\"";
+        if (r.kind == TraceKind::Push)
+            os << "push ";
+        os << (r.kind == TraceKind::Idle ? "idle" : escape(stage)) << "\",\"pid\":1,\"tid\":" << buf.tid
+           << ",\"ts\":" << micros(r.begin) << ",\"dur\":" << micros(r.end - r.begin);
+        if (r.index >= 0)
+            os << ",\"args\":{\"index\":" << r.index << ",\"count\":" << r.count << "}";
+        os << "}";
+        if (r.kind == TraceKind::Idle || r.index < 0)
+            return;
+        // 起点绑定到Push，终点绑定到执行同一个索引的Run
+        uint64_t id = ((uint64_t)r.stage << 32) | (uint32_t)r.index;
+        separate(os, first);
+        os << "{\"ph\":\"" << (r.kind == TraceKind::Push ? "s" : "f") << "\",\"bp\":\"e\",\"cat\":\"queue\",\"name\":\"queue\",\"id\":" << id
+           << ",\"pid\":1,\"tid\":" << buf.tid << ",\"ts\":" << micros(r.begin) << "}";
     }
 
-    void wait()
+    static std::string micros(uint64_t nanos)
     {
-        executor_.wait();
+        std::ostringstream os;
+        os << nanos / 1000 << "." << std::setw(3) << std::setfill('0') << nanos % 1000;
+        return os.str();
     }
 
-    // 对于CurrentThreadEx，需要手动调用run
-    void run()
+    static std::string escape(const std::string& s)
     {
-        executor_.run();
+        std::string out;
+        for (char c : s) {
+            if (c == '"' || c == '\\')
+                out += '\\';
+            if ((unsigned char)c >= 0x20)
+                out += c;
+        }
+        return out;
     }
 
-    // 公共方法用于链接
-    void setNext(StageBase* next)
+    std::chrono::steady_clock::time_point epoch;
+    std::mutex mtx;
+    std::vector<std::string> stageNames;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers;
+};
+
+inline uint32_t traceStage(const std::string& name)
+{
+    return Tracer::instance().registerStage(name);
+}
+
+// 记录从构造到析构的一段时间
+class TraceSpan {
+public:
+    TraceSpan(TraceKind kind, uint32_t stage, int index = -1, int count = 1)
+        : kind(kind)
+        , stage(stage)
+        , index(index)
+        , count(count)
+        , begin(Tracer::instance().now())
     {
-        next_ = next;
     }
 
-private:
-    void run(int index)
+    ~TraceSpan()
     {
-        func_(index);
-        if (next_) {
-            next_->push(index);
-        }
+        Tracer::instance().record(kind, stage, index, count, begin);
     }
 
-private:
-    std::string name_;
-    ExecutorT executor_;
-    Func func_;
-    StageBase* next_ = nullptr;
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
 
-    // 为了让所有StageT实例都可以访问next_
-    template <typename AnyExecutorT>
-    friend class StageT;
+private:
+    TraceKind kind;
+    uint32_t stage;
+    int index;
+    int count;
+    uint64_t begin;
 };
 
-using Stage = StageT<ThreadPoolEx<BoundedTaskQueue>>;
-using StageCurrent = StageT<CurrentThreadEx<BoundedTaskQueue>>;
+#else
 
-// 通用的chain函数，支持不同类型的StageT
-template <typename Stage1, typename Stage2>
-void chain(Stage1& a, Stage2& b)
+inline uint32_t traceStage(const std::string&)
 {
-    a.setNext(&b);
+    return 0;
 }
+
+class TraceSpan {
+public:
+    TraceSpan(TraceKind, uint32_t, int = -1, int = 1)
+    {
+    }
+};
+
+#endif
+
+// 等待策略基类（CRTP），派生类只需提供spin(peek)：
+// 在不持锁的情况下等待peek()成立，返回true表示条件可能已满足，false表示应当休眠
+template <typename Derived>
+class WaitPolicyBase {
+public:
+    // 持有lock时调用，返回时lock仍被持有且pred()成立
+    // pred在持锁状态下检查，peek在不持锁状态下检查（只读原子变量）
+    template <typename Pred, typename Peek>
+    void wait(std::unique_lock<std::mutex>& lock, std::condition_variable& cv, Pred pred, Peek peek)
+    {
+        if (pred()) {
+            countImmediate();
+            return;
+        }
+        auto start = std::chrono::steady_clock::now();
+        if (Derived::kSpins) {
+            while (true) {
+                lock.unlock();
+                bool ready = static_cast<Derived*>(this)->spin(peek);
+                lock.lock();
+                if (pred()) {
+                    countSpun();
+                    addWaitTime(start);
+                    return;
+                }
+                if (!ready)
+                    break;
+            }
+        }
+        countParked();
+        cv.wait(lock, pred);
+        addWaitTime(start);
+    }
+
+    WaitStats stats() const
+    {
+        WaitStats s;
+        s.immediate = immediate.load(std::memory_order_relaxed);
+        s.spun = spun.load(std::memory_order_relaxed);
+        s.parked = parked.load(std::memory_order_relaxed);
+        s.waitNanos = waitNanos.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    void countImmediate() { immediate.fetch_add(1, std::memory_order_relaxed); }
+    void countSpun() { spun.fetch_add(1, std::memory_order_relaxed); }
+    void countParked() { parked.fetch_add(1, std::memory_order_relaxed); }
+    void addWaitTime(std::chrono::steady_clock::time_point start)
+    {
+        waitNanos.fetch_add(elapsedNanos(start), std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> immediate { 0 };
+    std::atomic<uint64_t> spun { 0 };
+    std::atomic<uint64_t> parked { 0 };
+    std::atomic<uint64_t> waitNanos { 0 };
+};
+
+// 纯阻塞：直接进入条件变量等待（默认策略，即原有行为）
+class BlockingWait : public WaitPolicyBase<BlockingWait> {
+public:
+    static const bool kSpins = false;
+
+    template <typename Peek>
+    bool spin(Peek)
+    {
+        return false;
+    }
+};
+
+// 先有限次自旋（pause），再有限次让出CPU（yield），仍不满足才休眠
+// 适合突发负载，避免每个任务都付出一次完整的休眠/唤醒开销
+class SpinThenParkWait : public WaitPolicyBase<SpinThenParkWait> {
+public:
+    static const bool kSpins = true;
+
+    void setSpinLimits(int spins, int yields)
+    {
+        spinLimit = spins;
+        yieldLimit = yields;
+    }
+
+    template <typename Peek>
+    bool spin(Peek peek)
+    {
+        for (int i = 0; i < spinLimit; ++i) {
+            if (peek())
+                return true;
+            cpuRelax();
+        }
+        for (int i = 0; i < yieldLimit; ++i) {
+            if (peek())
+                return true;
+            std::this_thread::yield();
+        }
+        return peek();
+    }
+
+private:
+    int spinLimit = 2000;
+    int yieldLimit = 16;
+};
+
+// 忙轮询：从不休眠，适合对延迟敏感且独占CPU核心的阶段
+class BusyPollWait : public WaitPolicyBase<BusyPollWait> {
+public:
+    static const bool kSpins = true;
+
+    template <typename Peek>
+    bool spin(Peek peek)
+    {
+        while (!peek()) {
+            cpuRelax();
+        }
+        return true;
+    }
+};
+
+// 队列的运行时指标快照
+struct QueueStats {
+    size_t depth = 0; // 当前长度
+    size_t peakDepth = 0; // 历史最大长度
+    size_t capacity = 0; // 0表示无界
+    uint64_t dropped = 0; // 因FullPolicy被丢弃的任务数
+    WaitStats producer; // 生产者因队列满而等待（无界队列始终为0）
+    WaitStats consumer; // 消费者因队列空而等待
+};
+
+// 任务队列
+template <typename WaitPolicyT = BlockingWait>
+class BasicTaskQueue {
+public:
+    // 向队列添加任务，队列已关闭时丢弃任务并返回false
+    bool pushTask(Task task)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (closed)
+            return false;
+        tasks.push(std::move(task));
+        updateCount();
+        cv.notify_one(); // 通知一个等待的线程
+        return true;
+    }
+
+    // 非阻塞添加（无界队列只在已关闭时失败），失败时返回false且不移走task
+    bool tryPushTask(Task& task)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (closed)
+            return false;
+        tasks.push(std::move(task));
+        updateCount();
+        cv.notify_one();
+        return true;
+    }
+
+    // 批量添加任务，整批只加一次锁；[first, last)中的任务会被移走
+    template <typename InputIt>
+    void pushTasks(InputIt first, InputIt last)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (closed)
+            return;
+        size_t n = 0;
+        for (; first != last; ++first, ++n) {
+            tasks.push(std::move(*first));
+        }
+        updateCount();
+        if (n == 1) {
+            cv.notify_one();
+        } else if (n > 1) {
+            cv.notify_all();
+        }
+    }
+
+    // 从队列中取出任务；队列已关闭且为空时返回空任务
+    Task popTask()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        waitNotEmpty(lock); // 等待直到队列有任务
+        if (tasks.empty()) {
+            consumeInterrupt();
+            return Task();
+        }
+        Task task = std::move(tasks.front());
+        tasks.pop();
+        count.store(tasks.size(), std::memory_order_relaxed);
+        return task;
+    }
+
+    // 批量取出最多maxN个任务写入out，阻塞直到至少有一个任务，返回取出的个数
+    // 队列已关闭且为空时返回0
+    template <typename OutputIt>
+    size_t popTasks(OutputIt out, size_t maxN)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        waitNotEmpty(lock);
+        if (tasks.empty()) {
+            consumeInterrupt();
+            return 0;
+        }
+        size_t n = 0;
+        while (n < maxN && !tasks.empty()) {
+            *out++ = std::move(tasks.front());
+            tasks.pop();
+            ++n;
+        }
+        count.store(tasks.size(), std::memory_order_relaxed);
+        return n;
+    }
+
+    // 非阻塞取出，队列空时返回false
+    bool tryPopTask(Task& task)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (tasks.empty())
+            return false;
+        task = std::move(tasks.front());
+        tasks.pop();
+        count.store(tasks.size(), std::memory_order_relaxed);
+        return true;
+    }
+
+    bool empty()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        return tasks.empty();
+    }
+
+    // 关闭队列：之后的push被丢弃，阻塞的pop在取完剩余任务后返回空任务
+    void close()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        closed = true;
+        cv.notify_all();
+    }
+
+    // 让一个消费者在队列为空时从pop返回空任务（正在等待的，或者下一个遇到空队列的）
+    // 用于弹性线程池让空闲的工作线程退出
+    void interruptConsumer()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        ++interrupts;
+        cv.notify_all();
+    }
+
+    bool isClosed() const
+    {
+        return closed.load();
+    }
+
+    WaitPolicyT& consumerWaitPolicy()
+    {
+        return consumerWait;
+    }
+
+    size_t size() const
+    {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    QueueStats stats() const
+    {
+        QueueStats s;
+        s.depth = count.load(std::memory_order_relaxed);
+        s.peakDepth = peak.load(std::memory_order_relaxed);
+        s.consumer = consumerWait.stats();
+        return s;
+    }
+
+private:
+    // 持锁调用，更新长度副本和峰值
+    void updateCount()
+    {
+        size_t n = tasks.size();
+        count.store(n, std::memory_order_relaxed);
+        if (n > peak.load(std::memory_order_relaxed)) {
+            peak.store(n, std::memory_order_relaxed);
+        }
+    }
+
+    void waitNotEmpty(std::unique_lock<std::mutex>& lock)
+    {
+        consumerWait.wait(
+            lock, cv, [this] { return !tasks.empty() || closed || interrupts > 0; },
+            [this] { return count.load(std::memory_order_relaxed) > 0 || closed.load(std::memory_order_relaxed)
+                         || interrupts.load(std::memory_order_relaxed) > 0; });
+    }
+
+    // 持锁调用，队列为空时消耗一次interruptConsumer
+    void consumeInterrupt()
+    {
+        if (interrupts > 0) {
+            --interrupts;
+        }
+    }
+
+    std::queue<Task> tasks;
+    std::atomic<size_t> count { 0 }; // 队列长度的无锁副本，供自旋等待读取
+    std::atomic<size_t> peak { 0 };
+    std::atomic<bool> closed { false }; // 在mtx保护下修改，原子类型供自旋等待读取
+    std::atomic<int> interrupts { 0 }; // 同上，尚未被消耗的interruptConsumer次数
+    std::mutex mtx;
+    std::condition_variable cv;
+    WaitPolicyT consumerWait;
+};
+
+// 只增不减的环形缓冲区，用作有界队列的存储：std::queue（std::deque）每放入几个任务就分配一个新块、
+// 释放一个旧块，环形缓冲区达到最大长度后就不再分配
+class TaskRing {
+public:
+    void push(Task task)
+    {
+        if (count == cells.size()) {
+            grow();
+        }
+        cells[(head + count) & (cells.size() - 1)] = std::move(task);
+        ++count;
+    }
+
+    Task& front()
+    {
+        return cells[head];
+    }
+
+    void pop()
+    {
+        cells[head] = nullptr;
+        head = (head + 1) & (cells.size() - 1);
+        --count;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+private:
+    void grow()
+    {
+        std::vector<Task> larger(cells.empty() ? 16 : cells.size() * 2);
+        for (size_t i = 0; i < count; ++i) {
+            larger[i] = std::move(cells[(head + i) & (cells.size() - 1)]);
+        }
+        cells.swap(larger);
+        head = 0;
+    }
+
+    std::vector<Task> cells; // 长度为2的幂
+    size_t head = 0;
+    size_t count = 0;
+};
+
+// 有界队列满时pushTask的处理方式；有损策略适合遥测等允许丢数据的流式场景
+enum class FullPolicy {
+    Block, // 一直等到有空位（默认）
+    BlockFor, // 最多等待给定的时间，超时丢弃新任务
+    DropNewest, // 不等待，直接丢弃新任务（需要取回任务时用tryPushTask）
+    DropOldest, // 不等待，丢弃队首最早的任务，为新任务腾出位置
+};
+
+// 有界任务队列，用于在I/O和处理任务之间传递数据
+template <typename WaitPolicyT = BlockingWait>
+class BasicBoundedTaskQueue {
+public:
+    BasicBoundedTaskQueue(size_t capacity = 20)
+        : capacity(capacity)
+    {
+    }
+
+    // 可以在运行中调整，扩大时唤醒等待的生产者；缩小时已在队列中的任务保留
+    void setCapacity(size_t capacity)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        this->capacity = capacity;
+        cv_producer.notify_all();
+    }
+
+    // 队列满时pushTask的处理方式，timeout只用于FullPolicy::BlockFor
+    void setFullPolicy(FullPolicy policy, std::chrono::nanoseconds timeout = std::chrono::nanoseconds(0))
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        fullPolicy = policy;
+        fullTimeout = timeout;
+    }
+
+    // 每个因FullPolicy被丢弃（不会执行）的任务调用一次，参数为它的weight()，在锁外、被丢弃的任务析构之后调用
+    // 执行器据此把任务计为已完成，否则wait会一直等待被丢弃的任务
+    void setDropHandler(std::function<void(uint32_t)> handler)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        onDrop = std::move(handler);
+    }
+
+    // 向队列中添加任务，队列已关闭或任务按FullPolicy被丢弃时返回false
+    // DropOldest时通常挤出队首的任务，新任务放入并返回true；weight()为0的任务不会被丢弃，见makeRoom
+    bool pushTask(Task task)
+    {
+        Task evicted;
+        std::function<void(uint32_t)> dropped;
+        bool accepted;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            accepted = makeRoom(lock, task, evicted); // 等待缓冲区有空位
+            if (closed)
+                return false;
+            if (accepted) {
+                tasks.push(std::move(task));
+                updateCount();
+                cv_consumer.notify_one(); // 通知消费者有新的任务
+            } else {
+                evicted = std::move(task);
+            }
+            if (evicted) {
+                droppedCount.fetch_add(1, std::memory_order_relaxed);
+                dropped = onDrop;
+            }
+        }
+        uint32_t weight = evicted.weight();
+        evicted = nullptr; // 被丢弃任务携带的资源（例如MemoryLease）在锁外释放
+        if (dropped)
+            dropped(weight);
+        return accepted;
+    }
+
+    // 非阻塞添加，队列满或已关闭时返回false且不移走task
+    bool tryPushTask(Task& task)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (closed || tasks.size() >= capacity)
+            return false;
+        tasks.push(std::move(task));
+        updateCount();
+        cv_consumer.notify_one();
+        return true;
+    }
+
+    // 批量添加任务，每次等到有空位后尽可能多地放入，[first, last)中的任务会被移走
+    // 不是FullPolicy::Block时逐个按pushTask处理
+    template <typename InputIt>
+    void pushTasks(InputIt first, InputIt last)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (fullPolicy != FullPolicy::Block) {
+            lock.unlock();
+            for (; first != last; ++first) {
+                pushTask(std::move(*first));
+            }
+            return;
+        }
+        while (first != last) {
+            waitNotFull(lock);
+            if (closed)
+                return;
+            size_t n = 0;
+            for (; first != last && tasks.size() < capacity; ++first, ++n) {
+                tasks.push(std::move(*first));
+            }
+            updateCount();
+            if (n == 1) {
+                cv_consumer.notify_one();
+            } else {
+                cv_consumer.notify_all();
+            }
+        }
+    }
+
+    // 从队列中取出任务；队列已关闭且为空时返回空任务
+    Task popTask()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        waitNotEmpty(lock); // 等待队列中有任务
+        if (tasks.empty()) {
+            consumeInterrupt();
+            return Task();
+        }
+        Task task = std::move(tasks.front());
+        tasks.pop();
+        count.store(tasks.size(), std::memory_order_relaxed);
+        cv_producer.notify_one(); // 通知生产者可以继续生产
+        return task;
+    }
+
+    // 批量取出最多maxN个任务写入out，阻塞直到至少有一个任务，返回取出的个数
+    // 队列已关闭且为空时返回0
+    template <typename OutputIt>
+    size_t popTasks(OutputIt out, size_t maxN)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        waitNotEmpty(lock);
+        if (tasks.empty()) {
+            consumeInterrupt();
+            return 0;
+        }
+        size_t n = 0;
+        while (n < maxN && !tasks.empty()) {
+            *out++ = std::move(tasks.front());
+            tasks.pop();
+            ++n;
+        }
+        count.store(tasks.size(), std::memory_order_relaxed);
+        if (n == 1) {
+            cv_producer.notify_one();
+        } else if (n > 1) {
+            cv_producer.notify_all();
+        }
+        return n;
+    }
+
+    // 非阻塞取出，队列空时返回false
+    bool tryPopTask(Task& task)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (tasks.empty())
+            return false;
+        task = std::move(tasks.front());
+        tasks.pop();
+        count.store(tasks.size(), std::memory_order_relaxed);
+        cv_producer.notify_one();
+        return true;
+    }
+
+    bool empty()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        return tasks.empty();
+    }
+
+    // 关闭队列：之后的push被丢弃，阻塞的pop在取完剩余任务后返回空任务
+    void close()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        closed = true;
+        cv_consumer.notify_all();
+        cv_producer.notify_all();
+    }
+
+    // 让一个消费者在队列为空时从pop返回空任务（正在等待的，或者下一个遇到空队列的）
+    // 用于弹性线程池让空闲的工作线程退出
+    void interruptConsumer()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        ++interrupts;
+        cv_consumer.notify_all();
+    }
+
+    bool isClosed() const
+    {
+        return closed.load();
+    }
+
+    WaitPolicyT& consumerWaitPolicy()
+    {
+        return consumerWait;
+    }
+
+    WaitPolicyT& producerWaitPolicy()
+    {
+        return producerWait;
+    }
+
+    size_t size() const
+    {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    QueueStats stats() const
+    {
+        QueueStats s;
+        s.depth = count.load(std::memory_order_relaxed);
+        s.peakDepth = peak.load(std::memory_order_relaxed);
+        s.capacity = capacity.load(std::memory_order_relaxed);
+        s.dropped = droppedCount.load(std::memory_order_relaxed);
+        s.producer = producerWait.stats();
+        s.consumer = consumerWait.stats();
+        return s;
+    }
+
+protected:
+    // 持锁调用，更新长度副本和峰值
+    void updateCount()
+    {
+        size_t n = tasks.size();
+        count.store(n, std::memory_order_relaxed);
+        if (n > peak.load(std::memory_order_relaxed)) {
+            peak.store(n, std::memory_order_relaxed);
+        }
+    }
+
+    void waitNotEmpty(std::unique_lock<std::mutex>& lock)
+    {
+        consumerWait.wait(
+            lock, cv_consumer, [this] { return !tasks.empty() || closed || interrupts > 0; },
+            [this] { return count.load(std::memory_order_relaxed) > 0 || closed.load(std::memory_order_relaxed)
+                         || interrupts.load(std::memory_order_relaxed) > 0; });
+    }
+
+    // 持锁调用，队列为空时消耗一次interruptConsumer
+    void consumeInterrupt()
+    {
+        if (interrupts > 0) {
+            --interrupts;
+        }
+    }
+
+    // 持锁调用，按FullPolicy为新任务task腾出位置，返回false表示新任务应被丢弃
+    // weight()为0的任务不能丢弃：新任务是这样的任务时按Block等待；DropOldest的队首是这样的任务时改为丢弃新任务
+    bool makeRoom(std::unique_lock<std::mutex>& lock, const Task& task, Task& evicted)
+    {
+        if (fullPolicy == FullPolicy::Block || task.weight() == 0) {
+            waitNotFull(lock);
+            return true;
+        }
+        switch (fullPolicy) {
+        case FullPolicy::Block:
+            break;
+        case FullPolicy::BlockFor:
+            return cv_producer.wait_for(lock, fullTimeout, [this] { return tasks.size() < capacity || closed; });
+        case FullPolicy::DropNewest:
+            return tasks.size() < capacity;
+        case FullPolicy::DropOldest:
+            if (closed || tasks.size() < capacity || tasks.empty())
+                return true;
+            if (tasks.front().weight() == 0)
+                return false;
+            evicted = std::move(tasks.front());
+            tasks.pop();
+            return true;
+        }
+        return true;
+    }
+
+    void waitNotFull(std::unique_lock<std::mutex>& lock)
+    {
+        producerWait.wait(
+            lock, cv_producer, [this] { return tasks.size() < capacity || closed; },
+            [this] { return count.load(std::memory_order_relaxed) < capacity || closed.load(std::memory_order_relaxed); });
+    }
+
+    TaskRing tasks;
+    std::atomic<size_t> count { 0 }; // 队列长度的无锁副本，供自旋等待读取
+    std::atomic<size_t> peak { 0 };
+    std::atomic<bool> closed { false }; // 在mtx保护下修改，原子类型供自旋等待读取
+    std::atomic<int> interrupts { 0 }; // 同上，尚未被消耗的interruptConsumer次数
+    std::mutex mtx;
+    std::condition_variable cv_producer, cv_consumer;
+    std::atomic<size_t> capacity; // 队列的最大容量
+    FullPolicy fullPolicy = FullPolicy::Block;
+    std::chrono::nanoseconds fullTimeout { 0 };
+    std::function<void(uint32_t)> onDrop;
+    std::atomic<uint64_t> droppedCount { 0 };
+    WaitPolicyT consumerWait, producerWait;
+};
+
+using TaskQueue = BasicTaskQueue<>;
+using BoundedTaskQueue = BasicBoundedTaskQueue<>;
+
+// 优先级任务队列：每个优先级一个FIFO，用位图找到最高的非空优先级，push/pop都是O(1)
+// 优先级取值[0, kLevels)，数值越大越优先；pushTask(task)使用kDefaultPriority
+// 开启老化（setAging）后，任务每等待一个老化间隔就被视为提高一级，避免低优先级任务饿死
+// capacity为0时无界，否则队列满时push阻塞；接口与TaskQueue一致，可作为TaskQueueT参数
+template <typename WaitPolicyT = BlockingWait>
+class BasicPriorityTaskQueue {
+public:
+    static const int kLevels = 8;
+    static const int kDefaultPriority = kLevels / 2;
+
+    BasicPriorityTaskQueue(size_t capacity = 0)
+        : capacity(capacity)
+    {
+    }
+
+    void setCapacity(size_t capacity)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        this->capacity = capacity;
+        cv_producer.notify_all();
+    }
+
+    // 等待超过interval * n的任务按提高n级参与调度，0表示关闭老化
+    void setAging(std::chrono::nanoseconds interval)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        agingNanos = interval.count() > 0 ? interval.count() : 0;
+    }
+
+    bool pushTask(Task task)
+    {
+        return pushTask(std::move(task), kDefaultPriority);
+    }
+
+    // 按优先级添加任务，超出范围的优先级被截断；队列已关闭时丢弃任务并返回false
+    bool pushTask(Task task, int priority)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        waitNotFull(lock);
+        if (closed)
+            return false;
+        enqueue(std::move(task), priority);
+        updateCount();
+        cv_consumer.notify_one();
+        return true;
+    }
+
+    // 非阻塞添加（默认优先级），队列满或已关闭时返回false且不移走task
+    bool tryPushTask(Task& task)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (closed || full())
+            return false;
+        enqueue(std::move(task), kDefaultPriority);
+        updateCount();
+        cv_consumer.notify_one();
+        return true;
+    }
+
+    // 批量添加任务（默认优先级），[first, last)中的任务会被移走
+    template <typename InputIt>
+    void pushTasks(InputIt first, InputIt last)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (first != last) {
+            waitNotFull(lock);
+            if (closed)
+                return;
+            size_t n = 0;
+            for (; first != last && !full(); ++first, ++n) {
+                enqueue(std::move(*first), kDefaultPriority);
+            }
+            updateCount();
+            if (n == 1) {
+                cv_consumer.notify_one();
+            } else {
+                cv_consumer.notify_all();
+            }
+        }
+    }
+
+    // 取出当前最优先的任务；队列已关闭且为空时返回空任务
+    Task popTask()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        waitNotEmpty(lock);
+        if (total == 0) {
+            consumeInterrupt();
+            return Task();
+        }
+        Task task = dequeue();
+        cv_producer.notify_one();
+        return task;
+    }
+
+    // 批量取出最多maxN个任务写入out，按优先级顺序，阻塞直到至少有一个任务
+    // 队列已关闭且为空时返回0
+    template <typename OutputIt>
+    size_t popTasks(OutputIt out, size_t maxN)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        waitNotEmpty(lock);
+        if (total == 0) {
+            consumeInterrupt();
+            return 0;
+        }
+        size_t n = 0;
+        while (n < maxN && total > 0) {
+            *out++ = dequeue();
+            ++n;
+        }
+        if (n == 1) {
+            cv_producer.notify_one();
+        } else if (n > 1) {
+            cv_producer.notify_all();
+        }
+        return n;
+    }
+
+    // 非阻塞取出，队列空时返回false
+    bool tryPopTask(Task& task)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (total == 0)
+            return false;
+        task = dequeue();
+        cv_producer.notify_one();
+        return true;
+    }
+
+    bool empty()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        return total == 0;
+    }
+
+    // 关闭队列：之后的push被丢弃，阻塞的pop在取完剩余任务后返回空任务
+    void close()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        closed = true;
+        cv_consumer.notify_all();
+        cv_producer.notify_all();
+    }
+
+    // 让一个消费者在队列为空时从pop返回空任务，用于弹性线程池让空闲的工作线程退出
+    void interruptConsumer()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        ++interrupts;
+        cv_consumer.notify_all();
+    }
+
+    bool isClosed() const
+    {
+        return closed.load();
+    }
+
+    WaitPolicyT& consumerWaitPolicy()
+    {
+        return consumerWait;
+    }
+
+    WaitPolicyT& producerWaitPolicy()
+    {
+        return producerWait;
+    }
+
+    size_t size() const
+    {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    // 某个优先级上排队的任务数
+    size_t size(int priority)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        return levels[clampPriority(priority)].size();
+    }
+
+    QueueStats stats() const
+    {
+        QueueStats s;
+        s.depth = count.load(std::memory_order_relaxed);
+        s.peakDepth = peak.load(std::memory_order_relaxed);
+        s.capacity = capacity.load(std::memory_order_relaxed);
+        s.producer = producerWait.stats();
+        s.consumer = consumerWait.stats();
+        return s;
+    }
+
+private:
+    struct Entry {
+        Task task;
+        int64_t enqueued; // 入队时间，只在开启老化时记录
+    };
+
+    static int clampPriority(int priority)
+    {
+        return priority < 0 ? 0 : (priority >= kLevels ? kLevels - 1 : priority);
+    }
+
+    static int64_t nowNanos()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    bool full() const
+    {
+        size_t cap = capacity.load(std::memory_order_relaxed);
+        return cap > 0 && total >= cap;
+    }
+
+    // 持锁调用
+    void enqueue(Task task, int priority)
+    {
+        int level = clampPriority(priority);
+        Entry entry = { std::move(task), agingNanos > 0 ? nowNanos() : 0 };
+        levels[level].push_back(std::move(entry));
+        nonEmpty |= 1u << level;
+        ++total;
+    }
+
+    // 持锁调用，队列非空
+    Task dequeue()
+    {
+        int level = topLevel();
+        if (agingNanos > 0) {
+            level = agedLevel(level);
+        }
+        std::deque<Entry>& fifo = levels[level];
+        Task task = std::move(fifo.front().task);
+        fifo.pop_front();
+        if (fifo.empty()) {
+            nonEmpty &= ~(1u << level);
+        }
+        --total;
+        count.store(total, std::memory_order_relaxed);
+        return task;
+    }
+
+    // 最高的非空优先级
+    int topLevel() const
+    {
+        int level = kLevels - 1;
+        while (!(nonEmpty & (1u << level))) {
+            --level;
+        }
+        return level;
+    }
+
+    // 比较各优先级队首任务老化后的优先级，取最高者；相同时取原优先级高的
+    int agedLevel(int top) const
+    {
+        int64_t now = nowNanos();
+        int best = top;
+        int64_t bestScore = top + (now - levels[top].front().enqueued) / agingNanos;
+        for (int level = top - 1; level >= 0; --level) {
+            if (!(nonEmpty & (1u << level)))
+                continue;
+            int64_t score = level + (now - levels[level].front().enqueued) / agingNanos;
+            if (score > bestScore) {
+                best = level;
+                bestScore = score;
+            }
+        }
+        return best;
+    }
+
+    // 持锁调用，更新长度副本和峰值
+    void updateCount()
+    {
+        count.store(total, std::memory_order_relaxed);
+        if (total > peak.load(std::memory_order_relaxed)) {
+            peak.store(total, std::memory_order_relaxed);
+        }
+    }
+
+    void waitNotEmpty(std::unique_lock<std::mutex>& lock)
+    {
+        consumerWait.wait(
+            lock, cv_consumer, [this] { return total > 0 || closed || interrupts > 0; },
+            [this] { return count.load(std::memory_order_relaxed) > 0 || closed.load(std::memory_order_relaxed)
+                         || interrupts.load(std::memory_order_relaxed) > 0; });
+    }
+
+    // 持锁调用，队列为空时消耗一次interruptConsumer
+    void consumeInterrupt()
+    {
+        if (interrupts > 0) {
+            --interrupts;
+        }
+    }
+
+    void waitNotFull(std::unique_lock<std::mutex>& lock)
+    {
+        producerWait.wait(
+            lock, cv_producer, [this] { return !full() || closed; },
+            [this] {
+                size_t cap = capacity.load(std::memory_order_relaxed);
+                return cap == 0 || count.load(std::memory_order_relaxed) < cap || closed.load(std::memory_order_relaxed);
+            });
+    }
+
+    std::deque<Entry> levels[kLevels];
+    uint32_t nonEmpty = 0; // 第i位表示优先级i非空
+    size_t total = 0;
+    int64_t agingNanos = 0;
+    std::atomic<size_t> count { 0 }; // 队列长度的无锁副本，供自旋等待读取
+    std::atomic<size_t> peak { 0 };
+    std::atomic<bool> closed { false }; // 在mtx保护下修改，原子类型供自旋等待读取
+    std::atomic<int> interrupts { 0 }; // 同上，尚未被消耗的interruptConsumer次数
+    std::mutex mtx;
+    std::condition_variable cv_producer, cv_consumer;
+    std::atomic<size_t> capacity; // 0表示无界
+    WaitPolicyT consumerWait, producerWait;
+};
+
+template <typename WaitPolicyT>
+const int BasicPriorityTaskQueue<WaitPolicyT>::kLevels;
+
+template <typename WaitPolicyT>
+const int BasicPriorityTaskQueue<WaitPolicyT>::kDefaultPriority;
+
+// 有界优先级队列，默认容量与BoundedTaskQueue相同
+template <typename WaitPolicyT = BlockingWait>
+class BasicBoundedPriorityTaskQueue : public BasicPriorityTaskQueue<WaitPolicyT> {
+public:
+    BasicBoundedPriorityTaskQueue(size_t capacity = 20)
+        : BasicPriorityTaskQueue<WaitPolicyT>(capacity)
+    {
+    }
+};
+
+using PriorityTaskQueue = BasicPriorityTaskQueue<>;
+using BoundedPriorityTaskQueue = BasicBoundedPriorityTaskQueue<>;
+
+// 无锁有界MPMC环形队列（基于槽位序号，容量为2的幂）
+// 接口与BoundedTaskQueue一致，可作为ThreadPool/ThreadPoolEx/StageT的TaskQueueT参数
+// 只有在队列满或空时才会阻塞，其余情况push/pop都不加锁
+template <typename WaitPolicyT = BlockingWait>
+class BasicLockFreeTaskQueue {
+public:
+    BasicLockFreeTaskQueue(size_t capacity = 20)
+        : ring(nullptr)
+    {
+        setCapacity(capacity);
+    }
+
+    BasicLockFreeTaskQueue(const BasicLockFreeTaskQueue&) = delete;
+    BasicLockFreeTaskQueue& operator=(const BasicLockFreeTaskQueue&) = delete;
+
+    // 容量向上取整为2的幂（至少为2）；只能在队列为空且没有生产者时调用
+    // ThreadPoolEx的工作线程在构造时就已经阻塞在popTask中，所以旧的环保留到析构，
+    // 保证仍在读取旧环的消费者不会访问已释放的内存
+    void setCapacity(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        Ring* current = ring.load(std::memory_order_acquire);
+        if (current && current->mask + 1 == size) {
+            return;
+        }
+        Ring* r = new Ring(size);
+        if (boundNode >= 0) {
+            bindMemoryToNode(r->cells.get(), size * sizeof(Cell), boundNode);
+        }
+        std::lock_guard<std::mutex> lock(parkMtx);
+        rings.emplace_back(r);
+        enqueuePos.store(0, std::memory_order_relaxed);
+        dequeuePos.store(0, std::memory_order_relaxed);
+        ring.store(r, std::memory_order_release);
+    }
+
+    size_t capacity() const
+    {
+        return ring.load(std::memory_order_acquire)->mask + 1;
+    }
+
+    // 把环形缓冲区迁移到消费者所在的NUMA节点，之后setCapacity分配的环也放在该节点
+    // 以页为单位尽力而为，容量很小（不足一页）时没有效果
+    void bindToNode(int node)
+    {
+        boundNode = node;
+        Ring* r = ring.load(std::memory_order_acquire);
+        bindMemoryToNode(r->cells.get(), (r->mask + 1) * sizeof(Cell), node);
+    }
+
+    // 向队列中添加任务，队列满时按等待策略自旋或阻塞；队列已关闭时丢弃任务并返回false
+    bool pushTask(Task task)
+    {
+        if (closed.load(std::memory_order_acquire))
+            return false;
+        bool pushed = tryPushTask(task);
+        if (pushed) {
+            producerWait.countImmediate();
+        } else {
+            waitAndRetry(producerWait, producersWaiting, cv_producer,
+                [this] { return !full() || closed.load(std::memory_order_acquire); },
+                [this, &task, &pushed] {
+                    pushed = tryPushTask(task);
+                    return pushed || closed.load(std::memory_order_acquire);
+                });
+        }
+        if (pushed) {
+            updatePeak();
+            notifyConsumer();
+        }
+        return pushed;
+    }
+
+    // 从队列中取出任务，队列空时按等待策略自旋或阻塞；队列已关闭且为空时返回空任务
+    Task popTask()
+    {
+        Task task;
+        if (tryPopTask(task)) {
+            consumerWait.countImmediate();
+        } else {
+            waitAndRetry(consumerWait, consumersWaiting, cv_consumer,
+                [this] { return !empty() || closed.load(std::memory_order_acquire) || interrupts.load(std::memory_order_acquire) > 0; },
+                [this, &task] { return tryPopTask(task) || closed.load(std::memory_order_acquire) || consumeInterrupt(); });
+        }
+        if (task) {
+            notifyProducer();
+        }
+        return task;
+    }
+
+    // 批量接口，与BoundedTaskQueue一致；无锁路径本身没有加锁开销，逐个处理即可
+    template <typename InputIt>
+    void pushTasks(InputIt first, InputIt last)
+    {
+        for (; first != last; ++first) {
+            pushTask(std::move(*first));
+        }
+    }
+
+    template <typename OutputIt>
+    size_t popTasks(OutputIt out, size_t maxN)
+    {
+        if (maxN == 0)
+            return 0;
+        Task first = popTask();
+        if (!first)
+            return 0;
+        *out++ = std::move(first);
+        size_t n = 1;
+        Task task;
+        while (n < maxN && tryPopTask(task)) {
+            *out++ = std::move(task);
+            ++n;
+        }
+        if (n > 1) {
+            notifyProducer();
+        }
+        return n;
+    }
+
+    // 非阻塞添加，队列满时返回false且不修改task
+    bool tryPushTask(Task& task)
+    {
+        Ring* r = ring.load(std::memory_order_acquire);
+        Cell* cell;
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &r->cells[pos & r->mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false; // 队列已满
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->task = std::move(task);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 非阻塞取出，队列空时返回false
+    bool tryPopTask(Task& task)
+    {
+        Ring* r = ring.load(std::memory_order_acquire);
+        Cell* cell;
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &r->cells[pos & r->mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false; // 队列为空
+            } else {
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        task = std::move(cell->task);
+        cell->task = nullptr;
+        cell->sequence.store(pos + r->mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty()
+    {
+        Ring* r = ring.load(std::memory_order_acquire);
+        size_t pos = dequeuePos.load(std::memory_order_acquire);
+        size_t seq = r->cells[pos & r->mask].sequence.load(std::memory_order_acquire);
+        return (intptr_t)seq - (intptr_t)(pos + 1) < 0;
+    }
+
+    // 关闭队列：之后的push被丢弃，阻塞的pop在取完剩余任务后返回空任务
+    void close()
+    {
+        closed.store(true, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(parkMtx);
+        cv_consumer.notify_all();
+        cv_producer.notify_all();
+    }
+
+    bool isClosed() const
+    {
+        return closed.load();
+    }
+
+    // 让一个消费者在队列为空时从pop返回空任务（正在等待的，或者下一个遇到空队列的）
+    // 用于弹性线程池让空闲的工作线程退出
+    void interruptConsumer()
+    {
+        interrupts.fetch_add(1, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(parkMtx);
+        cv_consumer.notify_all();
+    }
+
+    WaitPolicyT& consumerWaitPolicy()
+    {
+        return consumerWait;
+    }
+
+    WaitPolicyT& producerWaitPolicy()
+    {
+        return producerWait;
+    }
+
+    // 两个位置计数器之差，并发修改时只是近似值
+    size_t size() const
+    {
+        size_t enq = enqueuePos.load(std::memory_order_relaxed);
+        size_t deq = dequeuePos.load(std::memory_order_relaxed);
+        return enq > deq ? enq - deq : 0;
+    }
+
+    QueueStats stats() const
+    {
+        QueueStats s;
+        s.depth = size();
+        s.peakDepth = peak.load(std::memory_order_relaxed);
+        s.capacity = capacity();
+        s.producer = producerWait.stats();
+        s.consumer = consumerWait.stats();
+        return s;
+    }
+
+private:
+    bool consumeInterrupt()
+    {
+        int n = interrupts.load(std::memory_order_acquire);
+        while (n > 0) {
+            if (interrupts.compare_exchange_weak(n, n - 1, std::memory_order_acq_rel)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void updatePeak()
+    {
+        size_t n = size();
+        size_t p = peak.load(std::memory_order_relaxed);
+        while (n > p && !peak.compare_exchange_weak(p, n, std::memory_order_relaxed)) {
+        }
+    }
+
+    // 先按策略在不持锁的情况下自旋，自旋失败才登记为等待者并在条件变量上休眠
+    template <typename Ready, typename Attempt>
+    void waitAndRetry(WaitPolicyT& policy, std::atomic<int>& waiting, std::condition_variable& cv,
+        Ready ready, Attempt attempt)
+    {
+        auto start = std::chrono::steady_clock::now();
+        while (true) {
+            bool spunReady = WaitPolicyT::kSpins && policy.spin(ready);
+            if (spunReady) {
+                if (attempt()) {
+                    policy.countSpun();
+                    policy.addWaitTime(start);
+                    return;
+                }
+                continue;
+            }
+            {
+                std::unique_lock<std::mutex> lock(parkMtx);
+                waiting.fetch_add(1);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                cv.wait(lock, ready);
+                waiting.fetch_sub(1);
+            }
+            policy.countParked();
+            if (attempt()) {
+                policy.addWaitTime(start);
+                return;
+            }
+        }
+    }
+
+    bool full()
+    {
+        Ring* r = ring.load(std::memory_order_acquire);
+        size_t pos = enqueuePos.load(std::memory_order_acquire);
+        size_t seq = r->cells[pos & r->mask].sequence.load(std::memory_order_acquire);
+        return (intptr_t)seq - (intptr_t)pos < 0;
+    }
+
+    // 只有存在等待者时才加锁通知，避免无竞争时的futex调用
+    void notifyConsumer()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (consumersWaiting.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(parkMtx);
+            cv_consumer.notify_one();
+        }
+    }
+
+    void notifyProducer()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (producersWaiting.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(parkMtx);
+            cv_producer.notify_one();
+        }
+    }
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        Task task;
+    };
+
+    struct Ring {
+        explicit Ring(size_t size)
+            : mask(size - 1)
+            , cells(new Cell[size])
+        {
+            for (size_t i = 0; i < size; ++i) {
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+        size_t mask;
+        std::unique_ptr<Cell[]> cells;
+    };
+
+    // 用填充把两端的位置计数器分到不同的缓存行，避免生产者和消费者互相伪共享
+    static const size_t kCacheLine = 64;
+
+    std::atomic<Ring*> ring;
+    std::vector<std::unique_ptr<Ring>> rings; // 所有分配过的环，析构时释放
+    int boundNode = -1;
+    char pad0[kCacheLine];
+    std::atomic<size_t> enqueuePos;
+    char pad1[kCacheLine - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> dequeuePos;
+    char pad2[kCacheLine - sizeof(std::atomic<size_t>)];
+    std::atomic<int> producersWaiting { 0 };
+    std::atomic<int> consumersWaiting { 0 };
+    std::atomic<size_t> peak { 0 };
+    std::atomic<bool> closed { false };
+    std::atomic<int> interrupts { 0 };
+    std::mutex parkMtx;
+    std::condition_variable cv_producer, cv_consumer;
+    WaitPolicyT consumerWait, producerWait;
+};
+
+using LockFreeTaskQueue = BasicLockFreeTaskQueue<>;
+
+// submit()的共享状态：一次分配一批并放入全局空闲链表循环使用，每次submit不需要堆分配
+// 不超过kInlineSize字节的结果直接存放在内部缓冲区中，更大的结果才在堆上分配
+class FutureState {
+public:
+    static const size_t kInlineSize = 64;
+
+    // 取得一个空闲的状态，引用计数为2（一个给TaskFuture，一个给执行的任务）
+    static FutureState* acquire()
+    {
+        FreeList& list = freeList();
+        std::lock_guard<std::mutex> lock(list.mtx);
+        if (!list.head) {
+            const size_t kBatch = 64;
+            list.chunks.emplace_back(new FutureState[kBatch]);
+            for (size_t i = 0; i < kBatch; ++i) {
+                list.chunks.back()[i].nextFree = list.head;
+                list.head = &list.chunks.back()[i];
+            }
+        }
+        FutureState* state = list.head;
+        list.head = state->nextFree;
+        state->refs.store(2, std::memory_order_relaxed);
+        return state;
+    }
+
+    // 释放一个引用，最后一个引用释放时销毁结果并放回空闲链表
+    void release()
+    {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+        if (destroy) {
+            destroy(value, value != &storage);
+            destroy = nullptr;
+        }
+        value = nullptr;
+        error = nullptr;
+        ready.store(false, std::memory_order_relaxed);
+        FreeList& list = freeList();
+        std::lock_guard<std::mutex> lock(list.mtx);
+        nextFree = list.head;
+        list.head = this;
+    }
+
+    template <typename R, typename V>
+    void setValue(V&& v)
+    {
+        setValue<R>(std::forward<V>(v), std::integral_constant<bool, (sizeof(R) <= kInlineSize && alignof(R) <= alignof(Storage))>());
+    }
+
+    void setError(std::exception_ptr e)
+    {
+        error = e;
+    }
+
+    // 结果（或异常）就绪，唤醒等待者
+    void complete()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        ready.store(true, std::memory_order_release);
+        cv.notify_all();
+    }
+
+    bool isReady() const
+    {
+        return ready.load(std::memory_order_acquire);
+    }
+
+    void wait()
+    {
+        if (isReady())
+            return;
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [this] { return isReady(); });
+    }
+
+    template <typename Rep, typename Period>
+    bool waitFor(const std::chrono::duration<Rep, Period>& timeout)
+    {
+        if (isReady())
+            return true;
+        std::unique_lock<std::mutex> lock(mtx);
+        return cv.wait_for(lock, timeout, [this] { return isReady(); });
+    }
+
+    // 就绪后调用：有异常时重新抛出
+    void rethrowIfError()
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    template <typename R>
+    R& valueRef()
+    {
+        return *static_cast<R*>(value);
+    }
+
+private:
+    using Storage = std::aligned_storage<kInlineSize, alignof(std::max_align_t)>::type;
+
+    struct FreeList {
+        std::mutex mtx;
+        FutureState* head = nullptr;
+        std::vector<std::unique_ptr<FutureState[]>> chunks;
+    };
+
+    // 进程内所有结果类型共用；有意不析构，避免静态对象析构顺序问题
+    static FreeList& freeList()
+    {
+        static FreeList* list = new FreeList;
+        return *list;
+    }
+
+    template <typename R>
+    static void destroyValue(void* p, bool heap)
+    {
+        if (heap) {
+            delete static_cast<R*>(p);
+        } else {
+            static_cast<R*>(p)->~R();
+        }
+    }
+
+    template <typename R, typename V>
+    void setValue(V&& v, std::true_type)
+    {
+        value = new (&storage) R(std::forward<V>(v));
+        destroy = &destroyValue<R>;
+    }
+
+    template <typename R, typename V>
+    void setValue(V&& v, std::false_type)
+    {
+        value = new R(std::forward<V>(v));
+        destroy = &destroyValue<R>;
+    }
+
+    Storage storage;
+    void* value = nullptr;
+    void (*destroy)(void*, bool) = nullptr;
+    std::exception_ptr error;
+    std::atomic<int> refs { 0 };
+    std::atomic<bool> ready { false };
+    std::mutex mtx;
+    std::condition_variable cv;
+    FutureState* nextFree = nullptr;
+};
+
+// submit()返回的结果句柄，只可移动；接口与std::future相近
+template <typename R>
+class TaskFuture {
+    static_assert(!std::is_reference<R>::value, "TaskFuture不支持引用类型的结果");
+
+public:
+    TaskFuture() = default;
+
+    explicit TaskFuture(FutureState* state)
+        : state(state)
+    {
+    }
+
+    TaskFuture(TaskFuture&& other) noexcept
+        : state(other.state)
+    {
+        other.state = nullptr;
+    }
+
+    TaskFuture& operator=(TaskFuture&& other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            state = other.state;
+            other.state = nullptr;
+        }
+        return *this;
+    }
+
+    TaskFuture(const TaskFuture&) = delete;
+    TaskFuture& operator=(const TaskFuture&) = delete;
+
+    ~TaskFuture()
+    {
+        reset();
+    }
+
+    bool valid() const
+    {
+        return state != nullptr;
+    }
+
+    bool ready() const
+    {
+        return state->isReady();
+    }
+
+    void wait() const
+    {
+        state->wait();
+    }
+
+    template <typename Rep, typename Period>
+    bool waitFor(const std::chrono::duration<Rep, Period>& timeout) const
+    {
+        return state->waitFor(timeout);
+    }
+
+    // 等待并取出结果，任务抛出的异常在这里重新抛出；调用后valid()为false
+    R get()
+    {
+        FutureState* s = state;
+        state = nullptr;
+        s->wait();
+        Releaser releaser { s };
+        s->rethrowIfError();
+        return take(s, std::is_void<R>());
+    }
+
+private:
+    struct Releaser {
+        FutureState* s;
+        ~Releaser() { s->release(); }
+    };
+
+    static R take(FutureState* s, std::false_type)
+    {
+        return std::move(s->valueRef<R>());
+    }
+
+    static void take(FutureState*, std::true_type)
+    {
+    }
+
+    void reset()
+    {
+        if (state) {
+            state->release();
+            state = nullptr;
+        }
+    }
+
+    FutureState* state = nullptr;
+};
+
+// f(args...)的返回类型；std::result_of在C++20中已移除
+template <typename F, typename... Args>
+using InvokeResult = decltype(std::declval<F>()(std::declval<Args>()...));
+
+// C++11没有std::index_sequence，用于展开submit的参数
+template <size_t... I>
+struct IndexSequence {
+};
+
+template <size_t N, size_t... I>
+struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, I...> {
+};
+
+template <size_t... I>
+struct MakeIndexSequence<0, I...> {
+    using type = IndexSequence<I...>;
+};
+
+// submit()放入队列的任务：携带函数、参数和共享状态
+// 任务没有执行就被销毁（线程池已停止）时，结果被设置为异常
+template <typename R, typename F, typename... Args>
+class SubmittedTask {
+public:
+    template <typename G, typename... A>
+    SubmittedTask(FutureState* state, G&& f, A&&... args)
+        : state(state)
+        , f(std::forward<G>(f))
+        , args(std::forward<A>(args)...)
+    {
+    }
+
+    SubmittedTask(SubmittedTask&& other) noexcept
+        : state(other.state)
+        , f(std::move(other.f))
+        , args(std::move(other.args))
+    {
+        other.state = nullptr;
+    }
+
+    SubmittedTask(const SubmittedTask&) = delete;
+
+    ~SubmittedTask()
+    {
+        if (state) {
+            state->setError(std::make_exception_ptr(std::runtime_error("task dropped before it ran")));
+            finish();
+        }
+    }
+
+    void operator()()
+    {
+        try {
+            run(typename MakeIndexSequence<sizeof...(Args)>::type(), std::is_void<R>());
+        } catch (...) {
+            state->setError(std::current_exception());
+        }
+        finish();
+    }
+
+private:
+    template <size_t... I>
+    void run(IndexSequence<I...>, std::false_type)
+    {
+        state->setValue<R>(f(std::move(std::get<I>(args))...));
+    }
+
+    template <size_t... I>
+    void run(IndexSequence<I...>, std::true_type)
+    {
+        f(std::move(std::get<I>(args))...);
+    }
+
+    void finish()
+    {
+        FutureState* s = state;
+        state = nullptr;
+        s->complete();
+        s->release();
+    }
+
+    FutureState* state;
+    F f;
+    std::tuple<Args...> args;
+};
+
+// 支持bindToNode的队列（无锁队列）迁移存储，其他队列依靠首次访问时的分配，不做处理
+template <typename TaskQueueT>
+auto bindQueueToNode(TaskQueueT& queue, int node, int) -> decltype(queue.bindToNode(node), void())
+{
+    queue.bindToNode(node);
+}
+
+template <typename TaskQueueT>
+void bindQueueToNode(TaskQueueT&, int, long)
+{
+}
+
+// 支持FullPolicy的队列（BoundedTaskQueue）设置丢弃回调，其他队列从不丢弃任务
+template <typename TaskQueueT>
+auto setQueueDropHandler(TaskQueueT& queue, std::function<void(uint32_t)> handler, int)
+    -> decltype(queue.setDropHandler(std::move(handler)), void())
+{
+    queue.setDropHandler(std::move(handler));
+}
+
+template <typename TaskQueueT>
+void setQueueDropHandler(TaskQueueT&, std::function<void(uint32_t)>, long)
+{
+}
+
+// 执行器的未完成任务计数，ThreadPoolEx、WorkStealingThreadPoolEx、CurrentThreadEx和SharedExecutorEx各持有一个，
+// 执行器只负责把任务放进自己的队列，入队前按任务的种类调用pushed/pushedChunk/retain，任务完成时调用finish
+// - 计数模式：set/add给出本批的任务数；上一批完成（wait返回）后可以直接为下一批计数，工作线程和队列保留
+// - 流式模式：open持有一个“未关闭”令牌（与上一批尚未完成的计数累加，例如跨进程时上游看不到下游何时排空），
+//   之后每个任务入队时加一，close时由执行器finish释放令牌；计数器归零时在最后完成任务的线程上调用onDrained
+// - 代表indices个计数的任务（StageT::pushRange的一个块、阶段融合）计数模式下只算一个任务；
+//   挂起中的协程和拆分出的任务用retain额外占一个计数，执行器不会在它们完成前排空
+class TaskCount {
+public:
+    TaskCount() = default;
+
+    // 只等待了尾部阶段时，本阶段可能在onDrained返回之后、通知wait之前被析构
+    ~TaskCount()
+    {
+        while (finishing_.load() > 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    void set(int n)
+    {
+        streaming_ = false;
+        counter_ = n;
+    }
+
+    void add(int n)
+    {
+        streaming_ = false;
+        counter_ += n;
+    }
+
+    void open()
+    {
+        streaming_ = true;
+        counter_ += 1;
+    }
+
+    bool streaming() const
+    {
+        return streaming_;
+    }
+
+    // 入队n个普通任务之前调用
+    void pushed(int n = 1)
+    {
+        if (streaming_)
+            counter_ += n;
+    }
+
+    // 入队或直接执行代表indices个计数的任务之前调用
+    void pushedChunk(int indices)
+    {
+        counter_ += streaming_ ? 1 : 1 - indices;
+    }
+
+    // indices同时是任务的weight()，为0（例如协程的恢复任务、parallelFor的块）时FullPolicy不会丢弃它
+    void pushedChunk(Task& task, int indices)
+    {
+        task.setWeight(indices > 0 ? indices : 0);
+        pushedChunk(indices);
+    }
+
+    void retain()
+    {
+        ++counter_;
+    }
+
+    // 撤销retain，只用于还没有入队的任务（例如tryFork时队列已满）
+    void unretain()
+    {
+        --counter_;
+    }
+
+    void setOnDrained(std::function<void()> callback)
+    {
+        onDrained_ = std::move(callback);
+    }
+
+    // 一个任务完成，返回减之前的计数；归零时在锁内调用onZero并通知wait
+    // 不会归零的递减用CAS无锁完成；可能归零的那一次在锁内递减：wait在锁内检查计数器，
+    // 看到0并析构执行器时，这里已经解锁，之后只访问局部变量
+    // 流式模式排空时先在锁外调用onDrained（关闭下游），再调用onZero并通知：wait返回时下游已经收到close，
+    // 例如ShmSender已经把close写进通道，调用者随后关闭通道不会丢掉它；finishing_让析构等到这里返回
+    template <typename OnZero>
+    int finish(OnZero onZero)
+    {
+        int n = counter_.load();
+        while (n > 1) {
+            if (counter_.compare_exchange_weak(n, n - 1))
+                return n;
+        }
+        std::function<void()> drained;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            n = counter_.fetch_sub(1);
+            if (n == 1) {
+                drained = std::move(onDrained_);
+                draining_ = (bool)drained;
+                if (draining_) {
+                    finishing_.fetch_add(1);
+                } else {
+                    onZero();
+                    cv_.notify_all();
+                }
+            }
+        }
+        if (drained) {
+            drained();
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                draining_ = false;
+                onZero();
+                cv_.notify_all();
+            }
+            finishing_.fetch_sub(1);
+        }
+        return n;
+    }
+
+    int finish()
+    {
+        return finish([] {});
+    }
+
+    void wait()
+    {
+        waitAtMost(0);
+    }
+
+    // 等待计数降到level，用于流式模式下等待空闲（只剩“未关闭”令牌）
+    void waitAtMost(int level)
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cv_.wait(lock, [&] { return counter_.load() <= level && !draining_; });
+    }
+
+    // 唤醒waitAtMost，计数未归零时由调用者判断需要唤醒
+    void notifyAll()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        cv_.notify_all();
+    }
+
+    // 在锁内检查：返回true时最后一个完成者已经解锁，调用者可以析构执行器
+    bool drained() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return counter_.load() == 0 && !draining_;
+    }
+
+    // 与最后完成任务的线程同步，它可能仍持有锁
+    void sync() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+    }
+
+private:
+    std::atomic<int> counter_ { 0 };
+    std::atomic<bool> streaming_ { false };
+    mutable std::mutex mtx_;
+    std::condition_variable cv_;
+    std::function<void()> onDrained_; // 流式模式排空后的回调，由close设置
+    bool draining_ = false; // 正在调用onDrained，受mtx_保护
+    std::atomic<int> finishing_ { 0 }; // onDrained返回后还要访问本对象的finish调用数
+};
+
+// 范围任务的拆分方式
+enum class RangeSplit {
+    Flat, // 推送时切成固定大小的块
+    Recursive, // 整个范围作为一个任务，执行时不断对半拆分，适合工作窃取线程池
+};
+
+// 线程池
+
+template <typename TaskQueueT>
+class ThreadPool {
+public:
+    ThreadPool(size_t numThreads, TaskQueueT& _taskQueue, TaskCount& count)
+        : taskQueue(_taskQueue)
+        , stop(false)
+        , active(0)
+        , placement(Placement::none())
+        , node(-1)
+        , count(count)
+    {
+        for (size_t i = 0; i < numThreads; ++i) {
+            addThread();
+        }
+    }
+    ~ThreadPool()
+    {
+        stopAll();
+        for (auto& worker : workers) {
+            if (worker.joinable()) {
+                worker.join();
+            }
+        }
+    }
+
+    // 弹性模式：运行时增加一个工作线程
+    void addThread()
+    {
+        std::lock_guard<std::mutex> lock(workersMtx);
+        reapExited();
+        active.fetch_add(1);
+        workers.emplace_back([this] { workerLoop(); });
+        place(workers.back());
+    }
+
+    // 设置工作线程的放置方式：立即作用于现有线程，之后addThread新建的线程也按此放置
+    void setPlacement(const Placement& p)
+    {
+        std::lock_guard<std::mutex> lock(workersMtx);
+        reapExited();
+        placement = p;
+        placed = 0;
+        node = -1;
+        for (auto& worker : workers) {
+            place(worker);
+        }
+    }
+
+    // 第一个被放置的工作线程所在的NUMA节点，未放置时为-1
+    int numaNode() const
+    {
+        return node.load();
+    }
+
+    // 弹性模式：运行时减少一个工作线程，至少保留一个
+    // 由一个空闲（或下一个遇到空队列）的工作线程退出，不打断正在执行的任务
+    bool removeThread()
+    {
+        std::lock_guard<std::mutex> lock(workersMtx);
+        reapExited();
+        if (stop || active.load() <= 1)
+            return false;
+        active.fetch_sub(1);
+        taskQueue.interruptConsumer();
+        return true;
+    }
+
+    size_t threadCount() const
+    {
+        return active.load();
+    }
+
+    // 关闭队列唤醒所有阻塞在popTask中的工作线程，不再需要发送空任务
+    void stopAll()
+    {
+        if (!stop.exchange(true)) {
+            taskQueue.close();
+        }
+    }
+
+    // close()可能在上游阶段的线程上调用，递减之后本对象随时可能被析构，不能再访问成员
+    // 计数器归零时工作线程不退出，继续在空队列上等待下一批任务
+    void taskFinished()
+    {
+        count.finish();
+    }
+
+    // 执行一个任务并计数，由工作线程和parallelFor的调用线程使用
+    // 它们执行期间本对象一定存在，所以可以在递减之后检查waitIdle的等待者
+    void runTask(Task& task)
+    {
+        task(); // 执行任务
+        task = nullptr;
+        if (count.finish() == 2 && idleWaiters.load() > 0) {
+            // 流式模式下计数器只剩“未关闭”令牌，说明已空闲
+            count.notifyAll();
+        }
+    }
+
+    // 等待未完成任务数降到level以下，不停止工作线程
+    void waitIdle(int level)
+    {
+        idleWaiters.fetch_add(1); // 先登记：runTask递减后看到登记才会唤醒
+        count.waitAtMost(level);
+        idleWaiters.fetch_sub(1);
+    }
+
+private:
+    void workerLoop()
+    {
+        while (true) {
+            Task task;
+            {
+                TraceSpan idle(TraceKind::Idle, 0);
+                task = taskQueue.popTask();
+            }
+            if (!task) {
+                if (stop) // 队列已关闭
+                    break;
+                // 被removeThread中断，本线程退出，由之后的addThread/removeThread回收
+                std::lock_guard<std::mutex> lock(workersMtx);
+                exited.push_back(std::this_thread::get_id());
+                break;
+            }
+            if (stop)
+                break;
+            runTask(task);
+        }
+    }
+
+    // 持有workersMtx时调用，按当前放置方式绑定一个工作线程
+    void place(std::thread& worker)
+    {
+        std::vector<int> cpus = placement.assign(placed++);
+        if (!pinThread(worker, cpus))
+            return;
+        if (node.load() < 0)
+            node = CpuTopology::instance().nodeOf(cpus.front());
+    }
+
+    // 持有workersMtx时调用，join已经退出的工作线程
+    void reapExited()
+    {
+        for (auto id : exited) {
+            for (auto it = workers.begin(); it != workers.end(); ++it) {
+                if (it->get_id() == id) {
+                    it->join();
+                    workers.erase(it);
+                    break;
+                }
+            }
+        }
+        exited.clear();
+    }
+
+    std::vector<std::thread> workers;
+    std::vector<std::thread::id> exited; // 已被removeThread退出、尚未join的线程
+    std::mutex workersMtx;
+    TaskQueueT& taskQueue;
+    std::atomic<bool> stop;
+    std::atomic<size_t> active; // 不包括已被要求退出的线程
+    Placement placement;
+    size_t placed = 0; // 已放置的线程数，作为Placement::assign的序号
+    std::atomic<int> node;
+    std::atomic<int> idleWaiters { 0 }; // 正在waitIdle的线程数，只有大于0时runTask才加锁通知
+    TaskCount& count; // 属于ThreadPoolEx
+};
+
+template <typename TaskQueueT>
+class ThreadPoolEx {
+public:
+    using ThreadPoolPtr = std::shared_ptr<ThreadPool<TaskQueueT>>;
+
+    TaskQueueT taskQueue;
+    ThreadPoolEx(size_t numThreads)
+    {
+        threadPool = std::make_shared<ThreadPool<TaskQueueT>>(numThreads, taskQueue, count);
+        setQueueDropHandler(taskQueue, [this](uint32_t) { release(); }, 0); // 被FullPolicy丢弃的任务计为已完成
+    }
+
+    ~ThreadPoolEx()
+    {
+        while (inlineRuns.load() > 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    size_t threadCount() const
+    {
+        return threadPool->threadCount();
+    }
+
+    bool addThread()
+    {
+        threadPool->addThread();
+        return true;
+    }
+
+    bool removeThread()
+    {
+        return threadPool->removeThread();
+    }
+
+    // 放置工作线程，并把队列存储迁移到工作线程（消费者）所在的节点
+    void setPlacement(const Placement& p)
+    {
+        threadPool->setPlacement(p);
+        if (threadPool->numaNode() >= 0)
+            bindQueueToNode(taskQueue, threadPool->numaNode(), 0);
+    }
+
+    int numaNode() const
+    {
+        return threadPool->numaNode();
+    }
+
+    // 计数方式见TaskCount
+    void setTaskCount(int n)
+    {
+        count.set(n);
+    }
+
+    void addTaskCount(int n)
+    {
+        count.add(n);
+    }
+
+    void openStream()
+    {
+        count.open();
+    }
+
+    void close(std::function<void()> onDrained = nullptr)
+    {
+        count.setOnDrained(std::move(onDrained));
+        threadPool->taskFinished();
+    }
+
+    void pushTask(Task task)
+    {
+        count.pushed();
+        taskQueue.pushTask(std::move(task));
+    }
+
+    // 按优先级添加任务，TaskQueueT需要是优先级队列（PriorityTaskQueue/BoundedPriorityTaskQueue）
+    void pushTask(Task task, int priority)
+    {
+        count.pushed();
+        taskQueue.pushTask(std::move(task), priority);
+    }
+
+    // 放入代表indices个计数的任务（StageT::pushRange的一个块）
+    void pushChunk(Task task, int indices)
+    {
+        count.pushedChunk(task, indices);
+        taskQueue.pushTask(std::move(task));
+    }
+
+    // 在执行中的任务里拆分出一个新任务，队列满时返回false且不移走task，由调用者自己继续执行
+    bool tryFork(Task& task)
+    {
+        count.retain(); // 先计数：新任务可能在本任务完成前就完成
+        if (taskQueue.tryPushTask(task))
+            return true;
+        count.unretain();
+        return false;
+    }
+
+    // 在调用线程上执行f，计数方式与放入代表indices个计数的任务并执行完相同（用于阶段融合）
+    // 在上游线程上执行：下游可能在taskFinished返回前就完成，析构函数要等inlineRuns归零
+    template <typename F>
+    bool runInline(F f, int indices)
+    {
+        ++inlineRuns;
+        count.pushedChunk(indices);
+        f();
+        threadPool->taskFinished();
+        --inlineRuns;
+        return true;
+    }
+
+    // 协程阶段：挂起中的协程占一个计数，release必须在本执行器的线程上调用
+    void retain()
+    {
+        count.retain();
+    }
+
+    void release()
+    {
+        threadPool->taskFinished();
+    }
+
+    template <typename InputIt>
+    void pushTasks(InputIt first, InputIt last)
+    {
+        count.pushed((int)std::distance(first, last));
+        taskQueue.pushTasks(first, last);
+    }
+
+    void wait()
+    {
+        count.wait();
+    }
+
+    // 作为长期存在的通用线程池使用：提交f(args...)并返回结果句柄
+    // 第一次submit时自动进入流式模式，线程池不会因为任务完成而停止；不能与setTaskCount混用
+    template <typename F, typename... Args>
+    TaskFuture<InvokeResult<F, Args...>> submit(F&& f, Args&&... args)
+    {
+        using R = InvokeResult<F, Args...>;
+        using Fn = SubmittedTask<R, typename std::decay<F>::type, typename std::decay<Args>::type...>;
+        ensureStreaming();
+        FutureState* state = FutureState::acquire();
+        pushTask(Fn(state, std::forward<F>(f), std::forward<Args>(args)...));
+        return TaskFuture<R>(state);
+    }
+
+    // 等待已提交的任务全部完成，工作线程保持运行，之后可以继续submit/pushTask
+    void waitIdle()
+    {
+        threadPool->waitIdle(count.streaming() ? 1 : 0);
+    }
+
+    // 对[begin, end)中的每个i执行func(i)，按grain个索引一块（0表示按线程数自动选择）
+    // 调用线程先从队列中取任务执行，返回时全部完成；与submit一样进入流式模式，线程池之后仍可使用
+    // 不要在本池的工作线程中调用：有界队列满时所有工作线程可能都阻塞在推送上
+    template <typename F>
+    void parallelFor(int begin, int end, int grain, F func, RangeSplit split = RangeSplit::Flat)
+    {
+        if (end <= begin)
+            return;
+        ensureStreaming();
+        if (grain <= 0) {
+            grain = std::max(1, (end - begin) / (int)(4 * threadCount()));
+        }
+        RangeJob<F> job(func, end - begin, grain, split == RangeSplit::Recursive);
+        if (job.recursive) {
+            pushTask(RangeChunk<F>::make(this, &job, begin, end));
+        } else {
+            for (int b = begin; b < end;) {
+                int e = end - b > grain ? b + grain : end;
+                pushTask(RangeChunk<F>::make(this, &job, b, e));
+                b = e;
+            }
+        }
+        std::unique_lock<std::mutex> lock(job.mtx);
+        while (!job.done) {
+            lock.unlock();
+            Task task;
+            if (taskQueue.tryPopTask(task)) {
+                threadPool->runTask(task);
+                lock.lock();
+                continue;
+            }
+            lock.lock();
+            job.cv.wait(lock, [&] { return job.done; });
+        }
+    }
+private:
+    template <typename F>
+    struct RangeJob {
+        RangeJob(F& func, int count, int grain, bool recursive)
+            : func(func)
+            , remaining(count)
+            , grain(grain)
+            , recursive(recursive)
+        {
+        }
+
+        // 最后完成的块在锁内通知：解锁后parallelFor可能立刻返回并销毁本对象
+        void finished(int n)
+        {
+            if (remaining.fetch_sub(n) != n)
+                return;
+            std::lock_guard<std::mutex> lock(mtx);
+            done = true;
+            cv.notify_all();
+        }
+
+        F& func;
+        std::atomic<int> remaining; // 尚未执行的索引数
+        int grain;
+        bool recursive;
+        bool done = false;
+        std::mutex mtx;
+        std::condition_variable cv;
+    };
+
+    template <typename F>
+    struct RangeChunk {
+        ThreadPoolEx* pool;
+        RangeJob<F>* job;
+        int begin, end;
+
+        // parallelFor的调用者在等待每个块完成，块的weight()为0，FullPolicy不会丢弃它
+        static Task make(ThreadPoolEx* pool, RangeJob<F>* job, int begin, int end)
+        {
+            Task task(RangeChunk { pool, job, begin, end });
+            task.setWeight(0);
+            return task;
+        }
+
+        void operator()()
+        {
+            while (job->recursive && end - begin > job->grain) {
+                int mid = begin + (end - begin) / 2;
+                Task half = make(pool, job, mid, end);
+                if (!pool->tryFork(half))
+                    break; // 队列已满，剩下的部分由本线程执行
+                end = mid;
+            }
+            for (int i = begin; i < end; ++i) {
+                job->func(i);
+            }
+            job->finished(end - begin);
+        }
+    };
+
+    void ensureStreaming()
+    {
+        std::call_once(serviceOnce, [this] {
+            if (!count.streaming())
+                openStream();
+        });
+    }
+
+    // threadPool必须最后声明，保证析构时先join工作线程
+    TaskCount count;
+    std::once_flag serviceOnce;
+    std::atomic<int> inlineRuns { 0 }; // 正在其他阶段线程上融合执行的任务数
+    ThreadPoolPtr threadPool;
+};
+
+// Chase-Lev工作窃取双端队列（Lê et al. 2013的C++11内存模型版本）
+// 只有所属线程可以在底部push/pop，其他线程只能从顶部steal
+// 元素以指针存储，使得steal时对槽位的读取是原子的
+template <typename T>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(size_t capacity = 64)
+        : top(0)
+        , bottom(0)
+    {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        arrays.emplace_back(new Array(size));
+        array.store(arrays.back().get(), std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // 仅所属线程调用
+    void push(T* item)
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Array* a = array.load(std::memory_order_relaxed);
+        if (b - t > (int64_t)a->mask) {
+            a = grow(a, t, b);
+        }
+        a->put(b, item);
+        bottom.store(b + 1, std::memory_order_release);
+    }
+
+    // 仅所属线程调用，队列为空时返回nullptr
+    T* pop()
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Array* a = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        T* item = nullptr;
+        if (t <= b) {
+            item = a->get(b);
+            if (t == b) {
+                // 最后一个元素，和窃取者竞争
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    item = nullptr;
+                }
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+        } else {
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // 任意线程调用，队列为空或竞争失败时返回nullptr
+    T* steal()
+    {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t < b) {
+            Array* a = array.load(std::memory_order_acquire);
+            T* item = a->get(t);
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                return nullptr;
+            }
+            return item;
+        }
+        return nullptr;
+    }
+
+    bool empty() const
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_relaxed);
+        return b <= t;
+    }
+
+private:
+    struct Array {
+        explicit Array(size_t size)
+            : mask(size - 1)
+            , slots(new std::atomic<T*>[size])
+        {
+        }
+        T* get(int64_t i) const
+        {
+            return slots[i & mask].load(std::memory_order_relaxed);
+        }
+        void put(int64_t i, T* item)
+        {
+            slots[i & mask].store(item, std::memory_order_relaxed);
+        }
+        size_t mask;
+        std::unique_ptr<std::atomic<T*>[]> slots;
+    };
+
+    // 扩容时旧数组保留到析构，因为窃取者可能仍在读取
+    Array* grow(Array* old, int64_t t, int64_t b)
+    {
+        Array* a = new Array((old->mask + 1) * 2);
+        for (int64_t i = t; i < b; ++i) {
+            a->put(i, old->get(i));
+        }
+        arrays.emplace_back(a);
+        array.store(a, std::memory_order_release);
+        return a;
+    }
+
+    std::atomic<int64_t> top;
+    std::atomic<int64_t> bottom;
+    std::atomic<Array*> array;
+    std::vector<std::unique_ptr<Array>> arrays;
+};
+
+// 工作窃取线程池：每个工作线程拥有一个Chase-Lev双端队列
+// 工作线程内部提交的任务进入本地队列，外部提交的任务进入共享的taskQueue
+// 本地队列为空时先随机窃取其他线程的任务，再从taskQueue取任务
+template <typename TaskQueueT>
+class WorkStealingThreadPool {
+public:
+    WorkStealingThreadPool(size_t numThreads, TaskQueueT& _taskQueue, TaskCount& count)
+        : taskQueue(_taskQueue)
+        , stop(false)
+        , sleepers(0)
+        , pushing(0)
+        , count(count)
+    {
+        for (size_t i = 0; i < numThreads; ++i) {
+            deques.emplace_back(new WorkStealingDeque<Task>());
+            spares.emplace_back(new SpareNodes());
+            spares.back()->nodes.reserve(kMaxSpare);
+        }
+        for (size_t i = 0; i < numThreads; ++i) {
+            workers.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+    ~WorkStealingThreadPool()
+    {
+        stopAll();
+        for (auto& worker : workers) {
+            if (worker.joinable()) {
+                worker.join();
+            }
+        }
+        while (pushing.load() > 0) {
+            std::this_thread::yield();
+        }
+        // 停止时还在队列中的任务不再执行，与FullPolicy丢弃的任务一样计为已完成
+        for (auto& deque : deques) {
+            while (Task* item = deque->pop()) {
+                delete item;
+                taskFinished();
+            }
+        }
+        Task task;
+        while (taskQueue.tryPopTask(task)) {
+            task = nullptr;
+            taskFinished();
+        }
+        for (auto& spare : spares) {
+            for (Task* node : spare->nodes) {
+                delete node;
+            }
+        }
+    }
+
+    // 在本池的工作线程中调用时放入本地队列，否则放入共享队列
+    void pushTask(Task task)
+    {
+        // 任务入队后可能立刻被执行完并触发析构，计数保证析构等到wakeOne返回
+        pushing.fetch_add(1);
+        WorkerContext& ctx = currentWorker();
+        if (ctx.pool == this) {
+            deques[ctx.index]->push(makeNode(ctx.index, std::move(task)));
+        } else {
+            taskQueue.pushTask(std::move(task));
+        }
+        wakeOne();
+        pushing.fetch_sub(1);
+    }
+
+    template <typename InputIt>
+    void pushTasks(InputIt first, InputIt last)
+    {
+        pushing.fetch_add(1);
+        WorkerContext& ctx = currentWorker();
+        if (ctx.pool == this) {
+            size_t n = 0;
+            for (; first != last; ++first, ++n) {
+                deques[ctx.index]->push(makeNode(ctx.index, std::move(*first)));
+            }
+            wakeMany(n);
+        } else {
+            // 共享队列可能是有界的，整批放入会在队列满时阻塞而工作线程仍在休眠，
+            // 所以逐个放入并唤醒
+            for (; first != last; ++first) {
+                taskQueue.pushTask(std::move(*first));
+                wakeOne();
+            }
+        }
+        pushing.fetch_sub(1);
+    }
+
+    // 工作线程数固定，放置只在这里设置一次
+    void setPlacement(const Placement& p)
+    {
+        int first = -1;
+        for (size_t i = 0; i < workers.size(); ++i) {
+            std::vector<int> cpus = p.assign(i);
+            if (pinThread(workers[i], cpus) && first < 0)
+                first = CpuTopology::instance().nodeOf(cpus.front());
+        }
+        node = first;
+    }
+
+    int numaNode() const
+    {
+        return node.load();
+    }
+
+    void stopAll()
+    {
+        if (!stop.exchange(true)) {
+            taskQueue.close();
+            std::lock_guard<std::mutex> lock(sleepMtx);
+            sleepCV.notify_all();
+        }
+    }
+
+    // 计数器归零时工作线程保留到析构
+    void taskFinished()
+    {
+        count.finish();
+    }
+
+private:
+    struct WorkerContext {
+        WorkStealingThreadPool* pool;
+        size_t index;
+    };
+
+    static WorkerContext& currentWorker()
+    {
+        static thread_local WorkerContext ctx = { nullptr, 0 };
+        return ctx;
+    }
+
+    void workerLoop(size_t index)
+    {
+        WorkerContext& ctx = currentWorker();
+        ctx.pool = this;
+        ctx.index = index;
+        uint32_t seed = (uint32_t)index * 2654435761u + 1;
+        Task task;
+        while (!stop) {
+            if (findTask(index, seed, task)) {
+                task(); // 执行任务
+                task = nullptr;
+                taskFinished();
+                continue;
+            }
+            TraceSpan idle(TraceKind::Idle, 0);
+            std::unique_lock<std::mutex> lock(sleepMtx);
+            sleepers.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            sleepCV.wait(lock, [this] { return stop || hasWork(); });
+            sleepers.fetch_sub(1);
+        }
+    }
+
+    // 本地队列的节点：每个工作线程保留最多kMaxSpare个用过的节点，嵌套提交的任务不必每次分配内存
+    // 节点由取走任务的线程回收，可能是窃取它的另一个工作线程；每个列表只由它自己的工作线程访问
+    Task* makeNode(size_t index, Task&& task)
+    {
+        std::vector<Task*>& nodes = spares[index]->nodes;
+        if (nodes.empty())
+            return new Task(std::move(task));
+        Task* node = nodes.back();
+        nodes.pop_back();
+        *node = std::move(task);
+        return node;
+    }
+
+    void takeNode(size_t index, Task* node, Task& task)
+    {
+        task = std::move(*node);
+        std::vector<Task*>& nodes = spares[index]->nodes;
+        if (nodes.size() < kMaxSpare) {
+            nodes.push_back(node);
+        } else {
+            delete node;
+        }
+    }
+
+    bool findTask(size_t index, uint32_t& seed, Task& task)
+    {
+        if (Task* item = deques[index]->pop()) {
+            takeNode(index, item, task);
+            return true;
+        }
+        size_t n = deques.size();
+        for (size_t attempt = 0; n > 1 && attempt < 2 * n; ++attempt) {
+            // xorshift随机选择窃取对象
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            size_t victim = seed % n;
+            if (victim == index)
+                continue;
+            if (Task* item = deques[victim]->steal()) {
+                takeNode(index, item, task);
+                return true;
+            }
+        }
+        return taskQueue.tryPopTask(task);
+    }
+
+    bool hasWork()
+    {
+        for (auto& deque : deques) {
+            if (!deque->empty())
+                return true;
+        }
+        return !taskQueue.empty();
+    }
+
+    // 只有存在休眠线程时才加锁唤醒
+    void wakeOne()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(sleepMtx);
+            sleepCV.notify_one();
+        }
+    }
+
+    void wakeMany(size_t n)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (n > 0 && sleepers.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(sleepMtx);
+            if (n == 1) {
+                sleepCV.notify_one();
+            } else {
+                sleepCV.notify_all();
+            }
+        }
+    }
+
+private:
+    static const size_t kMaxSpare = 256;
+
+    // 各工作线程的空闲节点列表，填充避免相邻列表伪共享
+    struct SpareNodes {
+        std::vector<Task*> nodes;
+        char pad[64];
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkStealingDeque<Task>>> deques;
+    std::vector<std::unique_ptr<SpareNodes>> spares;
+    TaskQueueT& taskQueue;
+    std::atomic<bool> stop;
+    std::atomic<int> sleepers; // 正在休眠的工作线程数
+    std::atomic<int> pushing; // 正在执行pushTask的线程数
+    std::atomic<int> node { -1 };
+    std::mutex sleepMtx;
+    std::condition_variable sleepCV;
+    TaskCount& count; // 属于WorkStealingThreadPoolEx
+};
+
+template <typename TaskQueueT>
+class WorkStealingThreadPoolEx {
+public:
+    using ThreadPoolPtr = std::shared_ptr<WorkStealingThreadPool<TaskQueueT>>;
+
+    TaskQueueT taskQueue; // 外部提交任务的共享队列
+    WorkStealingThreadPoolEx(size_t numThreads)
+        : numThreads(numThreads)
+    {
+        threadPool = std::make_shared<WorkStealingThreadPool<TaskQueueT>>(numThreads, taskQueue, count);
+        setQueueDropHandler(taskQueue, [this](uint32_t) { release(); }, 0); // 被FullPolicy丢弃的任务计为已完成
+    }
+
+    ~WorkStealingThreadPoolEx()
+    {
+        while (inlineRuns.load() > 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    size_t threadCount() const
+    {
+        return numThreads;
+    }
+
+    // 每个工作线程拥有固定的本地队列，不支持弹性调整
+    bool addThread()
+    {
+        return false;
+    }
+
+    bool removeThread()
+    {
+        return false;
+    }
+
+    void setPlacement(const Placement& p)
+    {
+        threadPool->setPlacement(p);
+        if (threadPool->numaNode() >= 0)
+            bindQueueToNode(taskQueue, threadPool->numaNode(), 0);
+    }
+
+    int numaNode() const
+    {
+        return threadPool->numaNode();
+    }
+
+    // 计数方式见TaskCount
+    void setTaskCount(int n)
+    {
+        count.set(n);
+    }
+
+    void addTaskCount(int n)
+    {
+        count.add(n);
+    }
+
+    void openStream()
+    {
+        count.open();
+    }
+
+    void close(std::function<void()> onDrained = nullptr)
+    {
+        count.setOnDrained(std::move(onDrained));
+        threadPool->taskFinished();
+    }
+
+    void pushTask(Task task)
+    {
+        count.pushed();
+        threadPool->pushTask(std::move(task));
+    }
+
+    // 放入代表indices个计数的任务（StageT::pushRange的一个块）
+    void pushChunk(Task task, int indices)
+    {
+        count.pushedChunk(task, indices);
+        threadPool->pushTask(std::move(task));
+    }
+
+    // 工作线程上拆分出的任务放入本地双端队列，空闲的线程会把它窃取走
+    bool tryFork(Task& task)
+    {
+        count.retain();
+        threadPool->pushTask(std::move(task));
+        return true;
+    }
+
+    // 在调用线程上执行f，计数方式与放入代表indices个计数的任务并执行完相同（用于阶段融合）
+    // 在上游线程上执行：下游可能在taskFinished返回前就完成，析构函数要等inlineRuns归零
+    template <typename F>
+    bool runInline(F f, int indices)
+    {
+        ++inlineRuns;
+        count.pushedChunk(indices);
+        f();
+        threadPool->taskFinished();
+        --inlineRuns;
+        return true;
+    }
+
+    // 协程阶段：挂起中的协程占一个计数，release必须在本执行器的线程上调用
+    void retain()
+    {
+        count.retain();
+    }
+
+    void release()
+    {
+        threadPool->taskFinished();
+    }
+
+    template <typename InputIt>
+    void pushTasks(InputIt first, InputIt last)
+    {
+        count.pushed((int)std::distance(first, last));
+        threadPool->pushTasks(first, last);
+    }
+
+    void wait()
+    {
+        count.wait();
+    }
+
+private:
+    size_t numThreads;
+    // threadPool必须最后声明，保证析构时先join工作线程
+    TaskCount count;
+    std::atomic<int> inlineRuns { 0 }; // 正在其他阶段线程上融合执行的任务数
+    ThreadPoolPtr threadPool;
+};
+
+template <typename TaskQueueT>
+class CurrentThread {
+public:
+    CurrentThread(TaskQueueT& _taskQueue, TaskCount& count)
+        : taskQueue(_taskQueue)
+        , stop(false)
+        , count(count)
+    {
+    }
+
+    // 执行任务直到计数器归零，之后可以为下一批计数并再次调用run
+    // 计数器已经归零时立即返回：例如下一批在上一次run中已经执行完，队列里不会再有唤醒
+    void run()
+    {
+        if (drained())
+            return;
+        while (true) {
+            Task task = taskQueue.popTask();
+            if (stop)
+                break;
+            if (!task) {
+                // 被taskFinished唤醒，或者是之前某一批留下的唤醒，只有计数器归零时才返回
+                if (drained() || taskQueue.isClosed())
+                    break;
+                continue;
+            }
+            task(); // 执行任务
+            taskFinished();
+        }
+    }
+
+    // 不阻塞：执行已入队的任务，最多maxTasks个，队列空时立即返回；返回执行的任务数
+    size_t runAvailable(size_t maxTasks)
+    {
+        size_t n = 0;
+        while (n < maxTasks && runOne()) {
+            ++n;
+        }
+        return n;
+    }
+
+    // 不阻塞：执行已入队的任务直到用完budget或队列为空；每个任务执行完才检查时间，
+    // 所以至少执行一个任务（如果有），超出budget的部分不超过一个任务的耗时
+    size_t runFor(std::chrono::microseconds budget)
+    {
+        auto deadline = std::chrono::steady_clock::now() + budget;
+        size_t n = 0;
+        while (runOne()) {
+            ++n;
+            if (std::chrono::steady_clock::now() >= deadline)
+                break;
+        }
+        return n;
+    }
+
+    ~CurrentThread()
+    {
+        stopAll();
+    }
+
+    void stopAll()
+    {
+        if (!stop.exchange(true)) {
+            taskQueue.close();
+        }
+    }
+
+    void taskFinished()
+    {
+        count.finish([&] {
+            taskQueue.interruptConsumer(); // 让run返回，队列保持打开供下一批使用
+        });
+    }
+
+    bool drained() const
+    {
+        return count.drained();
+    }
+
+private:
+    bool runOne()
+    {
+        if (stop)
+            return false;
+        Task task;
+        if (!taskQueue.tryPopTask(task))
+            return false;
+        task();
+        taskFinished();
+        return true;
+    }
+
+    // std::vector<std::thread> workers;
+    TaskQueueT& taskQueue;
+    std::atomic<bool> stop;
+    TaskCount& count; // 属于CurrentThreadEx
+};
+
+template <typename TaskQueueT>
+class CurrentThreadEx {
+public:
+    using CurrentThreadPtr = std::shared_ptr<CurrentThread<TaskQueueT>>;
+
+    TaskQueueT taskQueue;
+    CurrentThreadEx(int) // 为了保证调用方式和ThreadPoolEx一致，这里并没有意义
+    {
+        currentThread = std::make_shared<CurrentThread<TaskQueueT>>(taskQueue, count);
+        setQueueDropHandler(taskQueue, [this](uint32_t) { release(); }, 0); // 被FullPolicy丢弃的任务计为已完成
+    }
+
+    ~CurrentThreadEx()
+    {
+        while (pushing.load() > 0) {
+            std::this_thread::yield();
+        }
+#ifdef __linux__
+        if (wakeFd_ >= 0)
+            ::close(wakeFd_);
+#endif
+    }
+
+    size_t threadCount() const
+    {
+        return 1;
+    }
+
+    // 只在调用run的线程上执行，不支持弹性调整
+    bool addThread()
+    {
+        return false;
+    }
+
+    bool removeThread()
+    {
+        return false;
+    }
+
+    // 没有自己的工作线程，放置由调用run的线程决定
+    void setPlacement(const Placement&)
+    {
+    }
+
+    int numaNode() const
+    {
+        return -1;
+    }
+
+    // 计数方式见TaskCount
+    void setTaskCount(int n)
+    {
+        count.set(n);
+    }
+
+    void addTaskCount(int n)
+    {
+        count.add(n);
+    }
+
+    void openStream()
+    {
+        count.open();
+    }
+
+    void close(std::function<void()> onDrained = nullptr)
+    {
+        count.setOnDrained(std::move(onDrained));
+        currentThread->taskFinished();
+    }
+
+    // 其他线程上的push在任务入队后还要置位唤醒句柄，这时任务可能已经执行完，
+    // 计数保证析构等到signalWake返回，与WorkStealingThreadPool::pushTask相同
+    void pushTask(Task task)
+    {
+        pushing.fetch_add(1);
+        count.pushed();
+        taskQueue.pushTask(std::move(task));
+        signalWake();
+        pushing.fetch_sub(1);
+    }
+
+    // 按优先级添加任务，TaskQueueT需要是优先级队列（PriorityTaskQueue/BoundedPriorityTaskQueue）
+    void pushTask(Task task, int priority)
+    {
+        pushing.fetch_add(1);
+        count.pushed();
+        taskQueue.pushTask(std::move(task), priority);
+        signalWake();
+        pushing.fetch_sub(1);
+    }
+
+    // 放入代表indices个计数的任务（StageT::pushRange的一个块）
+    void pushChunk(Task task, int indices)
+    {
+        pushing.fetch_add(1);
+        count.pushedChunk(task, indices);
+        taskQueue.pushTask(std::move(task));
+        signalWake();
+        pushing.fetch_sub(1);
+    }
+
+    // 只有调用run的一个线程，拆分没有意义
+    bool tryFork(Task&)
+    {
+        return false;
+    }
+
+    // 任务必须在调用run的线程上执行，不能融合到上游，调用者照常入队
+    template <typename F>
+    bool runInline(F, int)
+    {
+        return false;
+    }
+
+    // 协程阶段：挂起中的协程占一个计数，release必须在本执行器的线程上调用
+    void retain()
+    {
+        count.retain();
+    }
+
+    void release()
+    {
+        currentThread->taskFinished();
+    }
+
+    template <typename InputIt>
+    void pushTasks(InputIt first, InputIt last)
+    {
+        pushing.fetch_add(1);
+        count.pushed((int)std::distance(first, last));
+        taskQueue.pushTasks(first, last);
+        signalWake();
+        pushing.fetch_sub(1);
+    }
+
+    void run()
+    {
+        currentThread->run();
+        count.sync();
+    }
+
+    // 用于GUI/渲染循环等每帧都要返回的线程：不等待新任务，执行已入队的任务后返回执行的个数
+    // 可以与run()交替使用，本批是否完成用drained()判断
+    size_t runAvailable(size_t maxTasks = SIZE_MAX)
+    {
+        clearWake();
+        size_t n = currentThread->runAvailable(maxTasks);
+        finishSlice();
+        return n;
+    }
+
+    size_t runFor(std::chrono::microseconds budget)
+    {
+        clearWake();
+        size_t n = currentThread->runFor(budget);
+        finishSlice();
+        return n;
+    }
+
+    // 计数模式下本批的任务都已完成，流式模式下还要求已经close
+    bool drained() const
+    {
+        return currentThread->drained();
+    }
+
+    // 唤醒句柄：有任务入队时变为可读，交给主循环的poll/epoll/select，之后调用runFor/runAvailable
+    // 第一次调用时创建eventfd，之前入队的任务也会使它可读；不是Linux时返回-1
+    // 应在调用run/runFor的线程上调用，句柄随执行器关闭
+    int wakeFd()
+    {
+#ifdef __linux__
+        if (wakeFd_ < 0) {
+            int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (fd < 0)
+                throw std::system_error(errno, std::generic_category(), "eventfd");
+            wakeFd_ = fd;
+            signaled_ = false;
+            if (!taskQueue.empty())
+                signalWake();
+        }
+#endif
+        return wakeFd_;
+    }
+
+private:
+    // 只在句柄未被置位时写一次，避免每次push都进入内核
+    void signalWake()
+    {
+#ifdef __linux__
+        int fd = wakeFd_.load(std::memory_order_acquire);
+        if (fd >= 0 && !signaled_.exchange(true)) {
+            uint64_t one = 1;
+            ssize_t r = ::write(fd, &one, sizeof(one));
+            (void)r;
+        }
+#endif
+    }
+
+    // 先读空句柄再清除标志：两者之间入队的任务不再写句柄，但会在本次调用中执行或由finishSlice补上
+    void clearWake()
+    {
+#ifdef __linux__
+        int fd = wakeFd_.load(std::memory_order_acquire);
+        if (fd < 0)
+            return;
+        uint64_t value;
+        ssize_t r = ::read(fd, &value, sizeof(value));
+        (void)r;
+        signaled_ = false;
+#endif
+    }
+
+    // 用完预算时队列里还有任务：重新置位，主循环下一次poll立即返回
+    void finishSlice()
+    {
+        count.sync();
+        if (!taskQueue.empty())
+            signalWake();
+    }
+
+    std::atomic<int> wakeFd_ { -1 };
+    std::atomic<bool> signaled_ { false }; // 句柄已可读（已写入，尚未被clearWake读空）
+    std::atomic<int> pushing { 0 }; // 正在执行push的线程数
+
+    // currentThread必须最后声明，保证先于它引用的成员析构
+    TaskCount count;
+    CurrentThreadPtr currentThread;
+};
+
+// 共享线程池上的一个逻辑队列，由SharedExecutorEx实现
+class SharedQueueBase {
+public:
+    virtual ~SharedQueueBase() = default;
+    // 并发数未达上限且有任务时执行一个任务并返回true
+    virtual bool tryRunOne() = 0;
+
+    int rank = 0; // 越大越优先被调度
+};
+
+// 多个阶段共用的工作线程池：每个阶段只是池中的一个逻辑队列，操作系统线程数与阶段数无关
+// 工作线程总是从rank最高（默认是最后注册的，即最下游）的可执行队列取任务，
+// 让在途的数据先排空，各阶段队列占用的内存保持有界
+class SharedThreadPool {
+public:
+    explicit SharedThreadPool(size_t numThreads)
+    {
+        for (size_t i = 0; i < numThreads; ++i) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    // 使用本池的阶段必须先于线程池析构
+    ~SharedThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMtx);
+            stop = true;
+            sleepCV.notify_all();
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    SharedThreadPool(const SharedThreadPool&) = delete;
+    SharedThreadPool& operator=(const SharedThreadPool&) = delete;
+
+    size_t threadCount() const
+    {
+        return workers.size();
+    }
+
+    void setPlacement(const Placement& p)
+    {
+        for (size_t i = 0; i < workers.size(); ++i) {
+            pinThread(workers[i], p.assign(i));
+        }
+    }
+
+    // 注册一个逻辑队列，rank默认取注册序号
+    void attach(const std::shared_ptr<SharedQueueBase>& queue)
+    {
+        std::lock_guard<std::mutex> lock(registryMtx);
+        queue->rank = nextRank++;
+        registry.push_back(queue);
+        sortRegistry();
+    }
+
+    void detach(SharedQueueBase* queue)
+    {
+        std::lock_guard<std::mutex> lock(registryMtx);
+        for (auto it = registry.begin(); it != registry.end(); ++it) {
+            if (it->get() == queue) {
+                registry.erase(it);
+                break;
+            }
+        }
+        ++version;
+        wake();
+    }
+
+    // 调整逻辑队列的调度优先级
+    void setRank(SharedQueueBase* queue, int rank)
+    {
+        std::lock_guard<std::mutex> lock(registryMtx);
+        queue->rank = rank;
+        sortRegistry();
+    }
+
+    // 有新任务时调用，只有存在休眠的工作线程时才加锁唤醒
+    void wake()
+    {
+        generation.fetch_add(1);
+        if (sleepers.load() > 0) {
+            std::lock_guard<std::mutex> lock(sleepMtx);
+            sleepCV.notify_one();
+        }
+    }
+
+    // 当前线程是否为本池的工作线程
+    bool onWorkerThread() const
+    {
+        return current() == this;
+    }
+
+private:
+    static const SharedThreadPool*& current()
+    {
+        static thread_local const SharedThreadPool* pool = nullptr;
+        return pool;
+    }
+
+    // 持有registryMtx时调用
+    void sortRegistry()
+    {
+        std::stable_sort(registry.begin(), registry.end(),
+            [](const std::shared_ptr<SharedQueueBase>& a, const std::shared_ptr<SharedQueueBase>& b) {
+                return a->rank > b->rank;
+            });
+        ++version;
+        wake();
+    }
+
+    void workerLoop()
+    {
+        current() = this;
+        // 注册表的本地副本，持有的shared_ptr保证阶段析构后逻辑队列仍然有效
+        std::vector<std::shared_ptr<SharedQueueBase>> queues;
+        uint64_t seenVersion = 0;
+        while (!stop) {
+            uint64_t seen = generation.load();
+            if (version.load() != seenVersion) {
+                std::lock_guard<std::mutex> lock(registryMtx);
+                queues = registry;
+                seenVersion = version.load();
+            }
+            bool ran = false;
+            for (auto& queue : queues) {
+                if (queue->tryRunOne()) {
+                    ran = true;
+                    break; // 每执行一个任务都从最下游重新开始
+                }
+            }
+            if (ran)
+                continue;
+            std::unique_lock<std::mutex> lock(sleepMtx);
+            sleepers.fetch_add(1);
+            sleepCV.wait(lock, [&] { return stop || generation.load() != seen; });
+            sleepers.fetch_sub(1);
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex registryMtx;
+    std::vector<std::shared_ptr<SharedQueueBase>> registry; // 按rank从高到低排列
+    std::atomic<uint64_t> version { 1 }; // 注册表变化时加一，工作线程据此刷新副本
+    int nextRank = 0;
+    std::atomic<uint64_t> generation { 0 }; // 每次wake加一，避免工作线程错过唤醒
+    std::atomic<int> sleepers { 0 };
+    std::mutex sleepMtx;
+    std::condition_variable sleepCV;
+    std::atomic<bool> stop { false }; // 在sleepMtx保护下修改，避免错过唤醒
+};
+
+// 在SharedThreadPool上执行的执行器，接口与ThreadPoolEx一致，可作为StageT/TypedStage的ExecutorT
+// 构造参数不是线程数而是本阶段的并发上限，add/removeThread调整的也是并发上限
+template <typename TaskQueueT>
+class SharedExecutorEx {
+public:
+    SharedExecutorEx(SharedThreadPool& pool, int concurrency)
+        : pool(pool)
+        , queue(std::make_shared<Queue>(pool, concurrency))
+        , taskQueue(queue->tasks)
+    {
+        setQueueDropHandler(taskQueue, [this](uint32_t) { release(); }, 0); // 被FullPolicy丢弃的任务计为已完成
+        pool.attach(queue);
+    }
+
+    ~SharedExecutorEx()
+    {
+        pool.detach(queue.get());
+    }
+
+    size_t threadCount() const
+    {
+        return queue->limit.load();
+    }
+
+    bool addThread()
+    {
+        queue->limit.fetch_add(1);
+        pool.wake();
+        return true;
+    }
+
+    bool removeThread()
+    {
+        int n = queue->limit.load();
+        while (n > 1) {
+            if (queue->limit.compare_exchange_weak(n, n - 1))
+                return true;
+        }
+        return false;
+    }
+
+    // 工作线程属于共享线程池，在SharedThreadPool::setPlacement中设置
+    void setPlacement(const Placement&)
+    {
+    }
+
+    int numaNode() const
+    {
+        return -1;
+    }
+
+    // 调度优先级，默认为注册序号（后构造的阶段优先）
+    void setRank(int rank)
+    {
+        pool.setRank(queue.get(), rank);
+    }
+
+    // 计数方式见TaskCount，计数器在逻辑队列中
+    void setTaskCount(int n)
+    {
+        queue->count.set(n);
+    }
+
+    void addTaskCount(int n)
+    {
+        queue->count.add(n);
+    }
+
+    void openStream()
+    {
+        queue->count.open();
+    }
+
+    void close(std::function<void()> onDrained = nullptr)
+    {
+        queue->count.setOnDrained(std::move(onDrained));
+        queue->taskFinished();
+    }
+
+    // 外部线程在队列满时阻塞；池内工作线程不能阻塞（所有线程都可能堵在满队列上），
+    // 而是在队列满时直接执行本队列的任务腾出空位，并发数已满时让出CPU等待
+    void pushTask(Task task)
+    {
+        queue->count.pushed();
+        enqueue(std::move(task));
+    }
+
+    // 放入代表indices个计数的任务（StageT::pushRange的一个块）
+    void pushChunk(Task task, int indices)
+    {
+        queue->count.pushedChunk(task, indices);
+        enqueue(std::move(task));
+    }
+
+    // 在执行中的任务里拆分出一个新任务，队列满时返回false且不移走task，由调用者自己继续执行
+    bool tryFork(Task& task)
+    {
+        queue->count.retain(); // 先计数：新任务可能在本任务完成前就完成
+        if (taskQueue.tryPushTask(task)) {
+            pool.wake();
+            return true;
+        }
+        queue->count.unretain();
+        return false;
+    }
+
+    // 在调用线程上执行f，计数方式与放入代表indices个计数的任务并执行完相同（用于阶段融合）
+    // 在上游线程上执行，f返回后本执行器随时可能被析构，先持有队列
+    template <typename F>
+    bool runInline(F f, int indices)
+    {
+        std::shared_ptr<Queue> q = queue;
+        q->count.pushedChunk(indices);
+        f();
+        q->taskFinished();
+        return true;
+    }
+
+    // 协程阶段：挂起中的协程占一个计数，release必须在本执行器的线程上调用
+    void retain()
+    {
+        queue->count.retain();
+    }
+
+    void release()
+    {
+        queue->taskFinished();
+    }
+
+    template <typename InputIt>
+    void pushTasks(InputIt first, InputIt last)
+    {
+        for (; first != last; ++first) {
+            pushTask(std::move(*first));
+        }
+    }
+
+    void wait()
+    {
+        queue->count.wait();
+    }
+
+private:
+    void enqueue(Task task)
+    {
+        if (!pool.onWorkerThread()) {
+            if (taskQueue.pushTask(std::move(task)))
+                pool.wake();
+            return;
+        }
+        while (!taskQueue.tryPushTask(task)) {
+            if (taskQueue.isClosed())
+                return;
+            if (!queue->tryRunOne())
+                std::this_thread::yield();
+        }
+        pool.wake();
+    }
+
+    // 逻辑队列由线程池和执行器共享，执行器析构后工作线程手中的副本仍然有效
+    struct Queue : SharedQueueBase {
+        Queue(SharedThreadPool& pool, int concurrency)
+            : pool(pool)
+            , limit(concurrency > 0 ? concurrency : 1)
+        {
+        }
+
+        bool tryRunOne() override
+        {
+            if (tasks.size() == 0)
+                return false;
+            int n = running.load();
+            do {
+                if (n >= limit.load())
+                    return false;
+            } while (!running.compare_exchange_weak(n, n + 1));
+            Task task;
+            if (!tasks.tryPopTask(task)) {
+                running.fetch_sub(1);
+                return false;
+            }
+            task();
+            task = nullptr;
+            running.fetch_sub(1);
+            // 执行任务的可能是pushTask中的线程，它不会回到调度循环，由其他工作线程接手剩余任务
+            if (tasks.size() > 0)
+                pool.wake();
+            taskFinished();
+            return true;
+        }
+
+        // 计数器归零时队列保持打开，之后可以开始下一批
+        void taskFinished()
+        {
+            count.finish();
+        }
+
+        SharedThreadPool& pool;
+        TaskQueueT tasks;
+        std::atomic<int> limit; // 并发上限
+        std::atomic<int> running { 0 }; // 正在执行的任务数
+        TaskCount count;
+    };
+
+    SharedThreadPool& pool;
+    std::shared_ptr<Queue> queue;
+
+public:
+    TaskQueueT& taskQueue; // 指向逻辑队列中的任务队列，必须在queue之后声明
+};
+
+// 阶段的输入端，上游阶段通过它把T类型的值推送给下游
+template <typename T>
+class StageInput {
+public:
+    virtual ~StageInput() = default;
+    virtual void push(T value) = 0;
+    // 上游丢弃了一个值（阶段函数出错或已取消，或者按FullPolicy丢弃）：按收到一个值计数但不执行，并继续通知下游
+    virtual void skip() = 0;
+    // 计数模式：本阶段将再收到n个任务，并按路由方式推导下游的任务数
+    virtual void addTaskCount(int n) = 0;
+    // 流式模式：openStream沿链向下游传播，close表示上游不会再push
+    // 有多个上游时，所有上游都close后本阶段才真正关闭
+    virtual void openStream() = 0;
+    virtual void close() = 0;
+    // 链接时调用：上游可能发送skip，本阶段会把skip继续传给下游的要检查下游能否处理，不能时抛出
+    virtual void acceptSkips()
+    {
+    }
+};
+
+// 索引的准入限制：上游push索引前先取得许可，例如OrderedStage只放行重排窗口能容纳的索引
+class AdmissionGate {
+public:
+    virtual ~AdmissionGate() = default;
+    // 阻塞到可以放入begin，返回[begin, end)中从begin起可以放入的部分的end（大于begin）
+    virtual int acquire(int begin, int end) = 0;
+};
+
+// 索引输入端，额外支持按范围推送
+template <>
+class StageInput<int> {
+public:
+    virtual ~StageInput() = default;
+    virtual void push(int index) = 0;
+    // 推送[begin, end)中的索引，grain为每块的索引数（0表示自动选择）
+    // 默认逐个push；StageT按块执行，并把块的边界原样传给下游
+    virtual void pushRange(int begin, int end, int grain = 0)
+    {
+        (void)grain;
+        for (int i = begin; i < end; ++i) {
+            push(i);
+        }
+    }
+    // 上游按FullPolicy丢弃了索引，或者上游TypedStage<T, int>出错时收到；索引阶段出错或已取消时照常传递索引
+    virtual void skip() = 0;
+    virtual void addTaskCount(int n) = 0;
+    virtual void openStream() = 0;
+    virtual void close() = 0;
+    virtual void acceptSkips()
+    {
+    }
+    // 需要上游的每一个索引（JoinStage、OrderedStage），不能是轮转或键分区的多个下游之一
+    virtual bool needsEveryIndex() const
+    {
+        return false;
+    }
+    // 上游索引阶段链接到本阶段时调用，本阶段及其下游的准入限制随之传给上游，见addGate
+    virtual void linkFrom(StageInput<int>* upstream)
+    {
+        (void)upstream;
+    }
+    // push索引前要取得gate的许可，并继续传给本阶段的上游；最终只有链头按顺序推送的线程会被阻塞
+    virtual void addGate(AdmissionGate* gate)
+    {
+        (void)gate;
+    }
+    // 上游不能等待许可时代替linkFrom调用，例如ShmReceiver：它用一个线程按通道顺序转发，
+    // 在窗口外的索引上阻塞时，缺少的索引排在它后面，会死锁；本阶段或其下游有准入限制时抛出std::invalid_argument
+    virtual void linkFromUngated()
+    {
+    }
+};
+
+// 索引阶段持有的准入限制：记录链接到本阶段的上游和下游传来的gate，gate沿上游一直传到链头
+class AdmissionGates {
+public:
+    void linkFrom(StageInput<int>* upstream)
+    {
+        if (std::find(upstreams_.begin(), upstreams_.end(), upstream) != upstreams_.end())
+            return;
+        upstreams_.push_back(upstream);
+        for (auto* gate : gates_) {
+            upstream->addGate(gate);
+        }
+    }
+
+    void linkFromUngated()
+    {
+        if (!gates_.empty())
+            throw std::invalid_argument("an index stage with a downstream OrderedStage cannot follow an ungated producer such as ShmReceiver");
+        ungated_ = true;
+    }
+
+    void add(AdmissionGate* gate)
+    {
+        if (ungated_)
+            throw std::invalid_argument("OrderedStage cannot be downstream of an ungated producer such as ShmReceiver");
+        if (std::find(gates_.begin(), gates_.end(), gate) != gates_.end())
+            return;
+        gates_.push_back(gate);
+        for (auto* upstream : upstreams_) {
+            upstream->addGate(gate);
+        }
+    }
+
+    // 依次取得所有gate的许可，返回可以放入的[begin, stop)的stop
+    int acquire(int begin, int end) const
+    {
+        for (auto* gate : gates_) {
+            end = gate->acquire(begin, end);
+        }
+        return end;
+    }
+
+    bool empty() const
+    {
+        return gates_.empty();
+    }
+
+private:
+    std::vector<StageInput<int>*> upstreams_;
+    std::vector<AdmissionGate*> gates_; // 下游OrderedStage的准入限制，在链接时设置
+    bool ungated_ = false; // 有不能等待许可的上游
+};
+
+// 不携带数据的输入端，用于连接返回void的阶段
+template <>
+class StageInput<void> {
+public:
+    virtual ~StageInput() = default;
+    virtual void push() = 0;
+    virtual void skip() = 0;
+    virtual void addTaskCount(int n) = 0;
+    virtual void openStream() = 0;
+    virtual void close() = 0;
+    virtual void acceptSkips()
+    {
+    }
+};
+
+// 基类，用于StageT链接；索引流水线即携带int的流水线
+class StageBase : public StageInput<int> {
+public:
+    // 由融合的上游在它自己的线程上调用：直接执行本阶段对[begin, end)的处理，不经过队列
+    virtual void runFused(int begin, int end) = 0;
+    // 输入队列中等待的任务数
+    virtual size_t queueDepth() const = 0;
+};
+
+// 融合两个阶段的方式
+enum class Fusion {
+    Always, // 上游执行完后总是直接执行下游
+    WhenIdle, // 只在下游输入队列为空时直接执行，否则照常入队
+};
+
+// 任务耗时直方图：第b个桶统计[2^b, 2^(b+1))纳秒的任务，记录只需几次relaxed原子加
+class LatencyHistogram {
+public:
+    static const int kBuckets = 40; // 最大约18分钟
+
+    void record(uint64_t nanos)
+    {
+        buckets[bucketOf(nanos)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        totalNanos.fetch_add(nanos, std::memory_order_relaxed);
+    }
+
+    uint64_t samples() const
+    {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t total() const
+    {
+        return totalNanos.load(std::memory_order_relaxed);
+    }
+
+    double mean() const
+    {
+        uint64_t n = samples();
+        return n ? (double)total() / n : 0.0;
+    }
+
+    // 返回p分位（0 < p <= 1）所在桶的中点，精度为2倍以内
+    double percentile(double p) const
+    {
+        uint64_t n = samples();
+        if (n == 0)
+            return 0.0;
+        uint64_t target = (uint64_t)(p * n);
+        if (target == 0)
+            target = 1;
+        uint64_t seen = 0;
+        for (int b = 0; b < kBuckets; ++b) {
+            seen += buckets[b].load(std::memory_order_relaxed);
+            if (seen >= target) {
+                return 1.5 * (double)(1ull << b);
+            }
+        }
+        return 1.5 * (double)(1ull << (kBuckets - 1));
+    }
+
+private:
+    static int bucketOf(uint64_t nanos)
+    {
+        int b = 0;
+        while (nanos > 1 && b < kBuckets - 1) {
+            nanos >>= 1;
+            ++b;
+        }
+        return b;
+    }
+
+    std::atomic<uint64_t> buckets[kBuckets] = {};
+    std::atomic<uint64_t> count { 0 };
+    std::atomic<uint64_t> totalNanos { 0 };
+};
+
+// 阶段的运行时指标快照，由Pipeline汇总
+struct StageReport {
+    std::string name;
+    size_t threads = 0;
+    uint64_t tasks = 0; // 开启统计后完成的任务数
+    double meanNanos = 0, p50Nanos = 0, p99Nanos = 0; // 任务耗时（不含推送到下游）
+    uint64_t busyNanos = 0; // 任务耗时总和
+    QueueStats queue; // 本阶段的输入队列
+    // 只用于BatchStage：提交的批数、批中的索引总数、因等待超时而提前提交的批数、批大小上限
+    uint64_t batches = 0, batchItems = 0, batchTimeouts = 0;
+    size_t maxBatch = 0;
+};
+
+// 阶段函数抛出的一个异常
+struct StageError {
+    std::string stage;
+    int index; // 出错的索引，TypedStage没有索引，为-1
+    std::exception_ptr error;
+};
+
+// 出错后的处理方式
+enum class ErrorPolicy {
+    Continue, // 只记录异常，其余任务照常执行
+    AbortOnFirst, // 第一个异常后取消，所有阶段中还未执行的任务都被丢弃
+};
+
+// 流水线级的异常收集器，同时是取消令牌
+// 设置了ErrorSink的阶段在执行每个任务前检查cancelled()：已取消时不再调用阶段函数，
+// 索引照常传给下游（TypedStage通知下游少了一个值），所以wait和close仍然正常结束
+// 阶段函数抛出的异常按索引记录在这里，不再从工作线程逃逸而终止进程
+class ErrorSink {
+public:
+    explicit ErrorSink(ErrorPolicy policy = ErrorPolicy::Continue)
+        : policy_(policy)
+    {
+    }
+
+    void setPolicy(ErrorPolicy policy)
+    {
+        policy_ = policy;
+    }
+
+    // 由阶段的工作线程调用
+    void record(const std::string& stage, int index, std::exception_ptr error)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            errors_.push_back(StageError { stage, index, error });
+        }
+        if (policy_ == ErrorPolicy::AbortOnFirst) {
+            cancel();
+        }
+    }
+
+    // 也可以在外部调用，例如用户中止或超时
+    void cancel()
+    {
+        cancelled_.store(true, std::memory_order_release);
+    }
+
+    bool cancelled() const
+    {
+        return cancelled_.load(std::memory_order_acquire);
+    }
+
+    bool hasErrors() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return !errors_.empty();
+    }
+
+    std::vector<StageError> errors() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return errors_;
+    }
+
+    // 重新抛出第一个异常，没有异常时什么也不做
+    void rethrowFirst() const
+    {
+        std::exception_ptr first;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (!errors_.empty())
+                first = errors_.front().error;
+        }
+        if (first)
+            std::rethrow_exception(first);
+    }
+
+    // 格式与Python的Pipeline.get_exception_summary相同，只列出前5个
+    std::string summary() const
+    {
+        std::vector<StageError> all = errors();
+        if (all.empty())
+            return "";
+        std::ostringstream os;
+        os << all.size() << " task(s) failed in pipeline:\n";
+        for (size_t i = 0; i < all.size() && i < 5; ++i) {
+            os << "  - Stage '" << all[i].stage << "', task " << all[i].index << ": " << describe(all[i].error) << "\n";
+        }
+        if (all.size() > 5)
+            os << "  ... and " << all.size() - 5 << " more errors\n";
+        return os.str();
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        errors_.clear();
+        cancelled_ = false;
+    }
+
+private:
+    static std::string describe(const std::exception_ptr& error)
+    {
+        try {
+            std::rethrow_exception(error);
+        } catch (const std::exception& e) {
+            return e.what();
+        } catch (...) {
+            return "unknown exception";
+        }
+    }
+
+    std::atomic<ErrorPolicy> policy_;
+    std::atomic<bool> cancelled_ { false };
+    mutable std::mutex mtx_;
+    std::vector<StageError> errors_;
+};
+
+// 可以被Pipeline监控的阶段
+class ReportableStage {
+public:
+    virtual ~ReportableStage() = default;
+    // 开启后每个任务多两次steady_clock::now()
+    virtual void enableMetrics(bool enable) = 0;
+    virtual StageReport report() const = 0;
+    // 异常记录到sink，执行任务前检查sink是否已取消；为nullptr时异常照常抛出
+    virtual void setErrorSink(ErrorSink* sink)
+    {
+        (void)sink;
+    }
+};
+
+// 可以被ElasticScheduler调整线程数的阶段，执行器不支持时add/removeThread返回false
+class ElasticStage : public ReportableStage {
+public:
+    virtual bool addThread() = 0;
+    virtual bool removeThread() = 0;
+};
+
+// 阶段有多个下游时的分发方式
+enum class Routing {
+    Broadcast, // 每个下游都收到一份
+    RoundRobin, // 依次轮流发给各个下游
+    KeyPartition, // 按键取模选择下游，同一个键总是发给同一个下游
+};
+
+// 阶段的下游列表，负责按路由方式分发输出、传播任务数和流式关闭
+template <typename T>
+class StageOutputsBase {
+public:
+    using Targets = std::vector<StageInput<T>*>;
+
+    void set(StageInput<T>* next)
+    {
+        if (next && skips) {
+            next->acceptSkips();
+        }
+        targets.clear();
+        if (next) {
+            targets.push_back(next);
+        }
+    }
+
+    void add(StageInput<T>* next)
+    {
+        if (skips) {
+            next->acceptSkips();
+        }
+        targets.push_back(next);
+    }
+
+    // 本阶段会向下游发送skip：按FullPolicy丢弃、设置了ErrorSink的TypedStage出错，或者转发上游的skip
+    // 一旦设置就不再取消，之后链接的下游同样要能处理skip
+    void sendSkips()
+    {
+        if (skips) {
+            return;
+        }
+        for (auto* next : targets) {
+            next->acceptSkips();
+        }
+        skips = true;
+    }
+
+    const Targets& list() const
+    {
+        return targets;
+    }
+
+    Routing routing() const
+    {
+        return route;
+    }
+
+    // 把n个任务按路由方式分给各个下游，计数是累计的，可以多次调用
+    // 轮转按第j个任务发给下游j % k计算，j在各次调用之间累计；
+    // 键分区要求每次调用对应键[0, n)中的索引：流水线复用时每一批、汇合时每个上游都从0开始
+    void addTaskCount(int n)
+    {
+        int before = route == Routing::KeyPartition ? 0 : expected;
+        expected += n;
+        for (size_t i = 0; i < targets.size(); ++i) {
+            int delta = share(i, before + n) - share(i, before);
+            if (delta > 0) {
+                targets[i]->addTaskCount(delta);
+            }
+        }
+    }
+
+    void openStream()
+    {
+        for (auto* next : targets) {
+            next->openStream();
+        }
+    }
+
+    // 通知下游少了一个值：单个下游和广播时每个下游都少一个，其余按轮转选择
+    // 键分区时没有值可以取键，计数模式下会发给错误的下游，StageOutputs在链接和计数时拒绝这种组合
+    void skip()
+    {
+        if (targets.empty()) {
+            return;
+        }
+        if (targets.size() == 1 || route == Routing::Broadcast) {
+            for (auto* next : targets) {
+                next->skip();
+            }
+            return;
+        }
+        targets[nextTarget()]->skip();
+    }
+
+    // 关闭所有下游；是静态函数，因为调用时本阶段可能已被析构
+    static void closeAll(const Targets& targets)
+    {
+        for (auto* next : targets) {
+            next->close();
+        }
+    }
+
+protected:
+    int share(size_t i, int total) const
+    {
+        if (route == Routing::Broadcast) {
+            return total;
+        }
+        int k = (int)targets.size();
+        return total / k + ((int)i < total % k ? 1 : 0);
+    }
+
+    size_t nextTarget()
+    {
+        return roundRobin.fetch_add(1, std::memory_order_relaxed) % targets.size();
+    }
+
+    Targets targets;
+    Routing route = Routing::Broadcast;
+    std::atomic<size_t> roundRobin { 0 };
+    int expected = 0;
+    bool skips = false; // 见sendSkips
+};
+
+template <typename T>
+class StageOutputs : public StageOutputsBase<T> {
+public:
+    using KeyFunc = std::function<size_t(const T&)>;
+
+    void set(StageInput<T>* next)
+    {
+        if (next) {
+            requireExactCounts(this->route, key != nullptr, { next }, this->skips, this->expected > 0);
+        }
+        StageOutputsBase<T>::set(next);
+    }
+
+    // 默认的路由方式是广播，只可移动的类型添加第二个下游前必须先选择其他路由方式
+    void add(StageInput<T>* next)
+    {
+        if (this->route == Routing::Broadcast && !this->targets.empty() && !std::is_copy_constructible<T>::value) {
+            throw std::invalid_argument("Routing::Broadcast requires a copyable output type");
+        }
+        typename StageOutputsBase<T>::Targets all = this->targets;
+        all.push_back(next);
+        requireExactCounts(this->route, key != nullptr, all, this->skips, this->expected > 0);
+        StageOutputsBase<T>::add(next);
+    }
+
+    void sendSkips()
+    {
+        requireExactCounts(this->route, key != nullptr, this->targets, true, this->expected > 0);
+        StageOutputsBase<T>::sendSkips();
+    }
+
+    // 键分区时key为空则整数类型直接以值为键，其他类型必须提供key
+    // 广播需要复制输出，只可移动的类型不能广播给多个下游
+    void setRouting(Routing routing, KeyFunc key = nullptr)
+    {
+        if (routing == Routing::KeyPartition && !key && !std::is_integral<T>::value) {
+            throw std::invalid_argument("Routing::KeyPartition requires a key function for non-integral types");
+        }
+        if (routing == Routing::Broadcast && this->targets.size() > 1 && !std::is_copy_constructible<T>::value) {
+            throw std::invalid_argument("Routing::Broadcast requires a copyable output type");
+        }
+        requireExactCounts(routing, key != nullptr, this->targets, this->skips, this->expected > 0);
+        this->route = routing;
+        this->key = std::move(key);
+    }
+
+    // 按路由方式推导下游的任务数，无法准确推导时抛出，见requireExactCounts
+    void addTaskCount(int n)
+    {
+        requireExactCounts(this->route, key != nullptr, this->targets, this->skips, true);
+        StageOutputsBase<T>::addTaskCount(n);
+    }
+
+    void push(T&& value)
+    {
+        size_t n = this->targets.size();
+        if (n == 0) {
+            return;
+        }
+        if (n == 1) {
+            this->targets[0]->push(std::move(value));
+            return;
+        }
+        switch (this->route) {
+        case Routing::Broadcast:
+            broadcast(std::move(value), std::is_copy_constructible<T>());
+            break;
+        case Routing::RoundRobin:
+            this->targets[this->nextTarget()]->push(std::move(value));
+            break;
+        case Routing::KeyPartition:
+            this->targets[keyOf(value, std::is_integral<T>()) % n]->push(std::move(value));
+            break;
+        }
+    }
+
+    // 只用于索引（T为int）：单个下游和广播时整块传给下游，轮转和键分区逐个分发以保持任务数的推导
+    void pushRange(int begin, int end)
+    {
+        if (this->targets.size() == 1 || this->route == Routing::Broadcast) {
+            for (auto* next : this->targets) {
+                next->pushRange(begin, end, end - begin);
+            }
+            return;
+        }
+        for (int i = begin; i < end; ++i) {
+            push(T(i));
+        }
+    }
+
+private:
+    // 推导下游任务数的所有限制都在这里检查：链接、路由、计数和skip来源变化时调用，不满足时抛出，本阶段保持不变
+    // 轮转和键分区分给多个下游时，每个下游只收到一部分索引，JoinStage和OrderedStage会一直等待缺少的索引；
+    // 它们也不知道skip对应哪个索引，不能接在会发送skip的阶段之后
+    // 计数模式下键分区按“键为[0, n)中的索引”推导每个下游的任务数：自定义的键与索引无关，
+    // skip没有键可取，都会让某个下游一直等待，这两种情况抛出std::logic_error，请改用流式模式
+    static void requireExactCounts(Routing routing, bool customKey, const typename StageOutputsBase<T>::Targets& targets,
+        bool skips, bool counted)
+    {
+        for (auto* next : targets) {
+            if (!needsEveryIndex(next)) {
+                continue;
+            }
+            if (skips) {
+                throw std::invalid_argument("JoinStage and OrderedStage cannot follow a stage that drops values (FullPolicy other than Block, or a TypedStage with an ErrorSink)");
+            }
+            if (routing != Routing::Broadcast && targets.size() > 1) {
+                throw std::invalid_argument("JoinStage and OrderedStage need every index; use Routing::Broadcast or link them as the only target");
+            }
+        }
+        if (!counted || routing != Routing::KeyPartition || targets.size() < 2) {
+            return;
+        }
+        if (customKey) {
+            throw std::logic_error("Routing::KeyPartition with a custom key cannot derive per-target counts; use openStream()");
+        }
+        if (skips) {
+            throw std::logic_error("Routing::KeyPartition cannot derive per-target counts when values are dropped; use openStream() or FullPolicy::Block");
+        }
+    }
+
+    static bool needsEveryIndex(StageInput<int>* next)
+    {
+        return next->needsEveryIndex();
+    }
+
+    template <typename U>
+    static bool needsEveryIndex(StageInput<U>*)
+    {
+        return false;
+    }
+
+    // 前n-1个下游收到副本，最后一个收到原值
+    void broadcast(T&& value, std::true_type)
+    {
+        size_t last = this->targets.size() - 1;
+        for (size_t i = 0; i < last; ++i) {
+            this->targets[i]->push(T(value));
+        }
+        this->targets[last]->push(std::move(value));
+    }
+
+    // add和setRouting已经拒绝了这种情况，只为让不可复制的类型能够编译
+    void broadcast(T&& value, std::false_type)
+    {
+        this->targets[0]->push(std::move(value));
+    }
+
+    size_t keyOf(const T& value, std::true_type) const
+    {
+        return key ? key(value) : (size_t)value;
+    }
+
+    size_t keyOf(const T& value, std::false_type) const
+    {
+        return key(value);
+    }
+
+    KeyFunc key;
+};
+
+template <>
+class StageOutputs<void> : public StageOutputsBase<void> {
+public:
+    // 没有数据可以取键，只支持广播和轮转
+    void setRouting(Routing routing)
+    {
+        if (routing == Routing::KeyPartition) {
+            throw std::invalid_argument("Routing::KeyPartition is not available for void outputs");
+        }
+        route = routing;
+    }
+
+    void push()
+    {
+        if (targets.empty()) {
+            return;
+        }
+        if (route == Routing::RoundRobin) {
+            targets[nextTarget()]->push();
+            return;
+        }
+        for (auto* next : targets) {
+            next->push();
+        }
+    }
+};
+
+template <typename ExecutorT>
+StageReport makeReport(const std::string& name, const ExecutorT& executor, const LatencyHistogram& serviceTime)
+{
+    StageReport r;
+    r.name = name;
+    r.threads = executor.threadCount();
+    r.tasks = serviceTime.samples();
+    r.meanNanos = serviceTime.mean();
+    r.p50Nanos = serviceTime.percentile(0.5);
+    r.p99Nanos = serviceTime.percentile(0.99);
+    r.busyNanos = serviceTime.total();
+    r.queue = executor.taskQueue.stats();
+    return r;
+}
+
+// 泛型Stage类，支持不同的执行器类型
+template <typename ExecutorT>
+class StageT : public StageBase, public ElasticStage {
+public:
+    using Func = std::function<void(int)>;
+
+    // 构造函数 - 对于ThreadPoolEx需要num_workers，对于CurrentThreadEx不需要
+    StageT(const std::string& name, int threads, int capacity, Func func)
+        : name_(name)
+        , executor_(threads)
+        , func_(std::move(func))
+        , traceId_(traceStage(name))
+    {
+        executor_.taskQueue.setCapacity(capacity);
+        setQueueDropHandler(executor_.taskQueue, [this](uint32_t weight) { dropped(weight); }, 0);
+    }
+
+    // 对于SharedExecutorEx：在共享线程池上执行，concurrency是本阶段的并发上限
+    StageT(const std::string& name, SharedThreadPool& pool, int concurrency, int capacity, Func func)
+        : name_(name)
+        , executor_(pool, concurrency)
+        , func_(std::move(func))
+        , traceId_(traceStage(name))
+    {
+        executor_.taskQueue.setCapacity(capacity);
+        setQueueDropHandler(executor_.taskQueue, [this](uint32_t weight) { dropped(weight); }, 0);
+    }
+
+    void setTaskCount(int n)
+    {
+        executor_.setTaskCount(n);
+    }
+
+    // 在头部阶段调用一次，代替在每个阶段调用setTaskCount
+    // 下游的任务数按路由方式自动推导，有多个上游的阶段会累加各上游的任务数
+    void addTaskCount(int n) override
+    {
+        outputs_.addTaskCount(n); // 先推导下游：路由方式无法推导时在这里抛出，本阶段的计数不变
+        executor_.addTaskCount(n);
+    }
+
+    // 进入流式模式（替代setTaskCount），会同时打开所有下游阶段
+    // 在头部阶段调用一次即可，之后可以无限地push
+    void openStream() override
+    {
+        if (openInputs_++ == 0) {
+            executor_.openStream();
+            outputs_.openStream();
+        }
+    }
+
+    // 结束流式输入：本阶段排空后自动关闭下游，下游排空后再继续向下传播
+    void close() override
+    {
+        if (--openInputs_ > 0) {
+            return;
+        }
+        // 回调只捕获下游列表，不访问本阶段，因为它执行时本阶段可能已被析构
+        typename StageOutputs<int>::Targets next = outputs_.list();
+        executor_.close([next]() {
+            StageOutputs<int>::closeAll(next);
+        });
+    }
+
+    void push(int index) override
+    {
+        gates_.acquire(index, index + 1);
+        TraceSpan trace(TraceKind::Push, traceId_, index);
+        executor_.pushTask([this, index]() {
+            run(index);
+        });
+    }
+
+    // 上游丢弃了一个值：按一个任务计数，执行时继续通知下游
+    void skip() override
+    {
+        executor_.pushTask([this]() {
+            outputs_.skip();
+        });
+    }
+
+    // 按块推送[begin, end)，每块只需一个任务、一次入队和一次计数，适合每个索引只需几纳秒的阶段
+    // 计数模式下按索引计数，与逐个push相同；执行完一块后把整块传给下游
+    // 有准入限制时按取得许可的部分分段推送
+    void pushRange(int begin, int end, int grain = 0) override
+    {
+        if (end <= begin)
+            return;
+        if (grain <= 0) {
+            grain = std::max(1, (end - begin) / (int)(4 * executor_.threadCount()));
+        }
+        while (begin < end) {
+            int stop = gates_.acquire(begin, end);
+            pushChunks(begin, stop, grain);
+            begin = stop;
+        }
+    }
+
+    void linkFrom(StageInput<int>* upstream) override
+    {
+        gates_.linkFrom(upstream);
+    }
+
+    void addGate(AdmissionGate* gate) override
+    {
+        gates_.add(gate);
+    }
+
+    void linkFromUngated() override
+    {
+        gates_.linkFromUngated();
+    }
+
+    // 运行中调整输入队列的容量
+    void setCapacity(size_t capacity)
+    {
+        executor_.taskQueue.setCapacity(capacity);
+    }
+
+    // 输入队列满时的处理方式（BoundedTaskQueue），见FullPolicy；计数模式下被丢弃的值会通知下游
+    // 除Block外的策略会丢弃值：下游有JoinStage/OrderedStage时抛出std::invalid_argument，
+    // 计数模式下键分区给多个下游时抛出std::logic_error（丢弃的值没有键，无法通知正确的下游）
+    void setFullPolicy(FullPolicy policy, std::chrono::nanoseconds timeout = std::chrono::nanoseconds(0))
+    {
+        if (policy != FullPolicy::Block)
+            outputs_.sendSkips();
+        executor_.taskQueue.setFullPolicy(policy, timeout);
+    }
+
+    // 上游会发送skip，本阶段把它们转给下游
+    void acceptSkips() override
+    {
+        outputs_.sendSkips();
+    }
+
+    // Recursive时整个范围作为一个任务，执行时对半拆分直到grain，拆出的一半可以被其他线程窃取
+    void setRangeSplit(RangeSplit split)
+    {
+        rangeSplit_ = split;
+    }
+
+    // 批量推送，整批任务只需一次入队加锁和唤醒
+    // 有准入限制时逐个push：整批取得许可前不入队，后面的索引会等待还没放入的前面的索引
+    void pushBatch(const std::vector<int>& indices)
+    {
+        if (!gates_.empty()) {
+            for (int index : indices) {
+                push(index);
+            }
+            return;
+        }
+        std::vector<Task> tasks;
+        tasks.reserve(indices.size());
+        for (int index : indices) {
+            tasks.emplace_back([this, index]() {
+                run(index);
+            });
+        }
+        executor_.pushTasks(tasks.begin(), tasks.end());
+    }
+
+    void wait()
+    {
+        executor_.wait();
+    }
+
+    // 对于CurrentThreadEx，需要手动调用run
+    void run()
+    {
+        executor_.run();
+    }
+
+    // 对于CurrentThreadEx：不阻塞地执行已入队的任务，用于每帧都要返回的GUI/渲染循环，见CurrentThreadEx
+    size_t runFor(std::chrono::microseconds budget)
+    {
+        return executor_.runFor(budget);
+    }
+
+    size_t runAvailable(size_t maxTasks = SIZE_MAX)
+    {
+        return executor_.runAvailable(maxTasks);
+    }
+
+    // 有任务入队时变为可读的句柄，交给主循环的poll
+    int wakeFd()
+    {
+        return executor_.wakeFd();
+    }
+
+    bool drained() const
+    {
+        return executor_.drained();
+    }
+
+    // 公共方法用于链接，下游也可以是TypedStage<int, Out>
+    void setNext(StageInput<int>* next)
+    {
+        outputs_.set(next);
+        fused_ = nullptr;
+        if (next)
+            next->linkFrom(this);
+    }
+
+    // 添加一个下游，和setNext/已添加的下游一起按setRouting的方式分发
+    void addNext(StageInput<int>* next)
+    {
+        outputs_.add(next);
+        fused_ = nullptr;
+        next->linkFrom(this);
+    }
+
+    // 把next设为唯一的下游并与之融合，见fuse()
+    void fuseNext(StageBase* next, Fusion fusion = Fusion::Always)
+    {
+        outputs_.set(next);
+        fused_ = next;
+        fusion_ = fusion;
+        next->linkFrom(this);
+    }
+
+    void runFused(int begin, int end) override
+    {
+        bool ran = executor_.runInline([this, begin, end]() {
+            if (end - begin == 1) {
+                run(begin);
+            } else {
+                runRange(begin, end, end - begin);
+            }
+        },
+            end - begin);
+        if (!ran) {
+            if (end - begin == 1) {
+                push(begin);
+            } else {
+                pushRange(begin, end, end - begin);
+            }
+        }
+    }
+
+    size_t queueDepth() const override
+    {
+        return executor_.taskQueue.size();
+    }
+
+    // 键分区默认以索引为键
+    void setRouting(Routing routing, StageOutputs<int>::KeyFunc key = nullptr)
+    {
+        outputs_.setRouting(routing, std::move(key));
+    }
+
+    const std::string& name() const
+    {
+        return name_;
+    }
+
+    void enableMetrics(bool enable) override
+    {
+        metricsEnabled_ = enable;
+    }
+
+    StageReport report() const override
+    {
+        return makeReport(name_, executor_, serviceTime_);
+    }
+
+    // 出错或已取消的索引照常传给下游，下游同样先检查是否已取消
+    void setErrorSink(ErrorSink* sink) override
+    {
+        errors_ = sink;
+    }
+
+    bool addThread() override
+    {
+        return executor_.addThread();
+    }
+
+    bool removeThread() override
+    {
+        return executor_.removeThread();
+    }
+
+    // 放置本阶段的工作线程，例如Placement::sameNodeAs(upstream)让本阶段与上游共用一个节点
+    void setPlacement(const Placement& p)
+    {
+        executor_.setPlacement(p);
+    }
+
+    int numaNode() const
+    {
+        return executor_.numaNode();
+    }
+
+protected:
+    // 派生阶段在任务之外访问本阶段时持有一个计数，期间wait不会返回，本阶段不会被析构
+    void retain()
+    {
+        executor_.retain();
+    }
+
+    void release()
+    {
+        executor_.release();
+    }
+
+private:
+    void run(int index)
+    {
+        {
+            TraceSpan trace(TraceKind::Run, traceId_, index);
+            if (metricsEnabled_.load(std::memory_order_relaxed)) {
+                auto start = std::chrono::steady_clock::now();
+                invoke(index);
+                serviceTime_.record(elapsedNanos(start));
+            } else {
+                invoke(index);
+            }
+        }
+        if (runFusedNext()) {
+            fused_->runFused(index, index + 1);
+        } else {
+            outputs_.push(std::move(index));
+        }
+    }
+
+    // 输入队列按FullPolicy丢弃了一个任务：计数模式下通知下游少了weight个值（pushRange的块整块丢弃）
+    // 执行器按一个任务计数，与pushChunk一致
+    void dropped(uint32_t weight)
+    {
+        if (openInputs_.load() == 0) {
+            for (uint32_t i = 0; i < weight; ++i) {
+                outputs_.skip();
+            }
+        }
+        executor_.release();
+    }
+
+    // 已取消时不执行，异常记录到errors_；没有设置ErrorSink时异常照常抛出
+    void invoke(int index)
+    {
+        if (!errors_) {
+            func_(index);
+            return;
+        }
+        if (errors_->cancelled()) {
+            return;
+        }
+        try {
+            func_(index);
+        } catch (...) {
+            errors_->record(name_, index, std::current_exception());
+        }
+    }
+
+    bool runFusedNext() const
+    {
+        return fused_ && (fusion_ == Fusion::Always || fused_->queueDepth() == 0);
+    }
+
+    void pushChunks(int begin, int end, int grain)
+    {
+        if (rangeSplit_ == RangeSplit::Recursive) {
+            TraceSpan trace(TraceKind::Push, traceId_, begin, end - begin);
+            executor_.pushChunk(rangeTask(begin, end, grain), end - begin);
+            return;
+        }
+        for (int b = begin; b < end;) {
+            int e = end - b > grain ? b + grain : end;
+            TraceSpan trace(TraceKind::Push, traceId_, b, e - b);
+            executor_.pushChunk(rangeTask(b, e, grain), e - b);
+            b = e;
+        }
+    }
+
+    Task rangeTask(int begin, int end, int grain)
+    {
+        return Task([this, begin, end, grain]() {
+            runRange(begin, end, grain);
+        });
+    }
+
+    // 指标按块记录，一块计为一个任务
+    void runRange(int begin, int end, int grain)
+    {
+        while (rangeSplit_ == RangeSplit::Recursive && end - begin > grain) {
+            int mid = begin + (end - begin) / 2;
+            Task half = rangeTask(mid, end, grain);
+            half.setWeight(end - mid);
+            if (!executor_.tryFork(half))
+                break; // 队列已满，剩下的部分由本线程执行
+            end = mid;
+        }
+        {
+            TraceSpan trace(TraceKind::Run, traceId_, begin, end - begin);
+            if (metricsEnabled_.load(std::memory_order_relaxed)) {
+                auto start = std::chrono::steady_clock::now();
+                for (int i = begin; i < end; ++i) {
+                    invoke(i);
+                }
+                serviceTime_.record(elapsedNanos(start));
+            } else {
+                for (int i = begin; i < end; ++i) {
+                    invoke(i);
+                }
+            }
+        }
+        if (runFusedNext()) {
+            fused_->runFused(begin, end);
+        } else {
+            outputs_.pushRange(begin, end);
+        }
+    }
+
+private:
+    std::string name_;
+    ExecutorT executor_;
+    Func func_;
+    StageOutputs<int> outputs_;
+    RangeSplit rangeSplit_ = RangeSplit::Flat;
+    StageBase* fused_ = nullptr; // 融合的下游，同时也是outputs_中唯一的下游
+    Fusion fusion_ = Fusion::Always;
+    ErrorSink* errors_ = nullptr;
+    AdmissionGates gates_;
+    uint32_t traceId_; // 定义TASK_QUEUE_TRACE时在Tracer中的编号
+    std::atomic<bool> metricsEnabled_ { false };
+    LatencyHistogram serviceTime_;
+    std::atomic<int> openInputs_ { 0 };
+};
+
+// 汇合阶段：同一个索引从全部inputs个上游都到达后才执行一次func
+// 例如解码阶段广播给缩略图和特征提取两个阶段，再由JoinStage汇合后写出
+template <typename ExecutorT>
+class JoinStageT : public StageT<ExecutorT> {
+public:
+    using Func = typename StageT<ExecutorT>::Func;
+
+    JoinStageT(const std::string& name, int threads, int capacity, int inputs, Func func)
+        : StageT<ExecutorT>(name, threads, capacity, std::move(func))
+        , inputs_(inputs)
+    {
+    }
+
+    // 每inputs次到达才执行一次，所以执行次数为到达次数除以inputs
+    void addTaskCount(int n) override
+    {
+        int before = arrivalsExpected_ / inputs_;
+        arrivalsExpected_ += n;
+        int delta = arrivalsExpected_ / inputs_ - before;
+        if (delta > 0) {
+            StageT<ExecutorT>::addTaskCount(delta);
+        }
+    }
+
+    void push(int index) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(arrivalsMtx_);
+            auto it = arrivals_.find(index);
+            if (it == arrivals_.end()) {
+                it = arrivals_.emplace(index, 0).first;
+            }
+            if (++it->second < inputs_) {
+                return;
+            }
+            arrivals_.erase(it);
+        }
+        StageT<ExecutorT>::push(index);
+    }
+
+    // 每个索引要单独计数到达次数，不能按块执行
+    void pushRange(int begin, int end, int = 0) override
+    {
+        for (int i = begin; i < end; ++i) {
+            push(i);
+        }
+    }
+
+    // 要等所有上游到达，不能与上游融合，照常入队
+    void runFused(int begin, int end) override
+    {
+        pushRange(begin, end);
+    }
+
+    // 不知道丢弃的是哪个索引，无法判断哪个索引不会到齐
+    void skip() override
+    {
+        throw std::logic_error("JoinStage requires index inputs; a TypedStage upstream dropped a value");
+    }
+
+    // 只收到一部分索引的上游会让其余索引永远到不齐
+    bool needsEveryIndex() const override
+    {
+        return true;
+    }
+
+private:
+    int inputs_;
+    int arrivalsExpected_ = 0;
+    std::mutex arrivalsMtx_;
+    std::unordered_map<int, int> arrivals_; // 尚未到齐的索引 -> 已到达的上游数
+};
+
+// 保序阶段：上游多线程处理后索引乱序到达，经过容量为window的重排窗口按first, first+1, ...的顺序放入本阶段
+// 缓存的索引不超过window个：链接到本阶段的上游索引阶段（沿链一直到链头）push前要等索引落入窗口，
+// 链头按顺序推送时流水线中最多只有window个索引，上游的工作线程不会因为窗口而阻塞，也就不会死锁
+// 上游不是索引阶段（例如TypedStage<T, int>）时超出窗口的push在本阶段阻塞，
+// 这时从链头到本阶段只能经过一个多线程阶段，并且它按FIFO顺序取任务
+// 放行在锁外进行：同一时刻只有一个上游线程负责按顺序放入本阶段，其他上游线程登记后立即返回
+// 只有一个工作线程（或CurrentThreadEx）时func按索引顺序执行
+// 每一批（或每个流）中每个索引只到达一次；上一批全部到达并放行后，addTaskCount/setTaskCount/openStream从first重新开始
+template <typename ExecutorT>
+class OrderedStageT : public StageT<ExecutorT>, private AdmissionGate {
+public:
+    using Func = typename StageT<ExecutorT>::Func;
+
+    OrderedStageT(const std::string& name, int threads, int capacity, int window, Func func, int first = 0)
+        : StageT<ExecutorT>(name, threads, capacity, std::move(func))
+        , window_(window < 1 ? 1 : window)
+        , first_(first)
+        , next_(first)
+        , pending_(window_, false)
+    {
+    }
+
+    void setTaskCount(int n)
+    {
+        {
+            std::lock_guard<std::mutex> lock(windowMtx_);
+            restartIfIdle();
+            expected_ = received_ + n;
+        }
+        StageT<ExecutorT>::setTaskCount(n);
+    }
+
+    void addTaskCount(int n) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(windowMtx_);
+            restartIfIdle();
+            expected_ += n;
+        }
+        StageT<ExecutorT>::addTaskCount(n);
+    }
+
+    void openStream() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(windowMtx_);
+            restartIfIdle();
+            ++openInputs_;
+        }
+        StageT<ExecutorT>::openStream();
+    }
+
+    void close() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(windowMtx_);
+            --openInputs_;
+        }
+        StageT<ExecutorT>::close();
+    }
+
+    void push(int index) override
+    {
+        std::unique_lock<std::mutex> lock(windowMtx_);
+        windowCV_.wait(lock, [&] { return index < next_ + window_; });
+        ++received_;
+        if (index < next_ || !admit(index)) {
+            // 已经放行过的序号或重复的序号，无法保序，直接放入
+            lock.unlock();
+            StageT<ExecutorT>::push(index);
+            return;
+        }
+        if (releasing_)
+            return; // 正在放行的线程解锁后会接着检查，由它放行
+        releasing_ = true;
+        // 放入最后一个索引后还要再检查一次窗口，这期间本阶段可能已经排空，wait返回后调用者会析构本阶段
+        this->retain();
+        while (true) {
+            int begin = next_;
+            advance();
+            int end = next_;
+            if (begin == end) {
+                releasing_ = false;
+                lock.unlock();
+                this->release(); // 之后不再访问成员
+                return;
+            }
+            windowCV_.notify_all(); // 窗口前移，唤醒等待窗口的上游
+            // 放入本阶段可能因为队列满而阻塞，不能持有窗口锁：其他上游线程要能继续登记
+            lock.unlock();
+            for (int i = begin; i < end; ++i) {
+                StageT<ExecutorT>::push(i);
+            }
+            lock.lock();
+        }
+    }
+
+    // 重排窗口按索引工作，不能按块执行
+    void pushRange(int begin, int end, int = 0) override
+    {
+        for (int i = begin; i < end; ++i) {
+            push(i);
+        }
+    }
+
+    // 必须经过重排窗口，不能与上游融合，照常入队
+    void runFused(int begin, int end) override
+    {
+        pushRange(begin, end);
+    }
+
+    // 不知道丢弃的是哪个索引，重排窗口会一直等待它
+    void skip() override
+    {
+        throw std::logic_error("OrderedStage requires index inputs; a TypedStage upstream dropped a value");
+    }
+
+    // 轮转或键分区只会送来一部分索引，缺口永远不会补齐
+    bool needsEveryIndex() const override
+    {
+        return true;
+    }
+
+    // 上游在push前等待索引落入本阶段的重排窗口
+    void linkFrom(StageInput<int>* upstream) override
+    {
+        StageT<ExecutorT>::linkFrom(upstream);
+        upstream->addGate(this);
+    }
+
+    void linkFromUngated() override
+    {
+        throw std::invalid_argument("OrderedStage cannot be downstream of an ungated producer such as ShmReceiver");
+    }
+
+    // 重排窗口中同时等待放行的索引数的峰值，不超过window
+    int peakBuffered() const
+    {
+        std::lock_guard<std::mutex> lock(windowMtx_);
+        return peakBuffered_;
+    }
+
+private:
+    // 本批（或本流）还没有全部到达时才限制准入，之前和之后的push不受影响
+    int acquire(int begin, int end) override
+    {
+        std::unique_lock<std::mutex> lock(windowMtx_);
+        windowCV_.wait(lock, [&] { return !ordering() || begin < next_ + window_; });
+        return ordering() ? std::min(end, next_ + window_) : end;
+    }
+
+    // 持有windowMtx_时调用
+    bool ordering() const
+    {
+        return openInputs_ > 0 || received_ < expected_;
+    }
+
+    // 持有windowMtx_时调用：登记窗口中一个不小于next_的索引，重复时返回false
+    bool admit(int index)
+    {
+        if (pending_[index % window_])
+            return false;
+        pending_[index % window_] = true;
+        peakBuffered_ = std::max(peakBuffered_, ++buffered_);
+        return true;
+    }
+
+    // 持有windowMtx_时调用：越过所有已到达的连续索引
+    void advance()
+    {
+        while (pending_[next_ % window_]) {
+            pending_[next_ % window_] = false;
+            --buffered_;
+            ++next_;
+        }
+    }
+
+    // 持有windowMtx_时调用：上一批（或上一个流）的索引都已到达并放行时，新的一批从first开始
+    // 有多个上游时它们都会调用，只有第一次生效，之后received_还没有追上expected_
+    void restartIfIdle()
+    {
+        if (buffered_ == 0 && openInputs_ == 0 && received_ >= expected_) {
+            next_ = first_;
+            expected_ = received_;
+        }
+    }
+
+    int window_;
+    int first_;
+    int next_; // 下一个要放行的索引
+    std::vector<bool> pending_; // 以index % window_为下标的重排窗口，记录[next_, next_ + window_)中已到达的索引
+    int buffered_ = 0; // 窗口中等待放行的索引数
+    int peakBuffered_ = 0;
+    int received_ = 0;
+    int expected_ = 0;
+    int openInputs_ = 0;
+    bool releasing_ = false; // 有线程正在锁外放行
+    mutable std::mutex windowMtx_;
+    std::condition_variable windowCV_; // next_前移时通知等待窗口的push和acquire
+};
+
+// 批处理阶段把一批索引交给下游的方式
+enum class BatchForward {
+    Each, // 逐个push
+    Ranges // 批中连续的索引合并为一个pushRange，下游按块执行
+};
+
+// 批处理阶段：攒够maxBatch个索引，或第一个索引已等待maxDelay时，把整批交给一次func调用
+// 适合每次调用有固定开销的阶段，例如GPU推理的kernel启动和主机-设备拷贝；maxBatch和maxDelay是吞吐与延迟之间的取舍
+// 一批是一个任务，计数模式下按索引计数，收到最后一个索引时立即提交剩余的部分，不再等待
+// 等待超时由本阶段的一个定时线程负责；CurrentThreadEx时批仍然在调用run()的线程上执行
+template <typename ExecutorT>
+class BatchStageT : public StageBase, public ElasticStage {
+public:
+    using Func = std::function<void(const int*, size_t)>;
+
+    BatchStageT(const std::string& name, int threads, int capacity, size_t maxBatch,
+        std::chrono::microseconds maxDelay, Func func)
+        : name_(name)
+        , executor_(threads)
+        , func_(std::move(func))
+        , maxBatch_(maxBatch < 1 ? 1 : maxBatch)
+        , maxDelay_(maxDelay)
+        , traceId_(traceStage(name))
+    {
+        executor_.taskQueue.setCapacity(capacity);
+        pending_.reserve(maxBatch_);
+        timer_ = std::thread([this]() {
+            timerLoop();
+        });
+    }
+
+    ~BatchStageT()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            stopping_ = true;
+        }
+        timerCV_.notify_all();
+        timer_.join();
+    }
+
+    void setTaskCount(int n)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            streaming_ = false;
+            expected_ = received_ + n;
+        }
+        executor_.setTaskCount(n);
+    }
+
+    void addTaskCount(int n) override
+    {
+        outputs_.addTaskCount(n);
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            streaming_ = false;
+            expected_ += n;
+        }
+        executor_.addTaskCount(n);
+    }
+
+    void openStream() override
+    {
+        if (openInputs_++ == 0) {
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                streaming_ = true;
+            }
+            executor_.openStream();
+            outputs_.openStream();
+        }
+    }
+
+    // 先提交攒了一半的批，再像StageT一样排空后关闭下游
+    void close() override
+    {
+        if (--openInputs_ > 0) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            submit();
+        }
+        typename StageOutputs<int>::Targets next = outputs_.list();
+        executor_.close([next]() {
+            StageOutputs<int>::closeAll(next);
+        });
+    }
+
+    void push(int index) override
+    {
+        gates_.acquire(index, index + 1);
+        TraceSpan trace(TraceKind::Push, traceId_, index);
+        std::lock_guard<std::mutex> lock(mtx_);
+        add(index);
+        flushIfLast();
+    }
+
+    // 有准入限制时按取得许可的部分分段加入，与StageT相同
+    void pushRange(int begin, int end, int = 0) override
+    {
+        while (begin < end) {
+            int stop = gates_.acquire(begin, end);
+            TraceSpan trace(TraceKind::Push, traceId_, begin, stop - begin);
+            std::lock_guard<std::mutex> lock(mtx_);
+            for (int i = begin; i < stop; ++i) {
+                add(i);
+            }
+            flushIfLast();
+            begin = stop;
+        }
+    }
+
+    // 下游OrderedStage的准入限制传给上游，批中的索引因此都在重排窗口内，见OrderedStageT
+    // window小于maxBatch时批攒不满，要等maxDelay或最后一个索引才提交
+    void linkFrom(StageInput<int>* upstream) override
+    {
+        gates_.linkFrom(upstream);
+    }
+
+    void addGate(AdmissionGate* gate) override
+    {
+        gates_.add(gate);
+    }
+
+    void linkFromUngated() override
+    {
+        gates_.linkFromUngated();
+    }
+
+    // 上游丢弃了一个值：按一个索引计数，执行时继续通知下游
+    void skip() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            ++received_;
+            flushIfLast();
+        }
+        executor_.pushTask([this]() {
+            outputs_.skip();
+        });
+    }
+
+    void acceptSkips() override
+    {
+        outputs_.sendSkips();
+    }
+
+    // 要先攒成批，不能与上游融合，照常加入当前批
+    void runFused(int begin, int end) override
+    {
+        pushRange(begin, end);
+    }
+
+    size_t queueDepth() const override
+    {
+        return executor_.taskQueue.size();
+    }
+
+    void setCapacity(size_t capacity)
+    {
+        executor_.taskQueue.setCapacity(capacity);
+    }
+
+    void setBatchForward(BatchForward forward)
+    {
+        forward_ = forward;
+    }
+
+    void wait()
+    {
+        executor_.wait();
+    }
+
+    // 对于CurrentThreadEx，需要手动调用run
+    void run()
+    {
+        executor_.run();
+    }
+
+    // 对于CurrentThreadEx：不阻塞地执行已入队的任务，与StageT相同
+    size_t runFor(std::chrono::microseconds budget)
+    {
+        return executor_.runFor(budget);
+    }
+
+    size_t runAvailable(size_t maxTasks = SIZE_MAX)
+    {
+        return executor_.runAvailable(maxTasks);
+    }
+
+    int wakeFd()
+    {
+        return executor_.wakeFd();
+    }
+
+    bool drained() const
+    {
+        return executor_.drained();
+    }
+
+    void setNext(StageInput<int>* next)
+    {
+        outputs_.set(next);
+        if (next)
+            next->linkFrom(this);
+    }
+
+    void addNext(StageInput<int>* next)
+    {
+        outputs_.add(next);
+        next->linkFrom(this);
+    }
+
+    void setRouting(Routing routing, StageOutputs<int>::KeyFunc key = nullptr)
+    {
+        outputs_.setRouting(routing, std::move(key));
+    }
+
+    const std::string& name() const
+    {
+        return name_;
+    }
+
+    void enableMetrics(bool enable) override
+    {
+        metricsEnabled_ = enable;
+    }
+
+    // 耗时按批记录，一批计为一个任务；batchItems / (batches * maxBatch)是批的平均填充率
+    StageReport report() const override
+    {
+        StageReport r = makeReport(name_, executor_, serviceTime_);
+        r.batches = batches_.load(std::memory_order_relaxed);
+        r.batchItems = batchItems_.load(std::memory_order_relaxed);
+        r.batchTimeouts = batchTimeouts_.load(std::memory_order_relaxed);
+        r.maxBatch = maxBatch_;
+        return r;
+    }
+
+    // 出错或已取消的批中的索引照常传给下游，记录的索引是批中的第一个
+    void setErrorSink(ErrorSink* sink) override
+    {
+        errors_ = sink;
+    }
+
+    bool addThread() override
+    {
+        return executor_.addThread();
+    }
+
+    bool removeThread() override
+    {
+        return executor_.removeThread();
+    }
+
+private:
+    // 以下各函数在持有mtx_时调用
+    void add(int index)
+    {
+        if (pending_.empty()) {
+            deadline_ = std::chrono::steady_clock::now() + maxDelay_;
+            timerCV_.notify_one();
+        }
+        pending_.push_back(index);
+        ++received_;
+        if (pending_.size() >= maxBatch_) {
+            submit();
+        }
+    }
+
+    // 计数模式下已收到全部索引，剩余的部分不必再等待
+    void flushIfLast()
+    {
+        if (!streaming_ && received_ >= expected_) {
+            submit();
+        }
+    }
+
+    // 在锁内入队：close()提交最后一批后，不会再有定时线程或上游的批在它之后入队
+    // 输入队列满时上游在这里阻塞，与StageT相同
+    void submit()
+    {
+        if (pending_.empty())
+            return;
+        std::vector<int> batch;
+        batch.reserve(maxBatch_);
+        batch.swap(pending_);
+        int n = (int)batch.size();
+        batches_.fetch_add(1, std::memory_order_relaxed);
+        batchItems_.fetch_add(n, std::memory_order_relaxed);
+        auto shared = std::make_shared<std::vector<int>>(std::move(batch));
+        executor_.pushChunk([this, shared]() {
+            runBatch(*shared);
+        },
+            n);
+    }
+
+    void timerLoop()
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        while (!stopping_) {
+            if (pending_.empty()) {
+                timerCV_.wait(lock);
+            } else if (std::chrono::steady_clock::now() < deadline_) {
+                timerCV_.wait_until(lock, deadline_);
+            } else {
+                batchTimeouts_.fetch_add(1, std::memory_order_relaxed);
+                submit();
+            }
+        }
+    }
+
+    void runBatch(const std::vector<int>& batch)
+    {
+        {
+            TraceSpan trace(TraceKind::Run, traceId_, batch.front(), (int)batch.size());
+            if (metricsEnabled_.load(std::memory_order_relaxed)) {
+                auto start = std::chrono::steady_clock::now();
+                invoke(batch);
+                serviceTime_.record(elapsedNanos(start));
+            } else {
+                invoke(batch);
+            }
+        }
+        if (forward_ == BatchForward::Each) {
+            for (int index : batch) {
+                outputs_.push(std::move(index));
+            }
+            return;
+        }
+        size_t b = 0;
+        for (size_t i = 1; i <= batch.size(); ++i) {
+            if (i == batch.size() || batch[i] != batch[i - 1] + 1) {
+                outputs_.pushRange(batch[b], batch[i - 1] + 1);
+                b = i;
+            }
+        }
+    }
+
+    void invoke(const std::vector<int>& batch)
+    {
+        if (!errors_) {
+            func_(batch.data(), batch.size());
+            return;
+        }
+        if (errors_->cancelled()) {
+            return;
+        }
+        try {
+            func_(batch.data(), batch.size());
+        } catch (...) {
+            errors_->record(name_, batch.front(), std::current_exception());
+        }
+    }
+
+    std::string name_;
+    ExecutorT executor_;
+    Func func_;
+    StageOutputs<int> outputs_;
+    size_t maxBatch_;
+    std::chrono::microseconds maxDelay_;
+    BatchForward forward_ = BatchForward::Each;
+    ErrorSink* errors_ = nullptr;
+    AdmissionGates gates_;
+    uint32_t traceId_;
+    std::atomic<bool> metricsEnabled_ { false };
+    LatencyHistogram serviceTime_;
+    std::atomic<int> openInputs_ { 0 };
+    std::atomic<uint64_t> batches_ { 0 };
+    std::atomic<uint64_t> batchItems_ { 0 };
+    std::atomic<uint64_t> batchTimeouts_ { 0 };
+
+    std::mutex mtx_; // 保护以下成员
+    std::condition_variable timerCV_;
+    std::vector<int> pending_; // 正在攒的批
+    std::chrono::steady_clock::time_point deadline_; // 当前批最迟的提交时间
+    long long received_ = 0; // 已收到的索引数（含skip），计数模式下与expected_比较
+    long long expected_ = 0;
+    bool streaming_ = false;
+    bool stopping_ = false;
+    std::thread timer_; // 最后构造，它会访问以上所有成员
+};
+
+using Stage = StageT<ThreadPoolEx<BoundedTaskQueue>>;
+using StageCurrent = StageT<CurrentThreadEx<BoundedTaskQueue>>;
+using StageLockFree = StageT<ThreadPoolEx<LockFreeTaskQueue>>;
+using StageWorkStealing = StageT<WorkStealingThreadPoolEx<BoundedTaskQueue>>;
+using JoinStage = JoinStageT<ThreadPoolEx<BoundedTaskQueue>>;
+using OrderedStage = OrderedStageT<ThreadPoolEx<BoundedTaskQueue>>;
+using OrderedStageCurrent = OrderedStageT<CurrentThreadEx<BoundedTaskQueue>>;
+using StageShared = StageT<SharedExecutorEx<BoundedTaskQueue>>;
+using BatchStage = BatchStageT<ThreadPoolEx<BoundedTaskQueue>>;
+using BatchStageCurrent = BatchStageT<CurrentThreadEx<BoundedTaskQueue>>;
+
+// 流水线级的内存预算：各阶段队列中的数据按字节计入同一个预算，而不是每个队列各自限制任务数
+// 数据大小相差很大时，按任务数限制要么浪费内存，要么让流水线停顿
+// 超过预算时acquire阻塞，直到其他数据被处理完释放；单个数据超过整个预算时在预算空闲时放行
+// 共用预算的阶段之间转交数据时不等待（见Holder）：否则上游队列占满预算而下游为空时，
+// 上游的工作线程都在等下游的预算，谁也不会释放，所以背压施加在流水线入口，内部最多超出每个工作线程一个数据
+class MemoryBudget {
+public:
+    // 工作线程执行使用本预算的阶段的任务期间持有，此时该线程上的acquire直接计入而不等待
+    class Holder {
+    public:
+        explicit Holder(MemoryBudget* budget)
+            : prev(current())
+        {
+            current() = budget;
+        }
+
+        ~Holder()
+        {
+            current() = prev;
+        }
+
+        Holder(const Holder&) = delete;
+        Holder& operator=(const Holder&) = delete;
+
+    private:
+        MemoryBudget* prev;
+    };
+
+    explicit MemoryBudget(size_t limitBytes)
+        : limitBytes(limitBytes)
+    {
+    }
+
+    // 可以在运行中调整，扩大时唤醒等待者
+    void setLimit(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        limitBytes = bytes;
+        cv.notify_all();
+    }
+
+    size_t limit() const
+    {
+        return limitBytes.load(std::memory_order_relaxed);
+    }
+
+    size_t used() const
+    {
+        return usedBytes.load(std::memory_order_relaxed);
+    }
+
+    size_t peak() const
+    {
+        return peakBytes.load(std::memory_order_relaxed);
+    }
+
+    void acquire(size_t bytes)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (current() != this)
+            cv.wait(lock, [&] { return fits(bytes); });
+        add(bytes);
+    }
+
+    // 等待最多timeout，超时返回false
+    template <typename Rep, typename Period>
+    bool acquireFor(size_t bytes, std::chrono::duration<Rep, Period> timeout)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (!cv.wait_for(lock, timeout, [&] { return fits(bytes); }))
+            return false;
+        add(bytes);
+        return true;
+    }
+
+    bool tryAcquire(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!fits(bytes))
+            return false;
+        add(bytes);
+        return true;
+    }
+
+    void release(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        usedBytes.fetch_sub(bytes, std::memory_order_relaxed);
+        cv.notify_all();
+    }
+
+private:
+    static MemoryBudget*& current()
+    {
+        static thread_local MemoryBudget* budget = nullptr;
+        return budget;
+    }
+
+    // 持锁调用
+    bool fits(size_t bytes) const
+    {
+        size_t used = usedBytes.load(std::memory_order_relaxed);
+        return used == 0 || used + bytes <= limitBytes.load(std::memory_order_relaxed);
+    }
+
+    void add(size_t bytes)
+    {
+        size_t now = usedBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        if (now > peakBytes.load(std::memory_order_relaxed))
+            peakBytes.store(now, std::memory_order_relaxed);
+    }
+
+    std::atomic<size_t> limitBytes;
+    std::atomic<size_t> usedBytes { 0 };
+    std::atomic<size_t> peakBytes { 0 };
+    std::mutex mtx;
+    std::condition_variable cv;
+};
+
+// 从MemoryBudget中占用的一段字节，只可移动，析构时归还
+class MemoryLease {
+public:
+    MemoryLease() = default;
+
+    MemoryLease(MemoryBudget* budget, size_t bytes)
+        : budget(budget)
+        , bytes(bytes)
+    {
+    }
+
+    MemoryLease(MemoryLease&& other) noexcept
+        : budget(other.budget)
+        , bytes(other.bytes)
+    {
+        other.budget = nullptr;
+    }
+
+    MemoryLease& operator=(MemoryLease&& other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            budget = other.budget;
+            bytes = other.bytes;
+            other.budget = nullptr;
+        }
+        return *this;
+    }
+
+    MemoryLease(const MemoryLease&) = delete;
+    MemoryLease& operator=(const MemoryLease&) = delete;
+
+    ~MemoryLease()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        if (budget) {
+            budget->release(bytes);
+            budget = nullptr;
+        }
+    }
+
+private:
+    MemoryBudget* budget = nullptr;
+    size_t bytes = 0;
+};
+
+// 携带数据的Stage：函数接收In&&并返回Out，返回值被移动到下游阶段的队列中
+// 数据随任务在阶段之间移动而不复制，不需要按索引访问的全局数组，
+// 内存占用只与正在流水线中的数据量有关
+template <typename In, typename Out, typename ExecutorT = ThreadPoolEx<BoundedTaskQueue>>
+class TypedStage : public StageInput<In>, public ElasticStage {
+public:
+    using Func = std::function<Out(In&&)>;
+
+    // 构造函数 - 对于ThreadPoolEx需要num_workers，对于CurrentThreadEx不需要
+    TypedStage(const std::string& name, int threads, int capacity, Func func)
+        : name_(name)
+        , executor_(threads)
+        , func_(std::move(func))
+        , traceId_(traceStage(name))
+    {
+        executor_.taskQueue.setCapacity(capacity);
+        setQueueDropHandler(executor_.taskQueue, [this](uint32_t weight) { dropped(weight); }, 0);
+    }
+
+    // 对于SharedExecutorEx：在共享线程池上执行，concurrency是本阶段的并发上限
+    TypedStage(const std::string& name, SharedThreadPool& pool, int concurrency, int capacity, Func func)
+        : name_(name)
+        , executor_(pool, concurrency)
+        , func_(std::move(func))
+        , traceId_(traceStage(name))
+    {
+        executor_.taskQueue.setCapacity(capacity);
+        setQueueDropHandler(executor_.taskQueue, [this](uint32_t weight) { dropped(weight); }, 0);
+    }
+
+    void setTaskCount(int n)
+    {
+        executor_.setTaskCount(n);
+    }
+
+    void addTaskCount(int n) override
+    {
+        outputs_.addTaskCount(n); // 先推导下游：路由方式无法推导时在这里抛出，本阶段的计数不变
+        executor_.addTaskCount(n);
+    }
+
+    void openStream() override
+    {
+        if (openInputs_++ == 0) {
+            executor_.openStream();
+            outputs_.openStream();
+        }
+    }
+
+    void close() override
+    {
+        if (--openInputs_ > 0) {
+            return;
+        }
+        typename StageOutputs<Out>::Targets next = outputs_.list();
+        executor_.close([next]() {
+            StageOutputs<Out>::closeAll(next);
+        });
+    }
+
+    void push(In value) override
+    {
+        TraceSpan trace(TraceKind::Push, traceId_);
+        MemoryLease lease = acquire(value);
+        executor_.pushTask(Item { this, std::move(value), std::move(lease) });
+    }
+
+    void skip() override
+    {
+        executor_.pushTask([this]() {
+            outputs_.skip();
+        });
+    }
+
+    // 运行中调整输入队列的容量
+    void setCapacity(size_t capacity)
+    {
+        executor_.taskQueue.setCapacity(capacity);
+    }
+
+    // 输入队列满时的处理方式（BoundedTaskQueue），见FullPolicy；计数模式下被丢弃的值会通知下游
+    // 下游的限制与StageT::setFullPolicy相同
+    void setFullPolicy(FullPolicy policy, std::chrono::nanoseconds timeout = std::chrono::nanoseconds(0))
+    {
+        if (policy != FullPolicy::Block)
+            outputs_.sendSkips();
+        executor_.taskQueue.setFullPolicy(policy, timeout);
+    }
+
+    void acceptSkips() override
+    {
+        outputs_.sendSkips();
+    }
+
+    // 批量推送，values中的值会被移走
+    void pushBatch(std::vector<In>& values)
+    {
+        std::vector<Task> tasks;
+        tasks.reserve(values.size());
+        for (auto& value : values) {
+            MemoryLease lease = acquire(value);
+            tasks.emplace_back(Item { this, std::move(value), std::move(lease) });
+        }
+        executor_.pushTasks(tasks.begin(), tasks.end());
+    }
+
+    void wait()
+    {
+        executor_.wait();
+    }
+
+    // 对于CurrentThreadEx，需要手动调用run
+    void run()
+    {
+        executor_.run();
+    }
+
+    // 对于CurrentThreadEx：不阻塞地执行已入队的任务，与StageT相同
+    size_t runFor(std::chrono::microseconds budget)
+    {
+        return executor_.runFor(budget);
+    }
+
+    size_t runAvailable(size_t maxTasks = SIZE_MAX)
+    {
+        return executor_.runAvailable(maxTasks);
+    }
+
+    int wakeFd()
+    {
+        return executor_.wakeFd();
+    }
+
+    bool drained() const
+    {
+        return executor_.drained();
+    }
+
+    // 输入队列中的数据按weigh(value)字节计入budget，多个阶段可以共用一个预算
+    // 预算用完时push阻塞（共用预算的上游阶段除外）；阶段函数返回后、推送到下游之前归还
+    // 共用预算的阶段之间不能夹着不使用该预算的阶段，否则它的线程可能与上游互相等待；可以让它的weigh返回0
+    void setMemoryBudget(MemoryBudget& budget, std::function<size_t(const In&)> weigh)
+    {
+        budget_ = &budget;
+        weigh_ = std::move(weigh);
+    }
+
+    void setNext(StageInput<Out>* next)
+    {
+        outputs_.set(next);
+    }
+
+    void addNext(StageInput<Out>* next)
+    {
+        outputs_.add(next);
+    }
+
+    // 参数与StageOutputs<Out>::setRouting相同；Out为void时只接受路由方式
+    template <typename... Args>
+    void setRouting(Args&&... args)
+    {
+        outputs_.setRouting(std::forward<Args>(args)...);
+    }
+
+    const std::string& name() const
+    {
+        return name_;
+    }
+
+    void enableMetrics(bool enable) override
+    {
+        metricsEnabled_ = enable;
+    }
+
+    StageReport report() const override
+    {
+        return makeReport(name_, executor_, serviceTime_);
+    }
+
+    // 出错或已取消时没有输出，改为通知下游少了一个值；下游的限制与setFullPolicy相同
+    void setErrorSink(ErrorSink* sink) override
+    {
+        if (sink)
+            outputs_.sendSkips();
+        errors_ = sink;
+    }
+
+    bool addThread() override
+    {
+        return executor_.addThread();
+    }
+
+    bool removeThread() override
+    {
+        return executor_.removeThread();
+    }
+
+    // 放置本阶段的工作线程，例如Placement::sameNodeAs(upstream)让本阶段与上游共用一个节点
+    void setPlacement(const Placement& p)
+    {
+        executor_.setPlacement(p);
+    }
+
+    int numaNode() const
+    {
+        return executor_.numaNode();
+    }
+
+private:
+    // 队列中的任务：C++11的lambda不能按移动捕获，用函数对象携带数据
+    struct Item {
+        TypedStage* stage;
+        In value;
+        MemoryLease lease;
+        void operator()()
+        {
+            MemoryBudget::Holder holder(stage->budget_);
+            stage->run(std::move(value), lease, std::is_void<Out>());
+        }
+    };
+
+    MemoryLease acquire(const In& value)
+    {
+        if (!budget_)
+            return MemoryLease();
+        size_t bytes = weigh_(value);
+        budget_->acquire(bytes);
+        return MemoryLease(budget_, bytes);
+    }
+
+    // 输入队列按FullPolicy丢弃了一个任务：计数模式下通知下游少了weight个值
+    void dropped(uint32_t weight)
+    {
+        if (openInputs_.load() == 0) {
+            for (uint32_t i = 0; i < weight; ++i) {
+                outputs_.skip();
+            }
+        }
+        executor_.release();
+    }
+
+    void run(In&& value, MemoryLease& lease, std::false_type)
+    {
+        if (!errors_) {
+            Out out = call(std::move(value), std::false_type());
+            lease.reset();
+            outputs_.push(std::move(out));
+            return;
+        }
+        bool produced = false;
+        try {
+            if (!errors_->cancelled()) {
+                Out out = call(std::move(value), std::false_type());
+                produced = true;
+                lease.reset();
+                outputs_.push(std::move(out));
+                return;
+            }
+        } catch (...) {
+            if (produced) {
+                throw; // 只捕获阶段函数的异常
+            }
+            errors_->record(name_, -1, std::current_exception());
+        }
+        outputs_.skip();
+    }
+
+    void run(In&& value, MemoryLease& lease, std::true_type)
+    {
+        lease.reset(); // 没有输出，排队的数据可以立即归还
+        if (!errors_) {
+            call(std::move(value), std::true_type());
+            outputs_.push();
+            return;
+        }
+        bool ok = false;
+        if (!errors_->cancelled()) {
+            try {
+                call(std::move(value), std::true_type());
+                ok = true;
+            } catch (...) {
+                errors_->record(name_, -1, std::current_exception());
+            }
+        }
+        if (ok) {
+            outputs_.push();
+        } else {
+            outputs_.skip();
+        }
+    }
+
+    // 执行阶段函数并记录耗时
+    Out call(In&& value, std::false_type)
+    {
+        TraceSpan trace(TraceKind::Run, traceId_);
+        if (metricsEnabled_.load(std::memory_order_relaxed)) {
+            auto start = std::chrono::steady_clock::now();
+            Out out = func_(std::move(value));
+            serviceTime_.record(elapsedNanos(start));
+            return out;
+        }
+        return func_(std::move(value));
+    }
+
+    void call(In&& value, std::true_type)
+    {
+        TraceSpan trace(TraceKind::Run, traceId_);
+        if (metricsEnabled_.load(std::memory_order_relaxed)) {
+            auto start = std::chrono::steady_clock::now();
+            func_(std::move(value));
+            serviceTime_.record(elapsedNanos(start));
+        } else {
+            func_(std::move(value));
+        }
+    }
+
+    std::string name_;
+    ExecutorT executor_;
+    Func func_;
+    StageOutputs<Out> outputs_;
+    std::atomic<bool> metricsEnabled_ { false };
+    LatencyHistogram serviceTime_;
+    std::atomic<int> openInputs_ { 0 };
+    ErrorSink* errors_ = nullptr;
+    MemoryBudget* budget_ = nullptr;
+    std::function<size_t(const In&)> weigh_;
+    uint32_t traceId_;
+};
+
+template <typename In, typename Out>
+using TypedStageCurrent = TypedStage<In, Out, CurrentThreadEx<BoundedTaskQueue>>;
+
+template <typename In, typename Out>
+using TypedStageShared = TypedStage<In, Out, SharedExecutorEx<BoundedTaskQueue>>;
+
+template <typename T, typename WaitPolicyT>
+class ObjectPool;
+
+// 从ObjectPool借出的对象，只可移动，析构或reset()时归还给对象池
+// 作为TypedStage的数据在阶段之间移动，最后一个阶段处理完后自动归还给第一个阶段
+template <typename T, typename WaitPolicyT = BlockingWait>
+class Pooled {
+public:
+    Pooled() = default;
+
+    Pooled(Pooled&& other) noexcept
+        : pool(other.pool)
+        , object(other.object)
+    {
+        other.pool = nullptr;
+        other.object = nullptr;
+    }
+
+    Pooled& operator=(Pooled&& other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            pool = other.pool;
+            object = other.object;
+            other.pool = nullptr;
+            other.object = nullptr;
+        }
+        return *this;
+    }
+
+    Pooled(const Pooled&) = delete;
+    Pooled& operator=(const Pooled&) = delete;
+
+    ~Pooled()
+    {
+        reset();
+    }
+
+    T& operator*() const
+    {
+        return *object;
+    }
+
+    T* operator->() const
+    {
+        return object;
+    }
+
+    T* get() const
+    {
+        return object;
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return object != nullptr;
+    }
+
+    // 提前归还
+    void reset()
+    {
+        if (object) {
+            pool->release(object);
+            pool = nullptr;
+            object = nullptr;
+        }
+    }
+
+private:
+    friend class ObjectPool<T, WaitPolicyT>;
+
+    Pooled(ObjectPool<T, WaitPolicyT>* pool, T* object)
+        : pool(pool)
+        , object(object)
+    {
+    }
+
+    ObjectPool<T, WaitPolicyT>* pool = nullptr;
+    T* object = nullptr;
+};
+
+// 流水线级的对象池：构造时预先分配固定数量的对象（例如大块缓冲区），之后只借出和归还，不再分配
+// 对象池为空时acquire阻塞，给读取阶段施加背压，流水线中同时存在的对象数不超过对象池的容量
+// 容量应不小于各阶段队列容量与线程数之和，否则流水线的并行度受对象池限制
+// 对象池必须比所有借出的Pooled活得更久
+template <typename T, typename WaitPolicyT = BlockingWait>
+class ObjectPool {
+public:
+    using Handle = Pooled<T, WaitPolicyT>;
+    using Recycle = std::function<void(T&)>;
+
+    // 用make()创建count个对象
+    template <typename Factory>
+    ObjectPool(size_t count, Factory make)
+    {
+        objects.reserve(count);
+        freeList.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            objects.emplace_back(new T(make()));
+            freeList.push_back(objects.back().get());
+        }
+        freeCount = count;
+    }
+
+    explicit ObjectPool(size_t count)
+        : ObjectPool(count, [] { return T(); })
+    {
+    }
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    // 归还时对对象调用recycle（例如清空内容但保留容量），在归还的线程上执行；须在借出对象之前设置
+    void setRecycle(Recycle recycle)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        this->recycle = std::move(recycle);
+    }
+
+    // 借出一个对象，对象池为空时阻塞；对象池已关闭时返回空的Pooled
+    Handle acquire()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        waitPolicy.wait(
+            lock, cv, [this] { return !freeList.empty() || closed; },
+            [this] { return freeCount.load(std::memory_order_relaxed) > 0 || closed.load(std::memory_order_relaxed); });
+        if (closed || freeList.empty())
+            return Handle();
+        return take();
+    }
+
+    // 非阻塞借出，对象池为空时返回空的Pooled
+    Handle tryAcquire()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (freeList.empty() || closed)
+            return Handle();
+        return take();
+    }
+
+    // 唤醒所有阻塞在acquire中的线程，之后的acquire返回空的Pooled；归还不受影响
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        closed = true;
+        cv.notify_all();
+    }
+
+    size_t capacity() const
+    {
+        return objects.size();
+    }
+
+    size_t available() const
+    {
+        return freeCount.load(std::memory_order_relaxed);
+    }
+
+    // acquire因对象池为空而等待的统计
+    WaitStats stats() const
+    {
+        return waitPolicy.stats();
+    }
+
+private:
+    friend class Pooled<T, WaitPolicyT>;
+
+    // 持锁调用
+    Handle take()
+    {
+        T* object = freeList.back();
+        freeList.pop_back();
+        freeCount.store(freeList.size(), std::memory_order_relaxed);
+        return Handle(this, object);
+    }
+
+    void release(T* object)
+    {
+        if (recycle) {
+            recycle(*object);
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        freeList.push_back(object); // 容量已预留，不会分配
+        freeCount.store(freeList.size(), std::memory_order_relaxed);
+        cv.notify_one();
+    }
+
+    std::vector<std::unique_ptr<T>> objects;
+    std::vector<T*> freeList; // 后进先出，最近归还的对象更可能还在缓存中
+    std::atomic<size_t> freeCount { 0 }; // freeList长度的无锁副本，供自旋等待读取
+    std::atomic<bool> closed { false };
+    Recycle recycle;
+    std::mutex mtx;
+    std::condition_variable cv;
+    WaitPolicyT waitPolicy;
+};
+
+// 通用的chain函数，支持不同类型的StageT和TypedStage
+template <typename Stage1, typename Stage2>
+void chain(Stage1& a, Stage2& b)
+{
+    a.setNext(&b);
+}
+
+// 融合两个相邻的索引阶段：a的任务执行完后直接在a的工作线程上执行b，省去一次闭包、入队和唤醒，
+// 同一个核心连续访问同一份数据；b的耗时仍然记在b的名下，b的wait/close/计数照常工作
+// b的func会以a的并发度执行，必须可以被这么多线程同时调用
+// b使用CurrentThreadEx，或者是JoinStage/OrderedStage时不融合，照常入队
+template <typename Stage1, typename Stage2>
+void fuse(Stage1& a, Stage2& b, Fusion fusion = Fusion::Always)
+{
+    a.fuseNext(&b, fusion);
+}
+
+// 流水线监控：登记的阶段开启耗时统计，report()输出各阶段指标并指出瓶颈
+// 只保存阶段的指针，阶段的生命周期由调用方管理
+class Pipeline {
+public:
+    Pipeline()
+        : start_(std::chrono::steady_clock::now())
+    {
+    }
+
+    // 登记阶段并开启指标，不改变阶段的异常处理方式
+    Pipeline& add(ReportableStage& stage)
+    {
+        stage.enableMetrics(true);
+        stages_.push_back(&stage);
+        return *this;
+    }
+
+    // 把阶段的异常接到本流水线的errors()，等同于stage.setErrorSink(&pipeline.errors())
+    // TypedStage出错时改为skip，下游不能处理时抛出，见TypedStage::setErrorSink
+    Pipeline& captureErrors(ReportableStage& stage)
+    {
+        stage.setErrorSink(&errors_);
+        return *this;
+    }
+
+    // 各阶段抛出的异常，以及取消整个流水线的令牌
+    ErrorSink& errors()
+    {
+        return errors_;
+    }
+
+    const ErrorSink& errors() const
+    {
+        return errors_;
+    }
+
+    // 例如在captureErrors之前设置ErrorPolicy::AbortOnFirst：第一个异常后所有阶段丢弃剩余任务
+    void setErrorPolicy(ErrorPolicy policy)
+    {
+        errors_.setPolicy(policy);
+    }
+
+    std::vector<StageReport> snapshot() const
+    {
+        std::vector<StageReport> reports;
+        for (auto* stage : stages_) {
+            reports.push_back(stage->report());
+        }
+        return reports;
+    }
+
+    // 利用率 = 任务耗时总和 / (运行时间 * 线程数)
+    double utilization(const StageReport& r) const
+    {
+        double capacity = (double)elapsedNanos(start_) * (r.threads ? r.threads : 1);
+        return capacity > 0 ? r.busyNanos / capacity : 0.0;
+    }
+
+    // 利用率最高的阶段即瓶颈：增加它的线程数收益最大，它上游的阶段会在push时阻塞
+    std::string bottleneck() const
+    {
+        std::string name;
+        double best = -1;
+        for (const auto& r : snapshot()) {
+            double u = utilization(r);
+            if (u > best) {
+                best = u;
+                name = r.name;
+            }
+        }
+        return name;
+    }
+
+    void report(std::ostream& os = std::cout) const
+    {
+        std::vector<StageReport> reports = snapshot();
+        os << std::left << std::setw(12) << "stage" << std::right
+           << std::setw(8) << "threads" << std::setw(10) << "tasks"
+           << std::setw(11) << "mean(us)" << std::setw(10) << "p50(us)" << std::setw(10) << "p99(us)"
+           << std::setw(7) << "util" << std::setw(7) << "depth" << std::setw(7) << "peak" << std::setw(7) << "cap"
+           << std::setw(13) << "blocked(ms)" << std::setw(10) << "idle(ms)" << "\n";
+        std::string worst;
+        double best = -1;
+        for (const auto& r : reports) {
+            double u = utilization(r);
+            if (u > best) {
+                best = u;
+                worst = r.name;
+            }
+            os << std::left << std::setw(12) << r.name << std::right << std::fixed << std::setprecision(1)
+               << std::setw(8) << r.threads << std::setw(10) << r.tasks
+               << std::setw(11) << r.meanNanos / 1e3 << std::setw(10) << r.p50Nanos / 1e3 << std::setw(10) << r.p99Nanos / 1e3
+               << std::setw(6) << std::setprecision(0) << u * 100 << "%"
+               << std::setw(7) << r.queue.depth << std::setw(7) << r.queue.peakDepth << std::setw(7) << r.queue.capacity
+               << std::setprecision(1)
+               << std::setw(13) << r.queue.producer.waitNanos / 1e6 << std::setw(10) << r.queue.consumer.waitNanos / 1e6 << "\n";
+        }
+        for (const auto& r : reports) {
+            if (r.batches == 0)
+                continue;
+            os << "batch " << r.name << ": " << r.batches << " batches, fill " << std::fixed << std::setprecision(0)
+               << 100.0 * r.batchItems / (r.batches * r.maxBatch) << "% (" << std::setprecision(1)
+               << (double)r.batchItems / r.batches << " of " << r.maxBatch << "), " << std::setprecision(0)
+               << 100.0 * r.batchTimeouts / r.batches << "% flushed by timeout\n";
+        }
+        os.unsetf(std::ios::floatfield);
+        if (!worst.empty()) {
+            os << "bottleneck: " << worst << " (" << (int)(best * 100) << "% busy)\n";
+        }
+    }
+
+private:
+    std::chrono::steady_clock::time_point start_;
+    std::vector<ReportableStage*> stages_;
+    ErrorSink errors_;
+};
+
+// 弹性调度：在全局线程预算内按队列占用情况调整各阶段的线程数
+// 输入队列持续满（或上游push被阻塞）的阶段获得线程，输入队列为空且利用率低的阶段让出线程
+// 每次调整最多移动一个线程，避免来回振荡
+class ElasticScheduler {
+public:
+    explicit ElasticScheduler(size_t threadBudget,
+        std::chrono::milliseconds interval = std::chrono::milliseconds(20))
+        : budget_(threadBudget)
+        , interval_(interval)
+        , lastTick_(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~ElasticScheduler()
+    {
+        stop();
+    }
+
+    ElasticScheduler(const ElasticScheduler&) = delete;
+    ElasticScheduler& operator=(const ElasticScheduler&) = delete;
+
+    // 登记阶段及其线程数范围（在start之前调用），当前线程数会被调整到范围内
+    // 同时开启阶段的耗时统计，利用率由它计算
+    ElasticScheduler& add(ElasticStage& stage, size_t minThreads, size_t maxThreads)
+    {
+        Entry e;
+        e.stage = &stage;
+        e.minThreads = minThreads < 1 ? 1 : minThreads;
+        e.maxThreads = maxThreads < e.minThreads ? e.minThreads : maxThreads;
+        stage.enableMetrics(true);
+        while (threadsOf(e) < e.minThreads && stage.addThread()) {
+        }
+        while (threadsOf(e) > e.maxThreads && stage.removeThread()) {
+        }
+        StageReport r = stage.report();
+        e.lastBlocked = r.queue.producer.waitNanos;
+        e.lastBusy = r.busyNanos;
+        entries_.push_back(e);
+        return *this;
+    }
+
+    // 启动后台线程，每隔interval调用一次rebalance
+    void start()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (thread_.joinable())
+            return;
+        running_ = true;
+        thread_ = std::thread([this] {
+            std::unique_lock<std::mutex> lock(mtx_);
+            while (!cv_.wait_for(lock, interval_, [this] { return !running_; })) {
+                lock.unlock();
+                rebalance();
+                lock.lock();
+            }
+        });
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            running_ = false;
+            cv_.notify_all();
+        }
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    // 执行一次调整；一般由start的后台线程调用，也可以在自己的循环中手动调用
+    void rebalance()
+    {
+        auto now = std::chrono::steady_clock::now();
+        double dt = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(now - lastTick_).count();
+        lastTick_ = now;
+        if (dt <= 0)
+            return;
+
+        size_t total = 0;
+        Entry* receiver = nullptr;
+        Entry* donor = nullptr;
+        double maxPressure = 0, minUtil = 1;
+        for (auto& e : entries_) {
+            StageReport r = e.stage->report();
+            size_t threads = r.threads ? r.threads : 1;
+            total += threads;
+            double blocked = (double)(r.queue.producer.waitNanos - e.lastBlocked) / dt;
+            double util = (double)(r.busyNanos - e.lastBusy) / (dt * threads);
+            e.lastBlocked = r.queue.producer.waitNanos;
+            e.lastBusy = r.busyNanos;
+            double occupancy = r.queue.capacity ? (double)r.queue.depth / r.queue.capacity
+                                                : (r.queue.depth > threads ? 1.0 : 0.0);
+            // 队列占用超过3/4或上游有超过10%的时间阻塞在push上
+            double pressure = occupancy + blocked;
+            if ((occupancy >= 0.75 || blocked > 0.1) && threads < e.maxThreads && pressure > maxPressure) {
+                maxPressure = pressure;
+                receiver = &e;
+            }
+            // 输入队列为空且一半以上的时间空闲
+            if (r.queue.depth == 0 && util < 0.5 && threads > e.minThreads && util < minUtil) {
+                minUtil = util;
+                donor = &e;
+            }
+        }
+
+        if (receiver && total < budget_) {
+            receiver->stage->addThread();
+        } else if (receiver && donor && donor != receiver) {
+            if (donor->stage->removeThread()) {
+                receiver->stage->addThread();
+            }
+        } else if (total > budget_ && donor) {
+            donor->stage->removeThread();
+        }
+    }
+
+private:
+    struct Entry {
+        ElasticStage* stage = nullptr;
+        size_t minThreads = 1, maxThreads = 1;
+        uint64_t lastBlocked = 0; // 上次调整时的producer.waitNanos
+        uint64_t lastBusy = 0; // 上次调整时的busyNanos
+    };
+
+    static size_t threadsOf(const Entry& e)
+    {
+        return e.stage->report().threads;
+    }
+
+    size_t budget_;
+    std::chrono::milliseconds interval_;
+    std::chrono::steady_clock::time_point lastTick_;
+    std::vector<Entry> entries_;
+    bool running_ = false;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::thread thread_;
+};
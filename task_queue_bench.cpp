@@ -0,0 +1,410 @@
+#include "task_queue.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 基准测试：队列吞吐量与延迟、线程池空任务开销、Stage流水线端到端吞吐量
+// 用法: task_queue_bench [--format csv|json] [--quick] [--repeat N] [--filter 子串]
+// 每个配置运行repeat次，输出吞吐量居中的一次，结果写到stdout，进度写到stderr
+
+namespace {
+
+struct Options {
+    bool json = false;
+    bool quick = false;
+    int repeat = 3;
+    std::string filter;
+};
+
+// 一行结果，不适用的字段为-1，输出时留空
+struct Result {
+    std::string suite;
+    std::string name;
+    int producers = -1;
+    int consumers = -1;
+    int threads = -1;
+    int stages = -1;
+    int capacity = -1;
+    long workNs = -1;
+    long ops = 0;
+    double seconds = 0;
+    double p50Ns = -1, p99Ns = -1, p999Ns = -1;
+
+    double opsPerSec() const
+    {
+        return seconds > 0 ? ops / seconds : 0;
+    }
+};
+
+uint64_t nowNanos()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// 忙等指定的纳秒数，模拟固定粒度的计算任务
+void spinFor(long ns)
+{
+    if (ns <= 0)
+        return;
+    uint64_t deadline = nowNanos() + (uint64_t)ns;
+    while (nowNanos() < deadline) {
+        cpuRelax();
+    }
+}
+
+double percentileOf(std::vector<uint64_t>& samples, double p)
+{
+    if (samples.empty())
+        return -1;
+    size_t i = (size_t)(p * (samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + i, samples.end());
+    return (double)samples[i];
+}
+
+// 多次运行取吞吐量居中的一次，减少偶然的调度抖动
+template <typename Fn>
+Result medianOf(int repeat, Fn run)
+{
+    std::vector<Result> runs;
+    for (int i = 0; i < repeat; ++i) {
+        runs.push_back(run());
+    }
+    std::sort(runs.begin(), runs.end(), [](const Result& a, const Result& b) {
+        return a.opsPerSec() < b.opsPerSec();
+    });
+    return runs[runs.size() / 2];
+}
+
+// ---------------------------------------------------------------------------
+// 队列：producers个线程各push ops/producers个任务，consumers个线程pop并执行
+// 每8个任务记录一次入队时间，消费者执行时计算入队到执行的延迟
+
+thread_local std::vector<uint64_t>* tlsSamples = nullptr;
+
+template <typename Queue>
+Result runQueue(const std::string& name, Queue& queue, int producers, int consumers, long ops)
+{
+    Result r;
+    r.suite = "queue";
+    r.name = name;
+    r.producers = producers;
+    r.consumers = consumers;
+    r.ops = ops / producers * producers;
+
+    std::vector<std::vector<uint64_t>> samples(consumers);
+    std::vector<std::thread> threads;
+    uint64_t start = nowNanos();
+    for (int c = 0; c < consumers; ++c) {
+        threads.emplace_back([&queue, &samples, c] {
+            tlsSamples = &samples[c];
+            while (Task task = queue.popTask()) {
+                task();
+            }
+            tlsSamples = nullptr;
+        });
+    }
+    std::vector<std::thread> producerThreads;
+    long perProducer = ops / producers;
+    for (int p = 0; p < producers; ++p) {
+        producerThreads.emplace_back([&queue, perProducer] {
+            for (long i = 0; i < perProducer; ++i) {
+                uint64_t t0 = (i & 7) == 0 ? nowNanos() : 0;
+                queue.pushTask([t0] {
+                    if (t0 && tlsSamples) {
+                        tlsSamples->push_back(nowNanos() - t0);
+                    }
+                });
+            }
+        });
+    }
+    for (auto& t : producerThreads) {
+        t.join();
+    }
+    queue.close(); // 消费者取完剩余任务后退出
+    for (auto& t : threads) {
+        t.join();
+    }
+    r.seconds = (nowNanos() - start) / 1e9;
+
+    std::vector<uint64_t> all;
+    for (auto& s : samples) {
+        all.insert(all.end(), s.begin(), s.end());
+    }
+    r.p50Ns = percentileOf(all, 0.5);
+    r.p99Ns = percentileOf(all, 0.99);
+    r.p999Ns = percentileOf(all, 0.999);
+    return r;
+}
+
+// 无界的TaskQueue没有setCapacity
+template <typename Queue>
+void setQueueCapacity(Queue& queue, int capacity)
+{
+    queue.setCapacity(capacity);
+}
+
+template <>
+void setQueueCapacity<TaskQueue>(TaskQueue&, int)
+{
+}
+
+template <typename Queue>
+void benchQueue(const Options& opt, std::vector<Result>& out, const std::string& name, int capacity)
+{
+    static const int kShapes[][2] = { { 1, 1 }, { 1, 4 }, { 4, 1 }, { 2, 2 }, { 4, 4 }, { 8, 8 } };
+    long ops = opt.quick ? 50000 : 500000;
+    for (auto& shape : kShapes) {
+        Result r = medianOf(opt.repeat, [&] {
+            Queue queue;
+            setQueueCapacity(queue, capacity);
+            return runQueue(name, queue, shape[0], shape[1], ops);
+        });
+        r.capacity = capacity > 0 ? capacity : -1;
+        out.push_back(r);
+        fprintf(stderr, "  %-28s %dx%d  %8.2f Mops/s\n", name.c_str(), shape[0], shape[1], r.opsPerSec() / 1e6);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// 线程池：从外部线程提交ops个空任务并等待完成，衡量每个任务的调度开销
+
+template <typename Executor>
+Result runPool(const std::string& name, int threads, long ops)
+{
+    Result r;
+    r.suite = "pool";
+    r.name = name;
+    r.threads = threads;
+    r.ops = ops;
+    Executor executor(threads);
+    executor.taskQueue.setCapacity(1024);
+    executor.setTaskCount((int)ops);
+    uint64_t start = nowNanos();
+    for (long i = 0; i < ops; ++i) {
+        executor.pushTask([] { });
+    }
+    executor.wait();
+    r.seconds = (nowNanos() - start) / 1e9;
+    r.capacity = 1024;
+    return r;
+}
+
+template <typename Executor>
+void benchPool(const Options& opt, std::vector<Result>& out, const std::string& name)
+{
+    long ops = opt.quick ? 50000 : 500000;
+    for (int threads : { 1, 2, 4, 8 }) {
+        Result r = medianOf(opt.repeat, [&] { return runPool<Executor>(name, threads, ops); });
+        out.push_back(r);
+        fprintf(stderr, "  %-28s %d threads  %6.0f ns/task\n", name.c_str(), threads, r.seconds * 1e9 / r.ops);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// 流水线：stages个Stage串联，每个阶段2个线程，每个任务忙等workNs纳秒
+
+template <typename StageType>
+Result runPipeline(const std::string& name, int stages, int capacity, long workNs, long ops)
+{
+    Result r;
+    r.suite = "pipeline";
+    r.name = name;
+    r.threads = 2;
+    r.stages = stages;
+    r.capacity = capacity;
+    r.workNs = workNs;
+    r.ops = ops;
+
+    std::vector<std::unique_ptr<StageType>> chainStages;
+    for (int s = 0; s < stages; ++s) {
+        chainStages.emplace_back(new StageType("S" + std::to_string(s), 2, capacity, [workNs](int) {
+            spinFor(workNs);
+        }));
+        if (s > 0) {
+            chain(*chainStages[s - 1], *chainStages[s]);
+        }
+    }
+    chainStages[0]->addTaskCount((int)ops);
+    uint64_t start = nowNanos();
+    for (long i = 0; i < ops; ++i) {
+        chainStages[0]->push((int)i);
+    }
+    for (auto& stage : chainStages) {
+        stage->wait();
+    }
+    r.seconds = (nowNanos() - start) / 1e9;
+    return r;
+}
+
+template <typename StageType>
+void benchPipeline(const Options& opt, std::vector<Result>& out, const std::string& name)
+{
+    for (int stages : { 1, 2, 4, 8 }) {
+        for (int capacity : { 4, 16, 64 }) {
+            for (long workNs : { 0L, 1000L, 10000L }) {
+                // 每个配置的总耗时大致相同
+                long ops = workNs >= 10000 ? 2000 : (workNs >= 1000 ? 20000 : 100000);
+                if (opt.quick) {
+                    ops /= 10;
+                }
+                Result r = medianOf(opt.repeat, [&] {
+                    return runPipeline<StageType>(name, stages, capacity, workNs, ops);
+                });
+                out.push_back(r);
+                fprintf(stderr, "  %-16s stages=%d cap=%-3d work=%-6ldns %10.0f items/s\n",
+                    name.c_str(), stages, capacity, workNs, r.opsPerSec());
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+void printField(std::string& line, double v, const char* fmt)
+{
+    if (v >= 0) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), fmt, v);
+        line += buf;
+    }
+}
+
+void printCsv(const std::vector<Result>& results)
+{
+    printf("suite,name,producers,consumers,threads,stages,capacity,work_ns,ops,seconds,ops_per_sec,p50_ns,p99_ns,p999_ns\n");
+    for (const auto& r : results) {
+        std::string line = r.suite + "," + r.name + ",";
+        printField(line, r.producers, "%.0f");
+        line += ",";
+        printField(line, r.consumers, "%.0f");
+        line += ",";
+        printField(line, r.threads, "%.0f");
+        line += ",";
+        printField(line, r.stages, "%.0f");
+        line += ",";
+        printField(line, r.capacity, "%.0f");
+        line += ",";
+        printField(line, (double)r.workNs, "%.0f");
+        line += ",";
+        printField(line, (double)r.ops, "%.0f");
+        line += ",";
+        printField(line, r.seconds, "%.6f");
+        line += ",";
+        printField(line, r.opsPerSec(), "%.0f");
+        line += ",";
+        printField(line, r.p50Ns, "%.0f");
+        line += ",";
+        printField(line, r.p99Ns, "%.0f");
+        line += ",";
+        printField(line, r.p999Ns, "%.0f");
+        printf("%s\n", line.c_str());
+    }
+}
+
+void printJson(const std::vector<Result>& results)
+{
+    printf("{\n  \"hardware_concurrency\": %u,\n  \"results\": [\n", std::thread::hardware_concurrency());
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        std::string line = "    {\"suite\": \"" + r.suite + "\", \"name\": \"" + r.name + "\"";
+        struct Field {
+            const char* key;
+            double value;
+            const char* fmt;
+        };
+        const Field fields[] = {
+            { "producers", (double)r.producers, "%.0f" },
+            { "consumers", (double)r.consumers, "%.0f" },
+            { "threads", (double)r.threads, "%.0f" },
+            { "stages", (double)r.stages, "%.0f" },
+            { "capacity", (double)r.capacity, "%.0f" },
+            { "work_ns", (double)r.workNs, "%.0f" },
+            { "ops", (double)r.ops, "%.0f" },
+            { "seconds", r.seconds, "%.6f" },
+            { "ops_per_sec", r.opsPerSec(), "%.0f" },
+            { "p50_ns", r.p50Ns, "%.0f" },
+            { "p99_ns", r.p99Ns, "%.0f" },
+            { "p999_ns", r.p999Ns, "%.0f" },
+        };
+        for (const auto& f : fields) {
+            if (f.value >= 0) {
+                line += std::string(", \"") + f.key + "\": ";
+                printField(line, f.value, f.fmt);
+            }
+        }
+        line += "}";
+        printf("%s%s\n", line.c_str(), i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+bool selected(const Options& opt, const std::string& name)
+{
+    return opt.filter.empty() || name.find(opt.filter) != std::string::npos;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--format") && i + 1 < argc) {
+            opt.json = !strcmp(argv[++i], "json");
+        } else if (!strcmp(argv[i], "--quick")) {
+            opt.quick = true;
+            opt.repeat = 1;
+        } else if (!strcmp(argv[i], "--repeat") && i + 1 < argc) {
+            opt.repeat = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+            opt.filter = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--format csv|json] [--quick] [--repeat N] [--filter substring]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<Result> results;
+
+    fprintf(stderr, "== queue push/pop\n");
+    if (selected(opt, "TaskQueue"))
+        benchQueue<TaskQueue>(opt, results, "TaskQueue", 0);
+    if (selected(opt, "BoundedTaskQueue"))
+        benchQueue<BoundedTaskQueue>(opt, results, "BoundedTaskQueue", 1024);
+    if (selected(opt, "BoundedTaskQueue<SpinThenPark>"))
+        benchQueue<BasicBoundedTaskQueue<SpinThenParkWait>>(opt, results, "BoundedTaskQueue<SpinThenPark>", 1024);
+    if (selected(opt, "LockFreeTaskQueue"))
+        benchQueue<LockFreeTaskQueue>(opt, results, "LockFreeTaskQueue", 1024);
+    if (selected(opt, "LockFreeTaskQueue<SpinThenPark>"))
+        benchQueue<BasicLockFreeTaskQueue<SpinThenParkWait>>(opt, results, "LockFreeTaskQueue<SpinThenPark>", 1024);
+
+    fprintf(stderr, "== pool empty-task overhead\n");
+    if (selected(opt, "ThreadPoolEx<Bounded>"))
+        benchPool<ThreadPoolEx<BoundedTaskQueue>>(opt, results, "ThreadPoolEx<Bounded>");
+    if (selected(opt, "ThreadPoolEx<LockFree>"))
+        benchPool<ThreadPoolEx<LockFreeTaskQueue>>(opt, results, "ThreadPoolEx<LockFree>");
+    if (selected(opt, "WorkStealing<Bounded>"))
+        benchPool<WorkStealingThreadPoolEx<BoundedTaskQueue>>(opt, results, "WorkStealing<Bounded>");
+
+    fprintf(stderr, "== pipeline end-to-end\n");
+    if (selected(opt, "Stage"))
+        benchPipeline<Stage>(opt, results, "Stage");
+    if (selected(opt, "StageLockFree"))
+        benchPipeline<StageLockFree>(opt, results, "StageLockFree");
+
+    if (opt.json) {
+        printJson(results);
+    } else {
+        printCsv(results);
+    }
+    return 0;
+}
@@ -0,0 +1,557 @@
+#pragma once
+// C++20协程阶段：阶段函数是协程，等待I/O或远程服务时挂起而不占用工作线程，
+// 恢复时回到本阶段的执行器上（包括CurrentThreadEx调用run的线程），少量线程就能同时处理大量请求
+// 需要C++20编译，其余部分仍然只依赖task_queue.hpp的C++11接口
+#include "task_queue.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// 协程阶段的公共部分，CoResumer通过它把协程放回阶段，与执行器类型无关
+class CoStageBase {
+public:
+    virtual ~CoStageBase() = default;
+    // 在本阶段的线程上恢复h：在本阶段的线程上调用时尽量入队，否则直接恢复；在其他线程上调用时入队
+    virtual void resume(std::coroutine_handle<> h) = 0;
+};
+
+// 正在执行协程阶段任务的线程记录该阶段，内置的等待操作据此找到协程所属的阶段
+inline thread_local CoStageBase* coCurrentStage = nullptr;
+
+// 协程阶段函数的返回类型：CoTask f(int index) { ...; co_await ...; }
+// 协程创建后先挂起，由阶段设置完成回调后再开始执行；执行结束时帧立即释放
+class CoTask {
+public:
+    struct promise_type {
+        using Clock = std::chrono::steady_clock;
+
+        void (*onDone)(void* stage, int index, Clock::time_point begin, std::exception_ptr error) = nullptr;
+        void* stage = nullptr;
+        int index = 0;
+        Clock::time_point begin; // 开启指标时记录的开始时间
+        bool captureErrors = false; // 阶段设置了ErrorSink时，异常交给onDone记录
+        std::exception_ptr error;
+
+        CoTask get_return_object()
+        {
+            return CoTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        // 先释放协程帧（包括其中的局部变量），再通知阶段，阶段随后把索引交给下游
+        struct FinalAwaiter {
+            bool await_ready() noexcept
+            {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<promise_type> h) noexcept
+            {
+                promise_type& p = h.promise();
+                void (*onDone)(void*, int, Clock::time_point, std::exception_ptr) = p.onDone;
+                void* stage = p.stage;
+                int index = p.index;
+                Clock::time_point begin = p.begin;
+                std::exception_ptr error = std::move(p.error);
+                h.destroy();
+                if (onDone)
+                    onDone(stage, index, begin, std::move(error));
+            }
+
+            void await_resume() noexcept
+            {
+            }
+        };
+
+        FinalAwaiter final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_void()
+        {
+        }
+
+        // 与普通阶段函数相同：没有ErrorSink时异常传播到恢复协程的线程
+        void unhandled_exception()
+        {
+            if (!captureErrors)
+                throw;
+            error = std::current_exception();
+        }
+    };
+
+    CoTask(CoTask&& other) noexcept
+        : handle(std::exchange(other.handle, nullptr))
+    {
+    }
+
+    CoTask& operator=(CoTask&& other) noexcept
+    {
+        if (this != &other) {
+            if (handle)
+                handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+
+    CoTask(const CoTask&) = delete;
+    CoTask& operator=(const CoTask&) = delete;
+
+    ~CoTask()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    // 交出协程句柄，之后由调用者负责恢复
+    std::coroutine_handle<promise_type> release()
+    {
+        return std::exchange(handle, nullptr);
+    }
+
+private:
+    explicit CoTask(std::coroutine_handle<promise_type> h)
+        : handle(h)
+    {
+    }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+// 恢复一个挂起的协程阶段任务，可以复制，必须且只能调用一次resume
+// 在其他线程（I/O回调、定时器线程）上调用时，协程被放回阶段的队列，由阶段的线程继续执行
+class CoResumer {
+public:
+    CoResumer() = default;
+
+    CoResumer(CoStageBase* stage, std::coroutine_handle<> handle)
+        : stage(stage)
+        , handle(handle)
+    {
+    }
+
+    void resume() const
+    {
+        stage->resume(handle);
+    }
+
+private:
+    CoStageBase* stage = nullptr;
+    std::coroutine_handle<> handle;
+};
+
+// 协程定时器：一个后台线程按截止时间执行回调，用于co_await stage.sleepFor(d)
+class CoTimer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static CoTimer& instance()
+    {
+        static CoTimer timer;
+        return timer;
+    }
+
+    // 回调在定时器线程上执行，应该尽快返回，例如只调用CoResumer::resume
+    void at(Clock::time_point deadline, std::function<void()> callback)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            entries.push(Entry { deadline, seq++, std::move(callback) });
+        }
+        cv.notify_one();
+    }
+
+    ~CoTimer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stop = true;
+        }
+        cv.notify_one();
+        worker.join();
+    }
+
+private:
+    struct Entry {
+        Clock::time_point deadline;
+        uint64_t seq; // 截止时间相同时按加入顺序执行
+        std::function<void()> callback;
+
+        bool operator>(const Entry& other) const
+        {
+            return deadline != other.deadline ? deadline > other.deadline : seq > other.seq;
+        }
+    };
+
+    CoTimer()
+        : worker([this] { loop(); })
+    {
+    }
+
+    void loop()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (!stop) {
+            if (entries.empty()) {
+                cv.wait(lock);
+                continue;
+            }
+            Clock::time_point deadline = entries.top().deadline;
+            if (Clock::now() < deadline) {
+                cv.wait_until(lock, deadline);
+                continue;
+            }
+            std::function<void()> callback = std::move(const_cast<Entry&>(entries.top()).callback);
+            entries.pop();
+            lock.unlock();
+            callback();
+            lock.lock();
+        }
+    }
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> entries;
+    uint64_t seq = 0;
+    bool stop = false;
+    std::thread worker; // 必须最后声明，其他成员初始化之后才启动
+};
+
+// 挂起当前的协程阶段任务，把恢复器交给start；start发起异步操作，并在操作完成时（可以在任何线程上）调用resume
+// 只能在协程阶段函数中co_await，例如：
+// co_await coSuspend([&](CoResumer r) { client.get(key, [&, r](Reply x) { reply = x; r.resume(); }); });
+template <typename StartF>
+auto coSuspend(StartF start)
+{
+    struct Awaiter {
+        StartF start;
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            // start返回前协程可能已经在其他线程上恢复，之后不能再访问本对象（它在协程帧中）
+            StartF f = std::move(start);
+            f(CoResumer(coCurrentStage, h));
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+    };
+    return Awaiter { std::move(start) };
+}
+
+// 挂起至少d时间，不占用工作线程
+template <typename Rep, typename Period>
+auto coSleepFor(std::chrono::duration<Rep, Period> d)
+{
+    auto deadline = CoTimer::Clock::now() + std::chrono::duration_cast<CoTimer::Clock::duration>(d);
+    return coSuspend([deadline](CoResumer r) {
+        CoTimer::instance().at(deadline, [r]() {
+            r.resume();
+        });
+    });
+}
+
+// 协程索引阶段，接口与StageT相同，可以和StageT、TypedStage<int, Out>互相链接
+// 每个索引启动一个协程，协程完成后才把索引交给下游；计数模式和流式模式下，
+// 挂起中的协程都计入未完成任务，wait/close会等它们全部完成
+// 开启指标后，记录的耗时是从协程开始到完成的时间，包含挂起等待的时间
+template <typename ExecutorT>
+class CoStageT : public StageBase, public ElasticStage, public CoStageBase {
+public:
+    using Func = std::function<CoTask(int)>;
+
+    CoStageT(const std::string& name, int threads, int capacity, Func func)
+        : name_(name)
+        , executor_(threads)
+        , func_(std::move(func))
+    {
+        executor_.taskQueue.setCapacity(capacity);
+    }
+
+    CoStageT(const std::string& name, SharedThreadPool& pool, int concurrency, int capacity, Func func)
+        : name_(name)
+        , executor_(pool, concurrency)
+        , func_(std::move(func))
+    {
+        executor_.taskQueue.setCapacity(capacity);
+    }
+
+    // 让出：挂起协程并放回本阶段的队列末尾，由本阶段的某个线程继续执行
+    // 在其他线程上co_await时，协程切换回本阶段的线程；本阶段队列已满时在当前线程继续
+    auto schedule()
+    {
+        struct Awaiter {
+            CoStageT* stage;
+
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            bool await_suspend(std::coroutine_handle<> h)
+            {
+                return stage->post(h);
+            }
+
+            void await_resume() const noexcept
+            {
+            }
+        };
+        return Awaiter { this };
+    }
+
+    void setTaskCount(int n)
+    {
+        executor_.setTaskCount(n);
+    }
+
+    void addTaskCount(int n) override
+    {
+        executor_.addTaskCount(n);
+        outputs_.addTaskCount(n);
+    }
+
+    void openStream() override
+    {
+        if (openInputs_++ == 0) {
+            executor_.openStream();
+            outputs_.openStream();
+        }
+    }
+
+    void close() override
+    {
+        if (--openInputs_ > 0) {
+            return;
+        }
+        typename StageOutputs<int>::Targets next = outputs_.list();
+        executor_.close([next]() {
+            StageOutputs<int>::closeAll(next);
+        });
+    }
+
+    void push(int index) override
+    {
+        gates_.acquire(index, index + 1);
+        executor_.pushTask([this, index]() {
+            start(index);
+        });
+    }
+
+    void skip() override
+    {
+        executor_.pushTask([this]() {
+            outputs_.skip();
+        });
+    }
+
+    void acceptSkips() override
+    {
+        outputs_.sendSkips();
+    }
+
+    // 协程不能与上游融合，照常入队
+    void runFused(int begin, int end) override
+    {
+        pushRange(begin, end);
+    }
+
+    size_t queueDepth() const override
+    {
+        return executor_.taskQueue.size();
+    }
+
+    void wait()
+    {
+        executor_.wait();
+    }
+
+    // 对于CurrentThreadEx，需要手动调用run，协程都在调用run的线程上恢复
+    void run()
+    {
+        executor_.run();
+    }
+
+    void setNext(StageInput<int>* next)
+    {
+        outputs_.set(next);
+        if (next)
+            next->linkFrom(this);
+    }
+
+    void addNext(StageInput<int>* next)
+    {
+        outputs_.add(next);
+        next->linkFrom(this);
+    }
+
+    // 下游OrderedStage的准入限制传给上游，与StageT相同
+    void linkFrom(StageInput<int>* upstream) override
+    {
+        gates_.linkFrom(upstream);
+    }
+
+    void addGate(AdmissionGate* gate) override
+    {
+        gates_.add(gate);
+    }
+
+    void linkFromUngated() override
+    {
+        gates_.linkFromUngated();
+    }
+
+    void setRouting(Routing routing, StageOutputs<int>::KeyFunc key = nullptr)
+    {
+        outputs_.setRouting(routing, std::move(key));
+    }
+
+    const std::string& name() const
+    {
+        return name_;
+    }
+
+    void enableMetrics(bool enable) override
+    {
+        metricsEnabled_ = enable;
+    }
+
+    StageReport report() const override
+    {
+        return makeReport(name_, executor_, serviceTime_);
+    }
+
+    // 已取消时不启动协程，已经挂起的协程照常完成；出错或已取消的索引照常传给下游
+    void setErrorSink(ErrorSink* sink) override
+    {
+        errors_ = sink;
+    }
+
+    bool addThread() override
+    {
+        return executor_.addThread();
+    }
+
+    bool removeThread() override
+    {
+        return executor_.removeThread();
+    }
+
+    void setPlacement(const Placement& p)
+    {
+        executor_.setPlacement(p);
+    }
+
+    int numaNode() const
+    {
+        return executor_.numaNode();
+    }
+
+    void resume(std::coroutine_handle<> h) override
+    {
+        if (coCurrentStage == this) {
+            Task task = resumeTask(h);
+            if (!executor_.tryFork(task))
+                resumeHere(h);
+            return;
+        }
+        executor_.pushChunk(resumeTask(h), 0);
+    }
+
+private:
+    void start(int index)
+    {
+        if (errors_ && errors_->cancelled()) {
+            outputs_.push(std::move(index));
+            return;
+        }
+        CoTask task = func_(index);
+        std::coroutine_handle<CoTask::promise_type> h = task.release();
+        h.promise().onDone = &CoStageT::finished;
+        h.promise().stage = this;
+        h.promise().index = index;
+        h.promise().captureErrors = errors_ != nullptr;
+        if (metricsEnabled_.load(std::memory_order_relaxed))
+            h.promise().begin = std::chrono::steady_clock::now();
+        executor_.retain(); // 协程完成时release
+        resumeHere(h);
+    }
+
+    // 在本阶段的线程上恢复协程
+    void resumeHere(std::coroutine_handle<> h)
+    {
+        CoStageBase* prev = coCurrentStage;
+        coCurrentStage = this;
+        h.resume();
+        coCurrentStage = prev;
+    }
+
+    Task resumeTask(std::coroutine_handle<> h)
+    {
+        return Task([this, h]() {
+            resumeHere(h);
+        });
+    }
+
+    // schedule：返回false表示不挂起，在当前线程继续
+    bool post(std::coroutine_handle<> h)
+    {
+        Task task = resumeTask(h);
+        if (coCurrentStage == this) {
+            // 本阶段的线程放入已满的本阶段队列会阻塞自己，放不下就继续执行
+            return executor_.tryFork(task);
+        }
+        executor_.pushChunk(std::move(task), 0);
+        return true;
+    }
+
+    // 协程完成的线程一定是本阶段的线程：开始和每次恢复都在本阶段的执行器上
+    static void finished(void* stage, int index, std::chrono::steady_clock::time_point begin, std::exception_ptr error)
+    {
+        static_cast<CoStageT*>(stage)->complete(index, begin, std::move(error));
+    }
+
+    void complete(int index, std::chrono::steady_clock::time_point begin, std::exception_ptr error)
+    {
+        if (begin != std::chrono::steady_clock::time_point())
+            serviceTime_.record(elapsedNanos(begin));
+        if (error)
+            errors_->record(name_, index, std::move(error));
+        outputs_.push(std::move(index));
+        executor_.release();
+    }
+
+    std::string name_;
+    ExecutorT executor_;
+    Func func_;
+    StageOutputs<int> outputs_;
+    std::atomic<bool> metricsEnabled_ { false };
+    LatencyHistogram serviceTime_;
+    std::atomic<int> openInputs_ { 0 };
+    ErrorSink* errors_ = nullptr;
+    AdmissionGates gates_;
+};
+
+using CoStage = CoStageT<ThreadPoolEx<BoundedTaskQueue>>;
+using CoStageCurrent = CoStageT<CurrentThreadEx<BoundedTaskQueue>>;
+using CoStageShared = CoStageT<SharedExecutorEx<BoundedTaskQueue>>;
@@ -0,0 +1,70 @@
+#include "task_queue_coro.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+// 协程阶段演示：每个请求等待20ms模拟远程调用，2个线程同时处理N个请求
+int main1()
+{
+    int N = 2000;
+    std::vector<int> datas(N, 0);
+
+    CoStage fetch("Fetch", 2, 64, [&](int i) -> CoTask {
+        co_await coSleepFor(std::chrono::milliseconds(20)); // 挂起期间不占用线程
+        datas[i] = i * 2;
+    });
+
+    std::atomic<long long> sum { 0 };
+    Stage reduce("Reduce", 1, 64, [&](int i) {
+        sum += datas[i];
+    });
+    chain(fetch, reduce);
+
+    auto start = std::chrono::steady_clock::now();
+    fetch.addTaskCount(N);
+    std::future<void> future = std::async(std::launch::async, [&]() {
+        for (int i = 0; i < N; ++i) {
+            fetch.push(i);
+        }
+    });
+    reduce.wait();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("%d requests on 2 threads: %.1f ms, sum=%lld\n", N, ms, sum.load());
+    return 0;
+}
+
+// CurrentThreadEx：协程都在调用run的线程（例如主线程）上开始和恢复
+int main2()
+{
+    int N = 100;
+    std::thread::id mainId = std::this_thread::get_id();
+    std::atomic<int> wrongThread { 0 };
+
+    CoStageCurrent render("Render", 1, 16, [&](int i) -> CoTask {
+        co_await coSleepFor(std::chrono::milliseconds(i % 10)); // 在定时器线程上到期，回到主线程恢复
+        if (std::this_thread::get_id() != mainId)
+            ++wrongThread;
+    });
+
+    render.openStream();
+    std::future<void> future = std::async(std::launch::async, [&]() {
+        for (int i = 0; i < N; ++i) {
+            render.push(i);
+        }
+        render.close();
+    });
+    render.run();
+    printf("%d coroutines resumed off the run thread: %d\n", N, wrongThread.load());
+    return 0;
+}
+
+int main()
+{
+    main1();
+    main2();
+    return 0;
+}
@@ -129,6 +129,38 @@ int main3()
     return 0;
 }
 
+int main4()
+{
+    int N = 10;
+
+    // 数据随任务在阶段之间移动，不需要共享的datas数组
+    TypedStage<int, std::vector<int>> makeStage("Make", 2, 4, [](int&& i) {
+        return std::vector<int>(i + 1, i);
+    });
+
+    TypedStage<std::vector<int>, int> sumStage("Sum", 2, 4, [](std::vector<int>&& v) {
+        return std::accumulate(v.begin(), v.end(), 0);
+    });
+
+    TypedStage<int, void> printStage("Print", 1, 4, [](int&& sum) {
+        printf("sum = %d\n", sum);
+    });
+
+    chain(makeStage, sumStage);
+    chain(sumStage, printStage);
+    makeStage.openStream();
+
+    std::future<void> future = std::async(std::launch::async, [&]() {
+        for (int i = 0; i < N; ++i) {
+            makeStage.push(i);
+        }
+        makeStage.close();
+    });
+
+    printStage.wait();
+    return 0;
+}
+
 int main()
 {
     printf("=== 演示1: 手动线程池 ===\n");
@@ -137,5 +169,13 @@ int main()
     main2();
     printf("\n=== 演示3: 混合流水线（ThreadPool + CurrentThread） ===\n");
     main3();
+    printf("\n=== 演示4: 携带数据的流水线（TypedStage） ===\n");
+    main4();
+#ifdef TASK_QUEUE_TRACE
+    // 用chrome://tracing或ui.perfetto.dev打开
+    if (Tracer::instance().writeChromeJson("task_queue_trace.json")) {
+        printf("\ntrace written to task_queue_trace.json\n");
+    }
+#endif
     return 0;
 }
@@ -0,0 +1,865 @@
+#pragma once
+// 异步I/O阶段：读写请求由一个I/O线程通过io_uring提交，完成后由阶段的投递线程推送到下游阶段的队列
+// 一个线程就能让存储设备保持足够的队列深度，不需要几十个阻塞在read/write中的工作线程
+// 没有io_uring（其他平台、内核不支持或被禁用）时退回到线程池中的pread/pwrite，接口不变
+#include "task_queue.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// 定义TASK_QUEUE_NO_IO_URING可以强制使用线程池
+#if defined(__linux__) && !defined(TASK_QUEUE_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define TASK_QUEUE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#endif
+#endif
+
+// 按页对齐的I/O缓冲区，满足O_DIRECT对地址和长度的对齐要求
+// 通常放在ObjectPool<IoBuffer>中循环使用，注册到io_uring后读取时不再需要映射用户内存
+class IoBuffer {
+public:
+    explicit IoBuffer(size_t capacity = 0, size_t alignment = 4096)
+        : capacity_(capacity)
+    {
+        if (capacity == 0)
+            return;
+        void* p = nullptr;
+        if (posix_memalign(&p, alignment, capacity) != 0)
+            throw std::bad_alloc();
+        data_ = static_cast<char*>(p);
+    }
+
+    IoBuffer(IoBuffer&& other) noexcept
+        : data_(other.data_)
+        , size_(other.size_)
+        , capacity_(other.capacity_)
+        , registered_(other.registered_)
+    {
+        other.data_ = nullptr;
+        other.size_ = other.capacity_ = 0;
+        other.registered_ = -1;
+    }
+
+    IoBuffer& operator=(IoBuffer&& other) noexcept
+    {
+        if (this != &other) {
+            free(data_);
+            data_ = other.data_;
+            size_ = other.size_;
+            capacity_ = other.capacity_;
+            registered_ = other.registered_;
+            other.data_ = nullptr;
+            other.size_ = other.capacity_ = 0;
+            other.registered_ = -1;
+        }
+        return *this;
+    }
+
+    IoBuffer(const IoBuffer&) = delete;
+    IoBuffer& operator=(const IoBuffer&) = delete;
+
+    ~IoBuffer()
+    {
+        free(data_);
+    }
+
+    char* data()
+    {
+        return data_;
+    }
+
+    const char* data() const
+    {
+        return data_;
+    }
+
+    // 有效数据的长度，读取完成后为读到的字节数，写入时写出这么多字节
+    size_t size() const
+    {
+        return size_;
+    }
+
+    void resize(size_t n)
+    {
+        if (n > capacity_)
+            throw std::out_of_range("IoBuffer::resize beyond capacity");
+        size_ = n;
+    }
+
+    size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    // 在io_uring中注册的编号，未注册时为-1
+    int registeredIndex() const
+    {
+        return registered_;
+    }
+
+private:
+    friend class IoEngine;
+
+    char* data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_;
+    int registered_ = -1;
+};
+
+// 在I/O阶段之间流动的数据块
+struct IoBlock {
+    int index = 0; // 块号
+    uint64_t offset = 0; // 文件偏移
+    int result = 0; // 读取或写入的字节数，出错时为-errno
+    Pooled<IoBuffer> buffer; // 下游用完后自动归还到读取阶段的对象池
+};
+
+// 一个读或写请求，done在请求完成时调用（io_uring时在I/O线程上，否则在线程池中），不能阻塞
+struct IoOp {
+    enum Kind { Read, Write };
+
+    Kind kind = Read;
+    int fd = -1;
+    IoBuffer* buffer = nullptr;
+    size_t length = 0;
+    uint64_t offset = 0;
+    void (*done)(IoOp* op, int result) = nullptr;
+    struct iovec iov; // 由IoEngine填写
+};
+
+#ifdef TASK_QUEUE_IO_URING
+// io_uring的最小封装，直接使用系统调用，不依赖liburing；只由I/O线程访问
+class IoRing {
+public:
+    IoRing() = default;
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    ~IoRing()
+    {
+        if (fd < 0)
+            return;
+        if (sqes)
+            munmap(sqes, sqeBytes);
+        if (cqRing && cqRing != sqRing)
+            munmap(cqRing, cqBytes);
+        if (sqRing)
+            munmap(sqRing, sqBytes);
+        ::close(fd);
+    }
+
+    // 内核不支持或被seccomp禁止时返回false
+    bool init(unsigned entries)
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+        if (fd < 0)
+            return false;
+        sqBytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cqBytes = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)
+            sqBytes = cqBytes = std::max(sqBytes, cqBytes);
+        sqRing = mapRing(sqBytes, IORING_OFF_SQ_RING);
+        cqRing = single ? sqRing : mapRing(cqBytes, IORING_OFF_CQ_RING);
+        sqeBytes = p.sq_entries * sizeof(io_uring_sqe);
+        void* s = mmap(nullptr, sqeBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        sqes = s == MAP_FAILED ? nullptr : static_cast<io_uring_sqe*>(s);
+        if (!sqRing || !cqRing || !sqes)
+            return false;
+        char* sq = static_cast<char*>(sqRing);
+        char* cq = static_cast<char*>(cqRing);
+        sqHead = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        sqEntries = p.sq_entries;
+        localTail = *sqTail;
+        return true;
+    }
+
+    bool registerBuffers(const std::vector<struct iovec>& iovs)
+    {
+        return syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iovs.data(), (unsigned)iovs.size()) == 0;
+    }
+
+    // 提交队列已满时返回nullptr
+    io_uring_sqe* nextSqe()
+    {
+        unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        if (localTail - head >= sqEntries)
+            return nullptr;
+        unsigned slot = localTail & sqMask;
+        io_uring_sqe* sqe = &sqes[slot];
+        memset(sqe, 0, sizeof(*sqe));
+        sqArray[slot] = slot;
+        ++localTail;
+        ++unsubmitted;
+        return sqe;
+    }
+
+    // 提交所有准备好的请求，并等待至少waitNr个完成
+    int enter(unsigned waitNr)
+    {
+        __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+        while (true) {
+            int r = (int)syscall(__NR_io_uring_enter, fd, unsubmitted, waitNr, waitNr ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (r >= 0) {
+                unsubmitted -= (unsigned)r;
+                return r;
+            }
+            if (errno != EINTR)
+                return -errno;
+        }
+    }
+
+    // 对每个完成的请求调用f(user_data, res)
+    template <typename F>
+    void reap(F f)
+    {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            const io_uring_cqe& cqe = cqes[head & cqMask];
+            uint64_t userData = cqe.user_data;
+            int res = cqe.res;
+            ++head;
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+            f(userData, res);
+        }
+    }
+
+private:
+    void* mapRing(size_t bytes, off_t offset)
+    {
+        void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    int fd = -1;
+    void* sqRing = nullptr;
+    void* cqRing = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqBytes = 0;
+    size_t cqBytes = 0;
+    size_t sqeBytes = 0;
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+    unsigned localTail = 0;
+    unsigned unsubmitted = 0;
+};
+#endif
+
+// I/O引擎：一个I/O线程持有io_uring，最多同时有depth个请求在设备上；读写阶段可以共用一个引擎
+// 引擎必须比使用它的阶段活得更久
+class IoEngine {
+public:
+    // fallbackThreads是没有io_uring时执行pread/pwrite的线程数
+    explicit IoEngine(unsigned depth = 64, int fallbackThreads = 4)
+        : depth(depth)
+    {
+#ifdef TASK_QUEUE_IO_URING
+        wakeFd = eventfd(0, EFD_CLOEXEC);
+        if (wakeFd >= 0 && ring.init(depth)) {
+            uring = true;
+            return;
+        }
+#endif
+        fallback.reset(new ThreadPoolEx<TaskQueue>(fallbackThreads));
+        fallback->openStream();
+    }
+
+    IoEngine(const IoEngine&) = delete;
+    IoEngine& operator=(const IoEngine&) = delete;
+
+    ~IoEngine()
+    {
+        if (fallback) {
+            fallback->close();
+            fallback->wait();
+        }
+#ifdef TASK_QUEUE_IO_URING
+        if (worker.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                stop = true;
+            }
+            wake();
+            worker.join();
+        }
+        if (wakeFd >= 0)
+            ::close(wakeFd);
+#endif
+    }
+
+    // 是否在使用io_uring，false表示退回到了线程池
+    bool usingIoUring() const
+    {
+        return uring;
+    }
+
+    // 注册固定缓冲区，读写这些缓冲区时使用READ_FIXED/WRITE_FIXED，省去每次映射用户内存
+    // 必须在第一次submit之前调用；之后调用或没有io_uring时返回false，缓冲区仍可正常使用
+    bool registerBuffers(const std::vector<IoBuffer*>& buffers)
+    {
+#ifdef TASK_QUEUE_IO_URING
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!uring || started)
+            return false;
+        registering.insert(registering.end(), buffers.begin(), buffers.end());
+        return true;
+#else
+        (void)buffers;
+        return false;
+#endif
+    }
+
+    // 提交一个请求，可以在任何线程上调用；op在done被调用之前必须保持有效
+    void submit(IoOp* op)
+    {
+        if (fallback) {
+            fallback->pushTask([op]() {
+                op->done(op, runBlocking(*op));
+            });
+            return;
+        }
+#ifdef TASK_QUEUE_IO_URING
+        bool first;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            if (error) {
+                int r = error;
+                lock.unlock();
+                op->done(op, r);
+                return;
+            }
+            if (!started) {
+                started = true;
+                worker = std::thread([this] { loop(); });
+            }
+            first = pending.empty();
+            pending.push_back(op);
+        }
+        // 队列非空时I/O线程已被唤醒过，还没有取走队列，会一起处理
+        if (first)
+            wake();
+#endif
+    }
+
+private:
+    static int runBlocking(IoOp& op)
+    {
+        ssize_t n = op.kind == IoOp::Read
+            ? pread(op.fd, op.buffer->data(), op.length, (off_t)op.offset)
+            : pwrite(op.fd, op.buffer->data(), op.length, (off_t)op.offset);
+        return n < 0 ? -errno : (int)n;
+    }
+
+#ifdef TASK_QUEUE_IO_URING
+    void wake()
+    {
+        uint64_t one = 1;
+        ssize_t n = ::write(wakeFd, &one, sizeof(one));
+        (void)n;
+    }
+
+    // 在I/O线程上注册，注册失败时这些缓冲区按普通缓冲区使用
+    void registerPending()
+    {
+        std::vector<IoBuffer*> buffers;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            buffers.swap(registering);
+        }
+        if (buffers.empty())
+            return;
+        std::vector<struct iovec> iovs(buffers.size());
+        for (size_t i = 0; i < buffers.size(); ++i) {
+            iovs[i].iov_base = buffers[i]->data();
+            iovs[i].iov_len = buffers[i]->capacity();
+        }
+        if (!ring.registerBuffers(iovs))
+            return;
+        for (size_t i = 0; i < buffers.size(); ++i) {
+            buffers[i]->registered_ = (int)i;
+        }
+    }
+
+    void prepare(io_uring_sqe* sqe, IoOp* op)
+    {
+        bool read = op->kind == IoOp::Read;
+        sqe->fd = op->fd;
+        sqe->off = op->offset;
+        sqe->user_data = (uint64_t)(uintptr_t)op;
+        if (op->buffer->registered_ >= 0) {
+            sqe->opcode = read ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+            sqe->addr = (uint64_t)(uintptr_t)op->buffer->data();
+            sqe->len = (unsigned)op->length;
+            sqe->buf_index = (uint16_t)op->buffer->registered_;
+        } else {
+            op->iov.iov_base = op->buffer->data();
+            op->iov.iov_len = op->length;
+            sqe->opcode = read ? IORING_OP_READV : IORING_OP_WRITEV;
+            sqe->addr = (uint64_t)(uintptr_t)&op->iov;
+            sqe->len = 1;
+        }
+    }
+
+    // 在eventfd上始终挂着一个读请求（user_data为0），submit写eventfd即可把I/O线程从等待中唤醒
+    void armWake(io_uring_sqe* sqe)
+    {
+        wakeIov.iov_base = &wakeValue;
+        wakeIov.iov_len = sizeof(wakeValue);
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = wakeFd;
+        sqe->addr = (uint64_t)(uintptr_t)&wakeIov;
+        sqe->len = 1;
+        sqe->user_data = 0;
+    }
+
+    void loop()
+    {
+        registerPending();
+        std::vector<IoOp*> batch;
+        std::deque<IoOp*> queued; // 已放入提交队列、内核还没有取走的请求，按放入的顺序；nullptr是eventfd读请求
+        size_t next = 0;
+        unsigned inflight = 0;
+        bool wakeArmed = false;
+        bool stopping = false;
+        int failed = 0;
+        while (true) {
+            if (next == batch.size()) {
+                batch.clear();
+                next = 0;
+                std::lock_guard<std::mutex> lock(mtx);
+                batch.swap(pending);
+                stopping = stop;
+            }
+            while (!failed && next < batch.size() && inflight < depth) {
+                io_uring_sqe* sqe = ring.nextSqe();
+                if (!sqe)
+                    break;
+                prepare(sqe, batch[next]);
+                queued.push_back(batch[next++]);
+                ++inflight;
+            }
+            if (stopping && inflight == 0 && next == batch.size())
+                break;
+            if (!failed && !wakeArmed) {
+                io_uring_sqe* sqe = ring.nextSqe();
+                if (sqe) {
+                    armWake(sqe);
+                    queued.push_back(nullptr);
+                    wakeArmed = true;
+                }
+            }
+            size_t reaped = 0;
+            int r = failed ? 0 : ring.enter(1);
+            if (r >= 0) {
+                queued.erase(queued.begin(), queued.begin() + std::min((size_t)r, queued.size()));
+            } else if (r != -EAGAIN && r != -EBUSY) {
+                // 环已不可用：还没有被内核取走的请求和之后的请求都以这个错误完成，已提交的请求照常等待完成
+                failed = r;
+                fail(queued, r, inflight, wakeArmed);
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    error = r;
+                }
+            }
+            ring.reap([&](uint64_t userData, int res) {
+                ++reaped;
+                if (userData == 0) {
+                    wakeArmed = false;
+                    return;
+                }
+                --inflight;
+                IoOp* op = reinterpret_cast<IoOp*>((uintptr_t)userData);
+                op->done(op, res);
+            });
+            if (failed) {
+                for (; next < batch.size(); ++next) {
+                    batch[next]->done(batch[next], failed);
+                }
+            }
+            // 资源暂时不足（EAGAIN/EBUSY）或环已不可用时，没有完成的请求就稍等再试，不空转
+            if ((r < 0 || failed) && reaped == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        // 让挂着的eventfd读请求完成，避免环关闭时内核还引用wakeValue
+        while (wakeArmed && !failed) {
+            wake();
+            if (ring.enter(1) < 0)
+                break;
+            ring.reap([&](uint64_t userData, int) {
+                if (userData == 0)
+                    wakeArmed = false;
+            });
+        }
+    }
+
+    // 环不可用时，让提交队列中内核还没有取走的请求以错误完成
+    static void fail(std::deque<IoOp*>& queued, int error, unsigned& inflight, bool& wakeArmed)
+    {
+        for (IoOp* op : queued) {
+            if (!op) {
+                wakeArmed = false;
+                continue;
+            }
+            --inflight;
+            op->done(op, error);
+        }
+        queued.clear();
+    }
+
+    IoRing ring;
+    int wakeFd = -1;
+    uint64_t wakeValue = 0;
+    struct iovec wakeIov;
+    std::vector<IoOp*> pending;
+    std::vector<IoBuffer*> registering;
+    int error = 0; // io_uring_enter返回的不可恢复的错误，之后的请求直接以它完成
+    bool stop = false;
+    bool started = false;
+    std::thread worker;
+#endif
+
+    unsigned depth;
+    bool uring = false;
+    std::mutex mtx;
+    std::unique_ptr<ThreadPoolEx<TaskQueue>> fallback;
+};
+
+// I/O阶段的公共部分：计数、流式关闭和向下游分发IoBlock，与StageT的语义相同
+template <typename In>
+class IoStage : public StageInput<In> {
+public:
+    explicit IoStage(const std::string& name)
+        : name_(name)
+        , delivery_(1)
+    {
+        delivery_.openStream();
+    }
+
+    // 等待进行中的完成回调返回，它们可能在下游完成之后才结束
+    ~IoStage()
+    {
+        while (running_.load() > 0) {
+            std::this_thread::yield();
+        }
+        delivery_.close();
+        delivery_.wait();
+        std::lock_guard<std::mutex> lock(mtx_);
+    }
+
+    void setTaskCount(int n)
+    {
+        streaming_ = false;
+        pending_ = n;
+    }
+
+    void addTaskCount(int n) override
+    {
+        streaming_ = false;
+        pending_ += n;
+        outputs_.addTaskCount(n);
+    }
+
+    // 上游丢弃了一个值：不提交请求，计数与一次请求相同
+    void skip() override
+    {
+        begin();
+        outputs_.skip();
+        finished();
+        running_.fetch_sub(1);
+    }
+
+    void acceptSkips() override
+    {
+        outputs_.sendSkips();
+    }
+
+    void openStream() override
+    {
+        if (openInputs_++ == 0) {
+            streaming_ = true;
+            ++pending_; // “未关闭”令牌
+            outputs_.openStream();
+        }
+    }
+
+    // 进行中的请求全部完成后关闭下游
+    void close() override
+    {
+        if (--openInputs_ > 0)
+            return;
+        typename StageOutputs<IoBlock>::Targets next = outputs_.list();
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            onDrained_ = [next]() {
+                StageOutputs<IoBlock>::closeAll(next);
+            };
+        }
+        running_.fetch_add(1); // finished()在关闭下游之后还要通知wait，析构等到它返回
+        finished();
+        running_.fetch_sub(1);
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        doneCV_.wait(lock, [this] { return pending_.load() <= 0 && !draining_; });
+    }
+
+    void setNext(StageInput<IoBlock>* next)
+    {
+        outputs_.set(next);
+    }
+
+    void addNext(StageInput<IoBlock>* next)
+    {
+        outputs_.add(next);
+    }
+
+    // 键分区默认以块号为键
+    void setRouting(Routing routing, typename StageOutputs<IoBlock>::KeyFunc key = nullptr)
+    {
+        if (routing == Routing::KeyPartition && !key) {
+            key = [](const IoBlock& block) {
+                return (size_t)block.index;
+            };
+        }
+        outputs_.setRouting(routing, std::move(key));
+    }
+
+    const std::string& name() const
+    {
+        return name_;
+    }
+
+protected:
+    // 提交请求之前调用
+    void begin()
+    {
+        running_.fetch_add(1);
+        if (streaming_)
+            ++pending_;
+    }
+
+    // 完成回调的最后一步，之后本阶段随时可能被析构
+    // 没有下游时块留在这里，先释放缓冲区再计数，wait返回时缓冲区已经回到对象池
+    void complete(IoBlock block)
+    {
+        outputs_.push(std::move(block));
+        block.buffer.reset();
+        finished();
+        running_.fetch_sub(1);
+    }
+
+    // 不经过I/O引擎直接交给下游（例如读取失败的块），计数与一次请求相同
+    void forward(IoBlock block)
+    {
+        begin();
+        complete(std::move(block));
+    }
+
+    // 引擎的完成回调调用：不阻塞，由本阶段的投递线程推送给下游
+    void deliver(IoBlock block)
+    {
+        delivery_.pushTask(Delivery { this, std::move(block) });
+    }
+
+private:
+    struct Delivery {
+        IoStage* stage;
+        IoBlock block;
+
+        void operator()()
+        {
+            stage->complete(std::move(block));
+        }
+    };
+
+    // 与TaskCount::finish相同：流式模式排空时先关闭下游再通知wait
+    void finished()
+    {
+        if (pending_.fetch_sub(1) != 1)
+            return;
+        std::function<void()> drained;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            drained = std::move(onDrained_);
+            draining_ = (bool)drained;
+            if (!draining_)
+                doneCV_.notify_all();
+        }
+        if (drained) {
+            drained();
+            std::lock_guard<std::mutex> lock(mtx_);
+            draining_ = false;
+            doneCV_.notify_all();
+        }
+    }
+
+    std::string name_;
+    StageOutputs<IoBlock> outputs_;
+    std::atomic<int> pending_ { 0 }; // 未完成的请求数，流式模式下另含一个“未关闭”令牌
+    std::atomic<int> running_ { 0 }; // 已提交但完成回调尚未返回的请求数
+    std::atomic<int> openInputs_ { 0 };
+    std::atomic<bool> streaming_ { false };
+    std::condition_variable doneCV_;
+    std::mutex mtx_;
+    std::function<void()> onDrained_;
+    bool draining_ = false; // 正在调用onDrained，受mtx_保护
+    // 完成的块由这个线程推送给下游：下游队列满时阻塞的只是它，
+    // I/O线程（或后备线程池）照常处理其他请求，共用同一个引擎的阶段不受影响
+    ThreadPoolEx<TaskQueue> delivery_;
+};
+
+// 读取阶段：收到块号index后读取文件中[index * blockSize, (index + 1) * blockSize)，
+// 读完把IoBlock推送给下游；缓冲区来自本阶段的对象池（depth个，已注册到io_uring），
+// 对象池空时push阻塞，下游处理完块、释放缓冲区后才会读下一块
+class IoReadStage : public IoStage<int> {
+public:
+    IoReadStage(const std::string& name, IoEngine& engine, int fd, size_t blockSize, int depth)
+        : IoStage<int>(name)
+        , engine_(engine)
+        , fd_(fd)
+        , blockSize_(blockSize)
+        , pool_(depth, [blockSize] { return IoBuffer(blockSize); })
+    {
+        // 借出全部缓冲区以取得它们的地址，注册后立即归还
+        std::vector<Pooled<IoBuffer>> all;
+        std::vector<IoBuffer*> buffers;
+        for (Pooled<IoBuffer> b = pool_.tryAcquire(); b; b = pool_.tryAcquire()) {
+            buffers.push_back(b.get());
+            all.push_back(std::move(b));
+        }
+        registered_ = engine_.registerBuffers(buffers);
+    }
+
+    void push(int index) override
+    {
+        ReadOp* op = new ReadOp;
+        op->buffer_ = pool_.acquire();
+        op->kind = IoOp::Read;
+        op->fd = fd_;
+        op->buffer = op->buffer_.get();
+        op->length = blockSize_;
+        op->offset = (uint64_t)index * blockSize_;
+        op->done = &IoReadStage::readDone;
+        op->stage = this;
+        op->index = index;
+        begin();
+        engine_.submit(op);
+    }
+
+    // 缓冲区是否已注册为io_uring固定缓冲区
+    bool registered() const
+    {
+        return registered_;
+    }
+
+    ObjectPool<IoBuffer>& pool()
+    {
+        return pool_;
+    }
+
+private:
+    struct ReadOp : IoOp {
+        IoReadStage* stage;
+        int index;
+        Pooled<IoBuffer> buffer_;
+    };
+
+    static void readDone(IoOp* base, int result)
+    {
+        ReadOp* op = static_cast<ReadOp*>(base);
+        IoBlock block;
+        block.index = op->index;
+        block.offset = op->offset;
+        block.result = result;
+        block.buffer = std::move(op->buffer_);
+        block.buffer->resize(result > 0 ? (size_t)result : 0);
+        IoReadStage* stage = op->stage;
+        delete op;
+        stage->deliver(std::move(block));
+    }
+
+    IoEngine& engine_;
+    int fd_;
+    size_t blockSize_;
+    ObjectPool<IoBuffer> pool_;
+    bool registered_ = false;
+};
+
+// 写入阶段：把IoBlock的buffer中size()个字节写到文件的offset处，写完后把块（result为写入的字节数）推送给下游
+// 没有下游时块在这里被丢弃，缓冲区回到它的对象池；读取失败（result < 0）的块不写，直接交给下游
+class IoWriteStage : public IoStage<IoBlock> {
+public:
+    IoWriteStage(const std::string& name, IoEngine& engine, int fd)
+        : IoStage<IoBlock>(name)
+        , engine_(engine)
+        , fd_(fd)
+    {
+    }
+
+    void push(IoBlock block) override
+    {
+        if (block.result < 0 || !block.buffer) {
+            forward(std::move(block));
+            return;
+        }
+        WriteOp* op = new WriteOp;
+        op->kind = IoOp::Write;
+        op->fd = fd_;
+        op->buffer = block.buffer.get();
+        op->length = block.buffer->size();
+        op->offset = block.offset;
+        op->done = &IoWriteStage::writeDone;
+        op->stage = this;
+        op->block = std::move(block);
+        begin();
+        engine_.submit(op);
+    }
+
+private:
+    struct WriteOp : IoOp {
+        IoWriteStage* stage;
+        IoBlock block;
+    };
+
+    static void writeDone(IoOp* base, int result)
+    {
+        WriteOp* op = static_cast<WriteOp*>(base);
+        IoBlock block = std::move(op->block);
+        block.result = result;
+        IoWriteStage* stage = op->stage;
+        delete op;
+        stage->deliver(std::move(block));
+    }
+
+    IoEngine& engine_;
+    int fd_;
+};
@@ -0,0 +1,562 @@
+// task_queue.hpp的Python扩展模块，接口与task_queue.py相同：
+//     import task_queue_native as tq
+// 队列、线程和分发都在C++中执行，不持有GIL；只有调用Python函数时才获取GIL，
+// 所以阶段函数调用NumPy、CUDA等会释放GIL的库时，多个工作线程可以真正并行
+// 阶段函数也可以是C/C++实现的原生函数（见STAGE_FUNC），执行时完全不需要GIL
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+
+#include "task_queue.hpp"
+
+namespace {
+
+// 原生阶段函数：void func(int index, void* context)，不能抛出异常
+using NativeStageFunc = void (*)(int, void*);
+const char* const kStageFuncCapsule = "task_queue_native.StageFunc";
+
+// 管理整个流水线的异常，与task_queue.py中的Pipeline相同
+struct PipelineObject {
+    PyObject_HEAD
+    PyObject* exceptions; // [(stage_name, index, exception)]
+};
+
+PyTypeObject PipelineType = { PyVarObject_HEAD_INIT(nullptr, 0) };
+
+PyObject* pipelineNew(PyTypeObject* type, PyObject*, PyObject*)
+{
+    PipelineObject* self = reinterpret_cast<PipelineObject*>(type->tp_alloc(type, 0));
+    if (!self)
+        return nullptr;
+    self->exceptions = PyList_New(0);
+    if (!self->exceptions) {
+        Py_DECREF(self);
+        return nullptr;
+    }
+    return reinterpret_cast<PyObject*>(self);
+}
+
+int pipelineTraverse(PipelineObject* self, visitproc visit, void* arg)
+{
+    Py_VISIT(self->exceptions);
+    return 0;
+}
+
+int pipelineClear(PipelineObject* self)
+{
+    Py_CLEAR(self->exceptions);
+    return 0;
+}
+
+void pipelineDealloc(PipelineObject* self)
+{
+    PyObject_GC_UnTrack(self);
+    pipelineClear(self);
+    Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+// 持有GIL时调用
+int addException(PipelineObject* pipeline, PyObject* stageName, int index, PyObject* exception)
+{
+    PyObject* entry = Py_BuildValue("(OiO)", stageName, index, exception);
+    if (!entry)
+        return -1;
+    int r = PyList_Append(pipeline->exceptions, entry);
+    Py_DECREF(entry);
+    return r;
+}
+
+PyObject* pipelineAddException(PipelineObject* self, PyObject* args)
+{
+    PyObject* stageName;
+    int index;
+    PyObject* exception;
+    if (!PyArg_ParseTuple(args, "OiO", &stageName, &index, &exception))
+        return nullptr;
+    if (addException(self, stageName, index, exception) < 0)
+        return nullptr;
+    Py_RETURN_NONE;
+}
+
+PyObject* pipelineHasExceptions(PipelineObject* self, PyObject*)
+{
+    return PyBool_FromLong(PyList_GET_SIZE(self->exceptions) > 0);
+}
+
+// 把line（新引用）追加到parts，line为空或追加失败时返回false
+bool appendLine(PyObject* parts, PyObject* line)
+{
+    if (!line)
+        return false;
+    int r = PyList_Append(parts, line);
+    Py_DECREF(line);
+    return r == 0;
+}
+
+PyObject* pipelineSummary(PipelineObject* self, PyObject*)
+{
+    Py_ssize_t n = PyList_GET_SIZE(self->exceptions);
+    if (n == 0)
+        return PyUnicode_FromString("No exceptions");
+    PyObject* parts = PyList_New(0);
+    if (!parts)
+        return nullptr;
+    bool ok = appendLine(parts, PyUnicode_FromFormat("%zd task(s) failed in pipeline:\n", n));
+    for (Py_ssize_t i = 0; ok && i < n && i < 5; ++i) { // 只显示前5个
+        PyObject* entry = PyList_GET_ITEM(self->exceptions, i);
+        PyObject* exc = PyTuple_GET_ITEM(entry, 2);
+        ok = appendLine(parts, PyUnicode_FromFormat("  - Stage '%S', task %S: %s: %S\n",
+                                   PyTuple_GET_ITEM(entry, 0), PyTuple_GET_ITEM(entry, 1), Py_TYPE(exc)->tp_name, exc));
+    }
+    if (ok && n > 5)
+        ok = appendLine(parts, PyUnicode_FromFormat("  ... and %zd more errors\n", n - 5));
+    PyObject* result = nullptr;
+    PyObject* empty = ok ? PyUnicode_FromString("") : nullptr;
+    if (empty) {
+        result = PyUnicode_Join(empty, parts);
+        Py_DECREF(empty);
+    }
+    Py_DECREF(parts);
+    return result;
+}
+
+PyMethodDef pipelineMethods[] = {
+    { "add_exception", reinterpret_cast<PyCFunction>(pipelineAddException), METH_VARARGS, "添加异常到pipeline" },
+    { "has_exceptions", reinterpret_cast<PyCFunction>(pipelineHasExceptions), METH_NOARGS, "检查是否有异常" },
+    { "get_exception_summary", reinterpret_cast<PyCFunction>(pipelineSummary), METH_NOARGS, "获取异常摘要" },
+    { nullptr, nullptr, 0, nullptr }
+};
+
+PyMemberDef pipelineMembers[] = {
+    { const_cast<char*>("exceptions"), T_OBJECT_EX, offsetof(PipelineObject, exceptions), READONLY, nullptr },
+    { nullptr, 0, 0, 0, nullptr }
+};
+
+// Stage和StageCurrent共用的对象布局，二者只是C++执行器不同
+struct StageObject {
+    PyObject_HEAD
+    Stage* threaded; // Stage时非空
+    StageCurrent* current; // StageCurrent时非空
+    PyObject* name;
+    PyObject* func; // Python可调用对象，或者包装原生函数的胶囊
+    PyObject* next;
+    PyObject* pipeline;
+    NativeStageFunc native;
+    void* nativeContext;
+};
+
+PyTypeObject StageType = { PyVarObject_HEAD_INIT(nullptr, 0) };
+PyTypeObject StageCurrentType = { PyVarObject_HEAD_INIT(nullptr, 0) };
+
+bool isStage(PyObject* obj)
+{
+    return PyObject_TypeCheck(obj, &StageType) || PyObject_TypeCheck(obj, &StageCurrentType);
+}
+
+StageInput<int>* inputOf(StageObject* self)
+{
+    if (self->threaded)
+        return self->threaded;
+    return self->current;
+}
+
+// 在工作线程上执行，不持有GIL；异常记录到pipeline，索引照常传给下游，使下游的计数正确递减
+void runIndex(StageObject* self, int index)
+{
+    if (self->native) {
+        self->native(index, self->nativeContext);
+        return;
+    }
+    PyGILState_STATE gil = PyGILState_Ensure();
+    PyObject* result = PyObject_CallFunction(self->func, "i", index);
+    if (result) {
+        Py_DECREF(result);
+    } else {
+        PyObject *type, *value, *traceback;
+        PyErr_Fetch(&type, &value, &traceback);
+        PyErr_NormalizeException(&type, &value, &traceback);
+        if (value && traceback)
+            PyException_SetTraceback(value, traceback);
+        if (!value || addException(reinterpret_cast<PipelineObject*>(self->pipeline), self->name, index, value) < 0)
+            PyErr_WriteUnraisable(self->func);
+        Py_XDECREF(type);
+        Py_XDECREF(value);
+        Py_XDECREF(traceback);
+    }
+    PyGILState_Release(gil);
+}
+
+PyObject* stageNew(PyTypeObject* type, PyObject* args, PyObject* kwds)
+{
+    static const char* keywords[] = { "name", "num_workers", "capacity", "func", "pipeline", nullptr };
+    PyObject* name;
+    PyObject* workers;
+    int capacity;
+    PyObject* func;
+    PyObject* pipeline = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "UOiO|O", const_cast<char**>(keywords),
+            &name, &workers, &capacity, &func, &pipeline))
+        return nullptr;
+    bool current = type == &StageCurrentType;
+    // StageCurrent的num_workers只为与Stage的接口一致，可以是None
+    int threads = 1;
+    if (!current) {
+        threads = (int)PyLong_AsLong(workers);
+        if (threads == -1 && PyErr_Occurred())
+            return nullptr;
+    }
+    NativeStageFunc native = nullptr;
+    void* nativeContext = nullptr;
+    if (PyCapsule_IsValid(func, kStageFuncCapsule)) {
+        native = reinterpret_cast<NativeStageFunc>(PyCapsule_GetPointer(func, kStageFuncCapsule));
+        nativeContext = PyCapsule_GetContext(func);
+    } else if (!PyCallable_Check(func)) {
+        PyErr_SetString(PyExc_TypeError, "func must be callable or a task_queue_native.StageFunc capsule");
+        return nullptr;
+    }
+    if (pipeline != Py_None && !PyObject_TypeCheck(pipeline, &PipelineType)) {
+        PyErr_SetString(PyExc_TypeError, "pipeline must be a task_queue_native.Pipeline");
+        return nullptr;
+    }
+
+    StageObject* self = reinterpret_cast<StageObject*>(type->tp_alloc(type, 0));
+    if (!self)
+        return nullptr;
+    Py_INCREF(name);
+    self->name = name;
+    Py_INCREF(func);
+    self->func = func;
+    self->native = native;
+    self->nativeContext = nativeContext;
+    if (pipeline == Py_None) {
+        self->pipeline = PyObject_CallObject(reinterpret_cast<PyObject*>(&PipelineType), nullptr);
+        if (!self->pipeline) {
+            Py_DECREF(self);
+            return nullptr;
+        }
+    } else {
+        Py_INCREF(pipeline);
+        self->pipeline = pipeline;
+    }
+
+    std::string stageName = PyUnicode_AsUTF8(name);
+    auto run = [self](int index) {
+        runIndex(self, index);
+    };
+    try {
+        if (current) {
+            self->current = new StageCurrent(stageName, threads, capacity, run);
+        } else {
+            self->threaded = new Stage(stageName, threads, capacity, run);
+        }
+    } catch (const std::exception& e) {
+        Py_DECREF(self);
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+        return nullptr;
+    }
+    return reinterpret_cast<PyObject*>(self);
+}
+
+int stageTraverse(StageObject* self, visitproc visit, void* arg)
+{
+    Py_VISIT(self->func);
+    Py_VISIT(self->next);
+    Py_VISIT(self->pipeline);
+    return 0;
+}
+
+int stageClear(StageObject* self)
+{
+    Py_CLEAR(self->func);
+    Py_CLEAR(self->next);
+    Py_CLEAR(self->pipeline);
+    return 0;
+}
+
+void stageDealloc(StageObject* self)
+{
+    PyObject_GC_UnTrack(self);
+    // 析构时join工作线程，它们可能正在等待GIL
+    Py_BEGIN_ALLOW_THREADS
+    delete self->threaded;
+    delete self->current;
+    Py_END_ALLOW_THREADS
+    stageClear(self);
+    Py_CLEAR(self->name);
+    Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+PyObject* stageSetTaskCount(StageObject* self, PyObject* arg)
+{
+    int n = (int)PyLong_AsLong(arg);
+    if (n == -1 && PyErr_Occurred())
+        return nullptr;
+    if (self->threaded)
+        self->threaded->setTaskCount(n);
+    else
+        self->current->setTaskCount(n);
+    Py_RETURN_NONE;
+}
+
+PyObject* stageAddTaskCount(StageObject* self, PyObject* arg)
+{
+    int n = (int)PyLong_AsLong(arg);
+    if (n == -1 && PyErr_Occurred())
+        return nullptr;
+    inputOf(self)->addTaskCount(n);
+    Py_RETURN_NONE;
+}
+
+// 队列满时push阻塞，必须先释放GIL，否则工作线程无法执行Python函数来腾出空间
+PyObject* stagePush(StageObject* self, PyObject* arg)
+{
+    int index = (int)PyLong_AsLong(arg);
+    if (index == -1 && PyErr_Occurred())
+        return nullptr;
+    StageInput<int>* input = inputOf(self);
+    Py_BEGIN_ALLOW_THREADS
+    input->push(index);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+// 推送[begin, end)，整个范围只释放一次GIL
+PyObject* stagePushRange(StageObject* self, PyObject* args)
+{
+    int begin, end, grain = 0;
+    if (!PyArg_ParseTuple(args, "ii|i", &begin, &end, &grain))
+        return nullptr;
+    StageInput<int>* input = inputOf(self);
+    Py_BEGIN_ALLOW_THREADS
+    input->pushRange(begin, end, grain);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+PyObject* stageOpenStream(StageObject* self, PyObject*)
+{
+    inputOf(self)->openStream();
+    Py_RETURN_NONE;
+}
+
+PyObject* stageClose(StageObject* self, PyObject*)
+{
+    StageInput<int>* input = inputOf(self);
+    Py_BEGIN_ALLOW_THREADS
+    input->close();
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+// 流水线中有任务失败时抛出RuntimeError，__cause__为第一个异常
+PyObject* raiseIfFailed(StageObject* self)
+{
+    PipelineObject* pipeline = reinterpret_cast<PipelineObject*>(self->pipeline);
+    if (PyList_GET_SIZE(pipeline->exceptions) == 0)
+        Py_RETURN_NONE;
+    PyObject* summary = pipelineSummary(pipeline, nullptr);
+    if (!summary)
+        return nullptr;
+    PyObject* error = PyObject_CallFunctionObjArgs(PyExc_RuntimeError, summary, nullptr);
+    Py_DECREF(summary);
+    if (!error)
+        return nullptr;
+    PyObject* first = PyTuple_GET_ITEM(PyList_GET_ITEM(pipeline->exceptions, 0), 2);
+    Py_INCREF(first);
+    PyException_SetCause(error, first);
+    PyErr_SetObject(PyExc_RuntimeError, error);
+    Py_DECREF(error);
+    return nullptr;
+}
+
+PyObject* stageWait(StageObject* self, PyObject*)
+{
+    if (!self->threaded) {
+        PyErr_SetString(PyExc_TypeError, "StageCurrent has no wait(), call run()");
+        return nullptr;
+    }
+    Stage* stage = self->threaded;
+    Py_BEGIN_ALLOW_THREADS
+    stage->wait();
+    Py_END_ALLOW_THREADS
+    return raiseIfFailed(self);
+}
+
+// 在当前线程中运行任务队列，阻塞直到所有任务完成；Python函数也在当前线程上调用
+PyObject* stageRun(StageObject* self, PyObject*)
+{
+    if (!self->current) {
+        PyErr_SetString(PyExc_TypeError, "Stage runs on its own threads, call wait()");
+        return nullptr;
+    }
+    StageCurrent* stage = self->current;
+    Py_BEGIN_ALLOW_THREADS
+    stage->run();
+    Py_END_ALLOW_THREADS
+    return raiseIfFailed(self);
+}
+
+PyObject* stageGetPipeline(StageObject* self, void*)
+{
+    Py_INCREF(self->pipeline);
+    return self->pipeline;
+}
+
+int stageSetPipeline(StageObject* self, PyObject* value, void*)
+{
+    if (!value || !PyObject_TypeCheck(value, &PipelineType)) {
+        PyErr_SetString(PyExc_TypeError, "pipeline must be a task_queue_native.Pipeline");
+        return -1;
+    }
+    Py_INCREF(value);
+    Py_SETREF(self->pipeline, value);
+    return 0;
+}
+
+PyObject* stageGetNext(StageObject* self, void*)
+{
+    PyObject* next = self->next ? self->next : Py_None;
+    Py_INCREF(next);
+    return next;
+}
+
+PyMethodDef stageMethods[] = {
+    { "setTaskCount", reinterpret_cast<PyCFunction>(stageSetTaskCount), METH_O, "设置任务总数" },
+    { "addTaskCount", reinterpret_cast<PyCFunction>(stageAddTaskCount), METH_O, "在头部调用，自动推导所有下游的任务数" },
+    { "push", reinterpret_cast<PyCFunction>(stagePush), METH_O, "推送索引到流水线" },
+    { "pushRange", reinterpret_cast<PyCFunction>(stagePushRange), METH_VARARGS, "按块推送[begin, end)" },
+    { "openStream", reinterpret_cast<PyCFunction>(stageOpenStream), METH_NOARGS, "进入流式模式（替代setTaskCount）" },
+    { "close", reinterpret_cast<PyCFunction>(stageClose), METH_NOARGS, "结束流式输入" },
+    { "wait", reinterpret_cast<PyCFunction>(stageWait), METH_NOARGS, "等待完成，有任务失败时抛出RuntimeError" },
+    { nullptr, nullptr, 0, nullptr }
+};
+
+PyMethodDef stageCurrentMethods[] = {
+    { "setTaskCount", reinterpret_cast<PyCFunction>(stageSetTaskCount), METH_O, "设置任务总数" },
+    { "addTaskCount", reinterpret_cast<PyCFunction>(stageAddTaskCount), METH_O, "在头部调用，自动推导所有下游的任务数" },
+    { "push", reinterpret_cast<PyCFunction>(stagePush), METH_O, "推送索引到流水线" },
+    { "pushRange", reinterpret_cast<PyCFunction>(stagePushRange), METH_VARARGS, "按块推送[begin, end)" },
+    { "openStream", reinterpret_cast<PyCFunction>(stageOpenStream), METH_NOARGS, "进入流式模式（替代setTaskCount）" },
+    { "close", reinterpret_cast<PyCFunction>(stageClose), METH_NOARGS, "结束流式输入" },
+    { "run", reinterpret_cast<PyCFunction>(stageRun), METH_NOARGS, "在当前线程中运行任务队列，阻塞直到所有任务完成" },
+    { nullptr, nullptr, 0, nullptr }
+};
+
+PyGetSetDef stageGetSet[] = {
+    { const_cast<char*>("pipeline"), reinterpret_cast<getter>(stageGetPipeline), reinterpret_cast<setter>(stageSetPipeline), nullptr, nullptr },
+    { const_cast<char*>("next"), reinterpret_cast<getter>(stageGetNext), nullptr, const_cast<char*>("由chain设置"), nullptr },
+    { nullptr, nullptr, nullptr, nullptr, nullptr }
+};
+
+PyMemberDef stageMembers[] = {
+    { const_cast<char*>("name"), T_OBJECT_EX, offsetof(StageObject, name), READONLY, nullptr },
+    { nullptr, 0, 0, 0, nullptr }
+};
+
+// 链接两个stage，stage_b及其下游改用stage_a的pipeline，返回stage_b
+PyObject* chainStages(PyObject*, PyObject* args)
+{
+    PyObject* a;
+    PyObject* b;
+    if (!PyArg_ParseTuple(args, "OO", &a, &b))
+        return nullptr;
+    if (!isStage(a) || !isStage(b)) {
+        PyErr_SetString(PyExc_TypeError, "chain() expects two task_queue_native stages");
+        return nullptr;
+    }
+    StageObject* first = reinterpret_cast<StageObject*>(a);
+    StageObject* second = reinterpret_cast<StageObject*>(b);
+    if (first->threaded)
+        first->threaded->setNext(inputOf(second));
+    else
+        first->current->setNext(inputOf(second));
+    Py_INCREF(b);
+    Py_XSETREF(first->next, b);
+    for (StageObject* s = second; s; s = reinterpret_cast<StageObject*>(s->next)) {
+        if (s->pipeline == first->pipeline)
+            break;
+        Py_INCREF(first->pipeline);
+        Py_SETREF(s->pipeline, first->pipeline);
+    }
+    Py_INCREF(b);
+    return b;
+}
+
+PyMethodDef moduleMethods[] = {
+    { "chain", chainStages, METH_VARARGS, "链接两个stage，自动共享pipeline" },
+    { nullptr, nullptr, 0, nullptr }
+};
+
+PyModuleDef moduleDef = {
+    PyModuleDef_HEAD_INIT,
+    "task_queue_native",
+    "task_queue.hpp的Python绑定，接口与task_queue.py相同",
+    -1,
+    moduleMethods,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+};
+
+int initStageType(PyTypeObject& type, const char* name, const char* doc, PyMethodDef* methods)
+{
+    type.tp_name = name;
+    type.tp_doc = doc;
+    type.tp_basicsize = sizeof(StageObject);
+    type.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC;
+    type.tp_new = stageNew;
+    type.tp_dealloc = reinterpret_cast<destructor>(stageDealloc);
+    type.tp_traverse = reinterpret_cast<traverseproc>(stageTraverse);
+    type.tp_clear = reinterpret_cast<inquiry>(stageClear);
+    type.tp_methods = methods;
+    type.tp_members = stageMembers;
+    type.tp_getset = stageGetSet;
+    return PyType_Ready(&type);
+}
+
+int addType(PyObject* module, const char* name, PyTypeObject& type)
+{
+    Py_INCREF(&type);
+    if (PyModule_AddObject(module, name, reinterpret_cast<PyObject*>(&type)) < 0) {
+        Py_DECREF(&type);
+        return -1;
+    }
+    return 0;
+}
+
+} // namespace
+
+PyMODINIT_FUNC PyInit_task_queue_native()
+{
+#if PY_VERSION_HEX < 0x03070000
+    PyEval_InitThreads();
+#endif
+    PipelineType.tp_name = "task_queue_native.Pipeline";
+    PipelineType.tp_doc = "管理整个流水线的异常";
+    PipelineType.tp_basicsize = sizeof(PipelineObject);
+    PipelineType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC;
+    PipelineType.tp_new = pipelineNew;
+    PipelineType.tp_dealloc = reinterpret_cast<destructor>(pipelineDealloc);
+    PipelineType.tp_traverse = reinterpret_cast<traverseproc>(pipelineTraverse);
+    PipelineType.tp_clear = reinterpret_cast<inquiry>(pipelineClear);
+    PipelineType.tp_methods = pipelineMethods;
+    PipelineType.tp_members = pipelineMembers;
+    if (PyType_Ready(&PipelineType) < 0)
+        return nullptr;
+    if (initStageType(StageType, "task_queue_native.Stage", "多线程执行的流水线阶段", stageMethods) < 0)
+        return nullptr;
+    if (initStageType(StageCurrentType, "task_queue_native.StageCurrent", "在调用run的线程中执行任务的流水线阶段", stageCurrentMethods) < 0)
+        return nullptr;
+
+    PyObject* module = PyModule_Create(&moduleDef);
+    if (!module)
+        return nullptr;
+    if (addType(module, "Pipeline", PipelineType) < 0 || addType(module, "Stage", StageType) < 0
+        || addType(module, "StageCurrent", StageCurrentType) < 0
+        || PyModule_AddStringConstant(module, "STAGE_FUNC", kStageFuncCapsule) < 0) {
+        Py_DECREF(module);
+        return nullptr;
+    }
+    return module;
+}
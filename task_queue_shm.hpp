@@ -0,0 +1,795 @@
+#pragma once
+// 跨进程传输：不同进程中的阶段通过同名的共享内存区交换索引或固定布局的描述符，不经过socket和序列化
+// 槽位中是trivially copyable的值而不是std::function，等待和唤醒使用进程间共享的futex，队列不满不空时不进入内核
+// 大块数据放在共享内存池（ShmArena）中，队列里只传递块的偏移，数据本身不复制
+// 只支持Linux；共享内存中的原子变量必须是无锁的（常见的64位平台都满足）
+#include "task_queue.hpp"
+
+#include <cerrno>
+#include <climits>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+    "task_queue_shm.hpp需要无锁的32位和64位原子变量");
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex要求原子变量与uint32_t布局相同");
+
+// 共享的32位字上的futex；不使用FUTEX_PRIVATE_FLAG，映射了同一页的其他进程也能被唤醒
+inline void shmFutexWait(std::atomic<uint32_t>& word, uint32_t expected)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, nullptr, nullptr, 0);
+}
+
+inline void shmFutexWake(std::atomic<uint32_t>& word, int count = INT_MAX)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, count, nullptr, nullptr, 0);
+}
+
+// 放在共享内存中的事件：状态改变后notify，等待方在条件不满足时睡在序号上
+// 先读序号再检查条件，notify在两者之间发生时futex发现序号已变，立即返回，不会丢失唤醒
+struct ShmEvent {
+    std::atomic<uint32_t> seq { 0 };
+    std::atomic<uint32_t> waiters { 0 }; // 只用于省去没有等待者时的系统调用
+
+    void notify()
+    {
+        seq.fetch_add(1);
+        if (waiters.load() > 0)
+            shmFutexWake(seq);
+    }
+
+    // ready可以有副作用（例如出队），返回true时不会再被调用
+    template <typename Ready>
+    void waitUntil(Ready ready)
+    {
+        for (;;) {
+            uint32_t s = seq.load();
+            if (ready())
+                return;
+            waiters.fetch_add(1);
+            shmFutexWait(seq, s);
+            waiters.fetch_sub(1);
+        }
+    }
+};
+
+enum class ShmMode {
+    Create, // 删除同名的残留区域（例如上次崩溃留下的）后新建，析构时删除名字
+    Open // 等待创建方完成初始化后映射，析构时只解除映射；不会映射创建方已退出的残留区域
+};
+
+// 命名共享内存区（POSIX shm_open），开头一页是就绪标志，data()按页对齐
+// 名字以'/'开头，例如"/gpu0.input"
+// 创建方在存活期间持有区域文件上的flock排他锁，进程退出（包括崩溃）时内核自动释放；
+// 打开方据此跳过上次崩溃留下的区域（其中的就绪标志仍是1），等待重新启动的创建方新建
+class ShmRegion {
+public:
+    static constexpr size_t HeaderSize = 4096;
+
+    // Open时size被忽略，timeout是等待创建方的最长时间
+    ShmRegion(const std::string& name, ShmMode mode, size_t size,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(10000))
+        : name_(name)
+        , owner_(mode == ShmMode::Create)
+    {
+        if (owner_) {
+            create(size);
+            return;
+        }
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!attach()) {
+            if (std::chrono::steady_clock::now() >= deadline)
+                throw std::runtime_error("ShmRegion: timed out waiting for " + name);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    ShmRegion(const ShmRegion&) = delete;
+    ShmRegion& operator=(const ShmRegion&) = delete;
+
+    ~ShmRegion()
+    {
+        munmap(base_, size_);
+        if (owner_) {
+            shm_unlink(name_.c_str());
+            close(fd_); // 释放flock
+        }
+    }
+
+    // 创建方初始化完data()中的结构后调用，之后Open的一方才会返回
+    void markReady()
+    {
+        ready().store(1, std::memory_order_release);
+    }
+
+    char* data()
+    {
+        return base_ + HeaderSize;
+    }
+
+    size_t size() const
+    {
+        return size_ - HeaderSize;
+    }
+
+    bool owner() const
+    {
+        return owner_;
+    }
+
+    const std::string& name() const
+    {
+        return name_;
+    }
+
+private:
+    // 先加锁再设置大小：打开方看到大小不为0时锁一定已经持有
+    void create(size_t size)
+    {
+        shm_unlink(name_.c_str());
+        int fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "shm_open " + name_);
+        size_ = HeaderSize + size;
+        const char* step = "flock ";
+        void* p = MAP_FAILED;
+        if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+            step = "ftruncate ";
+            if (ftruncate(fd, (off_t)size_) == 0) {
+                step = "mmap ";
+                p = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            }
+        }
+        if (p == MAP_FAILED) {
+            int err = errno;
+            close(fd);
+            shm_unlink(name_.c_str());
+            throw std::system_error(err, std::generic_category(), step + name_);
+        }
+        fd_ = fd; // 保持打开，锁随之持有到析构
+        base_ = static_cast<char*>(p);
+    }
+
+    // 映射一个创建方仍然存活并已初始化完的区域；还没有创建、是残留区域或还没有初始化完时返回false
+    bool attach()
+    {
+        int fd = shm_open(name_.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            if (errno != ENOENT)
+                throw std::system_error(errno, std::generic_category(), "shm_open " + name_);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size <= HeaderSize || !creatorAlive(fd)) {
+            close(fd); // 创建方还没有设置大小，或者已经退出
+            return false;
+        }
+        void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        int err = errno;
+        close(fd); // 映射保持有效
+        if (p == MAP_FAILED)
+            throw std::system_error(err, std::generic_category(), "mmap " + name_);
+        base_ = static_cast<char*>(p);
+        size_ = (size_t)st.st_size;
+        // 就绪后再确认名字仍指向这个区域：检查存活之后创建方可能刚好退出并被重新启动
+        if (ready().load(std::memory_order_acquire) != 0 && current(st)) {
+            return true;
+        }
+        munmap(base_, size_);
+        base_ = nullptr;
+        size_ = 0;
+        return false;
+    }
+
+    // 能取得共享锁说明没有创建方持有排他锁
+    static bool creatorAlive(int fd)
+    {
+        if (flock(fd, LOCK_SH | LOCK_NB) == 0) {
+            flock(fd, LOCK_UN);
+            return false;
+        }
+        return true;
+    }
+
+    bool current(const struct stat& mapped) const
+    {
+        int fd = shm_open(name_.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        bool same = fstat(fd, &st) == 0 && st.st_dev == mapped.st_dev && st.st_ino == mapped.st_ino;
+        close(fd);
+        return same;
+    }
+
+    std::atomic<uint32_t>& ready()
+    {
+        return *reinterpret_cast<std::atomic<uint32_t>*>(base_);
+    }
+
+    std::string name_;
+    bool owner_;
+    int fd_ = -1; // 创建方持有锁的描述符
+    char* base_ = nullptr;
+    size_t size_ = 0;
+};
+
+// 共享内存中的有界MPMC环形队列，元素是trivially copyable的T，任意进程都可以push和pop
+// 与LockFreeTaskQueue相同的按槽位序号的算法，只在队列满/空时睡在futex上
+// 创建方决定容量（向上取整为2的幂），打开方检查元素布局一致
+template <typename T>
+class ShmQueue {
+    static_assert(std::is_trivially_copyable<T>::value, "ShmQueue只能传递trivially copyable的值");
+
+public:
+    ShmQueue(const std::string& name, ShmMode mode, size_t capacity = 1024)
+        : region_(name, mode, bytesFor(roundUp(capacity)))
+    {
+        if (region_.owner()) {
+            size_t n = roundUp(capacity);
+            header_ = new (region_.data()) Header();
+            header_->capacity = n;
+            header_->slotSize = sizeof(Slot);
+            slots_ = reinterpret_cast<Slot*>(region_.data() + sizeof(Header));
+            for (size_t i = 0; i < n; ++i) {
+                new (&slots_[i]) Slot();
+                slots_[i].seq.store(i, std::memory_order_relaxed);
+            }
+            region_.markReady();
+        } else {
+            header_ = reinterpret_cast<Header*>(region_.data());
+            slots_ = reinterpret_cast<Slot*>(region_.data() + sizeof(Header));
+            if (header_->slotSize != sizeof(Slot) || bytesFor(header_->capacity) > region_.size())
+                throw std::invalid_argument("ShmQueue: element layout differs from the creating process");
+        }
+        mask_ = header_->capacity - 1;
+    }
+
+    // 队列满时阻塞；队列已关闭时返回false
+    bool push(const T& value)
+    {
+        bool pushed = false;
+        header_->notFull.waitUntil([&]() {
+            pushed = tryPush(value);
+            return pushed || isClosed();
+        });
+        return pushed;
+    }
+
+    bool tryPush(const T& value)
+    {
+        if (isClosed())
+            return false;
+        uint64_t pos = header_->tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = slots_[pos & mask_];
+            uint64_t seq = slot.seq.load(std::memory_order_acquire);
+            int64_t diff = (int64_t)(seq - pos);
+            if (diff == 0) {
+                if (header_->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.value = value;
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    header_->notEmpty.notify();
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // 满
+            } else {
+                pos = header_->tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // 队列空时阻塞；已关闭且为空，或cancel被置位并调用了interrupt()时返回false
+    bool pop(T& out, const std::atomic<bool>* cancel = nullptr)
+    {
+        bool popped = false;
+        header_->notEmpty.waitUntil([&]() {
+            popped = tryPop(out);
+            return popped || isClosed() || (cancel && cancel->load());
+        });
+        return popped;
+    }
+
+    bool tryPop(T& out)
+    {
+        uint64_t pos = header_->head.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = slots_[pos & mask_];
+            uint64_t seq = slot.seq.load(std::memory_order_acquire);
+            int64_t diff = (int64_t)(seq - (pos + 1));
+            if (diff == 0) {
+                if (header_->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    out = slot.value;
+                    slot.seq.store(pos + mask_ + 1, std::memory_order_release);
+                    header_->notFull.notify();
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // 空
+            } else {
+                pos = header_->head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // 所有进程中阻塞的push/pop都会返回，之后的push失败，剩余的值仍可pop
+    void close()
+    {
+        header_->closed.store(1);
+        header_->notEmpty.notify();
+        header_->notFull.notify();
+    }
+
+    bool isClosed() const
+    {
+        return header_->closed.load() != 0;
+    }
+
+    // 唤醒阻塞的pop，让它们重新检查cancel
+    void interrupt()
+    {
+        header_->notEmpty.notify();
+    }
+
+    // 近似值
+    size_t size() const
+    {
+        uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+        uint64_t head = header_->head.load(std::memory_order_relaxed);
+        return tail > head ? (size_t)(tail - head) : 0;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    size_t capacity() const
+    {
+        return mask_ + 1;
+    }
+
+private:
+    struct Header {
+        uint64_t capacity = 0;
+        uint64_t slotSize = 0;
+        std::atomic<uint32_t> closed { 0 };
+        ShmEvent notEmpty;
+        ShmEvent notFull;
+        alignas(64) std::atomic<uint64_t> tail { 0 };
+        alignas(64) std::atomic<uint64_t> head { 0 };
+    };
+
+    struct Slot {
+        std::atomic<uint64_t> seq { 0 };
+        T value;
+    };
+
+    static size_t roundUp(size_t n)
+    {
+        size_t c = 2;
+        while (c < n)
+            c <<= 1;
+        return c;
+    }
+
+    static size_t bytesFor(size_t capacity)
+    {
+        return sizeof(Header) + capacity * sizeof(Slot);
+    }
+
+    ShmRegion region_;
+    Header* header_ = nullptr;
+    Slot* slots_ = nullptr;
+    size_t mask_ = 0;
+};
+
+// 共享内存池中的一块，offset相对于池的起点，在每个进程中都有效；size是有效数据的长度
+struct ShmBuffer {
+    uint64_t offset = 0;
+    uint64_t size = 0;
+};
+
+// 固定大小块的共享内存池：生产进程allocate一块、写入数据后把ShmBuffer放进描述符，
+// 消费进程用data()直接读，用完release，块回到池中；空闲块是共享内存中带版本号的无锁栈
+// 与ObjectPool一样，池空时allocate阻塞，直到某个进程归还一块
+class ShmArena {
+public:
+    // Open时blockSize和blockCount被忽略，使用创建方的值
+    ShmArena(const std::string& name, ShmMode mode, size_t blockSize = 0, size_t blockCount = 0)
+        : region_(name, mode, bytesFor(alignBlock(blockSize), blockCount))
+    {
+        if (region_.owner()) {
+            if (blockSize == 0 || blockCount == 0 || blockCount >= UINT32_MAX)
+                throw std::invalid_argument("ShmArena: blockSize and blockCount must be positive");
+            header_ = new (region_.data()) Header();
+            header_->blockSize = alignBlock(blockSize);
+            header_->blockCount = blockCount;
+            header_->dataOffset = dataOffsetFor(blockCount);
+            next_ = reinterpret_cast<std::atomic<uint32_t>*>(region_.data() + sizeof(Header));
+            for (size_t i = 0; i < blockCount; ++i) {
+                new (&next_[i]) std::atomic<uint32_t>(i + 1 < blockCount ? (uint32_t)(i + 2) : 0);
+            }
+            header_->top.store(1); // 栈顶编号加一，0表示空
+            header_->freeCount.store((uint32_t)blockCount);
+            region_.markReady();
+        } else {
+            header_ = reinterpret_cast<Header*>(region_.data());
+            next_ = reinterpret_cast<std::atomic<uint32_t>*>(region_.data() + sizeof(Header));
+        }
+    }
+
+    // 池空时阻塞；size超过块大小时抛出invalid_argument
+    ShmBuffer allocate(size_t size)
+    {
+        checkSize(size);
+        ShmBuffer buffer;
+        header_->released.waitUntil([&]() {
+            return tryAllocate(size, buffer);
+        });
+        return buffer;
+    }
+
+    bool tryAllocate(size_t size, ShmBuffer& out)
+    {
+        checkSize(size);
+        uint64_t top = header_->top.load(std::memory_order_acquire);
+        for (;;) {
+            uint32_t first = (uint32_t)top;
+            if (first == 0)
+                return false;
+            uint64_t next = ((top >> 32) + 1) << 32 | next_[first - 1].load(std::memory_order_relaxed);
+            if (header_->top.compare_exchange_weak(top, next, std::memory_order_acquire)) {
+                header_->freeCount.fetch_sub(1, std::memory_order_relaxed);
+                out.offset = header_->dataOffset + (uint64_t)(first - 1) * header_->blockSize;
+                out.size = size;
+                return true;
+            }
+        }
+    }
+
+    // 可以由任意进程调用，之后buffer不能再访问
+    void release(const ShmBuffer& buffer)
+    {
+        uint32_t index = indexOf(buffer);
+        uint64_t top = header_->top.load(std::memory_order_relaxed);
+        uint64_t next;
+        do {
+            next_[index].store((uint32_t)top, std::memory_order_relaxed);
+            next = ((top >> 32) + 1) << 32 | (index + 1);
+        } while (!header_->top.compare_exchange_weak(top, next, std::memory_order_release, std::memory_order_relaxed));
+        header_->freeCount.fetch_add(1, std::memory_order_relaxed);
+        header_->released.notify();
+    }
+
+    char* data(const ShmBuffer& buffer)
+    {
+        indexOf(buffer);
+        return region_.data() + buffer.offset;
+    }
+
+    size_t blockSize() const
+    {
+        return header_->blockSize;
+    }
+
+    size_t blockCount() const
+    {
+        return header_->blockCount;
+    }
+
+    // 近似值
+    size_t available() const
+    {
+        return header_->freeCount.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Header {
+        uint64_t blockSize = 0;
+        uint64_t blockCount = 0;
+        uint64_t dataOffset = 0;
+        std::atomic<uint64_t> top { 0 }; // 高32位是版本号，防止ABA
+        std::atomic<uint32_t> freeCount { 0 };
+        ShmEvent released;
+    };
+
+    // 块按缓存行对齐，相邻的块不会共享缓存行
+    static size_t alignBlock(size_t n)
+    {
+        return (n + 63) / 64 * 64;
+    }
+
+    static size_t dataOffsetFor(size_t blockCount)
+    {
+        return (sizeof(Header) + blockCount * sizeof(uint32_t) + 4095) / 4096 * 4096;
+    }
+
+    static size_t bytesFor(size_t blockSize, size_t blockCount)
+    {
+        return dataOffsetFor(blockCount) + blockSize * blockCount;
+    }
+
+    void checkSize(size_t size) const
+    {
+        if (size > header_->blockSize)
+            throw std::invalid_argument("ShmArena: buffer larger than the block size");
+    }
+
+    uint32_t indexOf(const ShmBuffer& buffer) const
+    {
+        uint64_t rel = buffer.offset - header_->dataOffset;
+        if (buffer.offset < header_->dataOffset || rel % header_->blockSize != 0
+            || rel / header_->blockSize >= header_->blockCount)
+            throw std::out_of_range("ShmArena: buffer does not belong to this arena");
+        return (uint32_t)(rel / header_->blockSize);
+    }
+
+    ShmRegion region_;
+    Header* header_ = nullptr;
+    std::atomic<uint32_t>* next_ = nullptr;
+};
+
+// 通道中的一条消息：值本身，或者沿链传播的计数、skip、openStream和close
+// 控制消息与值在同一个队列中，接收方按发送的顺序转发给下游
+enum class ShmMessageKind : uint32_t { Value, Range, Skip, Count, Open, Close };
+
+template <typename T>
+struct ShmMessage {
+    ShmMessageKind kind;
+    int32_t arg; // Count的n，Range的end
+    int32_t grain; // Range的每块索引数，0表示由下游选择
+    T value; // Range时为begin
+};
+
+// 连接两个进程中阶段的通道，一端是ShmSender，另一端是ShmReceiver
+template <typename T>
+using ShmChannel = ShmQueue<ShmMessage<T>>;
+
+// 发送端：作为本进程中上游阶段的下游，把值、计数和流式关闭写进通道
+// 通道已关闭（对方进程要求退出）时丢弃
+template <typename T>
+class ShmSenderBase : public StageInput<T> {
+public:
+    explicit ShmSenderBase(ShmChannel<T>& channel)
+        : channel_(channel)
+    {
+    }
+
+    void push(T value) override
+    {
+        send(ShmMessageKind::Value, 0, value);
+    }
+
+    void skip() override
+    {
+        send(ShmMessageKind::Skip, 0, T());
+    }
+
+    void addTaskCount(int n) override
+    {
+        send(ShmMessageKind::Count, n, T());
+    }
+
+    // 有多个上游时，第一个openStream和最后一个close才发送给对方
+    void openStream() override
+    {
+        if (openInputs_++ == 0)
+            send(ShmMessageKind::Open, 0, T());
+    }
+
+    void close() override
+    {
+        if (--openInputs_ > 0)
+            return;
+        send(ShmMessageKind::Close, 0, T());
+    }
+
+protected:
+    void send(ShmMessageKind kind, int arg, const T& value, int grain = 0)
+    {
+        ShmMessage<T> message;
+        message.kind = kind;
+        message.arg = arg;
+        message.grain = grain;
+        message.value = value;
+        channel_.push(message);
+    }
+
+private:
+    ShmChannel<T>& channel_;
+    std::atomic<int> openInputs_ { 0 };
+};
+
+template <typename T>
+class ShmSender : public ShmSenderBase<T> {
+public:
+    using ShmSenderBase<T>::ShmSenderBase;
+};
+
+// 索引通道：整个范围只占一条消息，接收方用同样的grain交给下游
+template <>
+class ShmSender<int> : public ShmSenderBase<int> {
+public:
+    using ShmSenderBase<int>::ShmSenderBase;
+
+    void pushRange(int begin, int end, int grain = 0) override
+    {
+        if (begin < end)
+            send(ShmMessageKind::Range, end, begin, grain);
+    }
+};
+
+// 接收端：在另一个进程中从通道读出消息，按StageT的路由方式转发给本进程中的下游阶段
+// 只用一个线程转发，计数总是先于它之后发送的值到达下游；每个通道只能有一个接收端
+// 下游阶段不需要自己setTaskCount或openStream，计数、openStream和close由发送方的上游经通道传来
+template <typename T>
+class ShmReceiver {
+public:
+    ShmReceiver(const std::string& name, ShmChannel<T>& channel)
+        : name_(name)
+        , channel_(channel)
+    {
+    }
+
+    ShmReceiver(const ShmReceiver&) = delete;
+    ShmReceiver& operator=(const ShmReceiver&) = delete;
+
+    ~ShmReceiver()
+    {
+        stop();
+    }
+
+    // 转发线程不能等待下游OrderedStage的准入许可，见StageInput<int>::linkFromUngated
+    void setNext(StageInput<T>* next)
+    {
+        if (next)
+            linkUngated(next, std::is_same<T, int>());
+        outputs_.set(next);
+    }
+
+    void addNext(StageInput<T>* next)
+    {
+        linkUngated(next, std::is_same<T, int>());
+        outputs_.add(next);
+    }
+
+    void setRouting(Routing routing, typename StageOutputs<T>::KeyFunc key = nullptr)
+    {
+        outputs_.setRouting(routing, std::move(key));
+    }
+
+    // 链接好下游后在后台线程上开始转发
+    void start()
+    {
+        stopping_ = false;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            finished_ = false;
+        }
+        thread_ = std::thread([this]() {
+            run();
+        });
+    }
+
+    // 在当前线程上转发，直到通道关闭或stop()
+    void run()
+    {
+        ShmMessage<T> message;
+        while (channel_.pop(message, &stopping_)) {
+            dispatch(message);
+        }
+        std::lock_guard<std::mutex> lock(mtx_);
+        finished_ = true;
+        batchCV_.notify_all();
+    }
+
+    // 通道中剩余的消息留给之后的接收端（例如重启的进程）
+    void stop()
+    {
+        stopping_ = true;
+        channel_.interrupt();
+        if (thread_.joinable())
+            thread_.join();
+    }
+
+    // 下游的wait()/run()在计数到达之前就会返回，所以先等到新的一批开始（计数或openStream已经转发给下游）
+    // 返回false表示通道已关闭或已stop()，不会再有新的一批
+    bool waitBatch()
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        batchCV_.wait(lock, [this] { return batches_ > consumed_ || finished_; });
+        if (batches_ == consumed_)
+            return false;
+        consumed_ = batches_;
+        return true;
+    }
+
+    const std::string& name() const
+    {
+        return name_;
+    }
+
+private:
+    void dispatch(ShmMessage<T>& message)
+    {
+        switch (message.kind) {
+        case ShmMessageKind::Value:
+            outputs_.push(std::move(message.value));
+            break;
+        case ShmMessageKind::Range:
+            pushRange(message, std::is_same<T, int>());
+            break;
+        case ShmMessageKind::Skip:
+            outputs_.skip();
+            break;
+        case ShmMessageKind::Count:
+            outputs_.addTaskCount(message.arg);
+            batchStarted();
+            break;
+        case ShmMessageKind::Open:
+            outputs_.openStream();
+            batchStarted();
+            break;
+        case ShmMessageKind::Close:
+            StageOutputs<T>::closeAll(outputs_.list());
+            break;
+        }
+    }
+
+    // 与StageOutputs::pushRange相同，只是保留发送方的grain
+    void pushRange(const ShmMessage<T>& message, std::true_type)
+    {
+        const auto& targets = outputs_.list();
+        if (targets.size() == 1 || outputs_.routing() == Routing::Broadcast) {
+            for (auto* next : targets) {
+                next->pushRange(message.value, message.arg, message.grain);
+            }
+            return;
+        }
+        for (int i = message.value; i < message.arg; ++i) {
+            outputs_.push(T(i));
+        }
+    }
+
+    void pushRange(const ShmMessage<T>&, std::false_type)
+    {
+    }
+
+    static void linkUngated(StageInput<int>* next, std::true_type)
+    {
+        next->linkFromUngated();
+    }
+
+    static void linkUngated(StageInput<T>*, std::false_type)
+    {
+    }
+
+    void batchStarted()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        ++batches_;
+        batchCV_.notify_all();
+    }
+
+    std::string name_;
+    ShmChannel<T>& channel_;
+    StageOutputs<T> outputs_;
+    std::atomic<bool> stopping_ { false };
+    std::thread thread_;
+    std::mutex mtx_;
+    std::condition_variable batchCV_;
+    uint64_t batches_ = 0; // 已转发的计数和openStream消息数
+    uint64_t consumed_ = 0;
+    bool finished_ = false;
+};
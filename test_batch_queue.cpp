@@ -0,0 +1,121 @@
+// 批量接口测试：pushTasks/popTasks保持FIFO顺序，有界队列满时分段放入，StageT::pushBatch与逐个push结果相同
+
+#include "task_queue.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+int main()
+{
+    std::printf("测试1: TaskQueue整批放入，popTasks每次最多取maxN个\n");
+    {
+        TaskQueue queue;
+        std::vector<int> order;
+        std::vector<Task> tasks;
+        for (int i = 0; i < 10; ++i) {
+            tasks.emplace_back([&order, i] { order.push_back(i); });
+        }
+        queue.pushTasks(tasks.begin(), tasks.end());
+        std::vector<Task> out;
+        size_t sizes[3];
+        for (size_t& n : sizes) {
+            n = queue.popTasks(std::back_inserter(out), 4);
+        }
+        check(sizes[0] == 4 && sizes[1] == 4 && sizes[2] == 2, "依次取出4、4、2个");
+        for (Task& task : out) {
+            task();
+        }
+        bool fifo = order.size() == 10;
+        for (size_t i = 0; fifo && i < order.size(); ++i) {
+            fifo = order[i] == (int)i;
+        }
+        check(fifo, "取出顺序与放入顺序一致");
+        queue.close();
+        check(queue.popTasks(std::back_inserter(out), 4) == 0, "关闭且为空时popTasks返回0");
+    }
+
+    std::printf("测试2: 容量4的BoundedTaskQueue，一次pushTasks放入100个，队列满时等待消费者\n");
+    {
+        BoundedTaskQueue queue(4);
+        std::vector<int> order;
+        std::thread consumer([&] {
+            std::vector<Task> out;
+            while (true) {
+                out.clear();
+                if (queue.popTasks(std::back_inserter(out), 8) == 0)
+                    break;
+                for (Task& task : out) {
+                    task();
+                }
+            }
+        });
+        std::vector<Task> tasks;
+        for (int i = 0; i < 100; ++i) {
+            tasks.emplace_back([&order, i] { order.push_back(i); });
+        }
+        queue.pushTasks(tasks.begin(), tasks.end());
+        queue.close();
+        consumer.join();
+        bool fifo = order.size() == 100;
+        for (size_t i = 0; fifo && i < order.size(); ++i) {
+            fifo = order[i] == (int)i;
+        }
+        check(fifo, "100个任务全部按顺序执行");
+        check(queue.stats().peakDepth <= 4, "队列长度没有超过容量");
+    }
+
+    std::printf("测试3: StageT::pushBatch，下游按推导的计数正常结束\n");
+    {
+        std::atomic<long> sumA { 0 }, sumB { 0 };
+        Stage a("A", 4, 16, [&](int i) { sumA += i; });
+        Stage b("B", 2, 16, [&](int i) { sumB += i; });
+        chain(a, b);
+        std::vector<int> indices;
+        for (int i = 0; i < 1000; ++i) {
+            indices.push_back(i);
+        }
+        for (int batch = 0; batch < 2; ++batch) {
+            a.addTaskCount(1000);
+            a.pushBatch(indices);
+            b.wait();
+        }
+        check(sumA.load() == 2 * 499500 && sumB.load() == 2 * 499500, "两批各1000个索引都到达A和B");
+    }
+
+    std::printf("测试4: 下游是OrderedStage时pushBatch逐个取得许可，输出仍按索引顺序\n");
+    {
+        std::vector<int> out;
+        Stage a("A", 4, 8, [](int i) {
+            if (i % 5 == 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(300));
+        });
+        OrderedStage writer("Writer", 1, 8, 4, [&](int i) { out.push_back(i); });
+        chain(a, writer);
+        std::vector<int> indices;
+        for (int i = 0; i < 100; ++i) {
+            indices.push_back(i);
+        }
+        a.addTaskCount(100);
+        a.pushBatch(indices);
+        writer.wait();
+        bool ordered = out.size() == 100;
+        for (size_t i = 0; ordered && i < out.size(); ++i) {
+            ordered = out[i] == (int)i;
+        }
+        check(ordered, "Writer按0..99的顺序执行");
+    }
+
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}
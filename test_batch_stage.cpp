@@ -0,0 +1,146 @@
+// BatchStage测试：攒够maxBatch个索引提交，计数模式收到最后一个索引时立即提交剩余部分，
+// 流式模式超时由定时线程提交、close时提交剩余部分；Ranges按连续区间转发，批指标和出错时记录的索引
+
+#include "task_queue.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+int main()
+{
+    std::printf("测试1: 计数模式，20个索引按8、8、4分批，最后4个不等待maxDelay\n");
+    {
+        std::mutex mtx;
+        std::vector<size_t> sizes;
+        std::atomic<int> ranB { 0 };
+        BatchStage batch("Batch", 1, 8, 8, std::chrono::seconds(5), [&](const int*, size_t n) {
+            std::lock_guard<std::mutex> lock(mtx);
+            sizes.push_back(n);
+        });
+        Stage b("B", 1, 8, [&](int) { ++ranB; });
+        chain(batch, b);
+        Pipeline pipeline;
+        pipeline.add(batch);
+        auto start = std::chrono::steady_clock::now();
+        batch.addTaskCount(20);
+        for (int i = 0; i < 20; ++i) {
+            batch.push(i);
+        }
+        b.wait();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        check(sizes == std::vector<size_t>({ 8, 8, 4 }), "批大小依次为8、8、4");
+        check(elapsed < std::chrono::seconds(1) && ranB.load() == 20, "没有等待5秒的maxDelay，20个索引逐个到达B");
+        StageReport r = pipeline.snapshot()[0];
+        check(r.batches == 3 && r.batchItems == 20 && r.batchTimeouts == 0 && r.maxBatch == 8, "报告3批、20个索引、没有超时");
+    }
+
+    std::printf("测试2: 流式模式，不满一批时由定时线程在maxDelay后提交，close提交剩余部分\n");
+    {
+        std::atomic<int> calls { 0 }, items { 0 };
+        BatchStage batch("Batch", 1, 8, 100, std::chrono::milliseconds(20), [&](const int*, size_t n) {
+            ++calls;
+            items += (int)n;
+        });
+        Pipeline pipeline;
+        pipeline.add(batch);
+        batch.openStream();
+        for (int i = 0; i < 5; ++i) {
+            batch.push(i);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        check(calls.load() == 1 && items.load() == 5, "5个索引在超时后作为一批执行");
+        for (int i = 5; i < 8; ++i) {
+            batch.push(i);
+        }
+        batch.close();
+        batch.wait();
+        StageReport r = pipeline.snapshot()[0];
+        check(calls.load() == 2 && items.load() == 8, "close提交剩余的3个索引");
+        check(r.batches == 2 && r.batchTimeouts == 1, "报告2批，其中1批因超时提交");
+    }
+
+    std::printf("测试3: BatchForward::Ranges，连续的索引合并为pushRange\n");
+    {
+        std::vector<std::atomic<int>> hits(1000);
+        for (auto& h : hits) {
+            h = 0;
+        }
+        BatchStage batch("Batch", 2, 8, 64, std::chrono::milliseconds(1), [](const int*, size_t) {});
+        Stage b("B", 2, 8, [&](int i) { hits[i].fetch_add(1); });
+        batch.setBatchForward(BatchForward::Ranges);
+        chain(batch, b);
+        for (int round = 0; round < 2; ++round) {
+            batch.addTaskCount(1000);
+            batch.pushRange(0, 1000, 100);
+            b.wait();
+        }
+        bool twice = true;
+        for (auto& h : hits) {
+            twice = twice && h.load() == 2;
+        }
+        check(twice, "两批中每个索引各到达B一次");
+    }
+
+    std::printf("测试4: BatchStageCurrent，超时提交的批也在调用run的线程上执行\n");
+    {
+        std::thread::id mainId = std::this_thread::get_id();
+        std::atomic<int> offMain { 0 }, items { 0 };
+        BatchStageCurrent batch("Batch", 1, 8, 16, std::chrono::milliseconds(2), [&](const int*, size_t n) {
+            if (std::this_thread::get_id() != mainId)
+                ++offMain;
+            items += (int)n;
+        });
+        Pipeline pipeline;
+        pipeline.add(batch);
+        batch.openStream();
+        std::thread producer([&] {
+            for (int i = 0; i < 10; ++i) {
+                batch.push(i);
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            batch.close();
+        });
+        batch.run();
+        producer.join();
+        check(items.load() == 10 && offMain.load() == 0, "10个索引都在主线程上执行");
+        check(pipeline.snapshot()[0].batchTimeouts > 0, "生产者慢于maxDelay时批因超时提交");
+    }
+
+    std::printf("测试5: 出错时记录批中第一个索引，整批照常传给下游\n");
+    {
+        ErrorSink errors;
+        std::atomic<int> ranB { 0 };
+        BatchStage batch("Batch", 1, 8, 10, std::chrono::seconds(5), [](const int* idx, size_t) {
+            if (idx[0] == 10)
+                throw std::runtime_error("bad batch");
+        });
+        Stage b("B", 1, 8, [&](int) { ++ranB; });
+        chain(batch, b);
+        batch.setErrorSink(&errors);
+        batch.addTaskCount(30);
+        for (int i = 0; i < 30; ++i) {
+            batch.push(i);
+        }
+        b.wait();
+        std::vector<StageError> recorded = errors.errors();
+        check(recorded.size() == 1 && recorded[0].index == 10 && recorded[0].stage == "Batch", "记录了出错批的第一个索引10");
+        check(ranB.load() == 30, "30个索引都到达B");
+    }
+
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}
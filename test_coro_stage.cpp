@@ -0,0 +1,147 @@
+// CoStage测试（C++20）：挂起中的协程不占用工作线程，在其他线程上resume后回到本阶段的线程继续执行，
+// 异常记录到ErrorSink且索引照常传给下游，下游OrderedStage的准入限制穿过协程阶段，流式关闭等待挂起的协程
+
+#include "task_queue_coro.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+int main()
+{
+    std::printf("测试1: 2个线程同时挂起400个等待20ms的协程\n");
+    {
+        std::atomic<int> ranB { 0 };
+        CoStage fetch("Fetch", 2, 64, [](int) -> CoTask {
+            co_await coSleepFor(std::chrono::milliseconds(20));
+        });
+        Stage b("B", 1, 64, [&](int) { ++ranB; });
+        chain(fetch, b);
+        auto start = std::chrono::steady_clock::now();
+        fetch.addTaskCount(400);
+        std::thread producer([&] {
+            for (int i = 0; i < 400; ++i) {
+                fetch.push(i);
+            }
+        });
+        b.wait();
+        producer.join();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        check(ranB.load() == 400, "400个索引在协程完成后到达下游");
+        check(elapsed < std::chrono::seconds(2), "总耗时远小于串行等待的4秒");
+    }
+
+    std::printf("测试2: 在外部线程上resume，协程回到本阶段的线程；schedule让出后同样在本阶段的线程上继续\n");
+    {
+        std::mutex mtx;
+        std::set<std::thread::id> stageThreads, resumedOn;
+        std::vector<std::thread> resumers;
+        CoStage* self = nullptr;
+        CoStage stage("Stage", 2, 16, [&](int) -> CoTask {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                stageThreads.insert(std::this_thread::get_id());
+            }
+            co_await coSuspend([&](CoResumer r) {
+                std::lock_guard<std::mutex> lock(mtx);
+                resumers.emplace_back([r]() mutable { r.resume(); });
+            });
+            co_await self->schedule();
+            std::lock_guard<std::mutex> lock(mtx);
+            resumedOn.insert(std::this_thread::get_id());
+        });
+        self = &stage;
+        stage.addTaskCount(50);
+        for (int i = 0; i < 50; ++i) {
+            stage.push(i);
+        }
+        stage.wait();
+        for (std::thread& t : resumers) {
+            t.join(); // resume返回前阶段必须存在
+        }
+        bool onStage = true;
+        for (const std::thread::id& id : resumedOn) {
+            onStage = onStage && stageThreads.count(id) > 0;
+        }
+        check(!resumedOn.empty() && onStage && stageThreads.size() <= 2, "所有协程都在本阶段的2个线程上完成");
+    }
+
+    std::printf("测试3: CoStageCurrent的协程都在调用run的线程上恢复\n");
+    {
+        std::thread::id mainId = std::this_thread::get_id();
+        std::atomic<int> wrongThread { 0 }, done { 0 };
+        CoStageCurrent render("Render", 1, 16, [&](int i) -> CoTask {
+            co_await coSleepFor(std::chrono::milliseconds(i % 5));
+            if (std::this_thread::get_id() != mainId)
+                ++wrongThread;
+            ++done;
+        });
+        render.openStream();
+        std::thread producer([&] {
+            for (int i = 0; i < 100; ++i) {
+                render.push(i);
+            }
+            render.close();
+        });
+        render.run();
+        producer.join();
+        check(done.load() == 100 && wrongThread.load() == 0, "100个协程都在主线程上完成");
+    }
+
+    std::printf("测试4: 协程抛出的异常记录到ErrorSink，出错的索引照常传给下游\n");
+    {
+        ErrorSink errors;
+        std::atomic<int> ranB { 0 };
+        CoStage a("A", 2, 16, [](int i) -> CoTask {
+            co_await coSleepFor(std::chrono::milliseconds(1));
+            if (i % 10 == 0)
+                throw std::runtime_error("bad index");
+        });
+        Stage b("B", 1, 16, [&](int) { ++ranB; });
+        chain(a, b);
+        a.setErrorSink(&errors);
+        a.addTaskCount(100);
+        for (int i = 0; i < 100; ++i) {
+            a.push(i);
+        }
+        b.wait();
+        check(errors.errors().size() == 10 && ranB.load() == 100, "10个异常被记录，100个索引都到达下游");
+    }
+
+    std::printf("测试5: 协程完成顺序被打乱，下游OrderedStage仍按索引顺序执行\n");
+    {
+        std::vector<int> out;
+        CoStage a("A", 2, 16, [](int i) -> CoTask {
+            co_await coSleepFor(std::chrono::microseconds(200 * ((7 * i) % 5)));
+        });
+        OrderedStage writer("Writer", 1, 16, 4, [&](int i) { out.push_back(i); });
+        chain(a, writer);
+        a.openStream();
+        for (int i = 0; i < 200; ++i) {
+            a.push(i);
+        }
+        a.close();
+        writer.wait();
+        bool ordered = out.size() == 200;
+        for (size_t i = 0; ordered && i < out.size(); ++i) {
+            ordered = out[i] == (int)i;
+        }
+        check(ordered, "close等待挂起的协程，Writer按0..199的顺序执行");
+    }
+
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,132 @@
+// 推导任务数的回归测试：addTaskCount只在链头调用一次，下游的计数在丢弃和skip之后、多批复用时仍然准确，无法准确推导的组合被拒绝
+
+#include "task_queue.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+template <typename E, typename F>
+static bool throws(F f)
+{
+    try {
+        f();
+    } catch (const E&) {
+        return true;
+    }
+    return false;
+}
+
+static int failSome(int&& v)
+{
+    if (v % 7 == 0)
+        throw std::runtime_error("bad value");
+    return v;
+}
+
+int main()
+{
+    std::printf("测试1: TypedStage出错 -> 轮转给X、Y -> 汇合到Z，计数全部来自链头\n");
+    {
+        ErrorSink errors;
+        std::atomic<int> ranX { 0 }, ranZ { 0 };
+        TypedStage<int, int> a("A", 4, 8, failSome);
+        Stage x("X", 2, 8, [&](int) { ++ranX; });
+        Stage y("Y", 2, 8, [](int) {});
+        Stage z("Z", 2, 8, [&](int) { ++ranZ; });
+        a.setRouting(Routing::RoundRobin);
+        a.addNext(&x);
+        a.addNext(&y);
+        x.setNext(&z);
+        y.setNext(&z);
+        a.setErrorSink(&errors);
+        for (int batch = 0; batch < 2; ++batch) {
+            ranZ = 0;
+            a.addTaskCount(70);
+            for (int i = 0; i < 70; ++i) {
+                a.push(i);
+            }
+            x.wait();
+            y.wait();
+            z.wait();
+            check(ranZ.load() == 60, batch == 0 ? "Z执行了60次，被跳过的10个值也计入了各下游" : "第二批同样准确");
+        }
+        check(ranX.load() > 0, "X收到了一部分值");
+    }
+
+    std::printf("测试2: 丢弃 -> 轮转给X、Y -> 汇合到Z，按块推送的块整块丢弃\n");
+    {
+        std::atomic<int> ranZ { 0 };
+        Stage a("A", 1, 2, [](int) { std::this_thread::sleep_for(std::chrono::microseconds(200)); });
+        Stage x("X", 2, 8, [](int) {});
+        Stage y("Y", 2, 8, [](int) {});
+        Stage z("Z", 2, 8, [&](int) { ++ranZ; });
+        a.setFullPolicy(FullPolicy::DropNewest);
+        a.setRouting(Routing::RoundRobin);
+        a.addNext(&x);
+        a.addNext(&y);
+        x.setNext(&z);
+        y.setNext(&z);
+        a.addTaskCount(200);
+        a.pushRange(0, 100, 4);
+        for (int i = 100; i < 200; ++i) {
+            a.push(i);
+        }
+        z.wait();
+        check(ranZ.load() > 0 && ranZ.load() < 200, "Z正常结束，只执行了没有被丢弃的值");
+    }
+
+    std::printf("测试3: skip经过中间阶段后，中间阶段的键分区同样被拒绝\n");
+    {
+        ErrorSink errors;
+        TypedStage<int, int> a("A", 1, 8, failSome);
+        Stage b("B", 1, 8, [](int) {});
+        Stage x("X", 1, 8, [](int) {});
+        Stage y("Y", 1, 8, [](int) {});
+        a.setNext(&b);
+        a.setErrorSink(&errors);
+        b.setRouting(Routing::KeyPartition);
+        b.addNext(&x);
+        b.addNext(&y);
+        check(throws<std::logic_error>([&] { a.addTaskCount(10); }), "链头的addTaskCount抛出logic_error");
+
+        Stage c("C", 1, 8, [](int) {});
+        c.addNext(&x);
+        c.addNext(&y);
+        c.setRouting(Routing::KeyPartition, [](const int& v) { return (size_t)v / 2; });
+        check(throws<std::logic_error>([&] { c.addTaskCount(10); }), "自定义键的键分区在同一处被拒绝");
+    }
+
+    std::printf("测试4: 键分区复用流水线，每一批都推送[0, n)且n不能被下游数整除\n");
+    {
+        std::atomic<int> ranX { 0 }, ranY { 0 };
+        Stage a("A", 2, 8, [](int) {});
+        Stage x("X", 1, 8, [&](int) { ++ranX; });
+        Stage y("Y", 1, 8, [&](int) { ++ranY; });
+        a.setRouting(Routing::KeyPartition);
+        a.addNext(&x);
+        a.addNext(&y);
+        for (int batch = 0; batch < 3; ++batch) {
+            a.addTaskCount(3);
+            for (int i = 0; i < 3; ++i) {
+                a.push(i);
+            }
+            x.wait();
+            y.wait();
+        }
+        check(ranX.load() == 6 && ranY.load() == 3, "每一批的键0、2发给X，键1发给Y，三批都正常结束");
+    }
+
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,126 @@
+// FullPolicy丢弃的回归测试：丢弃的值不能送到JoinStage/OrderedStage，键分区的计数模式不能丢弃，其余路由照常完成
+
+#include "task_queue.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+template <typename E, typename F>
+static bool throws(F f)
+{
+    try {
+        f();
+    } catch (const E&) {
+        return true;
+    }
+    return false;
+}
+
+static void slow(int)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+}
+
+int main()
+{
+    std::printf("测试1: 下游是OrderedStage时不能设置丢弃策略\n");
+    {
+        Stage a("A", 1, 2, slow);
+        OrderedStage writer("Writer", 1, 8, 4, [](int) {});
+        chain(a, writer);
+        check(throws<std::invalid_argument>([&] { a.setFullPolicy(FullPolicy::DropNewest); }),
+            "setFullPolicy(DropNewest)抛出invalid_argument");
+        check(throws<std::invalid_argument>([&] { a.setFullPolicy(FullPolicy::BlockFor, std::chrono::milliseconds(1)); }),
+            "setFullPolicy(BlockFor)抛出invalid_argument");
+        a.setFullPolicy(FullPolicy::Block);
+        a.addTaskCount(50);
+        for (int i = 0; i < 50; ++i) {
+            a.push(i);
+        }
+        writer.wait();
+        check(true, "拒绝后仍按Block运行，没有丢弃");
+    }
+
+    std::printf("测试2: 已设置丢弃策略时不能链接JoinStage/OrderedStage，经过中间阶段也不行\n");
+    {
+        Stage a("A", 1, 2, slow);
+        Stage b("B", 1, 2, slow);
+        OrderedStage writer("Writer", 1, 8, 4, [](int) {});
+        JoinStage join("Join", 1, 8, 1, [](int) {});
+        a.setFullPolicy(FullPolicy::DropOldest);
+        check(throws<std::invalid_argument>([&] { a.setNext(&writer); }), "setNext(OrderedStage)抛出invalid_argument");
+        check(throws<std::invalid_argument>([&] { a.addNext(&join); }), "addNext(JoinStage)抛出invalid_argument");
+        chain(a, b);
+        check(throws<std::invalid_argument>([&] { b.setNext(&writer); }), "下游的下游是OrderedStage时同样抛出");
+    }
+
+    std::printf("测试3: 键分区给多个下游时，计数模式下不能丢弃\n");
+    {
+        Stage a("A", 1, 2, slow);
+        Stage x("X", 1, 8, [](int) {});
+        Stage y("Y", 1, 8, [](int) {});
+        a.setFullPolicy(FullPolicy::DropNewest);
+        a.setRouting(Routing::KeyPartition);
+        a.addNext(&x);
+        a.addNext(&y);
+        check(throws<std::logic_error>([&] { a.addTaskCount(60); }), "addTaskCount抛出logic_error");
+
+        std::printf("  流式模式下键分区可以丢弃\n");
+        a.openStream();
+        for (int i = 0; i < 60; ++i) {
+            a.push(i);
+        }
+        a.close();
+        x.wait();
+        y.wait();
+        check(true, "两个下游都正常结束");
+
+        Stage c("C", 1, 2, slow);
+        c.setRouting(Routing::KeyPartition);
+        c.addNext(&x);
+        c.addNext(&y);
+        c.addTaskCount(1);
+        c.push(0);
+        c.wait();
+        x.wait();
+        y.wait();
+        check(throws<std::logic_error>([&] { c.setFullPolicy(FullPolicy::DropNewest); }),
+            "计数之后再设置丢弃策略同样抛出logic_error");
+    }
+
+    std::printf("测试4: 轮转和广播时丢弃的值（包括整块）照常通知下游\n");
+    for (Routing routing : { Routing::RoundRobin, Routing::Broadcast }) {
+        std::atomic<int> ran { 0 };
+        Stage a("A", 1, 2, slow);
+        Stage x("X", 1, 8, [&](int) { ++ran; });
+        Stage y("Y", 1, 8, [&](int) { ++ran; });
+        a.setFullPolicy(FullPolicy::DropNewest);
+        a.setRouting(routing);
+        a.addNext(&x);
+        a.addNext(&y);
+        a.addTaskCount(100);
+        for (int i = 0; i < 60; ++i) {
+            a.push(i);
+        }
+        a.pushRange(60, 100, 8);
+        a.wait();
+        x.wait();
+        y.wait();
+        int copies = routing == Routing::Broadcast ? 2 : 1;
+        check(ran.load() < 100 * copies, routing == Routing::Broadcast ? "广播：有值被丢弃且wait正常返回" : "轮转：有值被丢弃且wait正常返回");
+    }
+
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+// ErrorSink回归测试：TypedStage出错时改为skip，下游不能是JoinStage/OrderedStage，键分区的计数模式被拒绝
+
+#include "task_queue.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+template <typename E, typename F>
+static bool throws(F f)
+{
+    try {
+        f();
+    } catch (const E&) {
+        return true;
+    }
+    return false;
+}
+
+// 每7个值抛出一次
+static int failSome(int&& v)
+{
+    if (v % 7 == 0)
+        throw std::runtime_error("bad value");
+    return v;
+}
+
+int main()
+{
+    std::printf("测试1: 有OrderedStage下游的TypedStage<int, int>不能设置ErrorSink\n");
+    {
+        ErrorSink errors;
+        TypedStage<int, int> a("A", 2, 8, failSome);
+        OrderedStage writer("Writer", 1, 8, 4, [](int) {});
+        a.setNext(&writer);
+        check(throws<std::invalid_argument>([&] { a.setErrorSink(&errors); }), "setErrorSink抛出invalid_argument");
+
+        Pipeline pipeline;
+        pipeline.add(a);
+        check(true, "pipeline.add只开启指标，不设置ErrorSink，不抛出");
+        check(throws<std::invalid_argument>([&] { pipeline.captureErrors(a); }), "pipeline.captureErrors同样抛出");
+
+        TypedStage<int, int> b("B", 2, 8, failSome);
+        JoinStage join("Join", 1, 8, 1, [](int) {});
+        b.setErrorSink(&errors);
+        check(throws<std::invalid_argument>([&] { b.setNext(&join); }), "设置ErrorSink之后链接JoinStage抛出invalid_argument");
+    }
+
+    std::printf("测试2: 键分区给多个下游时，计数模式下不能使用ErrorSink\n");
+    {
+        ErrorSink errors;
+        std::atomic<int> ran { 0 };
+        TypedStage<int, int> a("A", 2, 8, failSome);
+        Stage x("X", 1, 8, [&](int) { ++ran; });
+        Stage y("Y", 1, 8, [&](int) { ++ran; });
+        a.setRouting(Routing::KeyPartition);
+        a.addNext(&x);
+        a.addNext(&y);
+        a.setErrorSink(&errors);
+        check(throws<std::logic_error>([&] { a.addTaskCount(70); }), "addTaskCount抛出logic_error");
+
+        std::printf("  流式模式下键分区可以使用ErrorSink\n");
+        a.openStream();
+        for (int i = 0; i < 70; ++i) {
+            a.push(i);
+        }
+        a.close();
+        x.wait();
+        y.wait();
+        check(ran.load() == 60 && errors.errors().size() == 10, "60个值到达下游，10个异常被记录");
+    }
+
+    std::printf("测试3: 只有captureErrors的阶段把异常记录到pipeline.errors()\n");
+    {
+        std::atomic<int> ran { 0 };
+        Stage a("A", 2, 8, [](int i) {
+            if (i % 10 == 0)
+                throw std::runtime_error("bad index");
+        });
+        Stage b("B", 2, 8, [&](int) { ++ran; });
+        chain(a, b);
+        Pipeline pipeline;
+        pipeline.add(a).add(b);
+        pipeline.captureErrors(a);
+        a.addTaskCount(50);
+        for (int i = 0; i < 50; ++i) {
+            a.push(i);
+        }
+        b.wait();
+        check(ran.load() == 50 && pipeline.errors().errors().size() == 5, "5个异常被记录，出错的索引照常传给下游");
+        check(pipeline.snapshot().size() == 2 && pipeline.snapshot()[0].tasks == 50, "两个阶段都开启了指标");
+    }
+
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+// fuse()测试：融合后下游在上游的工作线程上执行，计数、流式关闭和指标照常工作；
+// 下游使用CurrentThreadEx或是OrderedStage时不融合，照常入队
+
+#include "task_queue.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+int main()
+{
+    std::printf("测试1: Fusion::Always，每个索引的A和B在同一个线程上执行\n");
+    {
+        const int n = 1000;
+        std::vector<std::thread::id> threadA(n), threadB(n);
+        std::atomic<int> ranB { 0 };
+        Stage a("A", 4, 8, [&](int i) { threadA[i] = std::this_thread::get_id(); });
+        Stage b("B", 2, 8, [&](int i) {
+            threadB[i] = std::this_thread::get_id();
+            ++ranB;
+        });
+        fuse(a, b);
+        Pipeline pipeline;
+        pipeline.add(a).add(b);
+        for (int batch = 0; batch < 2; ++batch) {
+            a.addTaskCount(n);
+            a.pushRange(0, n / 2, 16);
+            for (int i = n / 2; i < n; ++i) {
+                a.push(i);
+            }
+            b.wait();
+        }
+        check(ranB.load() == 2 * n, "两批都执行完，b.wait正常返回");
+        check(threadA == threadB, "B总是在执行A的工作线程上执行");
+        std::vector<StageReport> reports = pipeline.snapshot();
+        check(reports[1].tasks > 0 && reports[1].queue.peakDepth == 0, "B的耗时记在B的名下，B的输入队列没有用到");
+    }
+
+    std::printf("测试2: 融合对之后再链接阶段，流式模式的close穿过融合的下游\n");
+    {
+        std::atomic<int> ranC { 0 };
+        Stage a("A", 2, 8, [](int) {});
+        Stage b("B", 2, 8, [](int) {});
+        Stage c("C", 1, 8, [&](int) { ++ranC; });
+        fuse(a, b, Fusion::WhenIdle);
+        chain(b, c);
+        a.openStream();
+        for (int i = 0; i < 500; ++i) {
+            a.push(i);
+        }
+        a.close();
+        c.wait();
+        check(ranC.load() == 500, "500个值经过A、B到达C");
+    }
+
+    std::printf("测试3: 下游使用CurrentThreadEx时不融合，在调用run的线程上执行\n");
+    {
+        std::atomic<int> ranA { 0 };
+        std::atomic<bool> offMain { false };
+        std::thread::id mainThread = std::this_thread::get_id();
+        Stage a("A", 2, 8, [&](int) { ++ranA; });
+        StageCurrent b("B", 1, 8, [&](int) {
+            if (std::this_thread::get_id() != mainThread)
+                offMain = true;
+        });
+        fuse(a, b);
+        a.addTaskCount(100);
+        // B的队列满时A的工作线程会等待主线程执行B，所以在另一个线程上推送
+        std::thread producer([&] {
+            for (int i = 0; i < 100; ++i) {
+                a.push(i);
+            }
+        });
+        b.run();
+        producer.join();
+        check(ranA.load() == 100 && !offMain.load(), "B的100个任务都在主线程上执行");
+    }
+
+    std::printf("测试4: 下游是OrderedStage时不融合，输出仍按索引顺序\n");
+    {
+        std::vector<int> out;
+        Stage a("A", 4, 8, [](int i) {
+            if (i % 3 == 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+        });
+        OrderedStage writer("Writer", 1, 8, 4, [&](int i) { out.push_back(i); });
+        fuse(a, writer);
+        a.addTaskCount(200);
+        for (int i = 0; i < 200; ++i) {
+            a.push(i);
+        }
+        writer.wait();
+        bool ordered = out.size() == 200;
+        for (size_t i = 0; ordered && i < out.size(); ++i) {
+            ordered = out[i] == (int)i;
+        }
+        check(ordered, "Writer按0..199的顺序执行");
+    }
+
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,169 @@
+// I/O阶段测试：IoReadStage -> 处理 -> IoWriteStage复制文件，缓冲区回到对象池；
+// 短读、读写失败的块带着result交给下游，流式模式的close穿过读写阶段
+// 同一个文件定义TASK_QUEUE_NO_IO_URING后再编译一次，测试退回到线程池的路径
+
+#include "task_queue_io.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+static const size_t kBlock = 4096;
+static const int kBlocks = 64;
+
+static char pattern(size_t offset)
+{
+    return (char)((offset * 131 + offset / kBlock) % 251);
+}
+
+// 创建临时文件，返回路径；size个字节按pattern填充
+static std::string makeFile(size_t size)
+{
+    char path[] = "/tmp/tq_io_test_XXXXXX";
+    int fd = mkstemp(path);
+    std::vector<char> data(size);
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = pattern(i);
+    }
+    if (fd < 0 || write(fd, data.data(), size) != (ssize_t)size) {
+        std::perror("mkstemp/write");
+        std::exit(1);
+    }
+    close(fd);
+    return path;
+}
+
+int main()
+{
+#ifdef TASK_QUEUE_NO_IO_URING
+    std::printf("（TASK_QUEUE_NO_IO_URING：使用线程池中的pread/pwrite）\n");
+#endif
+    IoEngine engine(16);
+#ifdef TASK_QUEUE_NO_IO_URING
+    check(!engine.usingIoUring(), "定义TASK_QUEUE_NO_IO_URING时IoEngine退回到线程池");
+#else
+    std::printf("（IoEngine%s使用io_uring）\n", engine.usingIoUring() ? "" : "没有");
+#endif
+
+    std::string inPath = makeFile(kBlock * kBlocks);
+    std::string outPath = inPath + ".out";
+
+    std::printf("测试1: 按块号读取、校验、写到同一偏移，计数模式\n");
+    {
+        int in = open(inPath.c_str(), O_RDONLY);
+        int out = open(outPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        std::atomic<int> good { 0 };
+        IoReadStage read("Read", engine, in, kBlock, 8);
+        TypedStage<IoBlock, IoBlock> verify("Verify", 4, 8, [&](IoBlock&& b) {
+            bool ok = b.result == (int)kBlock && b.buffer->size() == kBlock;
+            for (size_t i = 0; ok && i < kBlock; ++i) {
+                ok = b.buffer->data()[i] == pattern(b.offset + i);
+            }
+            if (ok)
+                ++good;
+            return std::move(b);
+        });
+        IoWriteStage write("Write", engine, out);
+        read.setNext(&verify);
+        verify.setNext(&write);
+        for (int batch = 0; batch < 2; ++batch) {
+            read.addTaskCount(kBlocks);
+            for (int i = 0; i < kBlocks; ++i) {
+                read.push(i);
+            }
+            write.wait();
+        }
+        check(good.load() == 2 * kBlocks, "两批各64个块读到的内容都正确");
+        check(read.pool().available() == 8, "写完后缓冲区全部回到读取阶段的对象池");
+        close(in);
+        close(out);
+
+        std::vector<char> copy(kBlock * kBlocks + 1);
+        int fd = open(outPath.c_str(), O_RDONLY);
+        ssize_t n = ::read(fd, copy.data(), copy.size());
+        close(fd);
+        bool same = n == (ssize_t)(kBlock * kBlocks);
+        for (size_t i = 0; same && i < (size_t)n; ++i) {
+            same = copy[i] == pattern(i);
+        }
+        check(same, "输出文件与输入文件相同");
+    }
+
+    std::printf("测试2: 短读和写入失败的块带着result交给下游，流式模式\n");
+    {
+        int in = open(inPath.c_str(), O_RDONLY);
+        int readOnly = open(outPath.c_str(), O_RDONLY); // 写入返回-EBADF
+        std::atomic<int> full { 0 }, empty { 0 }, badWrite { 0 }, other { 0 };
+        IoReadStage read("Read", engine, in, kBlock, 4);
+        TypedStage<IoBlock, IoBlock> classify("Classify", 2, 8, [&](IoBlock&& b) {
+            if (b.result == (int)kBlock)
+                ++full;
+            else if (b.result == 0)
+                ++empty;
+            return std::move(b);
+        });
+        IoWriteStage write("Write", engine, readOnly);
+        TypedStage<IoBlock, void> sink("Sink", 1, 8, [&](IoBlock&& b) {
+            if (b.result == -EBADF)
+                ++badWrite;
+            else
+                ++other;
+        });
+        read.setNext(&classify);
+        classify.setNext(&write);
+        write.setNext(&sink);
+        read.openStream();
+        for (int i = kBlocks - 4; i < kBlocks + 4; ++i) {
+            read.push(i);
+        }
+        read.close();
+        sink.wait();
+        check(full.load() == 4 && empty.load() == 4, "文件末尾之后的4个块读到0字节");
+        check(badWrite.load() == 8 && other.load() == 0, "写入只读句柄的8个块以-EBADF交给下游");
+        close(in);
+        close(readOnly);
+    }
+
+    std::printf("测试3: 读取失败的块不写入，直接交给写入阶段的下游\n");
+    {
+        int dir = open("/tmp", O_RDONLY | O_DIRECTORY); // 读取返回-EISDIR
+        int out = open(outPath.c_str(), O_WRONLY);
+        std::atomic<int> failed { 0 };
+        IoReadStage read("Read", engine, dir, kBlock, 4);
+        IoWriteStage write("Write", engine, out);
+        TypedStage<IoBlock, void> sink("Sink", 1, 8, [&](IoBlock&& b) {
+            if (b.result == -EISDIR)
+                ++failed;
+        });
+        read.setNext(&write);
+        write.setNext(&sink);
+        read.addTaskCount(6);
+        for (int i = 0; i < 6; ++i) {
+            read.push(i);
+        }
+        sink.wait();
+        check(failed.load() == 6, "6个块以-EISDIR经过写入阶段");
+        close(dir);
+        close(out);
+    }
+
+    unlink(inPath.c_str());
+    unlink(outPath.c_str());
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}
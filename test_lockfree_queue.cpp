@@ -0,0 +1,113 @@
+// LockFreeTaskQueue测试：容量取整为2的幂，多生产者多消费者下每个任务恰好执行一次，可作为ThreadPoolEx/StageT的TaskQueueT
+
+#include "task_queue.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+int main()
+{
+    std::printf("测试1: 容量向上取整为2的幂，满时tryPushTask失败，按FIFO顺序取出\n");
+    {
+        LockFreeTaskQueue queue(5);
+        check(queue.capacity() == 8, "容量5取整为8");
+        std::vector<int> order;
+        int pushed = 0;
+        for (int i = 0; i < 10; ++i) {
+            Task task([&order, i] { order.push_back(i); });
+            if (queue.tryPushTask(task))
+                ++pushed;
+        }
+        check(pushed == 8, "放入8个后队列已满");
+        Task task;
+        while (queue.tryPopTask(task)) {
+            task();
+        }
+        bool fifo = order.size() == 8;
+        for (size_t i = 0; fifo && i < order.size(); ++i) {
+            fifo = order[i] == (int)i;
+        }
+        check(fifo, "取出顺序与放入顺序一致");
+        check(queue.empty(), "取完后队列为空");
+    }
+
+    std::printf("测试2: 4个生产者、4个消费者共用容量16的队列，满和空时都会等待\n");
+    {
+        const int producers = 4, consumers = 4, perProducer = 20000;
+        LockFreeTaskQueue queue(16);
+        std::vector<std::atomic<int>> seen(producers * perProducer);
+        for (auto& s : seen) {
+            s = 0;
+        }
+        std::vector<std::thread> threads;
+        for (int c = 0; c < consumers; ++c) {
+            threads.emplace_back([&] {
+                while (Task task = queue.popTask()) {
+                    task();
+                }
+            });
+        }
+        std::vector<std::thread> writers;
+        for (int p = 0; p < producers; ++p) {
+            writers.emplace_back([&, p] {
+                for (int i = 0; i < perProducer; ++i) {
+                    int id = p * perProducer + i;
+                    queue.pushTask([&seen, id] { seen[id].fetch_add(1); });
+                }
+            });
+        }
+        for (auto& t : writers) {
+            t.join();
+        }
+        queue.close();
+        for (auto& t : threads) {
+            t.join();
+        }
+        bool once = true;
+        for (auto& s : seen) {
+            once = once && s.load() == 1;
+        }
+        check(once, "80000个任务每个恰好执行一次");
+        QueueStats stats = queue.stats();
+        check(stats.peakDepth <= 16, "队列长度没有超过容量");
+        check(!queue.pushTask([] {}), "关闭后pushTask返回false");
+    }
+
+    std::printf("测试3: 作为ThreadPoolEx和StageT的TaskQueueT\n");
+    {
+        std::atomic<int> ran { 0 };
+        ThreadPoolEx<LockFreeTaskQueue> pool(4);
+        pool.taskQueue.setCapacity(8);
+        pool.setTaskCount(1000);
+        for (int i = 0; i < 1000; ++i) {
+            pool.pushTask([&] { ++ran; });
+        }
+        pool.wait();
+        check(ran.load() == 1000, "ThreadPoolEx<LockFreeTaskQueue>执行了1000个任务");
+
+        std::atomic<int> ranA { 0 }, ranB { 0 };
+        StageLockFree a("A", 4, 8, [&](int) { ++ranA; });
+        StageLockFree b("B", 2, 8, [&](int) { ++ranB; });
+        chain(a, b);
+        a.addTaskCount(500);
+        for (int i = 0; i < 500; ++i) {
+            a.push(i);
+        }
+        b.wait();
+        check(ranA.load() == 500 && ranB.load() == 500, "StageLockFree链接的两个阶段各执行500次");
+    }
+
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}
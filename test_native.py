@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+"""
+task_queue_native测试：计数和流式模式、异常传播、StageCurrent、pushRange、
+原生阶段函数（STAGE_FUNC胶囊），以及等待时释放GIL
+需要先构建task_queue_native（-DBUILD_PYTHON=ON），并把构建目录加入PYTHONPATH
+"""
+
+import ctypes
+import sys
+import threading
+import time
+
+import task_queue_native as tq
+
+failures = 0
+
+
+def check(ok, what):
+    global failures
+    print(f"{'✅' if ok else '❌'} {what}")
+    if not ok:
+        failures += 1
+
+
+print("测试1: 三个阶段链接，addTaskCount推导下游计数，重复两批")
+hits = [0] * 1000
+lock = threading.Lock()
+
+
+def count(i):
+    with lock:
+        hits[i] += 1
+
+
+a = tq.Stage("A", 4, 16, lambda i: None)
+b = tq.Stage("B", 2, 16, lambda i: None)
+c = tq.Stage("C", 1, 16, count)
+tq.chain(a, b)
+tq.chain(b, c)
+for batch in range(2):
+    a.addTaskCount(1000)
+    for i in range(1000):
+        a.push(i)
+    c.wait()
+check(hits == [2] * 1000, "每个索引在两批中各到达C一次")
+check(a.pipeline is c.pipeline and a.next is b, "chain让下游共享上游的pipeline")
+
+print("测试2: 阶段函数抛出异常，wait抛出RuntimeError，出错的索引照常传给下游")
+reached = []
+a = tq.Stage("A", 2, 8, lambda i: 1 / 0 if i % 10 == 0 else None)
+b = tq.Stage("B", 1, 8, reached.append)
+tq.chain(a, b)
+a.addTaskCount(50)
+for i in range(50):
+    a.push(i)
+try:
+    b.wait()
+    check(False, "wait应该抛出RuntimeError")
+except RuntimeError as e:
+    check(isinstance(e.__cause__, ZeroDivisionError), "RuntimeError的__cause__是第一个异常")
+check(len(b.pipeline.exceptions) == 5 and b.pipeline.has_exceptions(), "5个异常记录在pipeline中")
+check(sorted(reached) == list(range(50)), "50个索引都到达B")
+
+print("测试3: StageCurrent在调用run的线程上执行，另一个线程流式推送")
+main = threading.get_ident()
+threads = set()
+render = tq.StageCurrent("Render", None, 8, lambda i: threads.add(threading.get_ident()))
+render.openStream()
+
+
+def produce():
+    for i in range(200):
+        render.push(i)
+    render.close()
+
+
+producer = threading.Thread(target=produce)
+producer.start()
+render.run()
+producer.join()
+check(threads == {main}, "200个任务都在主线程上执行")
+
+print("测试4: pushRange按块推送，下游按索引计数")
+hits = [0] * 1000
+a = tq.Stage("A", 4, 8, lambda i: None)
+b = tq.Stage("B", 2, 8, count)
+tq.chain(a, b)
+a.addTaskCount(1000)
+a.pushRange(0, 700, 64)
+a.pushRange(700, 1000)
+b.wait()
+check(hits == [1] * 1000, "每个索引到达B一次")
+
+print("测试5: 原生阶段函数通过胶囊传入，context原样传给函数")
+NativeFunc = ctypes.CFUNCTYPE(None, ctypes.c_int, ctypes.c_void_p)
+slots = (ctypes.c_int * 256)()
+
+
+@NativeFunc
+def fill(i, context):
+    ctypes.cast(context, ctypes.POINTER(ctypes.c_int))[i] = i * 3
+
+
+newCapsule = ctypes.pythonapi.PyCapsule_New
+newCapsule.restype = ctypes.py_object
+newCapsule.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_void_p]
+setContext = ctypes.pythonapi.PyCapsule_SetContext
+setContext.argtypes = [ctypes.py_object, ctypes.c_void_p]
+capsuleName = ctypes.create_string_buffer(tq.STAGE_FUNC.encode())  # 胶囊只保存名字的指针
+capsule = newCapsule(ctypes.cast(fill, ctypes.c_void_p), capsuleName, None)
+setContext(capsule, ctypes.addressof(slots))
+native = tq.Stage("Native", 4, 16, capsule)
+native.openStream()
+native.pushRange(0, 256, 16)
+native.close()
+native.wait()
+check(list(slots) == [i * 3 for i in range(256)], "256个索引都由原生函数写入context")
+
+print("测试6: 工作线程等待时不持有GIL，4个线程并行sleep")
+sleeper = tq.Stage("Sleep", 4, 8, lambda i: time.sleep(0.02))
+sleeper.setTaskCount(40)
+start = time.monotonic()
+for i in range(40):
+    sleeper.push(i)
+sleeper.wait()
+elapsed = time.monotonic() - start
+check(elapsed < 0.6, f"40个20ms的任务耗时{elapsed:.2f}s，远小于串行的0.8s")
+
+print("测试7: 参数错误")
+try:
+    tq.Stage("Bad", 1, 8, 42)
+    check(False, "不可调用的func应该抛出TypeError")
+except TypeError:
+    check(True, "不可调用的func抛出TypeError")
+try:
+    tq.Stage("Bad", 1, 8, lambda i: None, pipeline=42)
+    check(False, "pipeline不是Pipeline时应该抛出TypeError")
+except TypeError:
+    check(True, "pipeline不是Pipeline时抛出TypeError")
+
+print("全部通过" if failures == 0 else "有测试失败")
+sys.exit(0 if failures == 0 else 1)
@@ -0,0 +1,114 @@
+// ObjectPool测试：借出和归还、recycle回调、close唤醒阻塞的acquire，
+// 缓冲区在TypedStage之间流动后自动归还，流水线中同时存在的对象数不超过容量
+
+#include "task_queue.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+using Buffer = std::vector<char>;
+
+int main()
+{
+    std::printf("测试1: 借出、归还和recycle\n");
+    {
+        ObjectPool<Buffer> pool(3, [] { return Buffer(); });
+        std::atomic<int> recycled { 0 };
+        pool.setRecycle([&](Buffer& b) {
+            b.clear();
+            ++recycled;
+        });
+        Pooled<Buffer> a = pool.acquire();
+        Pooled<Buffer> b = pool.acquire();
+        Pooled<Buffer> c = pool.tryAcquire();
+        check(a && b && c && pool.available() == 0, "借出3个后对象池为空");
+        check(!pool.tryAcquire(), "对象池为空时tryAcquire返回空的Pooled");
+        a->assign(4096, 'x');
+        Buffer* object = a.get();
+        size_t reserved = a->capacity();
+        a.reset();
+        check(!a && pool.available() == 1 && recycled.load() == 1, "reset归还对象并调用recycle");
+        Pooled<Buffer> again = pool.acquire();
+        check(again.get() == object && again->empty() && again->capacity() == reserved,
+            "再次借出的是刚归还的对象，内容已清空，容量保留");
+        Pooled<Buffer> moved(std::move(b));
+        check(!b && moved, "Pooled只可移动，移动后原对象为空");
+    }
+
+    std::printf("测试2: close唤醒阻塞在acquire中的线程\n");
+    {
+        ObjectPool<Buffer> pool(1);
+        Pooled<Buffer> held = pool.acquire();
+        std::atomic<bool> gotEmpty { false };
+        std::thread waiter([&] { gotEmpty = !pool.acquire(); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        pool.close();
+        waiter.join();
+        check(gotEmpty.load(), "close之后acquire返回空的Pooled");
+        held.reset();
+        check(pool.available() == 1, "关闭后归还不受影响");
+    }
+
+    std::printf("测试3: 容量4的缓冲区在三个TypedStage之间流动，最后一个阶段处理完后归还\n");
+    {
+        ObjectPool<Buffer> pool(4, [] { return Buffer(); });
+        pool.setRecycle([](Buffer& b) { b.clear(); });
+        std::atomic<int> peakInUse { 0 };
+        std::atomic<long> total { 0 };
+        std::mutex mtx;
+        std::set<const Buffer*> seen;
+        TypedStage<int, Pooled<Buffer>> read("Read", 2, 2, [&](int&& i) {
+            Pooled<Buffer> buf = pool.acquire();
+            buf->assign(1000, (char)(i % 100));
+            int inUse = (int)(pool.capacity() - pool.available());
+            int p = peakInUse.load();
+            while (inUse > p && !peakInUse.compare_exchange_weak(p, inUse)) {
+            }
+            return buf;
+        });
+        TypedStage<Pooled<Buffer>, Pooled<Buffer>> transform("Transform", 2, 2, [](Pooled<Buffer>&& buf) {
+            for (char& c : *buf) {
+                c += 1;
+            }
+            return std::move(buf);
+        });
+        TypedStage<Pooled<Buffer>, void> write("Write", 1, 2, [&](Pooled<Buffer>&& buf) {
+            long sum = 0;
+            for (char c : *buf) {
+                sum += c;
+            }
+            total += sum;
+            std::lock_guard<std::mutex> lock(mtx);
+            seen.insert(buf.get());
+        });
+        chain(read, transform);
+        chain(transform, write);
+        read.openStream();
+        long expected = 0;
+        for (int i = 0; i < 200; ++i) {
+            read.push(i);
+            expected += 1000L * (i % 100 + 1);
+        }
+        read.close();
+        write.wait();
+        check(total.load() == expected, "200个缓冲区的内容经过三个阶段后正确");
+        check(peakInUse.load() <= 4 && seen.size() <= 4, "同时借出的缓冲区不超过4个，全程只用到这4个对象");
+        check(pool.available() == 4, "结束后全部归还");
+    }
+
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}
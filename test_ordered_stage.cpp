@@ -0,0 +1,247 @@
+// OrderedStage回归测试：多线程上游之后保序、重排缓冲不超过窗口、多批复用、拒绝只收到部分索引的链接
+
+#include "task_queue.hpp"
+#include "task_queue_shm.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+static bool inOrder(const std::vector<int>& out, int n)
+{
+    if ((int)out.size() != n)
+        return false;
+    for (int i = 0; i < n; ++i) {
+        if (out[i] != i)
+            return false;
+    }
+    return true;
+}
+
+// 索引越小处理越慢，让后面的索引先到达OrderedStage
+static void jitter(int i)
+{
+    if (i % 16 == 0)
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+}
+
+int main()
+{
+    const int n = 5000;
+
+    std::printf("测试1: A(4线程) -> B(4线程) -> OrderedStage，窗口小于上游线程数\n");
+    {
+        std::mutex m;
+        std::vector<int> out;
+        Stage a("A", 4, 4, [](int i) { jitter(i); });
+        Stage b("B", 4, 4, [](int i) { jitter(i + 8); });
+        OrderedStage writer("Writer", 1, 4, 2, [&](int i) {
+            std::lock_guard<std::mutex> lock(m);
+            out.push_back(i);
+        });
+        chain(a, b);
+        chain(b, writer);
+        a.addTaskCount(n);
+        for (int i = 0; i < n; ++i) {
+            a.push(i);
+        }
+        writer.wait();
+        check(inOrder(out, n), "所有索引按顺序到达，没有死锁");
+        check(writer.peakBuffered() <= 2, "重排缓冲的峰值不超过窗口");
+
+        std::printf("测试2: 同一组阶段的第二批重新从0开始保序\n");
+        out.clear();
+        a.addTaskCount(n);
+        a.pushRange(0, n, 64);
+        writer.wait();
+        check(inOrder(out, n), "第二批仍然按顺序到达");
+        check(writer.peakBuffered() <= 2, "按块推送时重排缓冲的峰值仍不超过窗口");
+    }
+
+    std::printf("测试2b: 索引0很慢时，后面的索引不会无限制地堆积\n");
+    {
+        std::mutex m;
+        std::vector<int> out;
+        std::atomic<int> started { 0 };
+        Stage a("A", 4, 64, [&](int i) {
+            ++started;
+            if (i == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        });
+        OrderedStage writer("Writer", 1, 64, 8, [&](int i) {
+            std::lock_guard<std::mutex> lock(m);
+            out.push_back(i);
+        });
+        chain(a, writer);
+        a.addTaskCount(1000);
+        std::thread feeder([&] {
+            for (int i = 0; i < 1000; ++i) {
+                a.push(i);
+            }
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(25));
+        int whileSlow = started.load();
+        feeder.join();
+        writer.wait();
+        check(whileSlow <= 8, "索引0完成前上游最多开始window个索引");
+        check(inOrder(out, 1000) && writer.peakBuffered() <= 8, "按顺序到达，重排缓冲不超过窗口");
+    }
+
+    std::printf("测试3: 流式模式\n");
+    {
+        std::mutex m;
+        std::vector<int> out;
+        Stage a("A", 4, 8, [](int i) { jitter(i); });
+        OrderedStage writer("Writer", 1, 8, 4, [&](int i) {
+            std::lock_guard<std::mutex> lock(m);
+            out.push_back(i);
+        });
+        chain(a, writer);
+        a.openStream();
+        for (int i = 0; i < n; ++i) {
+            a.push(i);
+        }
+        a.close();
+        writer.wait();
+        check(inOrder(out, n), "流式输入按顺序到达");
+        check(writer.peakBuffered() <= 4, "流式模式下重排缓冲的峰值不超过窗口");
+    }
+
+    std::printf("测试3b: 上游是TypedStage<int, int>（不是索引阶段）时在本阶段阻塞\n");
+    {
+        std::mutex m;
+        std::vector<int> out;
+        TypedStage<int, int> a("A", 4, 8, [](int&& i) {
+            jitter(i);
+            return i;
+        });
+        OrderedStage writer("Writer", 1, 8, 2, [&](int i) {
+            std::lock_guard<std::mutex> lock(m);
+            out.push_back(i);
+        });
+        a.setNext(&writer);
+        a.addTaskCount(n);
+        for (int i = 0; i < n; ++i) {
+            a.push(i);
+        }
+        writer.wait();
+        check(inOrder(out, n), "按顺序到达，没有死锁");
+        check(writer.peakBuffered() <= 2, "重排缓冲的峰值不超过窗口");
+    }
+
+    std::printf("测试3c: A(4线程，索引0很慢) -> BatchStage(1线程) -> OrderedStage，准入限制经过批处理阶段传到链头\n");
+    {
+        std::mutex m;
+        std::vector<int> out;
+        Stage a("A", 4, 16, [](int i) {
+            if (i == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        });
+        BatchStage batch("Batch", 1, 16, 8, std::chrono::microseconds(500), [](const int*, size_t) {});
+        OrderedStage writer("Writer", 1, 16, 4, [&](int i) {
+            std::lock_guard<std::mutex> lock(m);
+            out.push_back(i);
+        });
+        chain(a, batch);
+        batch.setNext(&writer);
+        for (int round = 0; round < 2; ++round) {
+            out.clear();
+            a.addTaskCount(500);
+            if (round == 0) {
+                for (int i = 0; i < 500; ++i) {
+                    a.push(i);
+                }
+            } else {
+                a.pushRange(0, 500, 16);
+            }
+            writer.wait();
+            check(inOrder(out, 500), round == 0 ? "逐个push：按顺序到达，没有死锁" : "pushRange：按顺序到达，没有死锁");
+        }
+        check(writer.peakBuffered() <= 4, "重排缓冲的峰值不超过窗口");
+    }
+
+    std::printf("测试3d: ShmReceiver的转发线程不能等待准入许可，下游（包括下游的下游）不能是OrderedStage\n");
+    {
+        std::string name = "/tq_test_ordered_" + std::to_string(getpid());
+        ShmChannel<int> channel(name, ShmMode::Create, 64);
+        Stage a("A", 4, 16, [](int) {});
+        ShmSender<int> sender(channel);
+        ShmReceiver<int> receiver("Receiver", channel);
+        OrderedStage writer("Writer", 1, 16, 4, [](int) {});
+        a.setNext(&sender);
+        bool rejected = false;
+        try {
+            receiver.setNext(&writer);
+        } catch (const std::invalid_argument&) {
+            rejected = true;
+        }
+        check(rejected, "receiver.setNext(OrderedStage)抛出invalid_argument");
+
+        Stage b("B", 1, 16, [](int) {});
+        receiver.setNext(&b);
+        rejected = false;
+        try {
+            chain(b, writer);
+        } catch (const std::invalid_argument&) {
+            rejected = true;
+        }
+        check(rejected, "先链接receiver -> B，再链接B -> OrderedStage时抛出");
+
+        Stage c("C", 1, 16, [](int) {});
+        OrderedStage writer2("Writer2", 1, 16, 4, [](int) {});
+        chain(c, writer2);
+        rejected = false;
+        try {
+            receiver.addNext(&c);
+        } catch (const std::invalid_argument&) {
+            rejected = true;
+        }
+        check(rejected, "先链接C -> OrderedStage，再链接receiver -> C时抛出");
+    }
+
+    std::printf("测试4: 轮转或键分区的多个下游之一不能是OrderedStage/JoinStage\n");
+    {
+        Stage a("A", 1, 8, [](int) {});
+        Stage other("Other", 1, 8, [](int) {});
+        OrderedStage writer("Writer", 1, 8, 4, [](int) {});
+        JoinStage join("Join", 1, 8, 1, [](int) {});
+        a.setRouting(Routing::RoundRobin);
+        a.addNext(&other);
+        bool rejected = false;
+        try {
+            a.addNext(&writer);
+        } catch (const std::invalid_argument&) {
+            rejected = true;
+        }
+        check(rejected, "RoundRobin时addNext(OrderedStage)抛出invalid_argument");
+
+        Stage c("C", 1, 8, [](int) {});
+        c.addNext(&join);
+        c.addNext(&other);
+        rejected = false;
+        try {
+            c.setRouting(Routing::KeyPartition);
+        } catch (const std::invalid_argument&) {
+            rejected = true;
+        }
+        check(rejected, "有JoinStage下游时setRouting(KeyPartition)抛出invalid_argument");
+    }
+
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+// parallelFor/pushRange测试：每个索引恰好执行一次，Flat按grain对齐分块，Recursive在队列满时由本线程继续执行，
+// StageT::pushRange按索引计数，下游照常结束
+
+#include "task_queue.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+static bool allOnce(const std::vector<std::atomic<int>>& hits)
+{
+    for (auto& h : hits) {
+        if (h.load() != 1)
+            return false;
+    }
+    return true;
+}
+
+int main()
+{
+    std::printf("测试1: Flat拆分，每块是从begin开始的grain个连续索引\n");
+    {
+        ThreadPoolEx<BoundedTaskQueue> pool(4);
+        for (int grain : { 1, 7, 0 }) {
+            std::vector<std::atomic<int>> hits(1000);
+            std::vector<std::thread::id> owner(1000);
+            for (auto& h : hits) {
+                h = 0;
+            }
+            pool.parallelFor(5, 1005, grain, [&](int i) {
+                hits[i - 5].fetch_add(1);
+                owner[i - 5] = std::this_thread::get_id();
+            });
+            check(allOnce(hits), grain == 0 ? "grain为0时自动分块，每个索引执行一次" : "每个索引执行一次");
+            if (grain > 1) {
+                bool sameThread = true;
+                for (int i = 0; i < 1000; ++i) {
+                    sameThread = sameThread && owner[i] == owner[i - i % grain];
+                }
+                check(sameThread, "同一块内的索引由同一个线程执行");
+            }
+        }
+        bool empty = true;
+        pool.parallelFor(10, 10, 1, [&](int) { empty = false; });
+        check(empty, "空范围直接返回");
+        check(pool.submit([] { return 7; }).get() == 7, "parallelFor之后线程池仍可submit");
+    }
+
+    std::printf("测试2: Recursive拆分，队列容量为2时拆不出去的部分由当前线程执行\n");
+    {
+        ThreadPoolEx<BoundedTaskQueue> pool(4);
+        pool.taskQueue.setCapacity(2);
+        std::vector<std::atomic<int>> hits(100000);
+        for (auto& h : hits) {
+            h = 0;
+        }
+        pool.parallelFor(0, 100000, 16, [&](int i) { hits[i].fetch_add(1); }, RangeSplit::Recursive);
+        check(allOnce(hits), "100000个索引每个执行一次");
+    }
+
+    std::printf("测试3: StageT::pushRange按索引计数，Flat和Recursive两种拆分\n");
+    for (RangeSplit split : { RangeSplit::Flat, RangeSplit::Recursive }) {
+        std::vector<std::atomic<int>> hits(1000);
+        for (auto& h : hits) {
+            h = 0;
+        }
+        std::atomic<int> ranB { 0 };
+        Stage a("A", 4, 8, [&](int i) { hits[i].fetch_add(1); });
+        Stage b("B", 2, 8, [&](int) { ++ranB; });
+        chain(a, b);
+        a.setRangeSplit(split);
+        a.addTaskCount(1000);
+        a.pushRange(0, 600, 64);
+        for (int i = 600; i < 1000; ++i) {
+            a.push(i);
+        }
+        b.wait();
+        check(allOnce(hits) && ranB.load() == 1000,
+            split == RangeSplit::Flat ? "Flat：块和逐个push混用，A、B各执行1000次" : "Recursive：同样各执行1000次");
+    }
+
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+// PriorityTaskQueue测试：按优先级出队、同级先进先出、越界优先级被截断，老化使等待久的低优先级任务先出队，
+// 有界时满队列拒绝tryPushTask，ThreadPoolEx::pushTask(task, priority)按优先级调度
+
+#include "task_queue.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+// 按出队顺序执行队列中的全部任务
+static void drain(PriorityTaskQueue& queue)
+{
+    Task task;
+    while (queue.tryPopTask(task)) {
+        task();
+    }
+}
+
+int main()
+{
+    std::printf("测试1: 高优先级先出队，同一优先级内先进先出，越界优先级被截断\n");
+    {
+        PriorityTaskQueue queue;
+        std::vector<int> order;
+        // 编号 = 优先级 * 10 + 同级序号
+        for (int i = 0; i < 2; ++i) {
+            for (int p = 0; p < PriorityTaskQueue::kLevels; ++p) {
+                int id = p * 10 + i;
+                queue.pushTask([&order, id] { order.push_back(id); }, p);
+            }
+        }
+        queue.pushTask([&order] { order.push_back(100); }, 100);
+        queue.pushTask([&order] { order.push_back(-1); }, -5);
+        check(queue.size(PriorityTaskQueue::kLevels - 1) == 3, "优先级100截断为最高级");
+        check(queue.size(0) == 3, "优先级-5截断为0");
+        std::vector<int> expected = { 70, 71, 100, 60, 61, 50, 51, 40, 41, 30, 31, 20, 21, 10, 11, 0, 1, -1 };
+        drain(queue);
+        check(order == expected, "出队顺序按优先级从高到低，同级按放入顺序");
+    }
+
+    std::printf("测试2: 开启老化后，等待足够久的低优先级任务先于新的高优先级任务出队\n");
+    {
+        std::vector<int> order;
+        PriorityTaskQueue plain;
+        plain.pushTask([&order] { order.push_back(0); }, 0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        plain.pushTask([&order] { order.push_back(7); }, 7);
+        drain(plain);
+        check(order == std::vector<int>({ 7, 0 }), "未开启老化时高优先级先出队");
+
+        order.clear();
+        PriorityTaskQueue aged;
+        aged.setAging(std::chrono::milliseconds(1));
+        aged.pushTask([&order] { order.push_back(0); }, 0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        aged.pushTask([&order] { order.push_back(7); }, 7);
+        drain(aged);
+        check(order == std::vector<int>({ 0, 7 }), "等待20个老化间隔的优先级0任务先出队");
+    }
+
+    std::printf("测试3: 有界优先级队列满时tryPushTask失败\n");
+    {
+        BoundedPriorityTaskQueue queue(2);
+        Task a([] {}), b([] {}), c([] {});
+        check(queue.tryPushTask(a) && queue.tryPushTask(b), "容量内放入成功");
+        check(!queue.tryPushTask(c) && c, "队列已满时返回false且不移走任务");
+    }
+
+    std::printf("测试4: 单线程ThreadPoolEx<PriorityTaskQueue>按优先级执行排队中的任务\n");
+    {
+        std::mutex mtx;
+        std::vector<int> order;
+        std::atomic<bool> release { false };
+        ThreadPoolEx<PriorityTaskQueue> pool(1);
+        pool.setTaskCount(1 + 8);
+        pool.pushTask([&] {
+            while (!release.load()) {
+                std::this_thread::yield();
+            }
+        });
+        while (pool.taskQueue.size() > 0) {
+            std::this_thread::yield(); // 等工作线程取走阻塞任务，之后的任务都在队列中排队
+        }
+        for (int p = 0; p < 8; ++p) {
+            pool.pushTask([&, p] {
+                std::lock_guard<std::mutex> lock(mtx);
+                order.push_back(p);
+            }, p);
+        }
+        release = true;
+        pool.wait();
+        check(order == std::vector<int>({ 7, 6, 5, 4, 3, 2, 1, 0 }), "按优先级从高到低执行");
+    }
+
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}
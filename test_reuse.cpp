@@ -0,0 +1,150 @@
+// 多批复用测试：线程池和流水线在wait返回后接着处理下一批，工作线程不重新创建；
+// 计数模式和流式模式在批之间交替，StageCurrent可以多次run
+
+#include "task_queue.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <set>
+#include <thread>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+// 记录执行任务的线程
+struct ThreadSet {
+    std::mutex mtx;
+    std::set<std::thread::id> ids;
+
+    void add()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        ids.insert(std::this_thread::get_id());
+    }
+};
+
+int main()
+{
+    std::printf("测试1: ThreadPoolEx连续处理200批，每批10个任务\n");
+    {
+        ThreadPoolEx<BoundedTaskQueue> pool(4);
+        ThreadSet threads;
+        std::atomic<int> ran { 0 };
+        bool exact = true;
+        for (int batch = 0; batch < 200; ++batch) {
+            pool.setTaskCount(10);
+            for (int i = 0; i < 10; ++i) {
+                pool.pushTask([&] {
+                    threads.add();
+                    ++ran;
+                });
+            }
+            pool.wait();
+            exact = exact && ran.load() == 10 * (batch + 1);
+        }
+        check(exact, "每批wait返回时本批的任务都已完成");
+        check(threads.ids.size() <= 4 && pool.threadCount() == 4, "全程只用到同样的4个工作线程");
+    }
+
+    std::printf("测试2: A -> B处理500批，计数模式和流式模式交替\n");
+    {
+        ThreadSet threadsA;
+        std::atomic<int> ranB { 0 };
+        Stage a("A", 2, 8, [&](int) { threadsA.add(); });
+        Stage b("B", 1, 8, [&](int) { ++ranB; });
+        chain(a, b);
+        bool exact = true;
+        for (int batch = 0; batch < 500; ++batch) {
+            if (batch % 2 == 0) {
+                a.addTaskCount(20);
+                a.pushRange(0, 20, 8);
+            } else {
+                a.openStream();
+                for (int i = 0; i < 20; ++i) {
+                    a.push(i);
+                }
+                a.close();
+            }
+            b.wait();
+            exact = exact && ranB.load() == 20 * (batch + 1);
+        }
+        check(exact, "每批B.wait返回时本批的20个索引都已到达B");
+        check(threadsA.ids.size() <= 2, "A全程只用到自己的2个工作线程");
+    }
+
+    std::printf("测试3: TypedStage流水线处理100批\n");
+    {
+        std::atomic<long> sum { 0 };
+        TypedStage<int, int> square("Square", 2, 8, [](int&& i) { return i * i; });
+        TypedStage<int, void> add("Add", 1, 8, [&](int&& v) { sum += v; });
+        chain(square, add);
+        bool exact = true;
+        long expected = 0;
+        for (int batch = 0; batch < 100; ++batch) {
+            square.openStream();
+            for (int i = 0; i < 10; ++i) {
+                square.push(batch + i);
+                expected += (long)(batch + i) * (batch + i);
+            }
+            square.close();
+            add.wait();
+            exact = exact && sum.load() == expected;
+        }
+        check(exact, "每批wait返回时本批的值都已累加");
+    }
+
+    std::printf("测试4: StageCurrent多次run，上游是Stage\n");
+    {
+        std::thread::id mainId = std::this_thread::get_id();
+        std::atomic<int> offMain { 0 };
+        int ran = 0;
+        Stage a("A", 2, 8, [](int) {});
+        StageCurrent b("B", 1, 8, [&](int) {
+            if (std::this_thread::get_id() != mainId)
+                ++offMain;
+            ++ran;
+        });
+        chain(a, b);
+        bool exact = true;
+        for (int batch = 0; batch < 50; ++batch) {
+            a.addTaskCount(30);
+            std::thread producer([&] {
+                for (int i = 0; i < 30; ++i) {
+                    a.push(i);
+                }
+            });
+            b.run();
+            producer.join();
+            exact = exact && ran == 30 * (batch + 1);
+        }
+        check(exact && offMain.load() == 0, "每次run在本批完成后返回，任务都在主线程上执行");
+    }
+
+    std::printf("测试5: 两批在同一次run中执行完，之后的run立即返回\n");
+    {
+        int ran = 0;
+        StageCurrent b("B", 1, 64, [&](int) { ++ran; });
+        b.addTaskCount(10);
+        for (int i = 0; i < 10; ++i) {
+            b.push(i);
+        }
+        b.openStream();
+        for (int i = 0; i < 10; ++i) {
+            b.push(i);
+        }
+        b.close();
+        b.run();
+        b.run(); // 例如ShmReceiver::waitBatch对第二批返回true时
+        check(ran == 20, "第二次run没有等待已经完成的一批");
+    }
+
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}
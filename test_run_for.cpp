@@ -0,0 +1,179 @@
+// 主循环协作测试：runAvailable按maxTasks限制执行个数，runFor用完预算后返回，
+// wakeFd在有任务入队时变为可读、队列取空后复位，drained判断本批完成，以及与run交替使用
+
+#include "task_queue.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <poll.h>
+#include <thread>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+// 不阻塞地查看句柄是否可读
+static bool readable(int fd, int timeoutMs = 0)
+{
+    struct pollfd p = { fd, POLLIN, 0 };
+    return poll(&p, 1, timeoutMs) == 1 && (p.revents & POLLIN);
+}
+
+int main()
+{
+    std::printf("测试1: runAvailable最多执行maxTasks个，队列空时立即返回0\n");
+    {
+        int ran = 0;
+        StageCurrent ui("UI", 1, 64, [&](int) { ++ran; });
+        check(ui.runAvailable() == 0, "没有任务时返回0");
+        ui.addTaskCount(10);
+        for (int i = 0; i < 10; ++i) {
+            ui.push(i);
+        }
+        check(ui.runAvailable(3) == 3 && ran == 3, "maxTasks为3时执行3个");
+        check(!ui.drained(), "本批还有任务，drained为false");
+        check(ui.runAvailable() == 7 && ran == 10, "不限个数时执行剩余的7个");
+        check(ui.drained() && ui.runAvailable() == 0, "本批完成后drained为true，再次调用返回0");
+    }
+
+    std::printf("测试2: runFor用完预算后返回，至少执行一个任务\n");
+    {
+        int ran = 0;
+        StageCurrent ui("UI", 1, 64, [&](int) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            ++ran;
+        });
+        ui.addTaskCount(20);
+        for (int i = 0; i < 20; ++i) {
+            ui.push(i);
+        }
+        size_t first = ui.runFor(std::chrono::microseconds(1));
+        check(first == 1 && ran == 1, "预算小于一个任务的耗时时仍执行一个");
+        size_t second = ui.runFor(std::chrono::milliseconds(30));
+        check(second >= 2 && second <= 6, "30ms的预算执行2到6个5ms的任务");
+        size_t slices = 2;
+        while (!ui.drained()) {
+            ui.runFor(std::chrono::milliseconds(12));
+            ++slices;
+        }
+        check(ran == 20 && slices > 3, "分多次runFor执行完20个任务");
+    }
+
+    std::printf("测试3: wakeFd在入队时可读，取空后复位，用完预算时保持可读\n");
+    {
+        int ran = 0;
+        StageCurrent ui("UI", 1, 64, [&](int) { ++ran; });
+        ui.openStream();
+        ui.push(0);
+        int fd = ui.wakeFd();
+        check(fd >= 0 && readable(fd), "创建句柄之前入队的任务也使它可读");
+        ui.runAvailable();
+        check(ran == 1 && !readable(fd), "队列取空后句柄复位");
+        for (int i = 1; i < 5; ++i) {
+            ui.push(i);
+        }
+        check(readable(fd), "再次入队后句柄可读");
+        ui.runAvailable(2);
+        check(ran == 3 && readable(fd), "队列里还有任务时句柄保持可读");
+        ui.runAvailable();
+        check(ran == 5 && !readable(fd) && !ui.drained(), "取空后复位，流式模式未close时drained为false");
+        ui.close();
+        ui.runAvailable();
+        check(ui.drained(), "close之后drained为true");
+        check(ui.wakeFd() == fd, "再次调用wakeFd返回同一个句柄");
+    }
+
+    std::printf("测试4: 主循环poll句柄，上游Stage在其他线程上产生任务\n");
+    {
+        std::thread::id mainId = std::this_thread::get_id();
+        std::atomic<int> offMain { 0 };
+        int ran = 0;
+        Stage a("A", 2, 8, [](int) { std::this_thread::sleep_for(std::chrono::microseconds(200)); });
+        StageCurrent ui("UI", 1, 8, [&](int) {
+            if (std::this_thread::get_id() != mainId)
+                ++offMain;
+            ++ran;
+        });
+        chain(a, ui);
+        int fd = ui.wakeFd();
+        bool exact = true;
+        int wakeups = 0, idleFrames = 0;
+        for (int batch = 0; batch < 3; ++batch) {
+            a.addTaskCount(100);
+            std::thread producer([&] { a.pushRange(0, 100, 10); });
+            while (!ui.drained()) {
+                if (readable(fd, 100))
+                    ++wakeups;
+                else
+                    ++idleFrames;
+                ui.runFor(std::chrono::microseconds(500));
+            }
+            producer.join();
+            exact = exact && ran == 100 * (batch + 1);
+        }
+        check(exact && offMain.load() == 0, "每批的任务都在主线程上执行完");
+        check(wakeups > 0 && idleFrames == 0, "主循环由句柄唤醒，没有等到poll超时");
+    }
+
+    std::printf("测试5: runAvailable和run交替使用\n");
+    {
+        int ran = 0;
+        StageCurrent ui("UI", 1, 64, [&](int) { ++ran; });
+        ui.addTaskCount(20);
+        for (int i = 0; i < 20; ++i) {
+            ui.push(i);
+        }
+        ui.runAvailable(5);
+        ui.run();
+        check(ran == 20 && ui.drained(), "run执行完runAvailable剩下的15个");
+        ui.openStream();
+        std::thread producer([&] {
+            for (int i = 0; i < 10; ++i) {
+                ui.push(i);
+            }
+            ui.close();
+        });
+        producer.join();
+        ui.runAvailable(4);
+        ui.run();
+        check(ran == 30 && ui.drained(), "流式的一批也可以先部分执行再run");
+    }
+
+    std::printf("测试6: TypedStageCurrent和BatchStageCurrent提供同样的方法\n");
+    {
+        long sum = 0;
+        TypedStageCurrent<int, void> typed("Typed", 1, 16, [&](int&& v) { sum += v; });
+        int fd = typed.wakeFd();
+        typed.addTaskCount(4);
+        for (int i = 1; i <= 4; ++i) {
+            typed.push(i);
+        }
+        check(readable(fd) && typed.runAvailable(2) == 2 && sum == 3, "TypedStageCurrent的句柄可读，runAvailable执行2个");
+        typed.runFor(std::chrono::milliseconds(10));
+        check(sum == 10 && typed.drained(), "runFor执行剩余的值");
+
+        int items = 0;
+        BatchStageCurrent batch("Batch", 1, 16, 4, std::chrono::seconds(5), [&](const int*, size_t n) { items += (int)n; });
+        int batchFd = batch.wakeFd();
+        batch.addTaskCount(8);
+        for (int i = 0; i < 8; ++i) {
+            batch.push(i);
+        }
+        while (!batch.drained()) {
+            if (readable(batchFd, 100))
+                batch.runAvailable();
+            else
+                break;
+        }
+        check(items == 8 && batch.drained(), "BatchStageCurrent由句柄唤醒执行两批");
+    }
+
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}
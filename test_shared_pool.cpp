@@ -0,0 +1,109 @@
+// SharedThreadPool测试：多个阶段共用一组工作线程，每个阶段的并发不超过上限，
+// 池内线程推送到已满的下游队列时不会卡死，阶段可以先于线程池析构，add/removeThread调整并发上限
+
+#include "task_queue.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+// 记录同时执行的最大个数
+struct Concurrency {
+    std::atomic<int> now { 0 };
+    std::atomic<int> peak { 0 };
+
+    void enter()
+    {
+        int n = ++now;
+        int p = peak.load();
+        while (n > p && !peak.compare_exchange_weak(p, n)) {
+        }
+    }
+
+    void leave()
+    {
+        --now;
+    }
+};
+
+int main()
+{
+    SharedThreadPool pool(4);
+
+    std::printf("测试1: 三个阶段共用4个线程，队列容量只有2，各阶段不超过并发上限\n");
+    {
+        std::mutex mtx;
+        std::set<std::thread::id> threads;
+        Concurrency ca, cb;
+        std::atomic<int> ranC { 0 };
+        auto record = [&] {
+            std::lock_guard<std::mutex> lock(mtx);
+            threads.insert(std::this_thread::get_id());
+        };
+        StageShared a("A", pool, 2, 2, [&](int) {
+            ca.enter();
+            record();
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            ca.leave();
+        });
+        StageShared b("B", pool, 1, 2, [&](int) {
+            cb.enter();
+            record();
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            cb.leave();
+        });
+        StageShared c("C", pool, 4, 2, [&](int) {
+            record();
+            ++ranC;
+        });
+        chain(a, b);
+        chain(b, c);
+        for (int batch = 0; batch < 2; ++batch) {
+            a.addTaskCount(300);
+            for (int i = 0; i < 300; ++i) {
+                a.push(i);
+            }
+            c.wait();
+        }
+        check(ranC.load() == 600, "两批各300个索引都到达C");
+        check(ca.peak.load() <= 2 && cb.peak.load() == 1, "A的并发不超过2，B的并发为1");
+        check(threads.size() <= pool.threadCount(), "所有阶段函数都在共享的4个工作线程上执行");
+    }
+
+    std::printf("测试2: add/removeThread调整并发上限，最少为1\n");
+    {
+        StageShared s("S", pool, 1, 4, [](int) {});
+        check(!s.removeThread(), "并发上限为1时removeThread返回false");
+        check(s.addThread() && s.removeThread(), "addThread之后可以再减回1");
+    }
+
+    std::printf("测试3: 已析构的阶段从线程池注销，TypedStageShared在同一个池上继续运行\n");
+    {
+        std::atomic<int> total { 0 };
+        TypedStageShared<int, std::string> format("Format", pool, 2, 4, [](int&& v) { return std::to_string(v); });
+        TypedStageShared<std::string, void> sum("Sum", pool, 1, 4, [&](std::string&& s) { total += std::stoi(s); });
+        chain(format, sum);
+        format.openStream();
+        for (int i = 1; i <= 100; ++i) {
+            format.push(i);
+        }
+        format.close();
+        sum.wait();
+        check(total.load() == 5050, "流式模式下100个值全部经过两个阶段");
+    }
+
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}
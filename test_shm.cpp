@@ -0,0 +1,227 @@
+// 跨进程传输测试：ShmQueue的容量、关闭和布局检查，ShmArena的分配、归还和跨映射可见，
+// fork出的子进程经ShmChannel和ShmArena接收描述符（计数模式和流式模式各一批），
+// 以及同一进程中Stage -> ShmSender<int> -> ShmReceiver<int> -> Stage按范围传递索引
+
+#include "task_queue_shm.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+template <typename E, typename F>
+static bool throws(F f)
+{
+    try {
+        f();
+    } catch (const E&) {
+        return true;
+    }
+    return false;
+}
+
+// 每次运行使用不同的名字，并行运行的测试互不影响
+static std::string shmName(const char* what)
+{
+    return "/tq_test_" + std::to_string(getpid()) + "." + what;
+}
+
+struct Frame {
+    int index;
+    ShmBuffer pixels;
+};
+
+static char pixel(int index, size_t i)
+{
+    return (char)(index * 7 + i);
+}
+
+// 子进程：接收Frame，校验共享内存中的数据后归还块；返回值作为退出码
+static int consumer(const std::string& channelName, const std::string& arenaName)
+{
+    ShmChannel<Frame> channel(channelName, ShmMode::Open);
+    ShmArena arena(arenaName, ShmMode::Open);
+    int frames = 0;
+    bool intact = true;
+    TypedStageCurrent<Frame, void> verify("Verify", 1, 16, [&](Frame&& f) {
+        const char* p = arena.data(f.pixels);
+        intact = intact && f.pixels.size == (uint64_t)(500 + f.index);
+        for (size_t i = 0; intact && i < f.pixels.size; ++i) {
+            intact = p[i] == pixel(f.index, i);
+        }
+        arena.release(f.pixels);
+        ++frames;
+    });
+    ShmReceiver<Frame> receiver("FromParent", channel);
+    chain(receiver, verify);
+    receiver.start();
+    int batches = 0;
+    while (receiver.waitBatch()) {
+        verify.run();
+        ++batches;
+    }
+    return intact && frames == 300 && batches >= 1 ? 0 : 1;
+}
+
+struct Wide {
+    char bytes[64];
+};
+
+int main()
+{
+    std::printf("测试1: ShmQueue的容量、FIFO顺序、关闭和布局检查\n");
+    {
+        std::string name = shmName("queue");
+        ShmQueue<int> creator(name, ShmMode::Create, 5);
+        ShmQueue<int> opener(name, ShmMode::Open);
+        check(creator.capacity() == 8 && opener.capacity() == 8, "容量向上取整为8，打开方使用创建方的容量");
+        bool pushed = true;
+        for (int i = 0; i < 8; ++i) {
+            pushed = pushed && creator.tryPush(i);
+        }
+        check(pushed && !creator.tryPush(8), "放入8个后队列满，tryPush返回false");
+        int v = -1;
+        bool fifo = true;
+        for (int i = 0; i < 5; ++i) {
+            fifo = fifo && opener.tryPop(v) && v == i;
+        }
+        check(fifo && opener.size() == 3, "另一个映射按放入的顺序取出");
+        creator.close();
+        check(!creator.push(100) && opener.isClosed(), "关闭后push返回false，另一个映射也看到关闭");
+        int rest = 0;
+        while (opener.pop(v)) {
+            ++rest;
+        }
+        check(rest == 3, "关闭后剩余的3个值仍可取出，取空后pop返回false");
+        check(throws<std::invalid_argument>([&] { ShmQueue<Wide> wrong(name, ShmMode::Open); }),
+            "元素布局不同时打开抛出invalid_argument");
+    }
+
+    std::printf("测试2: ShmArena分配、归还，数据在两个映射之间可见\n");
+    {
+        std::string name = shmName("arena");
+        ShmArena creator(name, ShmMode::Create, 1000, 4);
+        ShmArena opener(name, ShmMode::Open);
+        check(opener.blockSize() == 1024 && opener.blockCount() == 4, "块大小按64字节对齐，打开方使用创建方的参数");
+        std::vector<ShmBuffer> blocks;
+        for (int i = 0; i < 4; ++i) {
+            blocks.push_back(creator.allocate(100 * i + 1));
+            creator.data(blocks.back())[0] = (char)('a' + i);
+        }
+        ShmBuffer extra;
+        check(!opener.tryAllocate(10, extra) && opener.available() == 0, "4块都借出后tryAllocate返回false");
+        bool visible = true;
+        for (int i = 0; i < 4; ++i) {
+            visible = visible && blocks[i].offset % 64 == 0 && opener.data(blocks[i])[0] == (char)('a' + i);
+        }
+        check(visible, "另一个映射按偏移读到写入的数据");
+        opener.release(blocks[2]);
+        check(creator.available() == 1 && creator.tryAllocate(10, extra) && extra.offset == blocks[2].offset,
+            "在另一个映射中归还的块可以再次分配");
+        check(throws<std::invalid_argument>([&] { creator.allocate(1025); }), "超过块大小时抛出invalid_argument");
+        ShmBuffer foreign;
+        foreign.offset = 3;
+        check(throws<std::out_of_range>([&] { creator.release(foreign); }), "不属于池的块抛出out_of_range");
+    }
+
+    // fork之前进程中还没有其他线程
+    std::printf("测试3: 子进程经通道接收描述符，计数模式和流式模式各一批\n");
+    {
+        std::string channelName = shmName("frames");
+        std::string arenaName = shmName("pixels");
+        ShmChannel<Frame> channel(channelName, ShmMode::Create, 16);
+        ShmArena arena(arenaName, ShmMode::Create, 1000, 8);
+        pid_t pid = fork();
+        if (pid == 0)
+            _exit(consumer(channelName, arenaName)); // 不析构从父进程复制来的创建方
+        ShmSender<Frame> toChild(channel);
+        TypedStage<int, Frame> produce("Produce", 2, 8, [&](int&& i) {
+            Frame f { i, arena.allocate(500 + i) }; // 8块借完时等待子进程归还
+            char* p = arena.data(f.pixels);
+            for (size_t k = 0; k < f.pixels.size; ++k) {
+                p[k] = pixel(i, k);
+            }
+            return f;
+        });
+        chain(produce, toChild);
+        produce.addTaskCount(100);
+        for (int i = 0; i < 100; ++i) {
+            produce.push(i);
+        }
+        produce.wait();
+        produce.openStream();
+        for (int i = 100; i < 300; ++i) {
+            produce.push(i);
+        }
+        produce.close();
+        produce.wait();
+        channel.close();
+        int status = 0;
+        waitpid(pid, &status, 0);
+        check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "子进程收到300个描述符，共享内存中的数据都正确");
+        check(arena.available() == 8, "子进程归还了所有块");
+    }
+
+    std::printf("测试4: 池空时allocate阻塞，直到另一个线程归还\n");
+    {
+        ShmArena arena(shmName("wait"), ShmMode::Create, 64, 1);
+        ShmBuffer held = arena.allocate(64);
+        std::atomic<bool> got { false };
+        std::thread waiter([&] {
+            arena.release(arena.allocate(8));
+            got = true;
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        check(!got.load(), "池空时allocate等待");
+        arena.release(held);
+        waiter.join();
+        check(got.load() && arena.available() == 1, "归还后等待的allocate返回");
+    }
+
+    std::printf("测试5: Stage -> ShmSender<int> -> ShmReceiver<int> -> Stage，pushRange按范围传递\n");
+    {
+        std::string name = shmName("indices");
+        ShmChannel<int> sendSide(name, ShmMode::Create, 4);
+        ShmChannel<int> receiveSide(name, ShmMode::Open);
+        std::vector<std::atomic<int>> hits(1000);
+        for (auto& h : hits) {
+            h = 0;
+        }
+        Stage a("A", 2, 8, [](int) {});
+        ShmSender<int> sender(sendSide);
+        chain(a, sender);
+        Stage b("B", 2, 8, [&](int i) { hits[i].fetch_add(1); });
+        ShmReceiver<int> receiver("Receiver", receiveSide);
+        chain(receiver, b);
+        receiver.start();
+        for (int batch = 0; batch < 2; ++batch) {
+            a.addTaskCount(1000);
+            a.pushRange(0, 1000, 100);
+            check(receiver.waitBatch(), "计数经通道到达，新的一批开始");
+            b.wait();
+        }
+        bool twice = true;
+        for (auto& h : hits) {
+            twice = twice && h.load() == 2;
+        }
+        check(twice && receiveSide.empty(), "两批中每个索引各到达B一次，通道已取空");
+        sendSide.close();
+        check(!receiver.waitBatch(), "通道关闭后waitBatch返回false");
+    }
+
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}
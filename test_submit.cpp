@@ -0,0 +1,110 @@
+// submit()/TaskFuture测试：返回值、参数转发、大结果、异常、丢弃的任务，waitIdle之后线程池继续可用
+
+#include "task_queue.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+template <typename E, typename F>
+static bool throws(F f)
+{
+    try {
+        f();
+    } catch (const E&) {
+        return true;
+    }
+    return false;
+}
+
+int main()
+{
+    std::printf("测试1: 结果、参数和异常\n");
+    {
+        ThreadPoolEx<BoundedTaskQueue> pool(4);
+        TaskFuture<int> sum = pool.submit([](int a, int b) { return a + b; }, 2, 3);
+        check(sum.valid() && sum.get() == 5 && !sum.valid(), "get返回f(args...)，之后valid()为false");
+
+        std::unique_ptr<int> owned(new int(42));
+        TaskFuture<int> moved = pool.submit([](std::unique_ptr<int> p) { return *p; }, std::move(owned));
+        check(moved.get() == 42, "只可移动的参数被移入任务");
+
+        TaskFuture<std::vector<std::string>> big = pool.submit([] {
+            return std::vector<std::string>(1000, std::string(100, 'x'));
+        });
+        std::vector<std::string> value = big.get();
+        check(value.size() == 1000 && value.back().size() == 100, "超过内部缓冲区的结果完整返回");
+
+        std::atomic<bool> ran { false };
+        TaskFuture<void> done = pool.submit([&] { ran = true; });
+        done.wait();
+        check(done.ready() && ran.load(), "void结果的wait返回时任务已执行");
+
+        TaskFuture<int> failed = pool.submit([]() -> int { throw std::runtime_error("boom"); });
+        check(failed.waitFor(std::chrono::seconds(5)), "waitFor在任务完成后返回true");
+        check(throws<std::runtime_error>([&] { failed.get(); }), "任务抛出的异常在get中重新抛出");
+    }
+
+    std::printf("测试2: 10000次submit之后waitIdle，线程池仍可继续submit\n");
+    {
+        ThreadPoolEx<BoundedTaskQueue> pool(4);
+        std::atomic<long> total { 0 };
+        std::vector<TaskFuture<int>> futures;
+        for (int round = 0; round < 2; ++round) {
+            for (int i = 0; i < 10000; ++i) {
+                futures.push_back(pool.submit([&total](int v) {
+                    total += v;
+                    return v;
+                }, i));
+            }
+            pool.waitIdle();
+            check(total.load() == (round + 1) * 49995000L, round == 0 ? "waitIdle返回时全部任务已完成" : "第二轮同样完成");
+        }
+        bool ready = true;
+        long sum = 0;
+        for (auto& f : futures) {
+            ready = ready && f.ready();
+            sum += f.get();
+        }
+        check(ready && sum == 2 * 49995000L, "每个future都已就绪并返回正确的值");
+    }
+
+    std::printf("测试3: 被FullPolicy丢弃的任务，future得到异常，waitIdle不会卡住\n");
+    {
+        ThreadPoolEx<BoundedTaskQueue> pool(1);
+        pool.taskQueue.setCapacity(1);
+        pool.taskQueue.setFullPolicy(FullPolicy::DropNewest);
+        std::atomic<bool> release { false };
+        TaskFuture<void> blocker = pool.submit([&] {
+            while (!release.load()) {
+                std::this_thread::yield();
+            }
+        });
+        while (pool.taskQueue.size() > 0) {
+            std::this_thread::yield(); // 等工作线程取走阻塞任务
+        }
+        TaskFuture<int> queued = pool.submit([] { return 1; });
+        TaskFuture<int> dropped = pool.submit([] { return 2; });
+        check(dropped.ready(), "队列已满，第三个任务立即被丢弃");
+        check(throws<std::runtime_error>([&] { dropped.get(); }), "被丢弃任务的get抛出runtime_error");
+        release = true;
+        pool.waitIdle();
+        check(queued.get() == 1, "排队中的任务照常完成，waitIdle正常返回");
+    }
+
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+// Tracer测试（定义TASK_QUEUE_TRACE）：每个索引的push和执行都有事件并由flow箭头相连，
+// pushRange按块记录，工作线程记录idle，线程按阶段命名；clear丢弃事件，环形缓冲区只保留最近的事件
+
+#ifndef TASK_QUEUE_TRACE
+#define TASK_QUEUE_TRACE
+#endif
+#ifndef TASK_QUEUE_TRACE_CAPACITY
+#define TASK_QUEUE_TRACE_CAPACITY 1024
+#endif
+
+#include "task_queue.hpp"
+
+#include <cstdio>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+// 导出的JSON每行一个事件
+static std::vector<std::string> exportLines()
+{
+    std::ostringstream os;
+    Tracer::instance().writeChromeJson(os);
+    std::vector<std::string> lines;
+    std::istringstream is(os.str());
+    std::string line;
+    while (std::getline(is, line)) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+static bool has(const std::string& line, const std::string& part)
+{
+    return line.find(part) != std::string::npos;
+}
+
+// 取出"key":后面的整数
+static long field(const std::string& line, const std::string& key)
+{
+    size_t pos = line.find("\"" + key + "\":");
+    if (pos == std::string::npos)
+        return -1;
+    return std::stol(line.substr(pos + key.size() + 3));
+}
+
+int main()
+{
+    std::printf("测试1: A(2线程) -> B(1线程)，每个索引的push和执行都有事件\n");
+    {
+        Stage a("TraceA", 2, 8, [](int) {});
+        Stage b("TraceB", 1, 8, [](int) {});
+        chain(a, b);
+        a.addTaskCount(100);
+        for (int i = 0; i < 100; ++i) {
+            a.push(i);
+        }
+        b.wait();
+    }
+    {
+        std::vector<std::string> lines = exportLines();
+        check(lines.front() == "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" && lines.back() == "]}",
+            "输出是trace-event JSON对象");
+        std::set<long> pushA, runA, pushB, runB;
+        std::map<long, int> flows;
+        int idle = 0;
+        std::set<std::string> threadNames;
+        for (const std::string& line : lines) {
+            if (has(line, "\"name\":\"push TraceA\""))
+                pushA.insert(field(line, "index"));
+            else if (has(line, "\"cat\":\"run\",\"name\":\"TraceA\""))
+                runA.insert(field(line, "index"));
+            else if (has(line, "\"name\":\"push TraceB\""))
+                pushB.insert(field(line, "index"));
+            else if (has(line, "\"cat\":\"run\",\"name\":\"TraceB\""))
+                runB.insert(field(line, "index"));
+            else if (has(line, "\"cat\":\"idle\""))
+                ++idle;
+            else if (has(line, "\"ph\":\"s\""))
+                ++flows[field(line, "id")];
+            else if (has(line, "\"ph\":\"f\""))
+                --flows[field(line, "id")];
+            else if (has(line, "\"thread_name\""))
+                threadNames.insert(line.substr(line.rfind(":\"") + 2, line.find(" #") - line.rfind(":\"") - 2));
+        }
+        check(pushA.size() == 100 && runA.size() == 100 && pushB.size() == 100 && runB.size() == 100,
+            "A、B各有100个push和100个执行事件");
+        bool paired = flows.size() == 200;
+        for (const auto& f : flows) {
+            paired = paired && f.second == 0;
+        }
+        check(paired, "每个push的flow起点都有对应执行的终点");
+        check(idle > 0, "工作线程记录了等待任务的时间");
+        check(threadNames.count("TraceA") && threadNames.count("TraceB") && threadNames.count("producer"),
+            "线程按执行的阶段命名，只推送的线程命名为producer");
+    }
+
+    std::printf("测试2: clear之后pushRange按块记录\n");
+    Tracer::instance().clear();
+    {
+        Stage a("TraceRange", 2, 8, [](int) {});
+        a.setTaskCount(256);
+        a.pushRange(0, 256, 64);
+        a.wait();
+    }
+    {
+        int events = 0, pushes = 0, chunked = 0;
+        bool stale = false;
+        for (const std::string& line : exportLines()) {
+            if (has(line, "\"ph\":\"X\""))
+                ++events;
+            if (has(line, "\"name\":\"push TraceRange\"")) {
+                ++pushes;
+                if (field(line, "count") == 64 && field(line, "index") % 64 == 0)
+                    ++chunked;
+            }
+            stale = stale || has(line, "TraceA");
+        }
+        check(!stale, "clear丢弃了之前的事件");
+        check(events > 0 && pushes == 4 && chunked == 4, "4个push事件，每个是从64的倍数开始的64个索引");
+    }
+
+    std::printf("测试3: 环形缓冲区满了覆盖最早的事件\n");
+    Tracer::instance().clear();
+    {
+        Stage a("TraceRing", 1, 64, [](int) {});
+        a.setTaskCount(5000);
+        for (int i = 0; i < 5000; ++i) {
+            a.push(i);
+        }
+        a.wait();
+    }
+    {
+        std::set<long> pushed;
+        for (const std::string& line : exportLines()) {
+            if (has(line, "\"name\":\"push TraceRing\""))
+                pushed.insert(field(line, "index"));
+        }
+        check(pushed.size() == TASK_QUEUE_TRACE_CAPACITY && *pushed.begin() == 5000 - TASK_QUEUE_TRACE_CAPACITY
+                && *pushed.rbegin() == 4999,
+            "推送线程只保留最近的TASK_QUEUE_TRACE_CAPACITY个事件");
+    }
+
+    std::printf("测试4: 写入文件\n");
+    check(!Tracer::instance().writeChromeJson(std::string("/nonexistent/trace.json")), "目录不存在时返回false");
+
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}
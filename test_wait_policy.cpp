@@ -0,0 +1,103 @@
+// 等待策略测试：BlockingWait只休眠，BusyPollWait只自旋，SpinThenParkWait自旋用完后休眠，
+// 生产者和消费者两侧分别计数，忙轮询的队列可以作为阶段的TaskQueueT并正常析构
+
+#include "task_queue.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+// 消费者在空队列上等待50ms后才收到任务，返回消费者一侧的统计
+template <typename QueueT>
+static WaitStats waitForTask(QueueT& queue)
+{
+    std::thread consumer([&] { queue.popTask()(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    queue.pushTask([] {});
+    consumer.join();
+    return queue.stats().consumer;
+}
+
+// 容量为2的队列已满，生产者等待50ms后才有空位，返回生产者一侧的统计
+template <typename QueueT>
+static WaitStats waitForSpace(QueueT& queue)
+{
+    queue.setCapacity(2);
+    queue.pushTask([] {});
+    queue.pushTask([] {});
+    std::thread producer([&] { queue.pushTask([] {}); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    queue.popTask()();
+    producer.join();
+    return queue.stats().producer;
+}
+
+int main()
+{
+    std::printf("测试1: 队列中已有任务时计为immediate\n");
+    {
+        BasicBoundedTaskQueue<BusyPollWait> queue(4);
+        queue.pushTask([] {});
+        queue.popTask()();
+        WaitStats s = queue.stats().consumer;
+        check(s.immediate == 1 && s.spun == 0 && s.parked == 0, "immediate为1，没有自旋和休眠");
+    }
+
+    std::printf("测试2: 消费者在空队列上等待\n");
+    {
+        BasicBoundedTaskQueue<BlockingWait> blocking(4);
+        WaitStats s = waitForTask(blocking);
+        check(s.parked == 1 && s.spun == 0, "BlockingWait直接休眠");
+        check(s.waitNanos >= 10000000, "等待时间计入waitNanos");
+
+        BasicBoundedTaskQueue<BusyPollWait> busy(4);
+        s = waitForTask(busy);
+        check(s.spun == 1 && s.parked == 0, "BusyPollWait自旋等到任务，从不休眠");
+
+        BasicBoundedTaskQueue<SpinThenParkWait> spinPark(4);
+        spinPark.consumerWaitPolicy().setSpinLimits(100, 2);
+        s = waitForTask(spinPark);
+        check(s.parked == 1 && s.spun == 0, "SpinThenParkWait自旋次数用完后休眠");
+
+        BasicLockFreeTaskQueue<BusyPollWait> lockFree(4);
+        s = waitForTask(lockFree);
+        check(s.spun == 1 && s.parked == 0, "LockFreeTaskQueue同样按策略忙轮询");
+    }
+
+    std::printf("测试3: 生产者在满队列上等待\n");
+    {
+        BasicBoundedTaskQueue<BlockingWait> blocking;
+        WaitStats s = waitForSpace(blocking);
+        check(s.parked == 1 && s.spun == 0, "BlockingWait的生产者休眠");
+
+        BasicBoundedTaskQueue<BusyPollWait> busy;
+        s = waitForSpace(busy);
+        check(s.spun == 1 && s.parked == 0, "BusyPollWait的生产者自旋");
+    }
+
+    std::printf("测试4: 忙轮询队列作为阶段的TaskQueueT\n");
+    {
+        std::atomic<int> ran { 0 };
+        {
+            StageT<ThreadPoolEx<BasicBoundedTaskQueue<BusyPollWait>>> hot("Hot", 2, 64, [&](int) { ++ran; });
+            hot.addTaskCount(1000);
+            for (int i = 0; i < 1000; ++i) {
+                hot.push(i);
+            }
+            hot.wait();
+        }
+        check(ran.load() == 1000, "执行1000次，析构时关闭队列使自旋中的工作线程退出");
+    }
+
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}
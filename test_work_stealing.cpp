@@ -0,0 +1,130 @@
+// 工作窃取测试：Chase-Lev双端队列的LIFO/FIFO两端，并发窃取时每个元素只取出一次，
+// 工作线程内提交的任务被其他线程窃取执行，停止时仍在队列中的任务计为已完成
+
+#include "task_queue.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    std::printf("%s %s\n", ok ? "✅" : "❌", what);
+    if (!ok)
+        ++failures;
+}
+
+int main()
+{
+    std::printf("测试1: 所属线程从底部LIFO取出，窃取者从顶部FIFO取出，扩容后元素不丢失\n");
+    {
+        WorkStealingDeque<int> deque(4);
+        std::vector<int> items(100);
+        for (int i = 0; i < 100; ++i) {
+            items[i] = i;
+            deque.push(&items[i]);
+        }
+        check(*deque.pop() == 99, "pop取出最后放入的元素");
+        check(*deque.steal() == 0, "steal取出最先放入的元素");
+        int n = 2;
+        while (deque.pop()) {
+            ++n;
+        }
+        check(n == 100 && deque.empty(), "容量4扩容后100个元素全部取出");
+    }
+
+    std::printf("测试2: 所属线程边放边取，3个窃取者并发窃取，每个元素恰好取出一次\n");
+    {
+        const int total = 200000;
+        WorkStealingDeque<int> deque;
+        std::vector<int> items(total);
+        std::vector<std::atomic<int>> taken(total);
+        for (int i = 0; i < total; ++i) {
+            items[i] = i;
+            taken[i] = 0;
+        }
+        std::atomic<bool> done { false };
+        std::vector<std::thread> thieves;
+        for (int t = 0; t < 3; ++t) {
+            thieves.emplace_back([&] {
+                while (!done.load() || !deque.empty()) {
+                    if (int* item = deque.steal())
+                        taken[*item].fetch_add(1);
+                }
+            });
+        }
+        for (int i = 0; i < total; ++i) {
+            deque.push(&items[i]);
+            if (i % 3 == 0) {
+                if (int* item = deque.pop())
+                    taken[*item].fetch_add(1);
+            }
+        }
+        while (int* item = deque.pop()) {
+            taken[*item].fetch_add(1);
+        }
+        done = true;
+        for (auto& t : thieves) {
+            t.join();
+        }
+        bool once = true;
+        for (auto& t : taken) {
+            once = once && t.load() == 1;
+        }
+        check(once, "200000个元素每个恰好取出一次");
+    }
+
+    std::printf("测试3: 一个任务内提交的1000个嵌套任务被其他工作线程窃取，连续三批复用节点\n");
+    {
+        WorkStealingThreadPoolEx<BoundedTaskQueue> pool(4);
+        for (int batch = 0; batch < 3; ++batch) {
+            std::atomic<int> ran { 0 };
+            std::mutex mtx;
+            std::set<std::thread::id> threads;
+            pool.setTaskCount(1 + 1000);
+            pool.pushTask([&] {
+                for (int i = 0; i < 1000; ++i) {
+                    pool.pushTask([&] {
+                        std::this_thread::sleep_for(std::chrono::microseconds(50));
+                        {
+                            std::lock_guard<std::mutex> lock(mtx);
+                            threads.insert(std::this_thread::get_id());
+                        }
+                        ++ran;
+                    });
+                }
+            });
+            pool.wait();
+            check(ran.load() == 1000, batch == 0 ? "1000个嵌套任务全部执行，wait正常返回" : "下一批同样全部执行");
+            check(threads.size() > 1, "嵌套任务由多个工作线程执行");
+        }
+    }
+
+    std::printf("测试4: 析构时仍在队列中的任务不执行，但计为已完成，onDrained照常调用\n");
+    {
+        std::atomic<int> ran { 0 };
+        std::atomic<bool> drained { false };
+        {
+            WorkStealingThreadPoolEx<BoundedTaskQueue> pool(1);
+            pool.openStream();
+            pool.pushTask([&] {
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                ++ran;
+            });
+            for (int i = 0; i < 10; ++i) {
+                pool.pushTask([&] { ++ran; });
+            }
+            pool.close([&] { drained = true; });
+        }
+        check(ran.load() < 11, "析构没有等待剩余任务执行");
+        check(drained.load(), "剩余任务计为已完成，计数器归零并调用onDrained");
+    }
+
+    std::printf("%s\n", failures == 0 ? "全部通过" : "有测试失败");
+    return failures == 0 ? 0 : 1;
+}